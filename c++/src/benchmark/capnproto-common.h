@@ -28,10 +28,8 @@
 #include "common.h"
 #include <capnp/serialize.h>
 #include <capnp/serialize-packed.h>
+#include <capnp/serialize-compressed.h>
 #include <kj/debug.h>
-#if HAVE_SNAPPY
-#include <capnp/serialize-snappy.h>
-#endif  // HAVE_SNAPPY
 #include <thread>
 
 namespace capnp {
@@ -100,32 +98,24 @@ struct Packed {
   }
 };
 
-#if HAVE_SNAPPY
-static byte snappyReadBuffer[SNAPPY_BUFFER_SIZE];
-static byte snappyWriteBuffer[SNAPPY_BUFFER_SIZE];
-static byte snappyCompressedBuffer[SNAPPY_COMPRESSED_BUFFER_SIZE];
-
-struct SnappyCompressed {
-  typedef BufferedInputStreamWrapper BufferedInput;
-  typedef SnappyPackedMessageReader MessageReader;
+struct Compressed {
+  typedef kj::BufferedInputStreamWrapper BufferedInput;
+  typedef CompressedPackedMessageReader MessageReader;
 
-  class ArrayMessageReader: private ArrayInputStream, public SnappyPackedMessageReader {
+  class ArrayMessageReader: private kj::ArrayInputStream, public CompressedPackedMessageReader {
   public:
     ArrayMessageReader(kj::ArrayPtr<const byte> array,
                        ReaderOptions options = ReaderOptions(),
                        kj::ArrayPtr<word> scratchSpace = nullptr)
       : ArrayInputStream(array),
-        SnappyPackedMessageReader(static_cast<ArrayInputStream&>(*this), options, scratchSpace,
-                                  kj::arrayPtr(snappyReadBuffer, SNAPPY_BUFFER_SIZE)) {}
+        CompressedPackedMessageReader(static_cast<kj::ArrayInputStream&>(*this),
+                                      options, scratchSpace) {}
   };
 
-  static inline void write(OutputStream& output, MessageBuilder& builder) {
-    writeSnappyPackedMessage(output, builder,
-        kj::arrayPtr(snappyWriteBuffer, SNAPPY_BUFFER_SIZE),
-        kj::arrayPtr(snappyCompressedBuffer, SNAPPY_COMPRESSED_BUFFER_SIZE));
+  static inline void write(kj::OutputStream& output, MessageBuilder& builder) {
+    writeCompressedPackedMessage(output, builder);
   }
 };
-#endif  // HAVE_SNAPPY
 
 // =======================================================================================
 
@@ -404,9 +394,7 @@ struct BenchmarkMethods {
 struct BenchmarkTypes {
   typedef capnp::Uncompressed Uncompressed;
   typedef capnp::Packed Packed;
-#if HAVE_SNAPPY
-  typedef capnp::SnappyCompressed SnappyCompressed;
-#endif  // HAVE_SNAPPY
+  typedef capnp::Compressed Compressed;
 
   typedef capnp::UseScratch ReusableResources;
   typedef capnp::NoScratch SingleUseResources;
@@ -158,9 +158,7 @@ struct BenchmarkMethods {
 struct BenchmarkTypes {
   typedef void Uncompressed;
   typedef void Packed;
-#if HAVE_SNAPPY
-  typedef void SnappyCompressed;
-#endif  // HAVE_SNAPPY
+  typedef void Compressed;
 
   typedef ReusableObjects ReusableResources;
   typedef SingleUseObjects SingleUseResources;
@@ -343,8 +343,10 @@ struct BenchmarkTypes {
   typedef protobuf::Uncompressed Uncompressed;
   typedef protobuf::Uncompressed Packed;
 #if HAVE_SNAPPY
-  typedef protobuf::SnappyCompressed SnappyCompressed;
-#endif  // HAVE_SNAPPY
+  typedef protobuf::SnappyCompressed Compressed;
+#else
+  typedef protobuf::Uncompressed Compressed;
+#endif  // HAVE_SNAPPY, else
 
   typedef protobuf::ReusableMessages ReusableResources;
   typedef protobuf::SingleUseMessages SingleUseResources;
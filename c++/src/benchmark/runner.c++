@@ -122,7 +122,7 @@ enum class Reuse {
 enum class Compression {
   NONE,
   PACKED,
-  SNAPPY
+  COMPRESSED
 };
 
 TestResult runTest(Product product, TestCase testCase, Mode mode, Reuse reuse,
@@ -180,8 +180,8 @@ TestResult runTest(Product product, TestCase testCase, Mode mode, Reuse reuse,
     case Compression::PACKED:
       argv[3] = strdup("packed");
       break;
-    case Compression::SNAPPY:
-      argv[3] = strdup("snappy");
+    case Compression::COMPRESSED:
+      argv[3] = strdup("compressed");
       break;
   }
 
@@ -382,8 +382,8 @@ int main(int argc, char* argv[]) {
       testCase = TestCase::EVAL;
     } else if (arg == "carsales") {
       testCase = TestCase::CARSALES;
-    } else if (arg == "snappy") {
-      compression = Compression::SNAPPY;
+    } else if (arg == "compressed") {
+      compression = Compression::COMPRESSED;
     } else if (arg == "-c") {
       ++i;
       if (i == argc) {
@@ -453,8 +453,9 @@ int main(int argc, char* argv[]) {
       cout << "* de-zero packing for Cap'n Proto" << endl;
       cout << "* standard packing for Protobuf" << endl;
       break;
-    case Compression::SNAPPY:
-      cout << "* Snappy compression" << endl;
+    case Compression::COMPRESSED:
+      cout << "* packing plus LZ4-format block compression for Cap'n Proto" << endl;
+      cout << "* Snappy compression for Protobuf (if built with HAVE_SNAPPY)" << endl;
       break;
   }
 
@@ -498,6 +499,10 @@ int main(int argc, char* argv[]) {
       Product::PROTOBUF, testCase, mode, Reuse::YES, compression, iters);
   protobuf.objectSize = protobufBase.objectSize;
   reportResults("Protobuf I/O", iters, protobuf);
+  TestResult protobufCompressed = runTest(
+      Product::PROTOBUF, testCase, mode, Reuse::YES, Compression::COMPRESSED, iters);
+  protobufCompressed.objectSize = protobufBase.objectSize;
+  reportResults("Protobuf compressed I/O", iters, protobufCompressed);
 
   TestResult capnp = runTest(
       Product::CAPNPROTO, testCase, mode, Reuse::YES, compression, iters);
@@ -507,6 +512,10 @@ int main(int argc, char* argv[]) {
       Product::CAPNPROTO, testCase, mode, Reuse::YES, Compression::PACKED, iters);
   capnpPacked.objectSize = capnpBase.objectSize;
   reportResults("Cap'n Proto packed I/O", iters, capnpPacked);
+  TestResult capnpCompressed = runTest(
+      Product::CAPNPROTO, testCase, mode, Reuse::YES, Compression::COMPRESSED, iters);
+  capnpCompressed.objectSize = capnpBase.objectSize;
+  reportResults("Cap'n Proto compressed I/O", iters, capnpCompressed);
 
   size_t protobufBinarySize = fileSize("protobuf-" + std::string(testCaseName(testCase)));
   size_t capnpBinarySize = fileSize("capnproto-" + std::string(testCaseName(testCase)));
@@ -523,6 +532,7 @@ int main(int argc, char* argv[]) {
   TestResult oldCapnpNoReuse;
   TestResult oldCapnp;
   TestResult oldCapnpPacked;
+  TestResult oldCapnpCompressed;
   size_t oldCapnpBinarySize = 0;
   size_t oldCapnpCodeSize = 0;
   size_t oldCapnpObjSize = 0;
@@ -565,6 +575,10 @@ int main(int argc, char* argv[]) {
         Product::CAPNPROTO, testCase, mode, Reuse::YES, Compression::PACKED, iters);
     oldCapnpPacked.objectSize = oldCapnpBase.objectSize;
     reportResults("Old Cap'n Proto packed I/O", iters, oldCapnpPacked);
+    oldCapnpCompressed = runTest(
+        Product::CAPNPROTO, testCase, mode, Reuse::YES, Compression::COMPRESSED, iters);
+    oldCapnpCompressed.objectSize = oldCapnpBase.objectSize;
+    reportResults("Old Cap'n Proto compressed I/O", iters, oldCapnpCompressed);
 
     oldCapnpBinarySize = fileSize("capnproto-" + std::string(testCaseName(testCase)));
     oldCapnpCodeSize = fileSize(std::string(testCaseName(testCase)) + ".capnp.c++")
@@ -591,10 +605,15 @@ int main(int argc, char* argv[]) {
   reportComparison("packed I/O time (us)", "",
       ((int64_t)protobuf.time.user - (int64_t)protobufBase.time.user) / 1000.0,
       ((int64_t)capnpPacked.time.user - (int64_t)capnpBase.time.user) / 1000.0, iters);
+  reportComparison("compressed I/O time (us)", "",
+      ((int64_t)protobufCompressed.time.user - (int64_t)protobufBase.time.user) / 1000.0,
+      ((int64_t)capnpCompressed.time.user - (int64_t)capnpBase.time.user) / 1000.0, iters);
 
   reportIntComparison("message size (bytes)", "", protobuf.messageSize, capnp.messageSize, iters);
   reportIntComparison("packed message size (bytes)", "",
                       protobuf.messageSize, capnpPacked.messageSize, iters);
+  reportIntComparison("compressed message size (bytes)", "",
+                      protobufCompressed.messageSize, capnpCompressed.messageSize, iters);
 
   reportComparison("binary size (KiB)", "",
       protobufBinarySize / 1024.0, capnpBinarySize / 1024.0, 1);
@@ -623,10 +642,15 @@ int main(int argc, char* argv[]) {
     reportComparison("packed I/O time (us)", "",
         ((int64_t)oldCapnpPacked.time.user - (int64_t)oldCapnpBase.time.user) / 1000.0,
         ((int64_t)capnpPacked.time.user - (int64_t)capnpBase.time.user) / 1000.0, iters);
+    reportComparison("compressed I/O time (us)", "",
+        ((int64_t)oldCapnpCompressed.time.user - (int64_t)oldCapnpBase.time.user) / 1000.0,
+        ((int64_t)capnpCompressed.time.user - (int64_t)capnpBase.time.user) / 1000.0, iters);
 
     reportIntComparison("message size (bytes)", "", oldCapnp.messageSize, capnp.messageSize, iters);
     reportIntComparison("packed message size (bytes)", "",
                         oldCapnpPacked.messageSize, capnpPacked.messageSize, iters);
+    reportIntComparison("compressed message size (bytes)", "",
+                        oldCapnpCompressed.messageSize, capnpCompressed.messageSize, iters);
 
     reportComparison("binary size (KiB)", "",
         oldCapnpBinarySize / 1024.0, capnpBinarySize / 1024.0, 1);
@@ -64,5 +64,64 @@ const ::capnp::_::RawSchema s_f264a779fef191ce = {
   0, 0, nullptr, nullptr, nullptr, { &s_f264a779fef191ce, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<21> b_e00cb5e3e75b6a4e = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+     78, 106,  91, 231, 227, 181,  12, 224,
+     16,   0,   0,   0,   5,   0,   1,   0,
+    129,  78,  48, 184, 123, 125, 248, 189,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 234,   0,   0,   0,
+     33,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     28,   0,   0,   0,   3,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47,  99,  43,
+     43,  46,  99,  97, 112, 110, 112,  58,
+    115, 112, 108, 105, 116,  72, 101,  97,
+    100, 101, 114, 115,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_e00cb5e3e75b6a4e = b_e00cb5e3e75b6a4e.words;
+#if !CAPNP_LITE
+const ::capnp::_::RawSchema s_e00cb5e3e75b6a4e = {
+  0xe00cb5e3e75b6a4e, b_e00cb5e3e75b6a4e.words, 21, nullptr, nullptr,
+  0, 0, nullptr, nullptr, nullptr, { &s_e00cb5e3e75b6a4e, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<20> b_dd8fa67392d824ea = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+    234,  36, 216, 146, 115, 166, 143, 221,
+     16,   0,   0,   0,   5,   0,   1,   0,
+    129,  78,  48, 184, 123, 125, 248, 189,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 170,   0,   0,   0,
+     29,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     24,   0,   0,   0,   3,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47,  99,  43,
+     43,  46,  99,  97, 112, 110, 112,  58,
+    108, 105, 116, 101,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_dd8fa67392d824ea = b_dd8fa67392d824ea.words;
+#if !CAPNP_LITE
+const ::capnp::_::RawSchema s_dd8fa67392d824ea = {
+  0xdd8fa67392d824ea, b_dd8fa67392d824ea.words, 20, nullptr, nullptr,
+  0, 0, nullptr, nullptr, nullptr, { &s_dd8fa67392d824ea, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
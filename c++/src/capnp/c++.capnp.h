@@ -15,6 +15,8 @@ namespace schemas {
 
 CAPNP_DECLARE_SCHEMA(b9c6f99ebf805f2c);
 CAPNP_DECLARE_SCHEMA(f264a779fef191ce);
+CAPNP_DECLARE_SCHEMA(e00cb5e3e75b6a4e);
+CAPNP_DECLARE_SCHEMA(dd8fa67392d824ea);
 
 }  // namespace schemas
 }  // namespace capnp
@@ -800,6 +800,180 @@ KJ_TEST("register field handler") {
   }
 }
 
+template <typename T>
+kj::String encodeToStream(const JsonCodec& json, T&& value, size_t bufferSize = 4096) {
+  kj::VectorOutputStream vector(bufferSize);
+  {
+    // Wrap in a BufferedOutputStreamWrapper too, so that small buffers are exercised.
+    kj::Array<byte> buffer = kj::heapArray<byte>(bufferSize);
+    kj::BufferedOutputStreamWrapper wrapper(vector, buffer);
+    json.encode(kj::fwd<T>(value), wrapper);
+  }
+  auto bytes = vector.getArray();
+  return kj::heapString(reinterpret_cast<const char*>(bytes.begin()), bytes.size());
+}
+
+KJ_TEST("streaming encode matches encode") {
+  MallocMessageBuilder message;
+  auto root = message.getRoot<TestAllTypes>();
+  initTestMessage(root);
+  root.setTextField("ab\"cd\\ef\x03/gh\n");
+  root.setFloat32Field(kj::inf());
+  root.setFloat64Field(kj::nan());
+
+  JsonCodec json;
+  auto expected = json.encode(root);
+  KJ_EXPECT(encodeToStream(json, root.asReader()) == expected);
+  KJ_EXPECT(encodeToStream(json, root.asReader(), 1) == expected);
+  KJ_EXPECT(encodeToStream(json, root.asReader(), 7) == expected);
+
+  KJ_EXPECT(encodeToStream(json, VOID) == "null");
+  KJ_EXPECT(encodeToStream(json, -5.5) == "-5.5");
+  KJ_EXPECT(encodeToStream(json, test::TestEnum::CORGE) == "\"corge\"");
+
+  json.setHasMode(HasMode::NON_DEFAULT);
+  KJ_EXPECT(encodeToStream(json, root.asReader()) == json.encode(root));
+
+  json.setPrettyPrint(true);
+  KJ_EXPECT(encodeToStream(json, root.asReader()) == json.encode(root));
+}
+
+KJ_TEST("streaming encode unions and handlers") {
+  JsonCodec json;
+
+  {
+    MallocMessageBuilder message;
+    auto root = message.getRoot<test::TestUnnamedUnion>();
+    root.setBefore("a");
+    root.setMiddle(44);
+    root.setAfter("c");
+
+    root.setFoo(123);
+    KJ_EXPECT(encodeToStream(json, root.asReader()) ==
+        "{\"before\":\"a\",\"foo\":123,\"middle\":44,\"after\":\"c\"}");
+    root.setBar(321);
+    KJ_EXPECT(encodeToStream(json, root.asReader()) ==
+        "{\"before\":\"a\",\"middle\":44,\"bar\":321,\"after\":\"c\"}");
+  }
+
+  TestStructHandler structHandler;
+  json.addTypeHandler(structHandler);
+  TestCallHandler callHandler;
+  json.addTypeHandler(callHandler);
+
+  {
+    MallocMessageBuilder message;
+    auto root = message.getRoot<test::TestOldVersion>();
+    root.setOld1(123);
+    root.setOld2("foo");
+    KJ_EXPECT(encodeToStream(json, root.asReader()) == "[\"123\",Frob(123,\"foo\"),null]");
+  }
+
+  JsonCodec fieldJson;
+  TestStructHandler fieldHandler;
+  fieldJson.addFieldHandler(StructSchema::from<test::TestOldVersion>().getFieldByName("old3"),
+                            fieldHandler);
+  {
+    MallocMessageBuilder message;
+    auto root = message.getRoot<test::TestOldVersion>();
+    root.setOld1(123);
+    root.setOld2("foo");
+    root.initOld3().setOld2("bar");
+    KJ_EXPECT(encodeToStream(fieldJson, root.asReader()) ==
+        "{\"old1\":\"123\",\"old2\":\"foo\",\"old3\":[\"0\",\"bar\",null]}");
+  }
+}
+
+KJ_TEST("decode skips unknown fields") {
+  JsonCodec json;
+  MallocMessageBuilder message;
+  auto root = message.initRoot<TestAllTypes>();
+
+  json.decode(
+      "{ \"unknown\": { \"a\": [1, 2.5e3, \"x\\\"y\\u0041\", null, true, false, {}] },"
+      "  \"int32Field\": 123, \"alsoUnknown\": [[[]]],"
+      "  \"structList\": [ {\"textField\": \"foo\", \"junk\": [1]}, {\"int8Field\": -3} ] }",
+      root);
+
+  KJ_EXPECT(root.getInt32Field() == 123);
+  auto list = root.getStructList();
+  KJ_ASSERT(list.size() == 2);
+  KJ_EXPECT(list[0].getTextField().asString() == "foo");
+  KJ_EXPECT(list[1].getInt8Field() == -3);
+
+  // Unknown fields must still be valid JSON, and count toward the nesting limit.
+  KJ_EXPECT_THROW_MESSAGE("Unexpected input",
+      json.decode("{\"unknown\": [1 2]}", root));
+  KJ_EXPECT_THROW_MESSAGE("Invalid escape",
+      json.decode("{\"unknown\": \"\\q\"}", root));
+  KJ_EXPECT_THROW_MESSAGE("Invalid hex digit",
+      json.decode("{\"unknown\": \"\\u00g1\"}", root));
+  json.setMaxNestingDepth(3);
+  KJ_EXPECT_THROW_MESSAGE("nested too deeply",
+      json.decode("{\"unknown\": [[[1]]]}", root));
+  json.decode("{\"unknown\": [[1]]}", root);
+}
+
+KJ_TEST("decode nested lists") {
+  JsonCodec json;
+  MallocMessageBuilder message;
+  auto root = message.initRoot<test::TestLists>();
+
+  // Lists nested at several levels, with lists inside unknown fields in between that are counted
+  // but never decoded.
+  json.decode(
+      "{ \"unknown\": [[1], [2, 3]],"
+      "  \"int32ListList\": [[1, 2], [], [3, 0, 4]],"
+      "  \"structListList\": [[{\"junk\": [[], [1]], \"int32List\": [5, 6, 7]}],"
+      "                       [], [{\"int32List\": []}, {\"textList\": [\"a\", \"b\"]}]],"
+      "  \"textListList\": [[\"x\"]] }",
+      root);
+
+  auto int32s = root.getInt32ListList();
+  KJ_ASSERT(int32s.size() == 3);
+  KJ_EXPECT(int32s[0].size() == 2);
+  KJ_EXPECT(int32s[0][1] == 2);
+  KJ_EXPECT(int32s[1].size() == 0);
+  KJ_EXPECT(int32s[2].size() == 3);
+  KJ_EXPECT(int32s[2][2] == 4);
+
+  auto structs = root.getStructListList();
+  KJ_ASSERT(structs.size() == 3);
+  KJ_ASSERT(structs[0].size() == 1);
+  KJ_EXPECT(structs[0][0].getInt32List().size() == 3);
+  KJ_EXPECT(structs[0][0].getInt32List()[2] == 7);
+  KJ_EXPECT(structs[1].size() == 0);
+  KJ_ASSERT(structs[2].size() == 2);
+  KJ_EXPECT(structs[2][0].getInt32List().size() == 0);
+  KJ_EXPECT(structs[2][1].getTextList().size() == 2);
+  KJ_EXPECT(structs[2][1].getTextList()[1].asString() == "b");
+
+  KJ_EXPECT(root.getTextListList().size() == 1);
+  KJ_EXPECT(root.getTextListList()[0][0].asString() == "x");
+}
+
+KJ_TEST("decode with handlers on root and field") {
+  TestStructHandler handler;
+  JsonCodec json;
+  json.addTypeHandler(handler);
+
+  MallocMessageBuilder message;
+  auto root = message.initRoot<test::TestOldVersion>();
+  json.decode("[\"5\", null, [\"7\", \"bar\", null]]", root);
+  // The root type has a handler, so the whole thing is decoded via JsonValue.
+  KJ_EXPECT(root.getOld1() == 5);
+  KJ_EXPECT(root.getOld3().getOld2().asString() == "bar");
+
+  JsonCodec fieldJson;
+  fieldJson.addFieldHandler(StructSchema::from<test::TestOldVersion>().getFieldByName("old3"),
+                            handler);
+  auto root2 = message.initRoot<test::TestOldVersion>();
+  fieldJson.decode("{\"old1\": \"5\", \"old3\": [\"7\", \"bar\", null]}", root2);
+  KJ_EXPECT(root2.getOld1() == 5);
+  KJ_EXPECT(root2.getOld3().getOld1() == 7);
+  KJ_EXPECT(root2.getOld3().getOld2().asString() == "bar");
+}
+
 class TestCapabilityHandler: public JsonCodec::Handler<test::TestInterface> {
 public:
   void encode(const JsonCodec& codec, test::TestInterface::Client input,
@@ -45,6 +45,57 @@ struct FieldHash {
   }
 };
 
+class TextWriter {
+  // Accumulates small pieces of text directly in a BufferedOutputStream's write buffer, so that
+  // streaming encoding doesn't make a virtual call per token.
+
+public:
+  explicit TextWriter(kj::BufferedOutputStream& inner): inner(inner) { reset(); }
+  KJ_DISALLOW_COPY(TextWriter);
+
+  void write(char c) {
+    if (pos == end) {
+      flush();
+      if (pos == end) {
+        inner.write(&c, 1);
+        return;
+      }
+    }
+    *pos++ = c;
+  }
+
+  void write(kj::ArrayPtr<const char> text) {
+    if (text.size() > size_t(end - pos)) {
+      flush();
+      if (text.size() > size_t(end - pos)) {
+        inner.write(text.begin(), text.size());
+        return;
+      }
+    }
+    memcpy(pos, text.begin(), text.size());
+    pos += text.size();
+  }
+
+  void flush() {
+    if (pos > begin) {
+      inner.write(begin, pos - begin);
+    }
+    reset();
+  }
+
+private:
+  kj::BufferedOutputStream& inner;
+  char* begin;
+  char* pos;
+  char* end;
+
+  void reset() {
+    auto buffer = inner.getWriteBuffer();
+    begin = pos = reinterpret_cast<char*>(buffer.begin());
+    end = reinterpret_cast<char*>(buffer.end());
+  }
+};
+
 }  // namespace
 
 struct JsonCodec::Impl {
@@ -55,6 +106,8 @@ struct JsonCodec::Impl {
   std::unordered_map<Type, HandlerBase*, TypeHash> typeHandlers;
   std::unordered_map<StructSchema::Field, HandlerBase*, FieldHash> fieldHandlers;
 
+  class Decoder;
+
   kj::StringTree encodeRaw(JsonValue::Reader value, uint indent, bool& multiline,
                            bool hasPrefix) const {
     switch (value.which()) {
@@ -145,6 +198,267 @@ struct JsonCodec::Impl {
     return kj::String(escaped.releaseAsArray());
   }
 
+  void writeRaw(JsonValue::Reader value, TextWriter& out) const {
+    // Like encodeRaw(), but without pretty-printing, writing straight to the output.
+
+    switch (value.which()) {
+      case JsonValue::NULL_:
+        out.write(kj::StringPtr("null"));
+        return;
+      case JsonValue::BOOLEAN:
+        out.write(value.getBoolean() ? kj::StringPtr("true") : kj::StringPtr("false"));
+        return;
+      case JsonValue::NUMBER:
+        out.write(kj::toCharSequence(value.getNumber()));
+        return;
+      case JsonValue::STRING:
+        writeString(value.getString(), out);
+        return;
+
+      case JsonValue::ARRAY: {
+        out.write('[');
+        bool first = true;
+        for (auto element: value.getArray()) {
+          if (!first) out.write(',');
+          first = false;
+          writeRaw(element, out);
+        }
+        out.write(']');
+        return;
+      }
+
+      case JsonValue::OBJECT: {
+        out.write('{');
+        bool first = true;
+        for (auto field: value.getObject()) {
+          if (!first) out.write(',');
+          first = false;
+          writeString(field.getName(), out);
+          out.write(':');
+          writeRaw(field.getValue(), out);
+        }
+        out.write('}');
+        return;
+      }
+
+      case JsonValue::CALL: {
+        auto call = value.getCall();
+        out.write(call.getFunction());
+        out.write('(');
+        bool first = true;
+        for (auto param: call.getParams()) {
+          if (!first) out.write(',');
+          first = false;
+          writeRaw(param, out);
+        }
+        out.write(')');
+        return;
+      }
+    }
+
+    KJ_FAIL_ASSERT("unknown JsonValue type", static_cast<uint>(value.which()));
+  }
+
+  void writeString(kj::StringPtr chars, TextWriter& out) const {
+    // Same escaping as encodeString().  Runs of characters needing no escape are written in one
+    // piece.
+
+    static const char HEXDIGITS[] = "0123456789abcdef";
+
+    out.write('"');
+    const char* run = chars.begin();
+    for (const char* p = chars.begin(); p != chars.end(); ++p) {
+      char c = *p;
+      kj::StringPtr escape;
+      switch (c) {
+        case '\"': escape = "\\\""; break;
+        case '\\': escape = "\\\\"; break;
+        case '/' : escape = "\\/" ; break;
+        case '\b': escape = "\\b"; break;
+        case '\f': escape = "\\f"; break;
+        case '\n': escape = "\\n"; break;
+        case '\r': escape = "\\r"; break;
+        case '\t': escape = "\\t"; break;
+        default:
+          if (c >= 0 && c < 0x20) break;
+          continue;
+      }
+
+      out.write(kj::arrayPtr(run, p));
+      run = p + 1;
+      if (escape.size() == 0) {
+        uint8_t c2 = c;
+        char hex[6] = { '\\', 'u', '0', '0', HEXDIGITS[c2 / 16], HEXDIGITS[c2 % 16] };
+        out.write(kj::arrayPtr(hex, sizeof(hex)));
+      } else {
+        out.write(escape);
+      }
+    }
+    out.write(kj::arrayPtr(run, chars.end()));
+    out.write('"');
+  }
+
+  void writeNumber(double value, TextWriter& out) const {
+    out.write(kj::toCharSequence(value));
+  }
+
+  void encodeStream(const JsonCodec& codec, DynamicValue::Reader input, Type type,
+                    TextWriter& out) const {
+    // Mirrors JsonCodec::encode(DynamicValue::Reader, Type, JsonValue::Builder), producing the
+    // same text that encodeRaw() would for the result (without pretty-printing).
+
+    auto iter = typeHandlers.find(type);
+    if (iter != typeHandlers.end()) {
+      encodeWithHandler(codec, *iter->second, input, out);
+      return;
+    }
+
+    switch (type.which()) {
+      case schema::Type::VOID:
+        out.write(kj::StringPtr("null"));
+        return;
+      case schema::Type::BOOL:
+        out.write(input.as<bool>() ? kj::StringPtr("true") : kj::StringPtr("false"));
+        return;
+      case schema::Type::INT8:
+      case schema::Type::INT16:
+      case schema::Type::INT32:
+      case schema::Type::UINT8:
+      case schema::Type::UINT16:
+      case schema::Type::UINT32:
+        writeNumber(input.as<double>(), out);
+        return;
+      case schema::Type::FLOAT32:
+      case schema::Type::FLOAT64: {
+        double value = input.as<double>();
+        if (kj::inf() == value) {
+          out.write(kj::StringPtr("\"Infinity\""));
+        } else if (-kj::inf() == value) {
+          out.write(kj::StringPtr("\"-Infinity\""));
+        } else if (kj::isNaN(value)) {
+          out.write(kj::StringPtr("\"NaN\""));
+        } else {
+          writeNumber(value, out);
+        }
+        return;
+      }
+      case schema::Type::INT64:
+        out.write('"');
+        out.write(kj::toCharSequence(input.as<int64_t>()));
+        out.write('"');
+        return;
+      case schema::Type::UINT64:
+        out.write('"');
+        out.write(kj::toCharSequence(input.as<uint64_t>()));
+        out.write('"');
+        return;
+      case schema::Type::TEXT:
+        writeString(input.as<Text>(), out);
+        return;
+      case schema::Type::DATA: {
+        out.write('[');
+        bool first = true;
+        for (byte b: input.as<Data>()) {
+          if (!first) out.write(',');
+          first = false;
+          writeNumber(b, out);
+        }
+        out.write(']');
+        return;
+      }
+      case schema::Type::LIST: {
+        auto list = input.as<DynamicList>();
+        auto elementType = type.asList().getElementType();
+        out.write('[');
+        for (auto i: kj::indices(list)) {
+          if (i > 0) out.write(',');
+          encodeStream(codec, list[i], elementType, out);
+        }
+        out.write(']');
+        return;
+      }
+      case schema::Type::ENUM: {
+        auto e = input.as<DynamicEnum>();
+        KJ_IF_MAYBE(symbol, e.getEnumerant()) {
+          writeString(symbol->getProto().getName(), out);
+        } else {
+          writeNumber(e.getRaw(), out);
+        }
+        return;
+      }
+      case schema::Type::STRUCT: {
+        auto structValue = input.as<DynamicStruct>();
+        bool first = true;
+        auto writeField = [&](StructSchema::Field field, bool isNull) {
+          if (!first) out.write(',');
+          first = false;
+          writeString(field.getProto().getName(), out);
+          out.write(':');
+          if (isNull) {
+            out.write(kj::StringPtr("null"));
+          } else {
+            encodeFieldStream(codec, field, structValue.get(field), out);
+          }
+        };
+
+        // Same field selection and ordering as encode(): the union member, if any, is written in
+        // order with the other fields.
+        auto which = structValue.which();
+        bool unionFieldIsNull = false;
+        KJ_IF_MAYBE(field, which) {
+          unionFieldIsNull = !structValue.has(*field, hasMode);
+          if (field->getProto().getDiscriminantValue() == 0 && unionFieldIsNull) {
+            which = nullptr;
+          }
+        }
+
+        out.write('{');
+        for (auto field: structValue.getSchema().getNonUnionFields()) {
+          KJ_IF_MAYBE(unionField, which) {
+            if (unionField->getIndex() < field.getIndex()) {
+              writeField(*unionField, unionFieldIsNull);
+              which = nullptr;
+            }
+          }
+          if (structValue.has(field, hasMode)) {
+            writeField(field, false);
+          }
+        }
+        KJ_IF_MAYBE(unionField, which) {
+          writeField(*unionField, unionFieldIsNull);
+        }
+        out.write('}');
+        return;
+      }
+      case schema::Type::INTERFACE:
+        KJ_FAIL_REQUIRE("don't know how to JSON-encode capabilities; "
+                        "please register a JsonCodec::Handler for this");
+      case schema::Type::ANY_POINTER:
+        KJ_FAIL_REQUIRE("don't know how to JSON-encode AnyPointer; "
+                        "please register a JsonCodec::Handler for this");
+    }
+  }
+
+  void encodeFieldStream(const JsonCodec& codec, StructSchema::Field field,
+                         DynamicValue::Reader input, TextWriter& out) const {
+    auto iter = fieldHandlers.find(field);
+    if (iter != fieldHandlers.end()) {
+      encodeWithHandler(codec, *iter->second, input, out);
+      return;
+    }
+
+    encodeStream(codec, input, field.getType(), out);
+  }
+
+  void encodeWithHandler(const JsonCodec& codec, const HandlerBase& handler,
+                         DynamicValue::Reader input, TextWriter& out) const {
+    // Handlers produce a JsonValue, so only the handled value itself is ever materialized.
+    MallocMessageBuilder message;
+    auto json = message.getRoot<JsonValue>();
+    handler.encodeBase(codec, input, json);
+    writeRaw(json, out);
+  }
+
   kj::StringTree encodeList(kj::Array<kj::StringTree> elements,
                             bool hasMultilineElement, uint indent, bool& multiline,
                             bool hasPrefix) const {
@@ -205,19 +519,31 @@ kj::String JsonCodec::encode(DynamicValue::Reader value, Type type) const {
   return encodeRaw(json);
 }
 
-void JsonCodec::decode(kj::ArrayPtr<const char> input, DynamicStruct::Builder output) const {
-  MallocMessageBuilder message;
-  auto json = message.getRoot<JsonValue>();
-  decodeRaw(input, json);
-  decode(json, output);
+void JsonCodec::encode(DynamicValue::Reader value, Type type,
+                       kj::BufferedOutputStream& output) const {
+  if (impl->prettyPrint) {
+    // Pretty-printing decides how to lay out each list based on the sizes of its encoded
+    // elements, which requires having encoded them all first.
+    auto text = encode(value, type);
+    output.write(text.begin(), text.size());
+    return;
+  }
+
+  TextWriter writer(output);
+  impl->encodeStream(*this, value, type, writer);
+  writer.flush();
 }
 
-Orphan<DynamicValue> JsonCodec::decode(
-    kj::ArrayPtr<const char> input, Type type, Orphanage orphanage) const {
-  MallocMessageBuilder message;
-  auto json = message.getRoot<JsonValue>();
-  decodeRaw(input, json);
-  return decode(json, type, orphanage);
+void JsonCodec::encodeRaw(JsonValue::Reader value, kj::BufferedOutputStream& output) const {
+  if (impl->prettyPrint) {
+    auto text = encodeRaw(value);
+    output.write(text.begin(), text.size());
+    return;
+  }
+
+  TextWriter writer(output);
+  impl->writeRaw(value, writer);
+  writer.flush();
 }
 
 kj::String JsonCodec::encodeRaw(JsonValue::Reader value) const {
@@ -617,6 +943,8 @@ public:
     return kj::arrayPtr(originalPos, wrapped.begin());
   }
 
+  kj::ArrayPtr<const char> remaining() { return wrapped; }
+
   void consumeWhitespace() {
     consumeWhile([](char chr) {
       return (
@@ -634,6 +962,60 @@ private:
 
 };  // class Input
 
+int decodeUnicodeEscape(kj::ArrayPtr<const char> hex) {
+  // Returns the code point written as the four hex digits of a \u escape.
+
+  KJ_REQUIRE(hex.size() == 4);
+  int codePoint = 0;
+
+  for (int i = 0; i < 4; ++i) {
+    char c = hex[i];
+    codePoint <<= 4;
+
+    if ('0' <= c && c <= '9') {
+      codePoint |= c - '0';
+    } else if ('a' <= c && c <= 'f') {
+      codePoint |= c - 'a';
+    } else if ('A' <= c && c <= 'F') {
+      codePoint |= c - 'A';
+    } else {
+      KJ_FAIL_REQUIRE("Invalid hex digit in unicode escape.", c);
+    }
+  }
+
+  // TODO(soon): Support at least basic multi-lingual plane, ie ignore surrogates.
+  KJ_REQUIRE(codePoint < 128, "non-ASCII unicode escapes are not supported (yet!)");
+  return codePoint;
+}
+
+// TODO(someday): This "interface" is ugly, and won't work if/when surrogates are handled.
+void unescapeAndAppend(kj::ArrayPtr<const char> hex, kj::Vector<char>& target) {
+  target.add(0x7f & static_cast<char>(decodeUnicodeEscape(hex)));
+}
+
+const char* findStringEnd(const char* pos, const char* end) {
+  // Returns the first '"', '\\', or NUL at or after `pos`, i.e. the end of a run of characters
+  // which can be copied out of a JSON string verbatim. Scans eight bytes at a time.
+
+  constexpr uint64_t ONES = 0x0101010101010101ull;
+  constexpr uint64_t HIGHS = 0x8080808080808080ull;
+
+  while (end - pos >= 8) {
+    uint64_t chunk;
+    memcpy(&chunk, pos, sizeof(chunk));
+    uint64_t quotes = chunk ^ (ONES * '"');
+    uint64_t backslashes = chunk ^ (ONES * '\\');
+    if ((((quotes - ONES) & ~quotes) | ((backslashes - ONES) & ~backslashes) |
+         ((chunk - ONES) & ~chunk)) & HIGHS) {
+      break;
+    }
+    pos += 8;
+  }
+
+  while (pos < end && *pos != '"' && *pos != '\\' && *pos != '\0') ++pos;
+  return pos;
+}
+
 class Parser {
 public:
   Parser(size_t maxNestingDepth, kj::ArrayPtr<const char> input) :
@@ -758,9 +1140,9 @@ private:
     kj::Vector<char> decoded;
 
     do {
-      auto stringValue = input.consumeWhile([](const char chr) {
-          return chr != '"' && chr != '\\';
-      });
+      auto rest = input.remaining();
+      auto stringValue = input.consume(
+          size_t(findStringEnd(rest.begin(), rest.end()) - rest.begin()));
 
       decoded.addAll(stringValue);
 
@@ -819,40 +1201,531 @@ private:
     return kj::String(number.releaseAsArray());
   }
 
-  // TODO(someday): This "interface" is ugly, and won't work if/when surrogates are handled.
-  void unescapeAndAppend(kj::ArrayPtr<const char> hex, kj::Vector<char>& target) {
-    KJ_REQUIRE(hex.size() == 4);
-    int codePoint = 0;
+  const size_t maxNestingDepth;
+  Input input;
+  size_t nestingDepth;
 
-    for (int i = 0; i < 4; ++i) {
-      char c = hex[i];
-      codePoint <<= 4;
 
-      if ('0' <= c && c <= '9') {
-        codePoint |= c - '0';
-      } else if ('a' <= c && c <= 'f') {
-        codePoint |= c - 'a';
-      } else if ('A' <= c && c <= 'F') {
-        codePoint |= c - 'A';
+};  // class Parser
+
+}  // namespace
+
+class JsonCodec::Impl::Decoder {
+  // Decodes JSON text directly into Cap'n Proto builders according to the target schema, instead
+  // of first parsing it into a JsonValue. Accepts and rejects exactly the same input as parsing
+  // with decodeRaw() followed by decode(JsonValue::Reader, ...), except that an error may be
+  // reported at a different point. Unknown fields are validated and skipped without allocating.
+  //
+  // Where a handler is registered for a type or field, the corresponding value is parsed into a
+  // JsonValue and passed to the handler as usual.
+
+public:
+  Decoder(const JsonCodec& codec, kj::ArrayPtr<const char> input)
+      : codec(codec), impl(*codec.impl), input(input) {}
+
+  void decodeObject(DynamicStruct::Builder output) {
+    StructSchema type = output.getSchema();
+    auto orphanage = Orphanage::getForMessageContaining(output);
+
+    input.consumeWhitespace();
+    KJ_REQUIRE(!input.exhausted() && input.nextChar() == '{', "Expected object value");
+    enter('{');
+    KJ_DEFER(--nestingDepth);
+
+    bool expectComma = false;
+    while (input.consumeWhitespace(), input.nextChar() != '}') {
+      if (expectComma) {
+        input.consume(',');
+        input.consumeWhitespace();
+      }
+
+      KJ_IF_MAYBE(field, type.findFieldByName(decodeString())) {
+        input.consumeWhitespace();
+        input.consume(':');
+        decodeField(output, *field, orphanage);
       } else {
-        KJ_FAIL_REQUIRE("Invalid hex digit in unicode escape.", c);
+        // Unknown json fields are ignored to allow schema evolution
+        input.consumeWhitespace();
+        input.consume(':');
+        skipValue();
       }
+
+      expectComma = true;
     }
 
-    // TODO(soon): Support at least basic multi-lingual plane, ie ignore surrogates.
-    KJ_REQUIRE(codePoint < 128, "non-ASCII unicode escapes are not supported (yet!)");
-    target.add(0x7f & static_cast<char>(codePoint));
+    input.consume('}');
   }
 
-  const size_t maxNestingDepth;
+  Orphan<DynamicValue> decodeValue(Type type, Orphanage orphanage) {
+    if (impl.typeHandlers.count(type)) {
+      auto json = parseJsonValue();
+      return codec.decode(json->getRoot<JsonValue>(), type, orphanage);
+    }
+
+    switch (type.which()) {
+      case schema::Type::STRUCT: {
+        auto orphan = orphanage.newOrphan(type.asStruct());
+        decodeObject(orphan.get());
+        return kj::mv(orphan);
+      }
+      case schema::Type::LIST:
+        return decodeList(type.asList(), orphanage);
+      case schema::Type::TEXT:
+        return orphanage.newOrphanCopy(decodeScalar(type).as<Text>());
+      case schema::Type::DATA:
+        return orphanage.newOrphanCopy(decodeScalar(type).as<Data>());
+      default: {
+        auto value = decodeScalar(type);
+        switch (value.getType()) {
+          case DynamicValue::VOID: return value.as<Void>();
+          case DynamicValue::BOOL: return value.as<bool>();
+          case DynamicValue::INT: return value.as<int64_t>();
+          case DynamicValue::UINT: return value.as<uint64_t>();
+          case DynamicValue::FLOAT: return value.as<double>();
+          case DynamicValue::ENUM: return value.as<DynamicEnum>();
+          default: KJ_UNREACHABLE;
+        }
+      }
+    }
+  }
+
+  void finish() {
+    input.consumeWhitespace();
+    KJ_REQUIRE(input.exhausted(), "Input remains after parsing JSON.");
+  }
+
+private:
+  const JsonCodec& codec;
+  const Impl& impl;
   Input input;
-  size_t nestingDepth;
+  size_t nestingDepth = 0;
+
+  kj::Vector<char> scratch;
+  kj::Vector<byte> scratchBytes;
+  // Reused for every string and byte array decoded, so that steady-state decoding of scalars and
+  // field names doesn't allocate.
+
+  struct ListSize {
+    const char* start;  // The list's '['.
+    uint size;
+  };
+  kj::Vector<ListSize> listSizes;
+  size_t listSizesPos = 0;
+  bool recordListSizes = false;
+  // See countListElements().
+
+  void enter(char c) {
+    input.consume(c);
+    KJ_REQUIRE(++nestingDepth <= impl.maxNestingDepth, "JSON message nested too deeply.");
+  }
 
+  void decodeField(DynamicStruct::Builder output, StructSchema::Field field,
+                   Orphanage orphanage) {
+    auto type = field.getType();
 
-};  // class Parser
+    auto iter = impl.fieldHandlers.find(field);
+    if (iter != impl.fieldHandlers.end()) {
+      auto json = parseJsonValue();
+      output.adopt(field, iter->second->decodeBase(
+          codec, json->getRoot<JsonValue>(), type, orphanage));
+      return;
+    }
 
-}  // namespace
+    if (impl.typeHandlers.count(type)) {
+      auto json = parseJsonValue();
+      output.adopt(field, codec.decode(json->getRoot<JsonValue>(), type, orphanage));
+      return;
+    }
+
+    switch (type.which()) {
+      case schema::Type::STRUCT:
+        decodeObject(output.init(field).as<DynamicStruct>());
+        break;
+      case schema::Type::LIST:
+        output.adopt(field, decodeList(type.asList(), orphanage));
+        break;
+      default:
+        output.set(field, decodeScalar(type));
+        break;
+    }
+  }
+
+  Orphan<DynamicList> decodeList(ListSchema type, Orphanage orphanage) {
+    input.consumeWhitespace();
+    KJ_REQUIRE(!input.exhausted() && input.nextChar() == '[', "Expected list value");
+
+    // The list is allocated in place, so we need its size up front.
+    uint count = countListElements();
+
+    auto elementType = type.getElementType();
+    bool handled = impl.typeHandlers.count(elementType);
+    auto orphan = orphanage.newOrphan(type, count);
+    auto output = orphan.get();
+
+    enter('[');
+    KJ_DEFER(--nestingDepth);
+    for (uint i = 0; i < count; i++) {
+      input.consumeWhitespace();
+      if (i > 0) input.consume(',');
+
+      if (handled) {
+        auto json = parseJsonValue();
+        output.adopt(i, codec.decode(json->getRoot<JsonValue>(), elementType, orphanage));
+        continue;
+      }
+
+      switch (elementType.which()) {
+        case schema::Type::STRUCT:
+          decodeObject(output[i].as<DynamicStruct>());
+          break;
+        case schema::Type::LIST:
+          output.adopt(i, decodeList(elementType.asList(), orphanage));
+          break;
+        default:
+          output.set(i, decodeScalar(elementType));
+          break;
+      }
+    }
+    input.consumeWhitespace();
+    input.consume(']');
+
+    return orphan;
+  }
+
+  DynamicValue::Reader decodeScalar(Type type) {
+    // Decode any value which isn't a struct or list. A returned Text or Data points into scratch
+    // space and is only valid until the next call.
+
+    input.consumeWhitespace();
+    KJ_REQUIRE(!input.exhausted(), "JSON message ends prematurely.");
+    char c = input.nextChar();
+
+    switch (type.which()) {
+      case schema::Type::VOID:
+        skipValue();
+        return capnp::VOID;
+      case schema::Type::BOOL:
+        if (c == 't') {
+          input.consume(kj::StringPtr("true"));
+          return true;
+        } else if (c == 'f') {
+          input.consume(kj::StringPtr("false"));
+          return false;
+        }
+        skipValue();
+        KJ_FAIL_REQUIRE("Expected boolean value");
+      case schema::Type::INT8:
+      case schema::Type::INT16:
+      case schema::Type::INT32:
+      case schema::Type::INT64:
+        // Relies on range check in DynamicValue::Reader::as<IntType>
+        if (c == '"') {
+          return decodeString().parseAs<int64_t>();
+        } else if (c == '-' || ('0' <= c && c <= '9')) {
+          return decodeNumber();
+        }
+        skipValue();
+        KJ_FAIL_REQUIRE("Expected integer value");
+      case schema::Type::UINT8:
+      case schema::Type::UINT16:
+      case schema::Type::UINT32:
+      case schema::Type::UINT64:
+        // Relies on range check in DynamicValue::Reader::as<IntType>
+        if (c == '"') {
+          return decodeString().parseAs<uint64_t>();
+        } else if (c == '-' || ('0' <= c && c <= '9')) {
+          return decodeNumber();
+        }
+        skipValue();
+        KJ_FAIL_REQUIRE("Expected integer value");
+      case schema::Type::FLOAT32:
+      case schema::Type::FLOAT64:
+        if (c == 'n') {
+          input.consume(kj::StringPtr("null"));
+          return kj::nan();
+        } else if (c == '"') {
+          return decodeString().parseAs<double>();
+        } else if (c == '-' || ('0' <= c && c <= '9')) {
+          return decodeNumber();
+        }
+        skipValue();
+        KJ_FAIL_REQUIRE("Expected float value");
+      case schema::Type::TEXT:
+        if (c == '"') {
+          return Text::Reader(decodeString());
+        }
+        skipValue();
+        KJ_FAIL_REQUIRE("Expected text value");
+      case schema::Type::DATA: {
+        KJ_REQUIRE(c == '[', "Expected data value") { skipValue(); break; }
+        scratchBytes.clear();
+        enter('[');
+        KJ_DEFER(--nestingDepth);
+        while (input.consumeWhitespace(), input.nextChar() != ']') {
+          if (scratchBytes.size() > 0) {
+            input.consume(',');
+            input.consumeWhitespace();
+          }
+          KJ_REQUIRE(!input.exhausted() &&
+                     (input.nextChar() == '-' || ('0' <= input.nextChar() &&
+                                                  input.nextChar() <= '9')),
+                     "Expected number in byte array");
+          double x = decodeNumber();
+          KJ_REQUIRE(byte(x) == x, "Number in byte array is not an integer in [0, 255]");
+          scratchBytes.add(x);
+        }
+        input.consume(']');
+        return Data::Reader(scratchBytes.begin(), scratchBytes.size());
+      }
+      case schema::Type::ENUM:
+        if (c == '"') {
+          return DynamicEnum(type.asEnum().getEnumerantByName(decodeString()));
+        }
+        skipValue();
+        KJ_FAIL_REQUIRE("Expected enum value");
+      case schema::Type::STRUCT:
+      case schema::Type::LIST:
+        KJ_FAIL_ASSERT("not a scalar type");
+      case schema::Type::INTERFACE:
+        KJ_FAIL_REQUIRE("don't know how to JSON-decode capabilities; "
+                        "please register a JsonCodec::Handler for this");
+      case schema::Type::ANY_POINTER:
+        KJ_FAIL_REQUIRE("don't know how to JSON-decode AnyPointer; "
+                        "please register a JsonCodec::Handler for this");
+    }
+
+    KJ_FAIL_REQUIRE("Unexpected input in JSON message.");
+  }
+
+  kj::StringPtr decodeString() {
+    // Decodes a quoted string into `scratch`. Valid until the next call.
+
+    scratch.clear();
+    input.consume('"');
+    for (;;) {
+      auto rest = input.remaining();
+      scratch.addAll(input.consume(size_t(findStringEnd(rest.begin(), rest.end()) - rest.begin())));
+
+      switch (input.nextChar()) {
+        case '"':
+          input.advance();
+          scratch.add('\0');
+          return kj::StringPtr(scratch.begin(), scratch.size() - 1);
+        case '\\':
+          input.advance();
+          switch (input.nextChar()) {
+            case '"' : scratch.add('"' ); input.advance(); break;
+            case '\\': scratch.add('\\'); input.advance(); break;
+            case '/' : scratch.add('/' ); input.advance(); break;
+            case 'b' : scratch.add('\b'); input.advance(); break;
+            case 'f' : scratch.add('\f'); input.advance(); break;
+            case 'n' : scratch.add('\n'); input.advance(); break;
+            case 'r' : scratch.add('\r'); input.advance(); break;
+            case 't' : scratch.add('\t'); input.advance(); break;
+            case 'u' :
+              input.consume('u');
+              unescapeAndAppend(input.consume(size_t(4)), scratch);
+              break;
+            default: KJ_FAIL_REQUIRE("Invalid escape in JSON string."); break;
+          }
+          break;
+        default:
+          // NUL, which Input treats as the end of the message. nextChar() has already thrown.
+          KJ_UNREACHABLE;
+      }
+    }
+  }
+
+  kj::ArrayPtr<const char> consumeNumber() {
+    auto number = input.consumeCustom([](Input& input) {
+      input.tryConsume('-');
+      if (!input.tryConsume('0')) {
+        input.consumeOne([](char c) { return '1' <= c && c <= '9'; });
+        input.consumeWhile([](char c) { return '0' <= c && c <= '9'; });
+      }
+
+      if (input.tryConsume('.')) {
+        input.consumeWhile([](char c) { return '0' <= c && c <= '9'; });
+      }
+
+      if (input.tryConsume('e') || input.tryConsume('E')) {
+        input.tryConsume('+') || input.tryConsume('-');
+        input.consumeWhile([](char c) { return '0' <= c && c <= '9'; });
+      }
+    });
+
+    KJ_REQUIRE(number.size() > 0, "Expected number in JSON input.");
+    return number;
+  }
+
+  double decodeNumber() {
+    auto number = consumeNumber();
+
+    // parseAs() needs a NUL terminator. Numbers are almost always short enough for the stack.
+    char buffer[64];
+    if (number.size() < sizeof(buffer)) {
+      memcpy(buffer, number.begin(), number.size());
+      buffer[number.size()] = '\0';
+      return kj::StringPtr(buffer, number.size()).parseAs<double>();
+    } else {
+      return kj::heapString(number).parseAs<double>();
+    }
+  }
+
+  uint countListElements() {
+    // Returns the number of elements in the list starting at the current position.
+    //
+    // A list that isn't inside one we have already counted is scanned to the end, recording the
+    // size of every list nested in it along the way, so that decoding nested lists doesn't scan
+    // their contents again at each level. Lists are decoded in the order they appear in the
+    // input, and the scan records them in the same order, so `listSizesPos` only moves forward;
+    // it passes over lists that were recorded but are never decoded, such as those inside unknown
+    // fields.
+
+    const char* start = input.remaining().begin();
+    while (listSizesPos < listSizes.size() && listSizes[listSizesPos].start < start) {
+      ++listSizesPos;
+    }
+
+    if (listSizesPos == listSizes.size() || listSizes[listSizesPos].start != start) {
+      // Everything recorded so far is behind us.
+      listSizes.clear();
+      listSizesPos = 0;
+
+      Input saved = input;
+      size_t savedDepth = nestingDepth;
+      recordListSizes = true;
+      KJ_DEFER(recordListSizes = false);
+      skipValue();
+      input = saved;
+      nestingDepth = savedDepth;
+    }
+
+    KJ_ASSERT(listSizes[listSizesPos].start == start);
+    return listSizes[listSizesPos++].size;
+  }
+
+  void skipValue() {
+    // Consumes one value, checking its syntax, without decoding it. If `recordListSizes` is set,
+    // adds every list in it to `listSizes`.
 
+    input.consumeWhitespace();
+    KJ_REQUIRE(!input.exhausted(), "JSON message ends prematurely.");
+
+    switch (input.nextChar()) {
+      case 'n': input.consume(kj::StringPtr("null")); break;
+      case 'f': input.consume(kj::StringPtr("false")); break;
+      case 't': input.consume(kj::StringPtr("true")); break;
+      case '"': skipString(); break;
+      case '[': {
+        size_t index = listSizes.size();
+        if (recordListSizes) {
+          listSizes.add(ListSize { input.remaining().begin(), 0 });
+        }
+
+        enter('[');
+        KJ_DEFER(--nestingDepth);
+        uint size = 0;
+        while (input.consumeWhitespace(), input.nextChar() != ']') {
+          if (size > 0) input.consume(',');
+          skipValue();
+          ++size;
+        }
+        input.consume(']');
+
+        if (recordListSizes) {
+          listSizes[index].size = size;
+        }
+        break;
+      }
+      case '{': {
+        enter('{');
+        KJ_DEFER(--nestingDepth);
+        bool expectComma = false;
+        while (input.consumeWhitespace(), input.nextChar() != '}') {
+          if (expectComma) {
+            input.consume(',');
+            input.consumeWhitespace();
+          }
+          skipString();
+          input.consumeWhitespace();
+          input.consume(':');
+          skipValue();
+          expectComma = true;
+        }
+        input.consume('}');
+        break;
+      }
+      case '-': case '0': case '1': case '2': case '3':
+      case '4': case '5': case '6': case '7': case '8':
+      case '9': consumeNumber(); break;
+      default: KJ_FAIL_REQUIRE("Unexpected input in JSON message.");
+    }
+  }
+
+  void skipString() {
+    input.consume('"');
+    for (;;) {
+      auto rest = input.remaining();
+      input.advance(findStringEnd(rest.begin(), rest.end()) - rest.begin());
+
+      if (input.nextChar() == '"') {
+        input.advance();
+        return;
+      }
+
+      // Backslash. Validate the escape as decodeString() would.
+      input.advance();
+      switch (input.nextChar()) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+          input.advance();
+          break;
+        case 'u':
+          input.consume('u');
+          decodeUnicodeEscape(input.consume(size_t(4)));
+          break;
+        default: KJ_FAIL_REQUIRE("Invalid escape in JSON string."); break;
+      }
+    }
+  }
+
+  kj::Own<MallocMessageBuilder> parseJsonValue() {
+    // Parse the next value into a JsonValue (the root of the returned message), for the benefit
+    // of a handler.
+
+    input.consumeWhitespace();
+    auto text = input.consumeCustom([this](Input&) { skipValue(); });
+
+    auto message = kj::heap<MallocMessageBuilder>();
+    auto json = message->getRoot<JsonValue>();
+    Parser parser(impl.maxNestingDepth - nestingDepth, text);
+    parser.parseValue(json);
+    return message;
+  }
+};
+
+void JsonCodec::decode(kj::ArrayPtr<const char> input, DynamicStruct::Builder output) const {
+  auto iter = impl->typeHandlers.find(output.getSchema());
+  if (iter != impl->typeHandlers.end()) {
+    MallocMessageBuilder message;
+    auto json = message.getRoot<JsonValue>();
+    decodeRaw(input, json);
+    iter->second->decodeStructBase(*this, json, output);
+    return;
+  }
+
+  Impl::Decoder decoder(*this, input);
+  decoder.decodeObject(output);
+  decoder.finish();
+}
+
+Orphan<DynamicValue> JsonCodec::decode(
+    kj::ArrayPtr<const char> input, Type type, Orphanage orphanage) const {
+  Impl::Decoder decoder(*this, input);
+  auto result = decoder.decodeValue(type, orphanage);
+  decoder.finish();
+  return result;
+}
 
 void JsonCodec::decodeRaw(kj::ArrayPtr<const char> input, JsonValue::Builder output) const {
   Parser parser(impl->maxNestingDepth, input);
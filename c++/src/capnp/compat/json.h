@@ -24,6 +24,7 @@
 #include <capnp/schema.h>
 #include <capnp/dynamic.h>
 #include <capnp/compat/json.capnp.h>
+#include <kj/io.h>
 
 namespace capnp {
 
@@ -90,6 +91,17 @@ public:
   // not distinguish between e.g. int32 and int64, which in JSON are handled differently. Most
   // of the time, though, you can use the single-argument templated version of `encode()` instead.
 
+  template <typename T>
+  void encode(T&& value, kj::BufferedOutputStream& output) const;
+  void encode(DynamicValue::Reader value, Type type, kj::BufferedOutputStream& output) const;
+  // Encode to JSON, writing the text incrementally to `output` rather than building it in memory.
+  // The output is identical to that of the versions above, and handlers are applied the same way,
+  // but only values produced by a handler are ever materialized as a JsonValue. Nothing is
+  // buffered beyond what `output` itself buffers, so you may want to flush it afterwards.
+  //
+  // Pretty-printing chooses the layout of each list based on its encoded elements, so when it is
+  // enabled these simply encode to a string and then write it.
+
   void decode(kj::ArrayPtr<const char> input, DynamicStruct::Builder output) const;
   // Decode JSON text directly into a struct builder. This only works for structs since lists
   // need to be allocated with the correct size in advance.
@@ -127,6 +139,7 @@ public:
   // for calling from Handler implementations.
 
   kj::String encodeRaw(JsonValue::Reader value) const;
+  void encodeRaw(JsonValue::Reader value, kj::BufferedOutputStream& output) const;
   void decodeRaw(kj::ArrayPtr<const char> input, JsonValue::Builder output) const;
   // Translate JsonValue <-> text.
 
@@ -239,6 +252,13 @@ kj::String JsonCodec::encode(T&& value) const {
   return encode(DynamicValue::Reader(ReaderFor<Base>(kj::fwd<T>(value))), type);
 }
 
+template <typename T>
+void JsonCodec::encode(T&& value, kj::BufferedOutputStream& output) const {
+  Type type = Type::from(value);
+  typedef FromAny<kj::Decay<T>> Base;
+  encode(DynamicValue::Reader(ReaderFor<Base>(kj::fwd<T>(value))), type, output);
+}
+
 template <typename T>
 inline Orphan<T> JsonCodec::decode(kj::ArrayPtr<const char> input, Orphanage orphanage) const {
   return decode(input, Type::from<T>(), orphanage).template releaseAs<T>();
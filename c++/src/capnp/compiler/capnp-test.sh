@@ -37,7 +37,16 @@ else
   CAPNP=${CAPNP:-capnp}
 fi
 
+if test -f ./capnpc-c++; then
+  CAPNPC_CXX=${CAPNPC_CXX:-./capnpc-c++}
+elif test -f ./capnpc-c++.exe; then
+  CAPNPC_CXX=${CAPNPC_CXX:-./capnpc-c++.exe}
+else
+  CAPNPC_CXX=${CAPNPC_CXX:-capnpc-c++}
+fi
+
 SCHEMA=`dirname "$0"`/../test.capnp
+SPLIT_SCHEMA=`dirname "$0"`/../test-split.capnp
 TESTDATA=`dirname "$0"`/../testdata
 
 SUFFIX=${TESTDATA#*/src/}
@@ -47,6 +56,9 @@ if [ "$PREFIX" = "" ]; then
   PREFIX=.
 fi
 
+TMPDIR=`mktemp -d`
+trap 'rm -rf "$TMPDIR"' EXIT
+
 # ========================================================================================
 # convert
 
@@ -74,6 +86,37 @@ $CAPNP convert binary:json --short $SCHEMA TestAllTypes < $TESTDATA/binary | cmp
 $CAPNP convert json:binary $SCHEMA TestAllTypes < $TESTDATA/pretty.json | cmp $TESTDATA/binary - || fail json to binary
 $CAPNP convert json:binary $SCHEMA TestAllTypes < $TESTDATA/short.json | cmp $TESTDATA/binary - || fail short json to binary
 
+# Converting on several threads must produce the same output, diagnostics and exit status as
+# converting one message at a time. Use enough messages that the input is read ahead in pieces.
+i=0
+while [ $i -lt 150 ]; do
+  cat $TESTDATA/binary $TESTDATA/segmented >> $TMPDIR/stream.binary
+  cat $TESTDATA/packed $TESTDATA/segmented-packed >> $TMPDIR/stream.packed
+  cat $TESTDATA/pretty.txt $TESTDATA/short.txt >> $TMPDIR/stream.text
+  cat $TESTDATA/pretty.json $TESTDATA/short.json >> $TMPDIR/stream.json
+  i=$((i + 1))
+done
+# Chop the last message short.
+head -c $((`wc -c < $TMPDIR/stream.binary` - 100)) $TMPDIR/stream.binary > $TMPDIR/stream.truncated
+
+test_convert_jobs() {
+  for jobs in 1 4; do
+    status=0
+    $CAPNP convert -j$jobs $1 $SCHEMA TestAllTypes < $2 > $TMPDIR/convert$jobs.out \
+        2> $TMPDIR/convert$jobs.err || status=$?
+    echo "exit status $status" >> $TMPDIR/convert$jobs.err
+  done
+  cmp $TMPDIR/convert1.out $TMPDIR/convert4.out || fail convert -j4 $1 output
+  cmp $TMPDIR/convert1.err $TMPDIR/convert4.err || fail convert -j4 $1 diagnostics
+}
+
+test_convert_jobs binary:text $TMPDIR/stream.binary
+test_convert_jobs packed:json $TMPDIR/stream.packed
+test_convert_jobs text:binary $TMPDIR/stream.text
+test_convert_jobs json:packed $TMPDIR/stream.json
+test_convert_jobs binary:text $TMPDIR/stream.truncated
+grep -q "exit status 0" $TMPDIR/convert1.err && fail convert truncated input succeeded
+
 # ========================================================================================
 # DEPRECATED encode/decode
 
@@ -111,3 +154,156 @@ test "x`$CAPNP eval $SCHEMA -ojson globalPrintableStruct | tr -d '\r'`" = "x{\"s
 
 $CAPNP compile --src-prefix="$PREFIX" -ofoo $TESTDATA/errors.capnp.nobuild 2>&1 | sed -e "s,^.*errors[.]capnp[.]nobuild:,file:,g" | tr -d '\r' |
     cmp $TESTDATA/errors.txt - || fail error output
+
+# ========================================================================================
+# bench
+
+# A quick smoke run: every benchmark runs and reports in the expected format.
+$CAPNP bench -n 3 binary $SCHEMA TestAllTypes < $TESTDATA/binary > /dev/null 2> $TMPDIR/bench.txt ||
+    fail bench
+grep -q '^message: 2816 bytes, 1 segment(s); [0-9]* bytes packed; [0-9]* bytes of JSON$' \
+    $TMPDIR/bench.txt || fail bench summary
+grep -q '^benchmark  *iterations  *mean ns  *p50 ns  *p90 ns  *p99 ns  *max ns  *ops/s  *MB/s$' \
+    $TMPDIR/bench.txt || fail bench header
+for name in build serialize pack unpack parse traverse canonicalize json-encode json-decode; do
+  grep -q "^$name  *3\(  *[0-9][0-9.]*\)\{7\}\$" $TMPDIR/bench.txt || fail bench $name
+done
+
+$CAPNP bench -n 3 --json --only parse,json-decode packed $SCHEMA TestAllTypes \
+    < $TESTDATA/packed > $TMPDIR/bench.json 2> /dev/null || fail bench --json
+test `wc -l < $TMPDIR/bench.json` -eq 2 || fail bench --only
+for name in parse json-decode; do
+  grep -q "^{\"benchmark\":\"$name\",\"iterations\":3,\"messageBytes\":2816,\"meanNs\":[0-9]*,\"p50Ns\":[0-9]*,\"p90Ns\":[0-9]*,\"p99Ns\":[0-9]*,\"maxNs\":[0-9]*,\"opsPerSec\":[0-9]*,\"bytesPerSec\":[0-9]*}\$" \
+      $TMPDIR/bench.json || fail bench --json $name
+done
+
+$CAPNP bench -n 3 --only nonsense binary $SCHEMA TestAllTypes < $TESTDATA/binary \
+    > /dev/null 2>&1 && fail bench accepted unknown benchmark
+
+# ========================================================================================
+# compile -j
+
+# Parsing on several threads must not change the output or the diagnostics.
+TEST_SCHEMAS="$SCHEMA `dirname "$0"`/../test-import.capnp `dirname "$0"`/../test-import2.capnp"
+$CAPNP compile --src-prefix="$PREFIX" -I"$PREFIX" -j1 -o- $TEST_SCHEMAS > $TMPDIR/j1.out 2> $TMPDIR/j1.err ||
+    fail compile -j1
+$CAPNP compile --src-prefix="$PREFIX" -I"$PREFIX" -j4 -o- $TEST_SCHEMAS > $TMPDIR/j4.out 2> $TMPDIR/j4.err ||
+    fail compile -j4
+cmp $TMPDIR/j1.out $TMPDIR/j4.out || fail compile -j4 output differs from -j1
+cmp $TMPDIR/j1.err $TMPDIR/j4.err || fail compile -j4 diagnostics differ from -j1
+
+# With errors in some files, including the missing ID warning that is suppressed after errors in
+# any other file. (Its suggested ID is random, so leave that out of the comparison.)
+mkdir $TMPDIR/jobs
+printf '@0xe0c2b5bd6d4c1a37;\nstruct Broken { x @0 :; }\n' > $TMPDIR/jobs/bad.capnp
+printf 'struct NoId { x @0 :UInt32; }\n' > $TMPDIR/jobs/noid.capnp
+for sources in "$TESTDATA/errors.capnp.nobuild" "$TMPDIR/jobs/bad.capnp $TMPDIR/jobs/noid.capnp" \
+               "$TMPDIR/jobs/noid.capnp $TMPDIR/jobs/bad.capnp" "$TMPDIR/jobs/noid.capnp"; do
+  for jobs in 1 4; do
+    $CAPNP compile --src-prefix="$PREFIX" -j$jobs -o- $sources 2>&1 > /dev/null |
+        sed -e 's/@0x[0-9a-f]*;/@0x...;/' > $TMPDIR/j$jobs.err || true
+  done
+  test -s $TMPDIR/j1.err || fail "compile $sources reported no errors"
+  cmp $TMPDIR/j1.err $TMPDIR/j4.err || fail "compile -j4 $sources diagnostics differ from -j1"
+done
+
+# ========================================================================================
+# compile -oc++
+
+# Regenerating unchanged output must not touch the files, or build tools would rebuild everything
+# that includes them.
+$CAPNP compile --src-prefix="$PREFIX" -o$CAPNPC_CXX:$TMPDIR $SPLIT_SCHEMA ||
+    fail compile split headers
+for file in test-split.capnp.h test-split.capnp.base.h test-split.capnp-TestSplitA.h \
+            test-split.capnp-TestSplitDerived.h test-split.capnp.c++; do
+  test -n "`find $TMPDIR -name $file`" || fail split headers missing $file
+done
+SPLIT_HEADER=`find $TMPDIR -name test-split.capnp.h`
+sleep 1
+touch $TMPDIR/marker
+$CAPNP compile --src-prefix="$PREFIX" -o$CAPNPC_CXX:$TMPDIR $SPLIT_SCHEMA ||
+    fail recompile split headers
+test -z "`find $TMPDIR -newer $TMPDIR/marker`" || fail regenerating unchanged output touched files
+
+# ...but changed output is still written, even when it is shorter than before.
+echo "// stale" >> $SPLIT_HEADER
+$CAPNP compile --src-prefix="$PREFIX" -o$CAPNPC_CXX:$TMPDIR $SPLIT_SCHEMA ||
+    fail recompile split headers
+test -z "`grep stale $SPLIT_HEADER`" || fail changed output was not rewritten
+
+# ========================================================================================
+# compile --cache-dir
+
+CACHE_SRC=$TMPDIR/cache-src
+CACHE=$TMPDIR/cache
+mkdir $CACHE_SRC
+printf '@0xe0c2b5bd6d4c1a37;\nusing B = import "b.capnp";\nstruct A { b @0 :B.B; }\n' > $CACHE_SRC/a.capnp
+printf '@0xd3a0c74c5bbd6f41;\nstruct B { x @0 :UInt32; }\n' > $CACHE_SRC/b.capnp
+
+compile_uncached() {
+  $CAPNP compile --src-prefix=$CACHE_SRC "$@" $CACHE_SRC/a.capnp
+}
+compile_cached() {
+  $CAPNP compile --src-prefix=$CACHE_SRC --cache-dir=$CACHE "$@" $CACHE_SRC/a.capnp
+}
+cache_entry() {
+  find $CACHE -name '*.output'
+}
+cache_entry_touched() {
+  test -n "`find $CACHE -name '*.output' -newer $TMPDIR/marker`"
+}
+mark_cache() {
+  sleep 1
+  touch $TMPDIR/marker
+}
+
+# Miss on an empty cache, which stores the request.
+compile_uncached -o- > $TMPDIR/request
+compile_cached -o- | cmp $TMPDIR/request - || fail cache miss output
+test `cache_entry | wc -l` -eq 1 || fail cache entry not written
+
+# Hit: same output, and the entry is left alone.
+mark_cache
+compile_cached -o- | cmp $TMPDIR/request - || fail cache hit output
+cache_entry_touched && fail cache hit rewrote the entry
+
+# A different plugin gets the cached request and produces the same files as without the cache.
+mkdir $TMPDIR/cache-out $TMPDIR/nocache-out
+compile_uncached -o$CAPNPC_CXX:$TMPDIR/nocache-out
+compile_cached -o$CAPNPC_CXX:$TMPDIR/cache-out
+cache_entry_touched && fail cache hit with another plugin rewrote the entry
+diff -r $TMPDIR/nocache-out $TMPDIR/cache-out > /dev/null || fail cache hit with another plugin
+
+# Editing an imported file, which isn't part of the entry's key, is a miss.
+printf '@0xd3a0c74c5bbd6f41;\nstruct B { x @0 :UInt32; y @1 :Text; }\n' > $CACHE_SRC/b.capnp
+mv $TMPDIR/request $TMPDIR/request-old
+compile_uncached -o- > $TMPDIR/request
+cmp -s $TMPDIR/request $TMPDIR/request-old && fail import edit did not change output
+mark_cache
+compile_cached -o- | cmp $TMPDIR/request - || fail cache miss after import edit
+cache_entry_touched || fail cache entry not replaced after import edit
+
+# A corrupt or truncated entry is ignored with a warning, then replaced.
+ENTRY=`cache_entry`
+for corruption in "printf garbage" "head -c 40 $ENTRY" "head -n 3 $ENTRY"; do
+  $corruption > $TMPDIR/corrupt
+  cp $TMPDIR/corrupt $ENTRY
+  mark_cache
+  compile_cached -o- 2> $TMPDIR/stderr | cmp $TMPDIR/request - ||
+      fail "cache output with corrupt entry ($corruption)"
+  grep -q "ignoring bad entry" $TMPDIR/stderr || fail "no warning for corrupt entry ($corruption)"
+  cache_entry_touched || fail "corrupt entry not replaced ($corruption)"
+done
+
+# A file without an ID, parsed after a file with errors, isn't told off for the missing ID -- so
+# its parse must not be cached, or fixing the other file would hide the error for good.
+printf '@0xe0c2b5bd6d4c1a37;\nstruct A { x @0 UInt32; }\n' > $CACHE_SRC/a.capnp
+printf 'struct B { x @0 :UInt32; }\n' > $CACHE_SRC/b.capnp
+$CAPNP compile --src-prefix=$CACHE_SRC --cache-dir=$CACHE -j1 -o- \
+    $CACHE_SRC/a.capnp $CACHE_SRC/b.capnp > /dev/null 2>&1 && fail compiled broken file
+printf '@0xe0c2b5bd6d4c1a37;\nstruct A { x @0 :UInt32; }\n' > $CACHE_SRC/a.capnp
+$CAPNP compile --src-prefix=$CACHE_SRC --cache-dir=$CACHE -j1 -o- \
+    $CACHE_SRC/a.capnp $CACHE_SRC/b.capnp > /dev/null 2> $TMPDIR/stderr &&
+    fail "cached parse hid missing file ID"
+grep -q "b.capnp:1:1: error: File does not declare an ID" $TMPDIR/stderr ||
+    fail "cached parse hid missing file ID"
@@ -34,6 +34,7 @@
 #include <kj/io.h>
 #include <kj/miniposix.h>
 #include <kj/debug.h>
+#include <kj/thread.h>
 #include "../message.h"
 #include <iostream>
 #include <kj/main.h>
@@ -44,8 +45,13 @@
 #include <capnp/serialize-packed.h>
 #include <capnp/serialize-text.h>
 #include <capnp/compat/json.h>
+#include <capnp/message-profile.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <thread>
+#include <deque>
+#include <chrono>
+#include <algorithm>
 
 #if _WIN32
 #include <process.h>
@@ -100,7 +106,11 @@ public:
              .addSubCommand("encode", KJ_BIND_METHOD(*this, getEncodeMain),
                             "DEPRECATED (use `convert`)")
              .addSubCommand("eval", KJ_BIND_METHOD(*this, getEvalMain),
-                            "Evaluate a const from a schema file.");
+                            "Evaluate a const from a schema file.")
+             .addSubCommand("bench", KJ_BIND_METHOD(*this, getBenchMain),
+                            "Benchmark encoding and decoding a sample message.")
+             .addSubCommand("profile", KJ_BIND_METHOD(*this, getProfileMain),
+                            "Show where the space in encoded messages goes.");
       addGlobalOptions(builder);
       return builder.build();
     }
@@ -126,6 +136,9 @@ public:
     // Only parse the schemas we actually need for decoding.
     compileEagerness = Compiler::NODE;
 
+    // Converting in parallel buffers more of the input, so only do it when asked.
+    jobs = 1;
+
     // Drop annotations since we don't need them.  This avoids importing files like c++.capnp.
     annotationFlag = Compiler::DROP_ANNOTATIONS;
 
@@ -156,6 +169,12 @@ public:
                "Do not print warning messages about the input being in the wrong format.  "
                "Use this if you find the warnings are wrong (but also let us know so "
                "we can improve them).")
+           .addOptionWithArg({'j', "jobs"}, KJ_BIND_METHOD(*this, setJobs), "<n>",
+               "Convert up to <n> messages at once, on separate threads. The output is the same, "
+               "in the same order. This only helps when converting a stream of binary, packed, "
+               "text, or JSON messages. Defaults to 1.")
+           .addOption({"stats"}, KJ_BIND_METHOD(*this, setStats),
+               "When done, print the number of messages converted and the rate to stderr.")
            .expectArg("<from>:<to>", KJ_BIND_METHOD(*this, setConversion))
            .expectOptionalArg("<schema-file>", KJ_BIND_METHOD(*this, addSource))
            .expectOptionalArg("<type>", KJ_BIND_METHOD(*this, setRootType))
@@ -167,6 +186,9 @@ public:
     // Only parse the schemas we actually need for decoding.
     compileEagerness = Compiler::NODE;
 
+    // Converting in parallel buffers more of the input, so only do it when asked.
+    jobs = 1;
+
     // Drop annotations since we don't need them.  This avoids importing files like c++.capnp.
     annotationFlag = Compiler::DROP_ANNOTATIONS;
 
@@ -191,6 +213,11 @@ public:
                       "Do not print warning messages about the input being in the wrong format.  "
                       "Use this if you find the warnings are wrong (but also let us know so "
                       "we can improve them).")
+           .addOptionWithArg({'j', "jobs"}, KJ_BIND_METHOD(*this, setJobs), "<n>",
+                      "Decode up to <n> messages at once, on separate threads. The output is the "
+                      "same, in the same order. Has no effect with --flat. Defaults to 1.")
+           .addOption({"stats"}, KJ_BIND_METHOD(*this, setStats),
+                      "When done, print the number of messages decoded and the rate to stderr.")
            .expectArg("<schema-file>", KJ_BIND_METHOD(*this, addSource))
            .expectArg("<type>", KJ_BIND_METHOD(*this, setRootType))
            .callAfterParsing(KJ_BIND_METHOD(*this, decode));
@@ -281,6 +308,74 @@ public:
     return builder.build();
   }
 
+  kj::MainFunc getBenchMain() {
+    // Only parse the schemas we actually need for decoding.
+    compileEagerness = Compiler::NODE;
+
+    // Drop annotations since we don't need them.  This avoids importing files like c++.capnp.
+    annotationFlag = Compiler::DROP_ANNOTATIONS;
+
+    kj::MainBuilder builder(context, VERSION_STRING,
+          "Reads one sample message from stdin in format <format> (see `capnp help convert` for "
+          "a list of formats), with root type <type> defined in <schema-file>, and measures how "
+          "fast various operations on it are. The benchmarks are:\n"
+          "    build        copy the message into a new MallocMessageBuilder\n"
+          "    serialize    write the message to a flat array in standard format\n"
+          "    pack         write the message in packed format\n"
+          "    unpack       read the packed message\n"
+          "    parse        read the message from a flat array\n"
+          "    traverse     read every field of the message using the dynamic API\n"
+          "    canonicalize canonicalize the message\n"
+          "    json-encode  encode the message as JSON\n"
+          "    json-decode  decode the message from JSON\n"
+          "For each one, the mean and percentile latencies of one operation are reported, along "
+          "with the throughput in operations and bytes (of the message in standard format) per "
+          "second.",
+
+          "Operations which take less than about a microsecond are timed in batches, so that "
+          "reading the clock doesn't dominate, and the percentiles are of the batch averages.");
+    addGlobalOptions(builder);
+    builder.addOptionWithArg({'n', "iterations"}, KJ_BIND_METHOD(*this, setBenchIterations), "<n>",
+                      "Run each benchmark exactly <n> times, after warming up.")
+           .addOptionWithArg({"time"}, KJ_BIND_METHOD(*this, setBenchTime), "<seconds>",
+                      "Run each benchmark for about <seconds>, unless -n is given. Defaults to 1.")
+           .addOptionWithArg({"only"}, KJ_BIND_METHOD(*this, setBenchOnly), "<names>",
+                      "Run only the benchmarks in the comma-separated list <names>.")
+           .addOption({"json"}, KJ_BIND_METHOD(*this, setBenchJson),
+                      "Print the results as JSON, one object per line, instead of as a table.")
+           .expectArg("<format>", KJ_BIND_METHOD(*this, setBenchFormat))
+           .expectArg("<schema-file>", KJ_BIND_METHOD(*this, addSource))
+           .expectArg("<type>", KJ_BIND_METHOD(*this, setRootType))
+           .callAfterParsing(KJ_BIND_METHOD(*this, bench));
+    return builder.build();
+  }
+
+  kj::MainFunc getProfileMain() {
+    // Only parse the schemas we actually need for decoding.
+    compileEagerness = Compiler::NODE;
+
+    // Drop annotations since we don't need them.  This avoids importing files like c++.capnp.
+    annotationFlag = Compiler::DROP_ANNOTATIONS;
+
+    kj::MainBuilder builder(context, VERSION_STRING,
+          "Reads one or more encoded Cap'n Proto messages with root type <type> defined in "
+          "<schema-file> from standard input, and reports where their space goes: how many words "
+          "each field path takes up, how much of that is padding, how many far pointers and "
+          "segment crossings there are, and how much space isn't reachable from the root at "
+          "all (left behind by orphaned objects).  The totals over all messages are printed to "
+          "standard output.");
+    addGlobalOptions(builder);
+    builder.addOption({"flat"}, KJ_BIND_METHOD(*this, codeFlat),
+                      "Interpret the input as one large single-segment message rather than a "
+                      "stream in standard serialization format.")
+           .addOption({'p', "packed"}, KJ_BIND_METHOD(*this, codePacked),
+                      "Expect the input to be packed using standard Cap'n Proto packing.")
+           .expectArg("<schema-file>", KJ_BIND_METHOD(*this, addSource))
+           .expectArg("<type>", KJ_BIND_METHOD(*this, setRootType))
+           .callAfterParsing(KJ_BIND_METHOD(*this, profile));
+    return builder.build();
+  }
+
   void addGlobalOptions(kj::MainBuilder& builder) {
     builder.addOptionWithArg({'I', "import-path"}, KJ_BIND_METHOD(*this, addImportPath), "<dir>",
                              "Add <dir> to the list of directories searched for non-relative "
@@ -306,8 +401,16 @@ public:
                              "For example, the following command:\n"
                              "    capnp compile --src-prefix=foo/bar -oc++:corge foo/bar/baz/qux.capnp\n"
                              "would generate the files corge/baz/qux.capnp.{h,c++}.")
-           .expectOneOrMoreArgs("<source>", KJ_BIND_METHOD(*this, addSource))
-           .callAfterParsing(KJ_BIND_METHOD(*this, generateOutput));
+           .addOptionWithArg({"cache-dir"}, KJ_BIND_METHOD(*this, setCacheDir), "<dir>",
+                             "Cache parsed schema files and compiled output in <dir>, creating "
+                             "it if needed.  When the source files and everything they import "
+                             "are unchanged since a previous compile, the cached output is sent "
+                             "to the plugins without compiling anything.")
+           .addOptionWithArg({'j', "jobs"}, KJ_BIND_METHOD(*this, setJobs), "<n>",
+                             "Parse schema files using up to <n> threads.  Defaults to the "
+                             "number of CPUs.  The output does not depend on <n>.")
+           .expectOneOrMoreArgs("<source>", KJ_BIND_METHOD(*this, addCompileSource))
+           .callAfterParsing(KJ_BIND_METHOD(*this, compileSourcesAndGenerateOutput));
   }
 
   // =====================================================================================
@@ -328,6 +431,15 @@ public:
   }
 
   kj::MainBuilder::Validity addSource(kj::StringPtr file) {
+    KJ_IF_MAYBE(module, loadSource(file)) {
+      compileSource(*module);
+      return true;
+    } else {
+      return "no such file";
+    }
+  }
+
+  kj::Maybe<Module&> loadSource(kj::StringPtr file) {
     if (!compilerConstructed) {
       compiler = compilerSpace.construct(annotationFlag);
       compilerConstructed = true;
@@ -353,15 +465,13 @@ public:
     }
 
     auto dirPathPair = interpretSourceFile(file);
-    KJ_IF_MAYBE(module, loader.loadModule(dirPathPair.dir, dirPathPair.path)) {
-      uint64_t id = compiler->add(*module);
-      compiler->eagerlyCompile(id, compileEagerness);
-      sourceFiles.add(SourceFile { id, module->getSourceName(), &*module });
-    } else {
-      return "no such file";
-    }
+    return loader.loadModule(dirPathPair.dir, dirPathPair.path);
+  }
 
-    return true;
+  void compileSource(Module& module) {
+    uint64_t id = compiler->add(module);
+    compiler->eagerlyCompile(id, compileEagerness);
+    sourceFiles.add(SourceFile { id, module.getSourceName(), &module });
   }
 
 public:
@@ -433,6 +543,67 @@ public:
     return true;
   }
 
+  kj::MainBuilder::Validity setJobs(kj::StringPtr arg) {
+    char* end;
+    jobs = strtoul(arg.cStr(), &end, 0);
+    if (arg.size() == 0 || *end != '\0' || jobs == 0) {
+      return "not a positive integer";
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity addCompileSource(kj::StringPtr file) {
+    // Sources given to "compile" are only loaded here. They are compiled together once all
+    // arguments have been parsed, so that parsing can be spread across threads.
+
+    KJ_IF_MAYBE(module, loadSource(file)) {
+      pendingSources.add(&*module);
+      return true;
+    } else {
+      return "no such file";
+    }
+  }
+
+  kj::MainBuilder::Validity setCacheDir(kj::StringPtr dir) {
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      cacheDir = disk->getRoot().openSubdir(disk->getCurrentPath().evalNative(dir),
+          kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT);
+    })) {
+      return "couldn't open or create directory";
+    }
+    loader.setCacheDirectory(*KJ_ASSERT_NONNULL(cacheDir));
+    return true;
+  }
+
+  kj::String getCacheSalt() {
+    return kj::str("capnp compile ", CAPNP_VERSION, ' ', compileEagerness, ' ',
+                   static_cast<uint>(annotationFlag));
+  }
+
+  kj::MainBuilder::Validity compileSourcesAndGenerateOutput() {
+    if (cacheDir != nullptr && !hadErrors()) {
+      KJ_IF_MAYBE(cached, loader.getCachedOutput(pendingSources, getCacheSalt())) {
+        if (outputs.size() == 0) {
+          return "no outputs specified";
+        }
+        return runPlugins(*cached);
+      }
+    }
+
+    if (jobs > 1) {
+      // Lexing and parsing are independent for each file, so do them all up-front in parallel.
+      // Translation must stay on this thread since it shares the compiler's state; it happens in
+      // the same order as without preparsing, so the output is identical.
+      loader.preparse(jobs);
+    }
+
+    for (auto module: pendingSources) {
+      compileSource(*module);
+    }
+
+    return generateOutput();
+  }
+
   kj::MainBuilder::Validity addSourcePrefix(kj::StringPtr prefix) {
     if (getSourceDirectory(prefix, true) == nullptr) {
       return "no such directory";
@@ -455,6 +626,14 @@ public:
       return "no outputs specified";
     }
 
+    auto request = buildCodeGeneratorRequest();
+    if (cacheDir != nullptr) {
+      loader.putCachedOutput(pendingSources, getCacheSalt(), request.asBytes());
+    }
+    return runPlugins(request.asBytes());
+  }
+
+  kj::Array<word> buildCodeGeneratorRequest() {
     MallocMessageBuilder message;
     auto request = message.initRoot<schema::CodeGeneratorRequest>();
 
@@ -480,9 +659,15 @@ public:
           *sourceFiles[i].module, Orphanage::getForMessageContaining(requestedFile)));
     }
 
+    return messageToFlatArray(message);
+  }
+
+  kj::MainBuilder::Validity runPlugins(kj::ArrayPtr<const byte> request) {
+    // Sends the serialized CodeGeneratorRequest to each output plugin.
+
     for (auto& output: outputs) {
       if (kj::str(output.name) == "-") {
-        writeMessageToFd(STDOUT_FILENO, message);
+        kj::FdOutputStream(STDOUT_FILENO).write(request.begin(), request.size());
         continue;
       }
 
@@ -604,7 +789,7 @@ public:
       KJ_SYSCALL(close(pipeFds[0]));
 #endif  // _WIN32, else
 
-      writeMessageToFd(pipeFds[1], message);
+      kj::FdOutputStream(pipeFds[1]).write(request.begin(), request.size());
       KJ_SYSCALL(close(pipeFds[1]));
 
 #if _WIN32
@@ -741,14 +926,35 @@ public:
       }
     }
 
-    while (input.tryGetReadBuffer().size() > 0) {
-      readOneAndConvert(input, output);
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (jobs > 1 && convertFrom != Format::FLAT && convertFrom != Format::FLAT_PACKED &&
+        convertFrom != Format::CANONICAL) {
+      convertInParallel(input, output);
+    } else {
+      while (input.tryGetReadBuffer().size() > 0) {
+        readOneAndConvert(input, output);
+        ++messagesConverted;
+      }
+    }
+
+    if (stats) {
+      auto seconds = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - startTime).count();
+      context.warning(kj::str(
+          "converted ", messagesConverted, " messages in ", seconds, " s (",
+          seconds == 0 ? 0.0 : messagesConverted / seconds, " messages/s)"));
     }
 
     context.exit();
     KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
   }
 
+  kj::MainBuilder::Validity setStats() {
+    stats = true;
+    return true;
+  }
+
 private:
   kj::Vector<byte> readAll(kj::BufferedInputStreamWrapper& input) {
     kj::Vector<byte> allBytes;
@@ -948,13 +1154,7 @@ private:
     ~ParseErrorCatcher() noexcept(false) {
       if (!unwindDetector.isUnwinding()) {
         KJ_IF_MAYBE(e, exception) {
-          context.error(kj::str(
-              "*** ERROR CONVERTING PREVIOUS MESSAGE ***\n"
-              "The following error occurred while converting the message above.\n"
-              "This probably means the input data is invalid/corrupted.\n",
-              "Exception description: ", e->getDescription(), "\n"
-              "Code location: ", e->getFile(), ":", e->getLine(), "\n"
-              "*** END ERROR ***"));
+          report(context, *e);
         }
       }
     }
@@ -967,6 +1167,23 @@ private:
       }
     }
 
+    kj::Maybe<kj::Exception> releaseException() {
+      // Take the exception, if any, so that it is reported later rather than on destruction.
+      kj::Maybe<kj::Exception> result = kj::mv(exception);
+      exception = nullptr;
+      return result;
+    }
+
+    static void report(kj::ProcessContext& context, const kj::Exception& e) {
+      context.error(kj::str(
+          "*** ERROR CONVERTING PREVIOUS MESSAGE ***\n"
+          "The following error occurred while converting the message above.\n"
+          "This probably means the input data is invalid/corrupted.\n",
+          "Exception description: ", e.getDescription(), "\n"
+          "Code location: ", e.getFile(), ":", e.getLine(), "\n"
+          "*** END ERROR ***"));
+    }
+
   private:
     kj::ProcessContext& context;
     kj::Maybe<kj::Exception> exception;
@@ -1023,27 +1240,229 @@ private:
         SegmentArrayMessageReader message(segments, options);
         return writeConversion(message.getRoot<AnyStruct>(), output);
       }
-      case Format::TEXT: {
-        auto text = readOneText(input);
-        MallocMessageBuilder message;
-        TextCodec codec;
-        codec.setPrettyPrint(pretty);
-        auto root = message.initRoot<DynamicStruct>(rootType);
-        codec.decode(text, root);
-        return writeConversion(root.asReader(), output);
+      case Format::TEXT:
+        return convertText(readOneText(input), output);
+      case Format::JSON:
+        return convertJson(readOneJson(input), output);
+    }
+
+    KJ_UNREACHABLE;
+  }
+
+  void convertText(kj::StringPtr text, kj::OutputStream& output) {
+    MallocMessageBuilder message;
+    TextCodec codec;
+    codec.setPrettyPrint(pretty);
+    auto root = message.initRoot<DynamicStruct>(rootType);
+    codec.decode(text, root);
+    writeConversion(root.asReader(), output);
+  }
+
+  void convertJson(kj::StringPtr text, kj::OutputStream& output) {
+    MallocMessageBuilder message;
+    JsonCodec codec;
+    codec.setPrettyPrint(pretty);
+    auto root = message.initRoot<DynamicStruct>(rootType);
+    codec.decode(text, root);
+    writeConversion(root.asReader(), output);
+  }
+
+  // -----------------------------------------------------------------
+  // Parallel conversion
+  //
+  // The input is split into messages on this thread, without parsing them: binary and packed
+  // messages are just read according to their segment tables, and text and JSON messages are
+  // delimited the same way readOneAndConvert() does. A kj::WorkerPool of `jobs` threads converts
+  // messages while this thread keeps reading more and writes out converted messages in input
+  // order.
+
+  struct ConvertJob final: public kj::WorkerPool::Job {
+    CompilerMain& main;
+
+    kj::Array<word> frame;
+    // A whole message in standard serialization format, for binary or packed input.
+
+    kj::String text;
+    // For text or JSON input.
+
+    kj::Own<kj::VectorOutputStream> output;
+    kj::Maybe<kj::Exception> error;
+    // The converted message, and the recoverable error to report after it, if any.
+
+    kj::Maybe<kj::Exception> fatalError;
+    // If conversion failed outright. Thrown once the output before it has been written.
+
+    size_t inputBytes = 0;
+
+    explicit ConvertJob(CompilerMain& main): main(main) {}
+    void run() override { main.convertOne(*this); }
+  };
+
+  static constexpr size_t MAX_QUEUED_BYTES = 64u << 20;
+
+  kj::Array<word> readOneFrame(kj::InputStream& input) {
+    // Reads one message in standard serialization format, including its segment table, without
+    // parsing it.
+
+    _::WireValue<uint32_t> firstWord[2];
+    input.read(firstWord, sizeof(firstWord));
+
+    uint segmentCount = firstWord[0].get() + 1;
+    KJ_REQUIRE(segmentCount > 0 && segmentCount < 512, "Message has too many segments.") {
+      // Recover like InputStreamMessageReader does.
+      segmentCount = 1;
+      firstWord[0].set(0);
+      firstWord[1].set(1);
+      break;
+    }
+
+    // The segment table is padded to a whole number of words.
+    auto table = kj::heapArray<_::WireValue<uint32_t>>((segmentCount & ~1) + 2);
+    table[0] = firstWord[0];
+    table[1] = firstWord[1];
+    if (segmentCount > 1) {
+      input.read(table.begin() + 2, (table.size() - 2) * sizeof(table[0]));
+    }
+
+    size_t totalWords = 0;
+    for (uint i = 0; i < segmentCount; i++) {
+      totalWords += table[i + 1].get();
+    }
+
+    auto tableWords = table.size() / 2;
+    auto frame = kj::heapArray<word>(tableWords + totalWords);
+    memcpy(frame.asBytes().begin(), table.begin(), tableWords * sizeof(word));
+    input.read(frame.begin() + tableWords, totalWords * sizeof(word));
+    return frame;
+  }
+
+  kj::Maybe<kj::Own<ConvertJob>> readConvertJob(kj::BufferedInputStreamWrapper& input,
+                                                kj::Maybe<kj::Exception>& readError) {
+    // As in readOneAndConvert(), a recoverable error while reading a message is reported after
+    // that message. If reading fails outright, returns null and sets `readError` so that it can
+    // be thrown once the messages before it have been written.
+
+    auto job = kj::heap<ConvertJob>(*this);
+    readError = kj::runCatchingExceptions([&]() {
+      ParseErrorCatcher parseErrorCatcher(context);
+      KJ_DEFER(job->error = parseErrorCatcher.releaseException());
+
+      switch (convertFrom) {
+        case Format::BINARY:
+          job->frame = readOneFrame(input);
+          job->inputBytes = job->frame.asBytes().size();
+          break;
+        case Format::PACKED: {
+          capnp::_::PackedInputStream unpacker(input);
+          job->frame = readOneFrame(unpacker);
+          job->inputBytes = job->frame.asBytes().size();
+          break;
+        }
+        case Format::TEXT:
+          job->text = readOneText(input);
+          job->inputBytes = job->text.size();
+          break;
+        case Format::JSON:
+          job->text = readOneJson(input);
+          job->inputBytes = job->text.size();
+          break;
+        case Format::FLAT:
+        case Format::FLAT_PACKED:
+        case Format::CANONICAL:
+          KJ_UNREACHABLE;
       }
-      case Format::JSON: {
-        auto text = readOneJson(input);
-        MallocMessageBuilder message;
-        JsonCodec codec;
-        codec.setPrettyPrint(pretty);
-        auto root = message.initRoot<DynamicStruct>(rootType);
-        codec.decode(text, root);
-        return writeConversion(root.asReader(), output);
+    });
+
+    if (readError == nullptr) {
+      return kj::mv(job);
+    } else {
+      return nullptr;
+    }
+  }
+
+  void convertOne(ConvertJob& job) {
+    // Runs on a worker thread. Mirrors readOneAndConvert().
+
+    ReaderOptions options;
+    options.nestingLimit = kj::maxValue;
+    options.traversalLimitInWords = kj::maxValue;
+
+    job.output = kj::heap<kj::VectorOutputStream>();
+
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      ParseErrorCatcher parseErrorCatcher(context);
+
+      switch (convertFrom) {
+        case Format::BINARY:
+        case Format::PACKED: {
+          FlatArrayMessageReader message(job.frame, options);
+          writeConversion(message.getRoot<AnyStruct>(), *job.output);
+          break;
+        }
+        case Format::TEXT:
+          convertText(job.text, *job.output);
+          break;
+        case Format::JSON:
+          convertJson(job.text, *job.output);
+          break;
+        case Format::FLAT:
+        case Format::FLAT_PACKED:
+        case Format::CANONICAL:
+          KJ_UNREACHABLE;
+      }
+
+      auto error = parseErrorCatcher.releaseException();
+      if (job.error == nullptr) {
+        job.error = kj::mv(error);
       }
+    })) {
+      job.fatalError = kj::mv(*exception);
     }
+  }
 
-    KJ_UNREACHABLE;
+  void convertInParallel(kj::BufferedInputStreamWrapper& input, kj::OutputStream& output) {
+    std::deque<kj::Own<ConvertJob>> inOrder;
+    // Jobs read but not yet written out, in input order. Only touched by this thread, but workers
+    // may be converting any of them, so it must outlive the pool.
+
+    kj::WorkerPool pool(jobs);
+
+    kj::Maybe<kj::Exception> readError;
+    size_t queuedBytes = 0;
+
+    for (;;) {
+      // Read ahead as far as the limits allow, so that the workers stay busy while we wait for
+      // the oldest message.
+      while (readError == nullptr && inOrder.size() < jobs * 64 &&
+             queuedBytes < MAX_QUEUED_BYTES && input.tryGetReadBuffer().size() > 0) {
+        auto maybeJob = readConvertJob(input, readError);
+        KJ_IF_MAYBE(job, maybeJob) {
+          queuedBytes += job->get()->inputBytes;
+          pool.submit(**job);
+          inOrder.push_back(kj::mv(*job));
+        }
+      }
+
+      if (inOrder.empty()) break;
+
+      auto job = kj::mv(inOrder.front());
+      inOrder.pop_front();
+      pool.wait(*job);
+      queuedBytes -= job->inputBytes;
+
+      output.write(job->output->getArray().begin(), job->output->getArray().size());
+      KJ_IF_MAYBE(e, job->error) {
+        ParseErrorCatcher::report(context, *e);
+      }
+      KJ_IF_MAYBE(e, job->fatalError) {
+        kj::throwFatalException(kj::mv(*e));
+      }
+      ++messagesConverted;
+    }
+
+    KJ_IF_MAYBE(e, readError) {
+      kj::throwFatalException(kj::mv(*e));
+    }
   }
 
   void writeConversion(AnyStruct::Reader reader, kj::OutputStream& output) {
@@ -1720,6 +2139,348 @@ public:
     KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
   }
 
+public:
+  // =====================================================================================
+  // "profile" command
+
+  kj::MainBuilder::Validity profile() {
+    ReaderOptions options;
+    options.nestingLimit = kj::maxValue;
+    options.traversalLimitInWords = kj::maxValue;
+
+    kj::FdInputStream rawInput(STDIN_FILENO);
+    kj::BufferedInputStreamWrapper input(rawInput);
+    MessageProfiler profiler;
+
+    switch (formatFromDeprecatedFlags(Format::BINARY)) {
+      case Format::BINARY:
+        while (input.tryGetReadBuffer().size() > 0) {
+          InputStreamMessageReader message(input, options);
+          profiler.add(message, rootType);
+        }
+        break;
+      case Format::PACKED:
+        while (input.tryGetReadBuffer().size() > 0) {
+          PackedMessageReader message(input, options);
+          profiler.add(message, rootType);
+        }
+        break;
+      case Format::FLAT: {
+        auto allBytes = readAll(input);
+        auto words = kj::heapArray<word>(allBytes.size() / sizeof(word));
+        memcpy(words.begin(), allBytes.begin(), words.size() * sizeof(word));
+        kj::ArrayPtr<const word> segments[1] = { words };
+        SegmentArrayMessageReader message(segments, options);
+        profiler.add(message, rootType);
+        break;
+      }
+      case Format::FLAT_PACKED: {
+        auto allBytes = readAll(input);
+        auto words = kj::heapArray<word>(computeUnpackedSizeInWords(allBytes));
+        kj::ArrayInputStream packedInput(allBytes);
+        capnp::_::PackedInputStream unpacker(packedInput);
+        unpacker.read(words.asBytes().begin(), words.asBytes().size());
+        kj::ArrayPtr<const word> segments[1] = { words };
+        SegmentArrayMessageReader message(segments, options);
+        profiler.add(message, rootType);
+        break;
+      }
+      default:
+        KJ_UNREACHABLE;
+    }
+
+    auto report = kj::str(profiler.getProfile(), '\n');
+    kj::FdOutputStream(STDOUT_FILENO).write(report.begin(), report.size());
+    context.exit();
+    KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
+  }
+
+  // =====================================================================================
+  // "bench" command
+
+  kj::MainBuilder::Validity setBenchFormat(kj::StringPtr name) {
+    KJ_IF_MAYBE(f, parseFormatName(name)) {
+      convertFrom = *f;
+      return true;
+    } else {
+      return kj::str("unknown format: ", name);
+    }
+  }
+
+  kj::MainBuilder::Validity setBenchIterations(kj::StringPtr arg) {
+    char* end;
+    benchIterations = strtoull(arg.cStr(), &end, 0);
+    if (arg.size() == 0 || *end != '\0' || benchIterations == 0) {
+      return "not a positive integer";
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setBenchTime(kj::StringPtr arg) {
+    char* end;
+    benchSeconds = strtod(arg.cStr(), &end);
+    if (arg.size() == 0 || *end != '\0' || !(benchSeconds > 0)) {
+      return "not a positive number";
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setBenchOnly(kj::StringPtr arg) {
+    static const char* const BENCHMARK_NAMES[] = {
+      "build", "serialize", "pack", "unpack", "parse", "traverse",
+      "canonicalize", "json-encode", "json-decode"
+    };
+
+    kj::StringPtr rest = arg;
+    for (;;) {
+      kj::String name;
+      KJ_IF_MAYBE(comma, rest.findFirst(',')) {
+        name = kj::heapString(rest.slice(0, *comma));
+        rest = rest.slice(*comma + 1);
+      } else {
+        name = kj::heapString(rest);
+        rest = nullptr;
+      }
+
+      bool known = false;
+      for (auto benchmark: BENCHMARK_NAMES) {
+        if (name == kj::StringPtr(benchmark)) known = true;
+      }
+      if (!known) {
+        return kj::str("unknown benchmark: ", name);
+      }
+      benchOnly.add(kj::mv(name));
+
+      if (rest == nullptr) break;
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setBenchJson() {
+    benchJson = true;
+    return true;
+  }
+
+  kj::MainBuilder::Validity bench() {
+    // Get the sample into a builder by way of the binary format.
+    convertTo = Format::BINARY;
+    kj::VectorOutputStream sampleBytes;
+    {
+      kj::FdInputStream rawInput(STDIN_FILENO);
+      kj::BufferedInputStreamWrapper input(rawInput);
+      if (input.tryGetReadBuffer().size() == 0) {
+        return "no sample message on stdin";
+      }
+      readOneAndConvert(input, sampleBytes);
+    }
+    auto sampleWords = kj::heapArray<word>(sampleBytes.getArray().size() / sizeof(word));
+    memcpy(sampleWords.begin(), sampleBytes.getArray().begin(), sampleWords.asBytes().size());
+
+    ReaderOptions options;
+    options.nestingLimit = kj::maxValue;
+    options.traversalLimitInWords = kj::maxValue;
+
+    MallocMessageBuilder sample;
+    {
+      FlatArrayMessageReader reader(sampleWords, options);
+      sample.setRoot(reader.getRoot<AnyStruct>());
+    }
+
+    // Prepare the inputs of the benchmarks which read something.
+    auto flat = messageToFlatArray(sample);
+    kj::VectorOutputStream packedStream;
+    writePackedMessage(packedStream, sample);
+    auto packed = packedStream.getArray();
+    FlatArrayMessageReader flatReader(flat, options);
+    auto root = flatReader.getRoot<AnyStruct>();
+    auto dynamicRoot = flatReader.getRoot<DynamicStruct>(rootType);
+    JsonCodec json;
+    auto jsonText = json.encode(dynamicRoot);
+
+    size_t messageBytes = flat.asBytes().size();
+    if (!benchJson) {
+      context.warning(kj::str(
+          "message: ", messageBytes, " bytes, ", sample.getSegmentsForOutput().size(),
+          " segment(s); ", packed.size(), " bytes packed; ", jsonText.size(), " bytes of JSON"));
+      context.warning(kj::str(
+          padRight("benchmark", 14), padLeft("iterations", 12), padLeft("mean ns", 12),
+          padLeft("p50 ns", 12), padLeft("p90 ns", 12), padLeft("p99 ns", 12),
+          padLeft("max ns", 12), padLeft("ops/s", 12), padLeft("MB/s", 10)));
+    }
+
+    auto run = [&](kj::StringPtr name, kj::Function<uint64_t()> op) {
+      if (benchOnly.size() > 0) {
+        bool selected = false;
+        for (auto& only: benchOnly) {
+          if (only == name) selected = true;
+        }
+        if (!selected) return;
+      }
+      printBenchResult(runBenchmark(name, kj::mv(op)), messageBytes);
+    };
+
+    run("build", [&]() -> uint64_t {
+      MallocMessageBuilder message;
+      message.setRoot(root);
+      return message.getSegmentsForOutput().size();
+    });
+    run("serialize", [&]() -> uint64_t {
+      return messageToFlatArray(sample).size();
+    });
+    run("pack", [&]() -> uint64_t {
+      kj::VectorOutputStream output(packed.size());
+      writePackedMessage(output, sample);
+      return output.getArray().size();
+    });
+    run("unpack", [&]() -> uint64_t {
+      kj::ArrayInputStream input(packed);
+      PackedMessageReader message(input, options);
+      return message.getRoot<AnyStruct>().getDataSection().size();
+    });
+    run("parse", [&]() -> uint64_t {
+      FlatArrayMessageReader message(flat, options);
+      return message.getRoot<AnyStruct>().getDataSection().size();
+    });
+    run("traverse", [&]() -> uint64_t {
+      return traverse(dynamicRoot);
+    });
+    run("canonicalize", [&]() -> uint64_t {
+      return root.canonicalize().size();
+    });
+    run("json-encode", [&]() -> uint64_t {
+      return json.encode(dynamicRoot).size();
+    });
+    run("json-decode", [&]() -> uint64_t {
+      MallocMessageBuilder message;
+      auto decoded = message.initRoot<DynamicStruct>(rootType);
+      json.decode(jsonText, decoded);
+      return message.getSegmentsForOutput().size();
+    });
+
+    context.exit();
+    KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
+  }
+
+private:
+  struct BenchResult {
+    kj::StringPtr name;
+    uint64_t iterations;
+    double meanNs;
+    double p50Ns;
+    double p90Ns;
+    double p99Ns;
+    double maxNs;
+  };
+
+  BenchResult runBenchmark(kj::StringPtr name, kj::Function<uint64_t()> op) {
+    typedef std::chrono::steady_clock Clock;
+    auto nanosSince = [](Clock::time_point start) {
+      return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    };
+
+    // Warm up for about 10ms, which also tells us roughly how long an operation takes.
+    uint64_t warmupOps = 0;
+    auto warmupStart = Clock::now();
+    do {
+      benchSink += op();
+      ++warmupOps;
+    } while (nanosSince(warmupStart) < 1e7);
+    double estimateNs = nanosSince(warmupStart) / warmupOps;
+
+    uint64_t batchSize = estimateNs >= 1000 ? 1 : uint64_t(1000 / kj::max(estimateNs, 1.0));
+
+    kj::Vector<double> samples;
+    uint64_t ops = 0;
+    double totalNs = 0;
+    for (;;) {
+      uint64_t n = benchIterations == 0 ? batchSize : kj::min(batchSize, benchIterations - ops);
+      auto start = Clock::now();
+      for (uint64_t i = 0; i < n; i++) {
+        benchSink += op();
+      }
+      double ns = nanosSince(start);
+
+      samples.add(ns / n);
+      ops += n;
+      totalNs += ns;
+      if (benchIterations == 0 ? totalNs >= benchSeconds * 1e9 : ops >= benchIterations) break;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+      return samples[kj::min(samples.size() - 1, size_t(samples.size() * p))];
+    };
+
+    return { name, ops, totalNs / ops, percentile(0.5), percentile(0.9), percentile(0.99),
+             samples.back() };
+  }
+
+  void printBenchResult(const BenchResult& result, size_t messageBytes) {
+    double opsPerSecond = 1e9 / result.meanNs;
+    auto round = [](double value) { return uint64_t(value + 0.5); };
+
+    if (benchJson) {
+      auto line = kj::str(
+          "{\"benchmark\":\"", result.name, "\",\"iterations\":", result.iterations,
+          ",\"messageBytes\":", messageBytes,
+          ",\"meanNs\":", round(result.meanNs), ",\"p50Ns\":", round(result.p50Ns),
+          ",\"p90Ns\":", round(result.p90Ns), ",\"p99Ns\":", round(result.p99Ns),
+          ",\"maxNs\":", round(result.maxNs), ",\"opsPerSec\":", round(opsPerSecond),
+          ",\"bytesPerSec\":", round(opsPerSecond * messageBytes), "}\n");
+      kj::FdOutputStream(STDOUT_FILENO).write(line.begin(), line.size());
+    } else {
+      uint64_t tenthsOfMBPerSecond = round(opsPerSecond * messageBytes / 1e5);
+      context.warning(kj::str(
+          padRight(result.name, 14), padLeft(kj::str(result.iterations), 12),
+          padLeft(kj::str(round(result.meanNs)), 12), padLeft(kj::str(round(result.p50Ns)), 12),
+          padLeft(kj::str(round(result.p90Ns)), 12), padLeft(kj::str(round(result.p99Ns)), 12),
+          padLeft(kj::str(round(result.maxNs)), 12), padLeft(kj::str(round(opsPerSecond)), 12),
+          padLeft(kj::str(tenthsOfMBPerSecond / 10, '.', tenthsOfMBPerSecond % 10), 10)));
+    }
+  }
+
+  static kj::String padLeft(kj::StringPtr text, size_t width) {
+    return kj::str(kj::repeat(' ', width - kj::min(width, text.size())), text);
+  }
+  static kj::String padRight(kj::StringPtr text, size_t width) {
+    return kj::str(text, kj::repeat(' ', width - kj::min(width, text.size())));
+  }
+
+  static uint64_t traverse(DynamicStruct::Reader reader) {
+    // Reads every field (and the active union member), returning a count so that nothing can be
+    // optimized away. Null pointers are skipped, since following them would just walk their
+    // defaults, which for recursive types never ends.
+
+    uint64_t count = 0;
+    KJ_IF_MAYBE(field, reader.which()) {
+      if (reader.has(*field)) count += traverse(reader.get(*field));
+    }
+    for (auto field: reader.getSchema().getNonUnionFields()) {
+      if (reader.has(field)) count += traverse(reader.get(field));
+    }
+    return count;
+  }
+
+  static uint64_t traverse(DynamicValue::Reader value) {
+    switch (value.getType()) {
+      case DynamicValue::STRUCT:
+        return traverse(value.as<DynamicStruct>());
+      case DynamicValue::LIST: {
+        uint64_t count = 1;
+        for (auto element: value.as<DynamicList>()) {
+          count += traverse(element);
+        }
+        return count;
+      }
+      case DynamicValue::TEXT:
+        return value.as<Text>().size();
+      case DynamicValue::DATA:
+        return value.as<Data>().size();
+      default:
+        return 1;
+    }
+  }
+
 public:
   // =====================================================================================
 
@@ -1790,6 +2551,18 @@ private:
   Format convertTo = Format::BINARY;
   // For the "convert" command.
 
+  bool stats = false;
+  uint64_t messagesConverted = 0;
+  // For the "convert" and "decode" commands.
+
+  uint64_t benchIterations = 0;
+  double benchSeconds = 1;
+  kj::Vector<kj::String> benchOnly;
+  bool benchJson = false;
+  uint64_t benchSink = 0;
+  // For the "bench" command. Benchmark results are added to `benchSink` so that they can't be
+  // optimized away.
+
   bool binary = false;
   bool flat = false;
   bool packed = false;
@@ -1807,6 +2580,13 @@ private:
 
   kj::Vector<SourceFile> sourceFiles;
 
+  kj::Vector<Module*> pendingSources;
+  kj::Maybe<kj::Own<const kj::Directory>> cacheDir;
+  // For the "compile" command.
+
+  uint jobs = kj::max(std::thread::hardware_concurrency(), 1u);
+  // Number of threads to use. For the "compile", "convert", and "decode" commands.
+
   struct OutputDirective {
     kj::ArrayPtr<const char> name;
     kj::Maybe<kj::Path> dir;
@@ -61,6 +61,8 @@ namespace {
 
 static constexpr uint64_t NAMESPACE_ANNOTATION_ID = 0xb9c6f99ebf805f2cull;
 static constexpr uint64_t NAME_ANNOTATION_ID = 0xf264a779fef191ceull;
+static constexpr uint64_t SPLIT_HEADERS_ANNOTATION_ID = 0xe00cb5e3e75b6a4eull;
+static constexpr uint64_t LITE_ANNOTATION_ID = 0xdd8fa67392d824eaull;
 
 bool hasDiscriminantValue(const schema::Field::Reader& reader) {
   return reader.getDiscriminantValue() != schema::Field::NO_DISCRIMINANT;
@@ -359,6 +361,18 @@ private:
   std::unordered_set<uint64_t> usedImports;
   bool hasInterfaces = false;
 
+  bool liteMode = false;
+  // True while generating a file annotated with $Cxx.lite.
+
+  std::unordered_set<uint64_t> usedSchemaBlobs;
+  // IDs of nodes whose encoded schema is referenced by a default value or constant. In lite mode,
+  // only these nodes' schemas are emitted.
+
+  uint64_t currentFileId = 0;
+  std::unordered_set<uint64_t> usedTopLevelNodes;
+  // Top-level nodes of the file being generated which have been referenced by name. Only used
+  // with $Cxx.splitHeaders, to work out which headers each top-level node's header must include.
+
   CppTypeName cppFullName(Schema schema, kj::Maybe<InterfaceSchema::Method> method) {
     return cppFullName(schema, schema, method);
   }
@@ -381,6 +395,9 @@ private:
 
       // Figure out what name to use.
       Schema parent = schemaLoader.get(node.getScopeId());
+      if (parent.getProto().getId() == currentFileId) {
+        usedTopLevelNodes.insert(node.getId());
+      }
       kj::StringPtr unqualifiedName;
       kj::String ownUnqualifiedName;
       KJ_IF_MAYBE(annotatedName, annotationValue(node, NAME_ANNOTATION_ID)) {
@@ -1561,6 +1578,7 @@ private:
       kj::String defaultParam = defaultOffset == 0 ? kj::str() : kj::str(
           ",\n        ::capnp::schemas::bp_", kj::hex(typeId), " + ", defaultOffset,
           defaultSize == 0 ? kj::strTree() : kj::strTree(", ", defaultSize));
+      if (defaultOffset != 0) usedSchemaBlobs.insert(typeId);
 
       bool shouldIncludeStructInit =
           kind == FieldKind::STRUCT || kind == FieldKind::BRAND_PARAMETER;
@@ -2718,10 +2736,6 @@ private:
         makeBrandDepMap(templateContext, schema.getGeneric()));
 
     auto schemaDef = kj::strTree(
-        "static const ::capnp::_::AlignedData<", rawSchema.size(), "> b_", hexId, " = {\n"
-        "  {", kj::mv(schemaLiteral), " }\n"
-        "};\n"
-        "::capnp::word const* const bp_", hexId, " = b_", hexId, ".words;\n"
         "#if !CAPNP_LITE\n",
         deps.size() == 0 ? kj::strTree() : kj::strTree(
             "static const ::capnp::_::RawSchema* const d_", hexId, "[] = {\n",
@@ -2758,6 +2772,14 @@ private:
         KJ_MAP(n, nestedTexts) { return kj::mv(n.outerTypeDecl); },
         templateContext);
 
+    // Only now do we know whether a default value or constant refers to the encoded schema.
+    auto schemaBlobDef = liteMode && usedSchemaBlobs.count(proto.getId()) == 0 ? kj::strTree() :
+        kj::strTree(
+        "static const ::capnp::_::AlignedData<", rawSchema.size(), "> b_", hexId, " = {\n"
+        "  {", kj::mv(schemaLiteral), " }\n"
+        "};\n"
+        "::capnp::word const* const bp_", hexId, " = b_", hexId, ".words;\n");
+
     NodeText result = {
       kj::mv(top.outerTypeDecl),
 
@@ -2779,6 +2801,7 @@ private:
           KJ_MAP(n, nestedTexts) { return kj::mv(n.capnpSchemaDecls); }),
 
       kj::strTree(
+          kj::mv(schemaBlobDef),
           kj::mv(schemaDef),
           kj::mv(top.capnpSchemaDefs),
           KJ_MAP(n, nestedTexts) { return kj::mv(n.capnpSchemaDefs); }),
@@ -2853,9 +2876,10 @@ private:
                 return kj::strTree("  ", toUpperCase(protoName(e.getProto())), ",\n");
               },
               "};\n"
-              "CAPNP_DECLARE_ENUM(", name, ", ", hexId, ");\n"),
+              "CAPNP_DECLARE_", liteMode ? "LITE_" : "", "ENUM(", name, ", ", hexId, ");\n"),
           kj::strTree(
-              "CAPNP_DEFINE_ENUM(", name, "_", hexId, ", ", hexId, ");\n"),
+              "CAPNP_DEFINE_", liteMode ? "LITE_" : "", "ENUM(", name, "_", hexId, ", ", hexId,
+              ");\n"),
 
           kj::strTree(),
         };
@@ -2883,6 +2907,7 @@ private:
 
       case schema::Node::CONST: {
         auto constText = makeConstText(scope, name, schema.asConst(), templateContext);
+        if (constText.needsSchema) usedSchemaBlobs.insert(proto.getId());
 
         return NodeText {
           scope.size() == 0 ? kj::strTree() : kj::strTree("  ", kj::mv(constText.decl)),
@@ -2917,9 +2942,18 @@ private:
 
   // -----------------------------------------------------------------
 
+  struct ExtraHeader {
+    kj::String suffix;
+    // Appended to the schema file's name to form the header's name.
+
+    kj::StringTree text;
+  };
+
   struct FileText {
     kj::StringTree header;
     kj::StringTree source;
+    kj::Vector<ExtraHeader> extraHeaders;
+    // Only with $Cxx.splitHeaders.
   };
 
   FileText makeFileText(Schema schema,
@@ -2956,10 +2990,24 @@ private:
       }
     }
 
+    bool splitHeaders = annotationValue(node, SPLIT_HEADERS_ANNOTATION_ID) != nullptr;
+    liteMode = annotationValue(node, LITE_ANNOTATION_ID) != nullptr;
+    usedSchemaBlobs.clear();
+    currentFileId = node.getId();
+    kj::Vector<kj::Array<uint64_t>> nodeDeps;
+
     auto nodeTexts = KJ_MAP(nested, node.getNestedNodes()) {
-      return makeNodeText(namespacePrefix, "", nested.getName(),
-                          schemaLoader.getUnbound(nested.getId()), TemplateContext());
+      usedTopLevelNodes.clear();
+      auto text = makeNodeText(namespacePrefix, "", nested.getName(),
+                               schemaLoader.getUnbound(nested.getId()), TemplateContext());
+      kj::Vector<uint64_t> deps(usedTopLevelNodes.size());
+      for (auto id: usedTopLevelNodes) {
+        if (id != nested.getId()) deps.add(id);
+      }
+      nodeDeps.add(deps.releaseAsArray());
+      return text;
     };
+    currentFileId = 0;
 
     kj::String separator = kj::str("// ", kj::repeat('=', 87), "\n");
 
@@ -2973,8 +3021,14 @@ private:
     kj::StringTree sourceDefs = kj::strTree(
         KJ_MAP(n, nodeTexts) { return kj::mv(n.sourceFileDefs); });
 
-    return FileText {
-      kj::strTree(
+    kj::Vector<ExtraHeader> extraHeaders;
+    if (splitHeaders) {
+      // Move the readers, builders, and inline methods out of `nodeTexts` first. What remains of
+      // the header below then only declares things, and becomes the base header.
+      extraHeaders = makeSplitHeaders(node, namespaceParts.asPtr(), nodeTexts, nodeDeps.asPtr());
+    }
+
+    auto header = kj::strTree(
           "// Generated by Cap'n Proto compiler, DO NOT EDIT\n"
           "// source: ", baseName(displayName), "\n"
           "\n"
@@ -3015,25 +3069,226 @@ private:
           KJ_MAP(n, nodeTexts) { return kj::mv(n.readerBuilderDefs); },
           separator, "\n",
           KJ_MAP(n, nodeTexts) { return kj::mv(n.inlineMethodDefs); },
-          KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n"),
+          KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n");
 
-      kj::strTree(
+    if (splitHeaders) {
+      // The main header just includes everything.
+      auto mainHeader = kj::strTree(
           "// Generated by Cap'n Proto compiler, DO NOT EDIT\n"
           "// source: ", baseName(displayName), "\n"
           "\n"
-          "#include \"", baseName(displayName), ".h\"\n"
+          "#pragma once\n"
           "\n"
-          "namespace capnp {\n"
-          "namespace schemas {\n",
-          KJ_MAP(n, nodeTexts) { return kj::mv(n.capnpSchemaDefs); },
-          "}  // namespace schemas\n"
-          "}  // namespace capnp\n",
-          sourceDefs.size() == 0 ? kj::strTree() : kj::strTree(
-              "\n", separator, "\n",
-              KJ_MAP(n, namespaceParts) { return kj::strTree("namespace ", n, " {\n"); }, "\n",
-              kj::mv(sourceDefs), "\n",
-              KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n"))
-    };
+          "#include \"", baseName(displayName), ".base.h\"\n",
+          KJ_MAP(h, extraHeaders) {
+            return kj::strTree("#include \"", baseName(displayName), h.suffix, "\"\n");
+          });
+      extraHeaders.add(ExtraHeader { kj::str(".base.h"), kj::mv(header) });
+      header = kj::mv(mainHeader);
+    }
+
+    auto source = kj::strTree(
+        "// Generated by Cap'n Proto compiler, DO NOT EDIT\n"
+        "// source: ", baseName(displayName), "\n"
+        "\n"
+        "#include \"", baseName(displayName), ".h\"\n"
+        "\n"
+        "namespace capnp {\n"
+        "namespace schemas {\n",
+        KJ_MAP(n, nodeTexts) { return kj::mv(n.capnpSchemaDefs); },
+        "}  // namespace schemas\n"
+        "}  // namespace capnp\n",
+        sourceDefs.size() == 0 ? kj::strTree() : kj::strTree(
+            "\n", separator, "\n",
+            KJ_MAP(n, namespaceParts) { return kj::strTree("namespace ", n, " {\n"); }, "\n",
+            kj::mv(sourceDefs), "\n",
+            KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n"));
+
+    if (liteMode) {
+      header = kj::strTree(removeNonLiteCode(header.flatten()));
+      source = kj::strTree(removeNonLiteCode(source.flatten()));
+      for (auto& extraHeader: extraHeaders) {
+        extraHeader.text = kj::strTree(removeNonLiteCode(extraHeader.text.flatten()));
+      }
+    }
+    liteMode = false;
+
+    return FileText { kj::mv(header), kj::mv(source), kj::mv(extraHeaders) };
+  }
+
+  static kj::String removeNonLiteCode(kj::StringPtr text) {
+    // Removes every `#if !CAPNP_LITE` section from the generated code, leaving exactly what a
+    // CAPNP_LITE build would compile, whatever mode the code is actually compiled in. We emit
+    // these sections ourselves, always with the directive on a line of its own, so it's enough
+    // to look at the lines. Anything this can't handle -- an `#else` or `#elif` for one of these
+    // sections, or CAPNP_LITE tested some other way -- is a bug in the code generator, so fail
+    // rather than emit code that a lite build wouldn't have compiled.
+
+    kj::Vector<char> result(text.size() + 1);
+    uint depth = 0;  // Nesting depth of conditionals within the section being removed.
+
+    const char* pos = text.begin();
+    while (pos < text.end()) {
+      const char* lineEnd = std::find(pos, text.end(), '\n');
+      if (lineEnd < text.end()) ++lineEnd;
+      kj::ArrayPtr<const char> line(pos, lineEnd);
+      pos = lineEnd;
+
+      const char* directive = line.begin();
+      while (directive < line.end() && *directive == ' ') ++directive;
+      auto startsWith = [&](kj::StringPtr prefix) {
+        return size_t(line.end() - directive) >= prefix.size() &&
+               memcmp(directive, prefix.begin(), prefix.size()) == 0;
+      };
+      auto mentionsLite = [&]() {
+        kj::StringPtr name = "CAPNP_LITE";
+        return std::search(directive, line.end(), name.begin(), name.end()) != line.end();
+      };
+
+      if (depth > 0) {
+        if (startsWith("#if")) {
+          ++depth;
+        } else if (startsWith("#endif")) {
+          --depth;
+        } else if (depth == 1 && (startsWith("#else") || startsWith("#elif"))) {
+          KJ_FAIL_ASSERT("can't remove non-lite code with an #else branch",
+                         kj::str(line.asChars()));
+        }
+      } else if (startsWith("#if !CAPNP_LITE\n")) {
+        depth = 1;
+      } else {
+        KJ_ASSERT(!startsWith("#") || !mentionsLite(),
+                  "unexpected CAPNP_LITE conditional in generated code", kj::str(line.asChars()));
+        result.addAll(line);
+      }
+    }
+
+    KJ_ASSERT(depth == 0, "unterminated #if !CAPNP_LITE in generated code");
+
+    result.add('\0');
+    return kj::String(result.releaseAsArray());
+  }
+
+  kj::Vector<ExtraHeader> makeSplitHeaders(
+      schema::Node::Reader file, kj::ArrayPtr<const kj::ArrayPtr<const char>> namespaceParts,
+      kj::ArrayPtr<NodeText> nodeTexts, kj::ArrayPtr<const kj::Array<uint64_t>> nodeDeps) {
+    // Moves the reader, builder, and inline method definitions of each top-level node out of
+    // `nodeTexts` and into a header of its own.
+    //
+    // Each node's header first includes the headers of its superclasses (see
+    // findSuperclassDeps()), then defines the node's readers and builders, then includes the
+    // headers of the other nodes it refers to, then defines its inline methods. Only the inline
+    // methods need other types to be complete, so this order works even when types refer to each
+    // other in a cycle: whichever header is included first, every reader and builder in the
+    // cycle is defined before any inline method is.
+
+    auto fileName = baseName(file.getDisplayName());
+    auto nested = file.getNestedNodes();
+
+    std::unordered_map<uint64_t, kj::String> suffixes;
+    for (auto i: kj::indices(nodeTexts)) {
+      if (nodeTexts[i].readerBuilderDefs.size() == 0 &&
+          nodeTexts[i].inlineMethodDefs.size() == 0) {
+        // Nothing to split out (e.g. an enum or a primitive constant).
+        continue;
+      }
+      auto proto = schemaLoader.getUnbound(nested[i].getId()).getProto();
+      kj::StringPtr name = nested[i].getName();
+      KJ_IF_MAYBE(annotatedName, annotationValue(proto, NAME_ANNOTATION_ID)) {
+        name = annotatedName->getText();
+      }
+      suffixes.insert(std::make_pair(proto.getId(), kj::str("-", name, ".h")));
+    }
+
+    auto openNamespace = kj::strTree(
+        KJ_MAP(n, namespaceParts) { return kj::strTree("namespace ", n, " {\n"); }, "\n");
+    auto closeNamespace = kj::strTree(
+        KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n");
+    auto prelude = kj::strTree(
+        "// Generated by Cap'n Proto compiler, DO NOT EDIT\n"
+        "// source: ", fileName, "\n"
+        "\n"
+        "#pragma once\n"
+        "\n"
+        "#include \"", fileName, ".base.h\"\n");
+
+    kj::Vector<ExtraHeader> result;
+
+    for (auto i: kj::indices(nodeTexts)) {
+      auto iter = suffixes.find(nested[i].getId());
+      if (iter == suffixes.end()) continue;
+
+      std::unordered_set<uint64_t> superclassDeps;
+      findSuperclassDeps(schemaLoader.getUnbound(nested[i].getId()), file.getId(),
+                         superclassDeps);
+      superclassDeps.erase(nested[i].getId());
+
+      kj::Vector<kj::String> earlyIncludes;
+      kj::Vector<kj::String> includes;
+      for (auto dep: nodeDeps[i]) {
+        auto depIter = suffixes.find(dep);
+        if (depIter != suffixes.end()) {
+          auto include = kj::str("#include \"", fileName, depIter->second, "\"\n");
+          if (superclassDeps.count(dep)) {
+            earlyIncludes.add(kj::mv(include));
+          } else {
+            includes.add(kj::mv(include));
+          }
+        }
+      }
+      // Make the output deterministic.
+      std::sort(earlyIncludes.begin(), earlyIncludes.end());
+      std::sort(includes.begin(), includes.end());
+
+      // A moved-from StringTree still reports its old size, so leave empty trees behind explicitly.
+      auto readerBuilderDefs = kj::mv(nodeTexts[i].readerBuilderDefs);
+      auto inlineMethodDefs = kj::mv(nodeTexts[i].inlineMethodDefs);
+      nodeTexts[i].readerBuilderDefs = kj::strTree();
+      nodeTexts[i].inlineMethodDefs = kj::strTree();
+
+      result.add(ExtraHeader { kj::str(iter->second), kj::strTree(
+          prelude.flatten(),
+          kj::strArray(earlyIncludes, ""),
+          "\n",
+          openNamespace.flatten(),
+          kj::mv(readerBuilderDefs),
+          closeNamespace.flatten(),
+          includes.size() == 0 ? kj::strTree() : kj::strTree(kj::strArray(includes, ""), "\n"),
+          openNamespace.flatten(),
+          kj::mv(inlineMethodDefs),
+          closeNamespace.flatten()) });
+    }
+
+    return result;
+  }
+
+  void findSuperclassDeps(Schema schema, uint64_t fileId, std::unordered_set<uint64_t>& deps) {
+    // Finds the top-level nodes of the file `fileId` which contain superclasses of any interface
+    // in `schema`'s scope. Client and Server classes derive from their superclasses' Client and
+    // Server classes, so those must be complete before the readers and builders are defined.
+    // Interfaces can't inherit in a cycle, so their headers can simply be included first.
+
+    auto proto = schema.getProto();
+    if (proto.isInterface()) {
+      for (auto superclass: schema.asInterface().getSuperclasses()) {
+        uint64_t id = superclass.getProto().getId();
+        for (;;) {
+          uint64_t scopeId = schemaLoader.get(id).getProto().getScopeId();
+          if (scopeId == fileId) {
+            deps.insert(id);
+            break;
+          } else if (scopeId == 0) {
+            // Declared in some other file, whose header is already included.
+            break;
+          }
+          id = scopeId;
+        }
+      }
+    }
+
+    for (auto nested: proto.getNestedNodes()) {
+      findSuperclassDeps(schemaLoader.getUnbound(nested.getId()), fileId, deps);
+    }
   }
 
   // -----------------------------------------------------------------
@@ -3054,11 +3309,25 @@ private:
     // At one point, in a fit of over-engineering, we used writable mmap() here. That turned out
     // to be a bad idea: writable mmap() is not implemented on some filesystems, especially shared
     // folders in VirtualBox. Oh well.
+    //
+    // If the file already has exactly the content we want, we leave it alone, so that its
+    // modification time doesn't change. Otherwise, build tools would recompile everything that
+    // includes it whenever any schema was recompiled, even if the output is the same.
 
     auto path = kj::Path::parse(filename);
+    auto content = text.flatten();
+
+    KJ_IF_MAYBE(existing, fs->getCurrent().tryOpenFile(path)) {
+      auto size = existing->get()->stat().size;
+      if (size == content.size() && (size == 0 ||
+          memcmp(existing->get()->mmap(0, size).begin(), content.begin(), size) == 0)) {
+        return;
+      }
+    }
+
     auto file = fs->getCurrent().openFile(path,
         kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT);
-    file->writeAll(text.flatten());
+    file->writeAll(content);
   }
 
   kj::MainBuilder::Validity run() {
@@ -3097,6 +3366,10 @@ private:
       auto fileText = makeFileText(schema, requestedFile);
 
       writeFile(kj::str(schema.getProto().getDisplayName(), ".h"), fileText.header);
+      for (auto& extraHeader: fileText.extraHeaders) {
+        writeFile(kj::str(schema.getProto().getDisplayName(), extraHeader.suffix),
+                  extraHeader.text);
+      }
       writeFile(kj::str(schema.getProto().getDisplayName(), ".c++"), fileText.source);
     }
 
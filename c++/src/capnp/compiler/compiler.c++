@@ -20,7 +20,7 @@
 // THE SOFTWARE.
 
 #include "compiler.h"
-#include "parser.h"      // only for generateChildId()
+#include "parser.h"      // only for generateChildId() and findImports()
 #include <kj/mutex.h>
 #include <kj/arena.h>
 #include <kj/vector.h>
@@ -1006,110 +1006,6 @@ kj::Maybe<kj::Array<const byte>> Compiler::CompiledModule::embedRelative(kj::Str
   return parserModule.embedRelative(embedPath);
 }
 
-static void findImports(Expression::Reader exp, std::set<kj::StringPtr>& output) {
-  switch (exp.which()) {
-    case Expression::UNKNOWN:
-    case Expression::POSITIVE_INT:
-    case Expression::NEGATIVE_INT:
-    case Expression::FLOAT:
-    case Expression::STRING:
-    case Expression::BINARY:
-    case Expression::RELATIVE_NAME:
-    case Expression::ABSOLUTE_NAME:
-    case Expression::EMBED:
-      break;
-
-    case Expression::IMPORT:
-      output.insert(exp.getImport().getValue());
-      break;
-
-    case Expression::LIST:
-      for (auto element: exp.getList()) {
-        findImports(element, output);
-      }
-      break;
-
-    case Expression::TUPLE:
-      for (auto element: exp.getTuple()) {
-        findImports(element.getValue(), output);
-      }
-      break;
-
-    case Expression::APPLICATION: {
-      auto app = exp.getApplication();
-      findImports(app.getFunction(), output);
-      for (auto param: app.getParams()) {
-        findImports(param.getValue(), output);
-      }
-      break;
-    }
-
-    case Expression::MEMBER: {
-      findImports(exp.getMember().getParent(), output);
-      break;
-    }
-  }
-}
-
-static void findImports(Declaration::Reader decl, std::set<kj::StringPtr>& output) {
-  switch (decl.which()) {
-    case Declaration::USING:
-      findImports(decl.getUsing().getTarget(), output);
-      break;
-    case Declaration::CONST:
-      findImports(decl.getConst().getType(), output);
-      break;
-    case Declaration::FIELD:
-      findImports(decl.getField().getType(), output);
-      break;
-    case Declaration::INTERFACE:
-      for (auto superclass: decl.getInterface().getSuperclasses()) {
-        findImports(superclass, output);
-      }
-      break;
-    case Declaration::METHOD: {
-      auto method = decl.getMethod();
-
-      auto params = method.getParams();
-      if (params.isNamedList()) {
-        for (auto param: params.getNamedList()) {
-          findImports(param.getType(), output);
-          for (auto ann: param.getAnnotations()) {
-            findImports(ann.getName(), output);
-          }
-        }
-      } else {
-        findImports(params.getType(), output);
-      }
-
-      if (method.getResults().isExplicit()) {
-        auto results = method.getResults().getExplicit();
-        if (results.isNamedList()) {
-          for (auto param: results.getNamedList()) {
-            findImports(param.getType(), output);
-            for (auto ann: param.getAnnotations()) {
-              findImports(ann.getName(), output);
-            }
-          }
-        } else {
-          findImports(results.getType(), output);
-        }
-      }
-      break;
-    }
-    default:
-      break;
-  }
-
-  for (auto ann: decl.getAnnotations()) {
-    findImports(ann.getName(), output);
-  }
-
-  for (auto nested: decl.getNestedDecls()) {
-    findImports(nested, output);
-  }
-}
-
 Orphan<List<schema::CodeGeneratorRequest::RequestedFile::Import>>
     Compiler::CompiledModule::getFileImportTable(Orphanage orphanage) {
   // Build a table of imports for CodeGeneratorRequest.RequestedFile.imports. Note that we only
@@ -0,0 +1,92 @@
+// Copyright (c) 2017 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "module-loader.h"
+#include <kj/test.h>
+
+namespace capnp {
+namespace compiler {
+namespace {
+
+class TestErrorReporter final: public GlobalErrorReporter {
+public:
+  void addError(const kj::ReadableDirectory& directory, kj::PathPtr path,
+                SourcePos start, SourcePos end, kj::StringPtr message) override {
+    KJ_FAIL_EXPECT("unexpected error", path, message);
+  }
+
+  bool hadErrors() override { return false; }
+};
+
+kj::Maybe<kj::Array<const byte>> getCached(const kj::ReadableDirectory& srcDir,
+                                           const kj::Directory& cacheDir, kj::StringPtr salt) {
+  // Each lookup uses a fresh loader, like a new run of the compiler would.
+  TestErrorReporter errorReporter;
+  ModuleLoader loader(errorReporter);
+  loader.setCacheDirectory(cacheDir);
+  Module* source = &KJ_ASSERT_NONNULL(loader.loadModule(srcDir, kj::Path("foo.capnp")));
+  return loader.getCachedOutput(kj::arrayPtr(&source, 1), salt);
+}
+
+KJ_TEST("compile output cache is keyed by salt and content") {
+  auto srcDir = kj::newInMemoryDirectory(kj::nullClock());
+  auto cacheDir = kj::newInMemoryDirectory(kj::nullClock());
+  srcDir->openFile(kj::Path("foo.capnp"), kj::WriteMode::CREATE)
+      ->writeAll("@0x84a2c6051e1061ed;\nstruct Foo {}\n");
+
+  {
+    TestErrorReporter errorReporter;
+    ModuleLoader loader(errorReporter);
+    loader.setCacheDirectory(*cacheDir);
+    Module* source = &KJ_ASSERT_NONNULL(loader.loadModule(*srcDir, kj::Path("foo.capnp")));
+    auto sources = kj::arrayPtr(&source, 1);
+    KJ_EXPECT(loader.getCachedOutput(sources, "one") == nullptr);
+    loader.putCachedOutput(sources, "one", "output one"_kj.asBytes());
+  }
+
+  KJ_EXPECT(kj::heapString(KJ_ASSERT_NONNULL(getCached(*srcDir, *cacheDir, "one")).asChars())
+            == "output one");
+  KJ_EXPECT(getCached(*srcDir, *cacheDir, "two") == nullptr);
+
+  {
+    // Another salt gets its own entry rather than replacing the first.
+    TestErrorReporter errorReporter;
+    ModuleLoader loader(errorReporter);
+    loader.setCacheDirectory(*cacheDir);
+    Module* source = &KJ_ASSERT_NONNULL(loader.loadModule(*srcDir, kj::Path("foo.capnp")));
+    loader.putCachedOutput(kj::arrayPtr(&source, 1), "two", "output two"_kj.asBytes());
+  }
+
+  KJ_EXPECT(kj::heapString(KJ_ASSERT_NONNULL(getCached(*srcDir, *cacheDir, "one")).asChars())
+            == "output one");
+  KJ_EXPECT(kj::heapString(KJ_ASSERT_NONNULL(getCached(*srcDir, *cacheDir, "two")).asChars())
+            == "output two");
+
+  srcDir->openFile(kj::Path("foo.capnp"), kj::WriteMode::MODIFY)
+      ->writeAll("@0x84a2c6051e1061ed;\nstruct Foo { bar @0 :Text; }\n");
+  KJ_EXPECT(getCached(*srcDir, *cacheDir, "one") == nullptr);
+  KJ_EXPECT(getCached(*srcDir, *cacheDir, "two") == nullptr);
+}
+
+}  // namespace
+}  // namespace compiler
+}  // namespace capnp
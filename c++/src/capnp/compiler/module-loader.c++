@@ -22,10 +22,13 @@
 #include "module-loader.h"
 #include "lexer.h"
 #include "parser.h"
+#include "type-id.h"
 #include <kj/vector.h>
 #include <kj/mutex.h>
 #include <kj/debug.h>
 #include <kj/io.h>
+#include <kj/thread.h>
+#include <kj/encoding.h>
 #include <capnp/message.h>
 #include <unordered_map>
 
@@ -107,6 +110,12 @@ struct FileKey {
   }
 };
 
+kj::String hashContent(kj::ArrayPtr<const byte> content) {
+  TypeIdGenerator hasher;
+  hasher.update(content);
+  return kj::encodeHex(hasher.finish());
+}
+
 struct FileKeyHash {
   size_t operator()(const FileKey& key) const {
     if (sizeof(size_t) < sizeof(key.hashCode)) {
@@ -137,10 +146,38 @@ public:
   kj::Maybe<kj::Array<const byte>> readEmbedFromSearchPath(kj::PathPtr path);
   GlobalErrorReporter& getErrorReporter() { return errorReporter; }
 
+  void preparse(uint threadCount);
+
+  void setCacheDirectory(const kj::Directory& dir) {
+    cacheDir = dir;
+    parsedFileCache = ParsedFileCache(dir);
+  }
+  kj::Maybe<const ParsedFileCache&> getParsedFileCache() {
+    KJ_IF_MAYBE(cache, parsedFileCache) {
+      return *cache;
+    } else {
+      return nullptr;
+    }
+  }
+  bool isCaching() { return cacheDir != nullptr; }
+
+  kj::Maybe<kj::Array<const byte>> getCachedOutput(
+      kj::ArrayPtr<Module* const> sources, kj::StringPtr salt);
+  void putCachedOutput(kj::ArrayPtr<Module* const> sources, kj::StringPtr salt,
+                       kj::ArrayPtr<const byte> output);
+
 private:
   GlobalErrorReporter& errorReporter;
   kj::Vector<const kj::ReadableDirectory*> searchPath;
   std::unordered_map<FileKey, kj::Own<Module>, FileKeyHash> modules;
+
+  kj::Maybe<const kj::Directory&> cacheDir;
+  kj::Maybe<ParsedFileCache> parsedFileCache;
+
+  kj::Path getCachedOutputPath(kj::ArrayPtr<Module* const> sources, kj::StringPtr salt);
+
+  kj::Vector<ModuleImpl*> allModules;
+  // Every module in `modules`, in the order loaded.
 };
 
 class ModuleLoader::ModuleImpl final: public Module {
@@ -161,34 +198,119 @@ public:
   }
 
   Orphan<ParsedFile> loadContent(Orphanage orphanage) override {
-    kj::Array<const char> content = file->mmap(0, file->stat().size).releaseAsChars();
+    contentLoaded = true;
+
+    KJ_IF_MAYBE(p, preparsed) {
+      auto result = orphanage.newOrphanCopy(p->get()->message.getRoot<ParsedFile>().asReader());
+
+      // Report errors now, as if we had only just parsed the file.
+      auto errors = kj::mv(p->get()->errors);
+      preparsed = nullptr;
+      for (auto& error: errors) {
+        if (error.onlyIfNoPriorErrors && hadErrors()) continue;
+        addError(error.startByte, error.endByte, error.message);
+      }
+      return result;
+    }
 
-    lineBreaks = nullptr;  // In case loadContent() is called multiple times.
-    lineBreaks = lineBreaksSpace.construct(content);
+    return parse(orphanage, *this);
+  }
 
-    MallocMessageBuilder lexedBuilder;
-    auto statements = lexedBuilder.initRoot<LexedStatements>();
-    lex(content, statements, *this);
+  bool shouldPreparse() {
+    return !contentLoaded && !preparseAttempted;
+  }
 
-    auto parsed = orphanage.newOrphan<ParsedFile>();
-    parseFile(statements.getStatements(), parsed.get(), *this);
-    return parsed;
+  void preparse() {
+    // Lexes and parses the file ahead of loadContent(), holding on to the result and any errors
+    // until then. This only touches the module's own state, so different modules can be
+    // preparsed on different threads at once.
+
+    preparseAttempted = true;
+    auto result = kj::heap<Preparsed>();
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      result->message.adoptRoot(parse(result->message.getOrphanage(), *result));
+      std::set<kj::StringPtr> importSet;
+      findImports(result->message.getRoot<ParsedFile>().getRoot(), importSet);
+      for (auto import: importSet) {
+        result->imports.add(kj::heapString(import));
+      }
+    })) {
+      // Leave it for loadContent() to try again and report the problem in the usual way.
+      return;
+    }
+    preparsed = kj::mv(result);
+  }
+
+  void loadPreparsedImports() {
+    // Loads (but does not parse) the modules imported by this one, so that they can be preparsed
+    // next. Must be called on the loader's thread.
+
+    KJ_IF_MAYBE(p, preparsed) {
+      for (auto& import: p->get()->imports) {
+        importRelative(import);
+      }
+    }
   }
 
   kj::Maybe<Module&> importRelative(kj::StringPtr importPath) override {
+    kj::Maybe<Module&> result;
     if (importPath.size() > 0 && importPath[0] == '/') {
-      return loader.loadModuleFromSearchPath(kj::Path::parse(importPath.slice(1)));
+      result = loader.loadModuleFromSearchPath(kj::Path::parse(importPath.slice(1)));
     } else {
-      return loader.loadModule(sourceDir, path.parent().eval(importPath));
+      result = loader.loadModule(sourceDir, path.parent().eval(importPath));
+    }
+
+    if (loader.isCaching() && !hasDependency(imports, importPath)) {
+      KJ_IF_MAYBE(module, result) {
+        imports.add(Import { kj::heapString(importPath), &kj::downcast<ModuleImpl>(*module) });
+      } else {
+        imports.add(Import { kj::heapString(importPath), nullptr });
+      }
     }
+
+    return result;
   }
 
   kj::Maybe<kj::Array<const byte>> embedRelative(kj::StringPtr embedPath) override {
+    kj::Maybe<kj::Array<const byte>> result;
     if (embedPath.size() > 0 && embedPath[0] == '/') {
-      return loader.readEmbedFromSearchPath(kj::Path::parse(embedPath.slice(1)));
+      result = loader.readEmbedFromSearchPath(kj::Path::parse(embedPath.slice(1)));
     } else {
-      return loader.readEmbed(sourceDir, path.parent().eval(embedPath));
+      result = loader.readEmbed(sourceDir, path.parent().eval(embedPath));
     }
+
+    if (loader.isCaching() && !hasDependency(embeds, embedPath)) {
+      KJ_IF_MAYBE(content, result) {
+        embeds.add(Embed { kj::heapString(embedPath), hashContent(*content) });
+      } else {
+        embeds.add(Embed { kj::heapString(embedPath), nullptr });
+      }
+    }
+
+    return result;
+  }
+
+  // The files this module has imported or embedded so far, recorded only if the loader has a
+  // cache directory. The compiler resolves everything it needs through importRelative() and
+  // embedRelative(), so once compilation finishes these describe everything the output depends
+  // on.
+
+  struct Import {
+    kj::String path;
+    ModuleImpl* module;  // null if not found
+  };
+  struct Embed {
+    kj::String path;
+    kj::String hash;  // null if not found
+  };
+  kj::Vector<Import> imports;
+  kj::Vector<Embed> embeds;
+
+  kj::StringPtr getContentHash() {
+    if (contentHash == nullptr) {
+      contentHash = hashContent(file->mmap(0, file->stat().size));
+    }
+    return contentHash;
   }
 
   void addError(uint32_t startByte, uint32_t endByte, kj::StringPtr message) override {
@@ -212,6 +334,72 @@ private:
 
   kj::SpaceFor<LineBreakTable> lineBreaksSpace;
   kj::Maybe<kj::Own<LineBreakTable>> lineBreaks;
+
+  class Preparsed final: public ErrorReporter {
+  public:
+    MallocMessageBuilder message;
+    kj::Vector<kj::String> imports;
+
+    struct Error {
+      uint32_t startByte;
+      uint32_t endByte;
+      kj::String message;
+
+      bool onlyIfNoPriorErrors;
+      // The parser asked hadErrors() before reporting this one, and would not have reported it
+      // had the answer been yes. That answer is about every file, not just this one, so we don't
+      // know it yet; loadContent() asks again when it replays the error.
+    };
+    kj::Vector<Error> errors;
+
+    void addError(uint32_t startByte, uint32_t endByte, kj::StringPtr message) override {
+      errors.add(Error { startByte, endByte, kj::heapString(message), answeredNoErrors });
+      answeredNoErrors = false;
+    }
+
+    bool hadErrors() override {
+      // Errors in this file are enough to say yes. Otherwise the answer depends on other files,
+      // so say no for now, and mark the error that follows (if any) for loadContent() to check.
+      answeredNoErrors = errors.size() == 0;
+      return !answeredNoErrors;
+    }
+
+  private:
+    bool answeredNoErrors = false;
+  };
+
+  kj::Maybe<kj::Own<Preparsed>> preparsed;
+  bool preparseAttempted = false;
+  bool contentLoaded = false;
+
+  kj::String contentHash;
+
+  template <typename T>
+  static bool hasDependency(kj::Vector<T>& list, kj::StringPtr path) {
+    for (auto& item: list) {
+      if (item.path == path) return true;
+    }
+    return false;
+  }
+
+  Orphan<ParsedFile> parse(Orphanage orphanage, ErrorReporter& errorReporter) {
+    kj::Array<const char> content = file->mmap(0, file->stat().size).releaseAsChars();
+
+    lineBreaks = nullptr;  // In case loadContent() is called multiple times.
+    lineBreaks = lineBreaksSpace.construct(content);
+
+    KJ_IF_MAYBE(cache, loader.getParsedFileCache()) {
+      return cache->parse(content, orphanage, errorReporter);
+    }
+
+    MallocMessageBuilder lexedBuilder;
+    auto statements = lexedBuilder.initRoot<LexedStatements>();
+    lex(content, statements, errorReporter);
+
+    auto parsed = orphanage.newOrphan<ParsedFile>();
+    parseFile(statements.getStatements(), parsed.get(), errorReporter);
+    return parsed;
+  }
 };
 
 // =======================================================================================
@@ -231,6 +419,7 @@ kj::Maybe<Module&> ModuleLoader::Impl::loadModule(
     auto& result = *module;
     auto insertResult = modules.insert(std::make_pair(key, kj::mv(module)));
     if (insertResult.second) {
+      allModules.add(&result);
       return result;
     } else {
       // Now that we have the file open, we noticed a collision. Return the old file.
@@ -268,6 +457,233 @@ kj::Maybe<kj::Array<const byte>> ModuleLoader::Impl::readEmbedFromSearchPath(kj:
   return nullptr;
 }
 
+void ModuleLoader::Impl::preparse(uint threadCount) {
+  // Work breadth-first through the import graph: preparse every module we know about but haven't
+  // parsed, in parallel, then load whatever those import and repeat. Only the parsing is done on
+  // other threads; loading modules touches the module table, so it stays on this thread.
+
+  size_t scanned = 0;
+  while (scanned < allModules.size()) {
+    kj::Vector<ModuleImpl*> batch;
+    for (; scanned < allModules.size(); scanned++) {
+      if (allModules[scanned]->shouldPreparse()) {
+        batch.add(allModules[scanned]);
+      }
+    }
+
+    kj::MutexGuarded<size_t> next(0);
+    auto work = [&]() {
+      for (;;) {
+        size_t i;
+        {
+          auto lock = next.lockExclusive();
+          if (*lock == batch.size()) return;
+          i = (*lock)++;
+        }
+        batch[i]->preparse();
+      }
+    };
+
+    {
+      kj::Vector<kj::Own<kj::Thread>> threads;
+      for (uint i = 1; i < kj::min(threadCount, batch.size()); i++) {
+        threads.add(kj::heap<kj::Thread>(work));
+      }
+      work();
+    }
+
+    for (auto module: batch) {
+      module->loadPreparsedImports();
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------------
+// Output cache
+//
+// A cache entry is keyed by the salt plus the names and content hashes of the source files. It
+// starts with a text manifest listing every module the compiler reached from those sources, in
+// breadth-first order, each followed by the imports and embeds it resolved:
+//
+//     capnp-compile-cache
+//     module <TAB> <source name> <TAB> <content hash>
+//     import <TAB> <import path> <TAB> <index of imported module>
+//     embed <TAB> <embed path> <TAB> <content hash>
+//     ...
+//     end
+//
+// The cached output follows. To check an entry, we resolve each import and embed again, exactly
+// as the compiler would, and compare hashes, so changes to any file -- or to which file an import
+// resolves to -- are noticed without parsing anything.
+
+static constexpr kj::StringPtr CACHE_MAGIC = "capnp-compile-cache\n"_kj;
+
+kj::Path ModuleLoader::Impl::getCachedOutputPath(
+    kj::ArrayPtr<Module* const> sources, kj::StringPtr salt) {
+  TypeIdGenerator hasher;
+  hasher.update(salt);
+  for (auto source: sources) {
+    auto& module = kj::downcast<ModuleImpl>(*source);
+    auto entry = kj::str("\n", module.getSourceName(), "\t", module.getContentHash());
+    hasher.update(entry.asArray());
+  }
+  return kj::Path(kj::str(kj::encodeHex(hasher.finish()), ".output"));
+}
+
+kj::Maybe<kj::Array<const byte>> ModuleLoader::Impl::getCachedOutput(
+    kj::ArrayPtr<Module* const> sources, kj::StringPtr salt) {
+  const kj::Directory* dir;
+  KJ_IF_MAYBE(d, cacheDir) {
+    dir = d;
+  } else {
+    return nullptr;
+  }
+
+  auto path = getCachedOutputPath(sources, salt);
+  kj::Maybe<kj::Array<const byte>> result;
+
+  KJ_IF_MAYBE(file, dir->tryOpenFile(path)) {
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      auto bytes = file->get()->readAllBytes();
+      auto text = bytes.asChars();
+      KJ_REQUIRE(text.size() >= CACHE_MAGIC.size() &&
+                 text.slice(0, CACHE_MAGIC.size()) == CACHE_MAGIC.asArray(),
+                 "not a capnp compile cache entry");
+      size_t pos = CACHE_MAGIC.size();
+
+      kj::Vector<ModuleImpl*> resolved;
+      for (auto source: sources) {
+        resolved.add(&kj::downcast<ModuleImpl>(*source));
+      }
+      ModuleImpl* current = nullptr;
+      size_t moduleCount = 0;
+
+      for (;;) {
+        // Split off the next line, then split it on tabs.
+        size_t end = pos;
+        while (end < text.size() && text[end] != '\n') ++end;
+        KJ_REQUIRE(end < text.size(), "truncated cache entry");
+        auto line = text.slice(pos, end);
+        pos = end + 1;
+
+        kj::Vector<kj::String> fields;
+        size_t fieldStart = 0;
+        for (size_t i = 0; i <= line.size(); i++) {
+          if (i == line.size() || line[i] == '\t') {
+            fields.add(kj::heapString(line.slice(fieldStart, i)));
+            fieldStart = i + 1;
+          }
+        }
+
+        if (fields[0] == "end") {
+          KJ_REQUIRE(moduleCount == resolved.size(), "cache entry doesn't cover every module");
+          kj::Array<const byte> output = kj::heapArray(bytes.slice(pos, bytes.size()));
+          result = kj::mv(output);
+          return;
+        }
+
+        KJ_REQUIRE(fields.size() == 3, "malformed cache entry");
+        if (fields[0] == "module") {
+          KJ_REQUIRE(moduleCount < resolved.size(), "malformed cache entry");
+          current = resolved[moduleCount++];
+          if (current->getSourceName() != fields[1] || current->getContentHash() != fields[2]) {
+            return;
+          }
+        } else if (fields[0] == "import") {
+          KJ_REQUIRE(current != nullptr, "malformed cache entry");
+          auto index = fields[2].parseAs<uint>();
+          KJ_IF_MAYBE(module, current->importRelative(fields[1])) {
+            auto* impl = &kj::downcast<ModuleImpl>(*module);
+            if (index == resolved.size()) {
+              resolved.add(impl);
+            } else if (index > resolved.size() || resolved[index] != impl) {
+              return;
+            }
+          } else {
+            return;
+          }
+        } else if (fields[0] == "embed") {
+          KJ_REQUIRE(current != nullptr, "malformed cache entry");
+          KJ_IF_MAYBE(content, current->embedRelative(fields[1])) {
+            if (hashContent(*content) != fields[2]) return;
+          } else {
+            return;
+          }
+        } else {
+          KJ_FAIL_REQUIRE("malformed cache entry");
+        }
+      }
+    })) {
+      KJ_LOG(WARNING, "ignoring bad entry in compile cache", path, *exception);
+      return nullptr;
+    }
+  }
+
+  return result;
+}
+
+void ModuleLoader::Impl::putCachedOutput(
+    kj::ArrayPtr<Module* const> sources, kj::StringPtr salt, kj::ArrayPtr<const byte> output) {
+  const kj::Directory* dir;
+  KJ_IF_MAYBE(d, cacheDir) {
+    dir = d;
+  } else {
+    return;
+  }
+
+  kj::Vector<ModuleImpl*> order;
+  std::unordered_map<ModuleImpl*, uint> indexes;
+  for (auto source: sources) {
+    auto* impl = &kj::downcast<ModuleImpl>(*source);
+    indexes.insert(std::make_pair(impl, order.size()));
+    order.add(impl);
+  }
+
+  auto isPlain = [](kj::StringPtr text) {
+    for (char c: text) {
+      if (c == '\t' || c == '\n') return false;
+    }
+    return true;
+  };
+
+  kj::Vector<kj::String> lines;
+  lines.add(kj::heapString(CACHE_MAGIC));
+  for (size_t i = 0; i < order.size(); i++) {
+    auto& module = *order[i];
+    if (!isPlain(module.getSourceName())) return;
+    lines.add(kj::str("module\t", module.getSourceName(), "\t", module.getContentHash(), "\n"));
+
+    for (auto& import: module.imports) {
+      // A missing file would have been a compile error, but don't cache it if we got here anyway.
+      if (import.module == nullptr || !isPlain(import.path)) return;
+      auto insertResult = indexes.insert(std::make_pair(import.module, order.size()));
+      if (insertResult.second) {
+        order.add(import.module);
+      }
+      lines.add(kj::str("import\t", import.path, "\t", insertResult.first->second, "\n"));
+    }
+
+    for (auto& embed: module.embeds) {
+      if (embed.hash == nullptr || !isPlain(embed.path)) return;
+      lines.add(kj::str("embed\t", embed.path, "\t", embed.hash, "\n"));
+    }
+  }
+  lines.add(kj::str("end\n"));
+
+  auto path = getCachedOutputPath(sources, salt);
+  KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+    auto replacer = dir->replaceFile(path, kj::WriteMode::CREATE | kj::WriteMode::MODIFY |
+                                           kj::WriteMode::CREATE_PARENT);
+    auto& file = replacer->get();
+    auto manifest = kj::strArray(lines, "");
+    file.writeAll(manifest);
+    file.write(manifest.size(), output);
+    replacer->commit();
+  })) {
+    KJ_LOG(WARNING, "couldn't write to compile cache", path, *exception);
+  }
+}
+
 // =======================================================================================
 
 ModuleLoader::ModuleLoader(GlobalErrorReporter& errorReporter)
@@ -282,5 +698,23 @@ kj::Maybe<Module&> ModuleLoader::loadModule(const kj::ReadableDirectory& dir, kj
   return impl->loadModule(dir, path);
 }
 
+void ModuleLoader::preparse(uint threadCount) {
+  impl->preparse(threadCount);
+}
+
+void ModuleLoader::setCacheDirectory(const kj::Directory& dir) {
+  impl->setCacheDirectory(dir);
+}
+
+kj::Maybe<kj::Array<const byte>> ModuleLoader::getCachedOutput(
+    kj::ArrayPtr<Module* const> sources, kj::StringPtr salt) {
+  return impl->getCachedOutput(sources, salt);
+}
+
+void ModuleLoader::putCachedOutput(
+    kj::ArrayPtr<Module* const> sources, kj::StringPtr salt, kj::ArrayPtr<const byte> output) {
+  impl->putCachedOutput(sources, salt, output);
+}
+
 }  // namespace compiler
 }  // namespace capnp
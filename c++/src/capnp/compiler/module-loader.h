@@ -51,6 +51,31 @@ public:
   // Tries to load a module with the given path inside the given directory. Returns nullptr if the
   // file doesn't exist.
 
+  void preparse(uint threadCount);
+  // Lexes and parses every module loaded so far, plus everything they import (transitively), using
+  // up to `threadCount` threads. Compiling those modules later then skips straight to
+  // translation. Errors found while parsing are held back and reported when the compiler loads
+  // each module, so the compiler's output -- including the order of error messages -- is the
+  // same as without preparsing.
+
+  void setCacheDirectory(const kj::Directory& dir);
+  // Keeps parsed files in `dir` (see ParsedFileCache) and enables getCachedOutput() and
+  // putCachedOutput(). Also makes each module remember which files it imports and embeds, which
+  // those methods rely on.
+
+  kj::Maybe<kj::Array<const byte>> getCachedOutput(
+      kj::ArrayPtr<Module* const> sources, kj::StringPtr salt);
+  void putCachedOutput(kj::ArrayPtr<Module* const> sources, kj::StringPtr salt,
+                       kj::ArrayPtr<const byte> output);
+  // Caches some output derived from compiling `sources` (and everything they depend on), such as
+  // a serialized CodeGeneratorRequest. `salt` should capture any other inputs, such as compiler
+  // options.
+  //
+  // putCachedOutput() must be called after compiling, so that each module has seen everything it
+  // depends on; it does nothing if some import or embed could not be found. getCachedOutput()
+  // returns the stored output only if every file reached from `sources` -- resolved afresh -- has
+  // the same content as when it was stored. Both do nothing without a cache directory.
+
 private:
   class Impl;
   kj::Own<Impl> impl;
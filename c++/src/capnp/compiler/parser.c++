@@ -20,9 +20,12 @@
 // THE SOFTWARE.
 
 #include "parser.h"
+#include "lexer.h"
 #include "type-id.h"
 #include <capnp/dynamic.h>
+#include <capnp/serialize.h>
 #include <kj/debug.h>
+#include <kj/encoding.h>
 #if !_MSC_VER
 #include <unistd.h>
 #endif
@@ -63,6 +66,110 @@ uint64_t generateRandomId() {
   return result | (1ull << 63);
 }
 
+static void findImports(Expression::Reader exp, std::set<kj::StringPtr>& output) {
+  switch (exp.which()) {
+    case Expression::UNKNOWN:
+    case Expression::POSITIVE_INT:
+    case Expression::NEGATIVE_INT:
+    case Expression::FLOAT:
+    case Expression::STRING:
+    case Expression::BINARY:
+    case Expression::RELATIVE_NAME:
+    case Expression::ABSOLUTE_NAME:
+    case Expression::EMBED:
+      break;
+
+    case Expression::IMPORT:
+      output.insert(exp.getImport().getValue());
+      break;
+
+    case Expression::LIST:
+      for (auto element: exp.getList()) {
+        findImports(element, output);
+      }
+      break;
+
+    case Expression::TUPLE:
+      for (auto element: exp.getTuple()) {
+        findImports(element.getValue(), output);
+      }
+      break;
+
+    case Expression::APPLICATION: {
+      auto app = exp.getApplication();
+      findImports(app.getFunction(), output);
+      for (auto param: app.getParams()) {
+        findImports(param.getValue(), output);
+      }
+      break;
+    }
+
+    case Expression::MEMBER: {
+      findImports(exp.getMember().getParent(), output);
+      break;
+    }
+  }
+}
+
+void findImports(Declaration::Reader decl, std::set<kj::StringPtr>& output) {
+  switch (decl.which()) {
+    case Declaration::USING:
+      findImports(decl.getUsing().getTarget(), output);
+      break;
+    case Declaration::CONST:
+      findImports(decl.getConst().getType(), output);
+      break;
+    case Declaration::FIELD:
+      findImports(decl.getField().getType(), output);
+      break;
+    case Declaration::INTERFACE:
+      for (auto superclass: decl.getInterface().getSuperclasses()) {
+        findImports(superclass, output);
+      }
+      break;
+    case Declaration::METHOD: {
+      auto method = decl.getMethod();
+
+      auto params = method.getParams();
+      if (params.isNamedList()) {
+        for (auto param: params.getNamedList()) {
+          findImports(param.getType(), output);
+          for (auto ann: param.getAnnotations()) {
+            findImports(ann.getName(), output);
+          }
+        }
+      } else {
+        findImports(params.getType(), output);
+      }
+
+      if (method.getResults().isExplicit()) {
+        auto results = method.getResults().getExplicit();
+        if (results.isNamedList()) {
+          for (auto param: results.getNamedList()) {
+            findImports(param.getType(), output);
+            for (auto ann: param.getAnnotations()) {
+              findImports(ann.getName(), output);
+            }
+          }
+        } else {
+          findImports(results.getType(), output);
+        }
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  for (auto ann: decl.getAnnotations()) {
+    findImports(ann.getName(), output);
+  }
+
+  for (auto nested: decl.getNestedDecls()) {
+    findImports(nested, output);
+  }
+}
+
 void parseFile(List<Statement>::Reader statements, ParsedFile::Builder result,
                ErrorReporter& errorReporter) {
   CapnpParser parser(Orphanage::getForMessageContaining(result), errorReporter);
@@ -123,6 +230,92 @@ void parseFile(List<Statement>::Reader statements, ParsedFile::Builder result,
   }
 }
 
+// =======================================================================================
+
+namespace {
+
+class ErrorTracker final: public ErrorReporter {
+  // Passes errors through to another ErrorReporter, remembering whether the parse can be cached:
+  // not if it reported errors, nor if it was told about errors elsewhere, since the parser then
+  // suppresses some of its own (e.g. the missing file ID) which a later, error-free run must see.
+
+public:
+  explicit ErrorTracker(ErrorReporter& inner): inner(inner) {}
+
+  bool cacheable = true;
+
+  void addError(uint32_t startByte, uint32_t endByte, kj::StringPtr message) override {
+    cacheable = false;
+    inner.addError(startByte, endByte, message);
+  }
+
+  bool hadErrors() override {
+    bool result = inner.hadErrors();
+    if (result) cacheable = false;
+    return result;
+  }
+
+private:
+  ErrorReporter& inner;
+};
+
+}  // namespace
+
+Orphan<ParsedFile> ParsedFileCache::parse(kj::ArrayPtr<const char> content, Orphanage orphanage,
+                                          ErrorReporter& errorReporter) const {
+  TypeIdGenerator hasher;
+  auto prefix = kj::str("capnp-parsed-file ", CAPNP_VERSION);
+  hasher.update(kj::arrayPtr(prefix.cStr(), prefix.size() + 1));
+  hasher.update(content);
+  auto path = kj::Path(kj::str(kj::encodeHex(hasher.finish()), ".parsed"));
+
+  KJ_IF_MAYBE(file, dir.tryOpenFile(path)) {
+    kj::Maybe<Orphan<ParsedFile>> result;
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      auto bytes = file->get()->mmap(0, file->get()->stat().size);
+      KJ_REQUIRE(bytes.size() % sizeof(word) == 0, "cached parse has wrong size");
+      auto words = kj::arrayPtr(reinterpret_cast<const word*>(bytes.begin()),
+                                bytes.size() / sizeof(word));
+
+      // Copying the root validates it, so a corrupt entry throws here rather than later.
+      ReaderOptions options;
+      options.traversalLimitInWords = kj::max(words.size() * 2, options.traversalLimitInWords);
+      FlatArrayMessageReader reader(words, options);
+      result = orphanage.newOrphanCopy(reader.getRoot<ParsedFile>());
+    })) {
+      // Fall back to parsing.
+      KJ_LOG(WARNING, "ignoring bad entry in parsed file cache", path, *exception);
+    } else {
+      return kj::mv(KJ_ASSERT_NONNULL(result));
+    }
+  }
+
+  ErrorTracker errorTracker(errorReporter);
+
+  MallocMessageBuilder lexedBuilder;
+  auto statements = lexedBuilder.initRoot<LexedStatements>();
+  lex(content, statements, errorTracker);
+
+  auto parsed = orphanage.newOrphan<ParsedFile>();
+  parseFile(statements.getStatements(), parsed.get(), errorTracker);
+
+  if (errorTracker.cacheable) {
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      MallocMessageBuilder message;
+      message.setRoot(parsed.getReader());
+      auto replacer = dir.replaceFile(path, kj::WriteMode::CREATE | kj::WriteMode::MODIFY |
+                                            kj::WriteMode::CREATE_PARENT);
+      replacer->get().writeAll(messageToFlatArray(message).asBytes());
+      replacer->commit();
+    })) {
+      // The cache is only an optimization, so press on.
+      KJ_LOG(WARNING, "couldn't write to parsed file cache", path, *exception);
+    }
+  }
+
+  return parsed;
+}
+
 namespace p = kj::parse;
 
 namespace {
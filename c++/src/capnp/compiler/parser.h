@@ -29,7 +29,9 @@
 #include <capnp/compiler/lexer.capnp.h>
 #include <kj/parse/common.h>
 #include <kj/arena.h>
+#include <kj/filesystem.h>
 #include "error-reporter.h"
+#include <set>
 
 namespace capnp {
 namespace compiler {
@@ -41,6 +43,32 @@ void parseFile(List<Statement>::Reader statements, ParsedFile::Builder result,
 // If any errors are reported, then the output is not usable.  However, it may be passed on through
 // later stages of compilation in order to detect additional errors.
 
+class ParsedFileCache {
+  // An on-disk cache of parsed schema files, keyed by a hash of the source text (and the
+  // compiler version). Lexing and parsing are a large part of the cost of compiling a file, and
+  // most files -- especially shared imports like c++.capnp -- rarely change between compiles.
+  //
+  // Entries are written atomically, so a cache directory may be shared by concurrent processes.
+  // Unreadable or corrupt entries are ignored. The cache never removes entries; delete the
+  // directory to clear it.
+
+public:
+  explicit ParsedFileCache(const kj::Directory& dir): dir(dir) {}
+
+  Orphan<ParsedFile> parse(kj::ArrayPtr<const char> content, Orphanage orphanage,
+                           ErrorReporter& errorReporter) const;
+  // Equivalent to lex() followed by parseFile(), but reuses the result from a previous call with
+  // identical content if there is one. A result is only cached if parsing reported no errors, so
+  // a hit never reports errors.
+
+private:
+  const kj::Directory& dir;
+};
+
+void findImports(Declaration::Reader decl, std::set<kj::StringPtr>& output);
+// Adds to `output` the path of every file imported (with an `import` expression) anywhere within
+// `decl`, including its nested declarations.
+
 uint64_t generateRandomId();
 // Generate a new random unique ID.  This lives here mostly for lack of a better location.
 
@@ -26,41 +26,6 @@
 namespace capnp {
 namespace compiler {
 
-class TypeIdGenerator {
-  // A non-cryptographic deterministic random number generator used to generate type IDs when the
-  // developer did not specify one themselves.
-  //
-  // The underlying algorithm is MD5. MD5 is safe to use here because this is not intended to be a
-  // cryptographic random number generator. In retrospect it would have been nice to use something
-  // else just to avoid people freaking out about it, but changing the algorithm now would break
-  // backwards-compatibility.
-
-public:
-  TypeIdGenerator();
-
-  void update(kj::ArrayPtr<const kj::byte> data);
-  inline void update(kj::ArrayPtr<const char> data) {
-    return update(data.asBytes());
-  }
-  inline void update(kj::StringPtr data) {
-    return update(data.asArray());
-  }
-
-  kj::ArrayPtr<const kj::byte> finish();
-
-private:
-  bool finished = false;
-
-  struct {
-    uint lo, hi;
-    uint a, b, c, d;
-    kj::byte buffer[64];
-    uint block[16];
-  } ctx;
-
-  const kj::byte* body(const kj::byte* ptr, size_t size);
-};
-
 uint64_t generateChildId(uint64_t parentId, kj::StringPtr childName) {
   // Compute ID by hashing the concatenation of the parent ID and the declaration name, and
   // then taking the first 8 bytes.
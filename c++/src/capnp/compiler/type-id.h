@@ -38,5 +38,43 @@ uint64_t generateMethodParamsId(uint64_t parentId, uint16_t methodOrdinal, bool
 // pseudo-randomly from the input using an algorithm that should produce a uniform distribution of
 // IDs.
 
+class TypeIdGenerator {
+  // A non-cryptographic deterministic random number generator used to generate type IDs when the
+  // developer did not specify one themselves. Also used to compute content hashes for the
+  // compiler's on-disk caches, where collisions are only a concern if someone is trying to
+  // poison their own cache.
+  //
+  // The underlying algorithm is MD5. MD5 is safe to use here because this is not intended to be a
+  // cryptographic random number generator. In retrospect it would have been nice to use something
+  // else just to avoid people freaking out about it, but changing the algorithm now would break
+  // backwards-compatibility.
+
+public:
+  TypeIdGenerator();
+
+  void update(kj::ArrayPtr<const kj::byte> data);
+  inline void update(kj::ArrayPtr<const char> data) {
+    return update(data.asBytes());
+  }
+  inline void update(kj::StringPtr data) {
+    return update(data.asArray());
+  }
+
+  kj::ArrayPtr<const kj::byte> finish();
+  // Returns the 16-byte digest. The returned array points into the generator.
+
+private:
+  bool finished = false;
+
+  struct {
+    uint lo, hi;
+    uint a, b, c, d;
+    kj::byte buffer[64];
+    uint block[16];
+  } ctx;
+
+  const kj::byte* body(const kj::byte* ptr, size_t size);
+};
+
 }  // namespace compiler
 }  // namespace capnp
@@ -492,6 +492,72 @@ TEST(DynamicApi, BuilderAssign) {
   listValue.set(0, 123);
 }
 
+TEST(DynamicApi, AccessPlan) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  DynamicAccessPlan plan(Schema::from<TestAllTypes>(), {
+      "int32Field", "textField", "enumField", "structField.uInt64Field",
+      "structField.structField.structField.textField", "int16List", "float64Field" });
+  ASSERT_EQ(7u, plan.size());
+
+  auto reader = toDynamic(root.asReader());
+  EXPECT_EQ(-12345678, plan.get(reader, 0).as<int32_t>());
+  EXPECT_EQ("foo", plan.get(reader, 1).as<Text>());
+  EXPECT_EQ(TestEnum::CORGE, plan.get(reader, 2).as<TestEnum>());
+  EXPECT_EQ(345678901234567890ull, plan.get(reader, 3).as<uint64_t>());
+  EXPECT_EQ("really nested", plan.get(reader, 4).as<Text>());
+  checkList<int16_t>(plan.get(reader, 5), {11111, -11111});
+  EXPECT_EQ(-123e45, plan.get(reader, 6).as<double>());
+
+  DynamicValue::Reader values[7];
+  plan.getAll(reader, values);
+  EXPECT_EQ(-12345678, values[0].as<int32_t>());
+  EXPECT_EQ("really nested", values[4].as<Text>());
+
+  EXPECT_ANY_THROW(DynamicAccessPlan(Schema::from<TestAllTypes>(), {"noSuchField"}));
+  EXPECT_ANY_THROW(DynamicAccessPlan(Schema::from<TestAllTypes>(), {"int32Field.foo"}));
+}
+
+TEST(DynamicApi, AccessPlanDefaults) {
+  MallocMessageBuilder builder;
+  auto reader = toDynamic(builder.initRoot<TestDefaults>().asReader());
+
+  DynamicAccessPlan plan(Schema::from<TestDefaults>(), {
+      "boolField", "int8Field", "uInt32Field", "float32Field", "textField", "dataField",
+      "structField.int32Field", "structField.structField.textField" });
+
+  EXPECT_TRUE(plan.get(reader, 0).as<bool>());
+  EXPECT_EQ(-123, plan.get(reader, 1).as<int8_t>());
+  EXPECT_EQ(3456789012u, plan.get(reader, 2).as<uint32_t>());
+  EXPECT_EQ(1234.5f, plan.get(reader, 3).as<float>());
+  EXPECT_EQ("foo", plan.get(reader, 4).as<Text>());
+  EXPECT_EQ(data("bar"), plan.get(reader, 5).as<Data>());
+  EXPECT_EQ(-78901234, plan.get(reader, 6).as<int32_t>());
+  EXPECT_EQ("nested", plan.get(reader, 7).as<Text>());
+}
+
+TEST(DynamicApi, AccessPlanGroupsAndUnions) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestGroups>();
+  auto bar = root.getGroups().initBar();
+  bar.setCorge(123);
+  bar.setGrault("foo");
+
+  DynamicAccessPlan plan(Schema::from<test::TestGroups>(), {
+      "groups.bar.corge", "groups.bar.grault", "groups.foo.corge" });
+
+  auto reader = toDynamic(root.asReader());
+  EXPECT_EQ(123, plan.get(reader, 0).as<int32_t>());
+  EXPECT_EQ("foo", plan.get(reader, 1).as<Text>());
+  EXPECT_ANY_THROW(plan.get(reader, 2));
+
+  // The plan only applies to the type it was built for.
+  MallocMessageBuilder other;
+  EXPECT_ANY_THROW(plan.get(toDynamic(other.initRoot<TestAllTypes>().asReader()), 0));
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
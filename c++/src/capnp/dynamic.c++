@@ -21,6 +21,7 @@
 
 #include "dynamic.h"
 #include <kj/debug.h>
+#include <kj/vector.h>
 
 namespace capnp {
 
@@ -1035,6 +1036,225 @@ void DynamicStruct::Builder::clear(kj::StringPtr name) {
 
 // =======================================================================================
 
+DynamicAccessPlan::DynamicAccessPlan(
+    StructSchema schema, std::initializer_list<kj::StringPtr> paths)
+    : DynamicAccessPlan(schema, kj::arrayPtr(paths.begin(), paths.size())) {}
+
+DynamicAccessPlan::DynamicAccessPlan(
+    StructSchema schema, kj::ArrayPtr<const kj::StringPtr> paths)
+    : schema(schema) {
+  auto builder = kj::heapArrayBuilder<kj::Array<Step>>(paths.size());
+  for (auto path: paths) {
+    kj::Vector<Step> steps;
+    StructSchema current = schema;
+    for (;;) {
+      KJ_IF_MAYBE(dot, path.findFirst('.')) {
+        auto field = current.getFieldByName(kj::heapString(path.begin(), *dot));
+        KJ_REQUIRE(field.getType().isStruct(),
+            "Field path component is not a group or struct.",
+            field.getProto().getName(), current.getProto().getDisplayName());
+        steps.add(makeStep(field));
+        current = field.getType().asStruct();
+        path = path.slice(*dot + 1);
+      } else {
+        steps.add(makeStep(current.getFieldByName(path)));
+        break;
+      }
+    }
+    builder.add(steps.releaseAsArray());
+  }
+  this->paths = builder.finish();
+}
+
+DynamicAccessPlan::Step DynamicAccessPlan::makeStep(StructSchema::Field field) {
+  auto proto = field.getProto();
+  auto type = field.getType();
+
+  Step step;
+  step.field = field;
+  step.type = type;
+  step.which = type.which();
+  step.isGroup = proto.isGroup();
+  step.discriminantValue = proto.getDiscriminantValue();
+  step.discriminantOffset =
+      field.getContainingStruct().getProto().getStruct().getDiscriminantOffset();
+  step.offset = 0;
+  step.mask = 0;
+  step.defaultValue = nullptr;
+  step.defaultSize = 0;
+
+  if (step.isGroup) return step;
+
+  auto slot = proto.getSlot();
+  step.offset = slot.getOffset();
+
+  // See DynamicStruct::Reader::get() regarding why the default may be "anyPointer".
+  auto dval = slot.getDefaultValue();
+
+  switch (step.which) {
+#define HANDLE_TYPE(discrim, titleCase, type) \
+    case schema::Type::discrim: \
+      step.mask = bitCast<_::Mask<type>>(dval.get##titleCase()); \
+      break;
+
+    HANDLE_TYPE(BOOL, Bool, bool)
+    HANDLE_TYPE(INT8, Int8, int8_t)
+    HANDLE_TYPE(INT16, Int16, int16_t)
+    HANDLE_TYPE(INT32, Int32, int32_t)
+    HANDLE_TYPE(INT64, Int64, int64_t)
+    HANDLE_TYPE(UINT8, Uint8, uint8_t)
+    HANDLE_TYPE(UINT16, Uint16, uint16_t)
+    HANDLE_TYPE(UINT32, Uint32, uint32_t)
+    HANDLE_TYPE(UINT64, Uint64, uint64_t)
+    HANDLE_TYPE(FLOAT32, Float32, float)
+    HANDLE_TYPE(FLOAT64, Float64, double)
+
+#undef HANDLE_TYPE
+
+    case schema::Type::ENUM:
+      step.mask = dval.getEnum();
+      break;
+
+    case schema::Type::TEXT:
+      if (!dval.isAnyPointer()) {
+        auto text = dval.getText();
+        step.defaultValue = reinterpret_cast<const word*>(text.begin());
+        step.defaultSize = text.size();
+      }
+      break;
+
+    case schema::Type::DATA:
+      if (!dval.isAnyPointer()) {
+        auto data = dval.getData();
+        step.defaultValue = reinterpret_cast<const word*>(data.begin());
+        step.defaultSize = data.size();
+      }
+      break;
+
+    case schema::Type::LIST:
+      if (!dval.isAnyPointer()) {
+        step.defaultValue = dval.getList().getAs<_::UncheckedMessage>();
+      }
+      break;
+
+    case schema::Type::STRUCT:
+      if (!dval.isAnyPointer()) {
+        step.defaultValue = dval.getStruct().getAs<_::UncheckedMessage>();
+      }
+      break;
+
+    case schema::Type::VOID:
+    case schema::Type::ANY_POINTER:
+    case schema::Type::INTERFACE:
+      break;
+  }
+
+  return step;
+}
+
+inline _::StructReader DynamicAccessPlan::walk(_::StructReader reader, const Step& step) {
+  if (step.isGroup) {
+    return reader;
+  } else {
+    return reader.getPointerField(assumePointerOffset(step.offset))
+                 .getStruct(step.defaultValue);
+  }
+}
+
+DynamicValue::Reader DynamicAccessPlan::read(_::StructReader reader, const Step& step) {
+  switch (step.which) {
+    case schema::Type::VOID:
+      return reader.getDataField<Void>(assumeDataOffset(step.offset));
+
+#define HANDLE_TYPE(discrim, type) \
+    case schema::Type::discrim: \
+      return reader.getDataField<type>( \
+          assumeDataOffset(step.offset), static_cast<_::Mask<type>>(step.mask));
+
+    HANDLE_TYPE(BOOL, bool)
+    HANDLE_TYPE(INT8, int8_t)
+    HANDLE_TYPE(INT16, int16_t)
+    HANDLE_TYPE(INT32, int32_t)
+    HANDLE_TYPE(INT64, int64_t)
+    HANDLE_TYPE(UINT8, uint8_t)
+    HANDLE_TYPE(UINT16, uint16_t)
+    HANDLE_TYPE(UINT32, uint32_t)
+    HANDLE_TYPE(UINT64, uint64_t)
+    HANDLE_TYPE(FLOAT32, float)
+    HANDLE_TYPE(FLOAT64, double)
+
+#undef HANDLE_TYPE
+
+    case schema::Type::ENUM:
+      return DynamicEnum(step.type.asEnum(), reader.getDataField<uint16_t>(
+          assumeDataOffset(step.offset), static_cast<uint16_t>(step.mask)));
+
+    case schema::Type::TEXT:
+      return reader.getPointerField(assumePointerOffset(step.offset))
+                   .getBlob<Text>(step.defaultValue,
+                       assumeMax<MAX_TEXT_SIZE>(step.defaultSize) * BYTES);
+
+    case schema::Type::DATA:
+      return reader.getPointerField(assumePointerOffset(step.offset))
+                   .getBlob<Data>(step.defaultValue,
+                       assumeBits<BLOB_SIZE_BITS>(step.defaultSize) * BYTES);
+
+    case schema::Type::LIST: {
+      auto listType = step.type.asList();
+      return DynamicList::Reader(listType,
+          reader.getPointerField(assumePointerOffset(step.offset))
+                .getList(elementSizeFor(listType.getElementType().which()), step.defaultValue));
+    }
+
+    case schema::Type::STRUCT:
+      return DynamicStruct::Reader(step.type.asStruct(), walk(reader, step));
+
+    case schema::Type::ANY_POINTER:
+      return AnyPointer::Reader(reader.getPointerField(assumePointerOffset(step.offset)));
+
+    case schema::Type::INTERFACE:
+      return DynamicCapability::Client(step.type.asInterface(),
+          reader.getPointerField(assumePointerOffset(step.offset)).getCapability());
+  }
+
+  KJ_UNREACHABLE;
+}
+
+DynamicValue::Reader DynamicAccessPlan::get(DynamicStruct::Reader input, size_t index) const {
+  KJ_REQUIRE(input.schema == schema, "DynamicAccessPlan used with a struct of the wrong type.",
+             input.schema.getProto().getDisplayName(), schema.getProto().getDisplayName());
+  KJ_REQUIRE(index < paths.size(), "DynamicAccessPlan path index out-of-bounds.");
+
+  _::StructReader reader = input.reader;
+  auto& steps = paths[index];
+  for (auto i: kj::indices(steps)) {
+    auto& step = steps[i];
+    if (step.discriminantValue != schema::Field::NO_DISCRIMINANT) {
+      KJ_REQUIRE(reader.getDataField<uint16_t>(assumeDataOffset(step.discriminantOffset)) ==
+                     step.discriminantValue,
+          "Tried to get() a union member which is not currently initialized.",
+          step.field.getProto().getName(),
+          step.field.getContainingStruct().getProto().getDisplayName());
+    }
+    if (i + 1 == steps.size()) {
+      return read(reader, step);
+    }
+    reader = walk(reader, step);
+  }
+
+  KJ_UNREACHABLE;
+}
+
+void DynamicAccessPlan::getAll(
+    DynamicStruct::Reader reader, kj::ArrayPtr<DynamicValue::Reader> output) const {
+  KJ_REQUIRE(output.size() == paths.size(), "Output array size doesn't match number of paths.");
+  for (auto i: kj::indices(paths)) {
+    output[i] = get(reader, i);
+  }
+}
+
+// =======================================================================================
+
 DynamicValue::Reader DynamicList::Reader::operator[](uint index) const {
   KJ_REQUIRE(index < size(), "List index out-of-bounds.");
 
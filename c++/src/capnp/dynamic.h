@@ -249,6 +249,7 @@ private:
   friend class Orphan<DynamicValue>;
   friend class Orphan<AnyPointer>;
   friend class AnyStruct::Reader;
+  friend class DynamicAccessPlan;
 };
 
 class DynamicStruct::Builder {
@@ -372,6 +373,62 @@ private:
 
 // -------------------------------------------------------------------
 
+class DynamicAccessPlan {
+  // Resolves a fixed set of field paths against a StructSchema once, so that the same fields can
+  // then be read out of any number of DynamicStruct::Readers of that type without repeating the
+  // name lookups and schema walking that DynamicStruct::Reader::get() does on every call.  Useful
+  // for generic code that pulls the same handful of fields out of a large stream of messages.
+  //
+  // Each path is a dot-separated list of field names, e.g. "foo.bar.baz".  Every component but
+  // the last must name a group or a struct-typed field.
+
+public:
+  DynamicAccessPlan(StructSchema schema, kj::ArrayPtr<const kj::StringPtr> paths);
+  DynamicAccessPlan(StructSchema schema, std::initializer_list<kj::StringPtr> paths);
+  // Throws if any path does not resolve.
+
+  inline StructSchema getSchema() const { return schema; }
+  inline size_t size() const { return paths.size(); }
+
+  DynamicValue::Reader get(DynamicStruct::Reader reader, size_t index) const;
+  // Read the value at `paths[index]`.  Semantics are exactly those of calling get() on each
+  // component in turn: a null struct pointer along the way reads as that field's default, and
+  // reaching through a union member which is not currently set throws.
+
+  void getAll(DynamicStruct::Reader reader, kj::ArrayPtr<DynamicValue::Reader> output) const;
+  // Read every path, in order.  `output.size()` must equal `size()`.
+
+private:
+  struct Step {
+    StructSchema::Field field;
+    Type type;
+    schema::Type::Which which;
+    bool isGroup;
+
+    uint16_t discriminantValue;
+    uint32_t discriminantOffset;
+    // If discriminantValue != schema::Field::NO_DISCRIMINANT, the field is a union member and is
+    // only readable when the 16-bit value at discriminantOffset matches.
+
+    uint32_t offset;
+    uint64_t mask;
+    // Slot offset and, for primitive types, the bits of the default value.
+
+    const word* defaultValue;
+    uint32_t defaultSize;
+    // For pointer types, the encoded default (and its byte size, for blobs).
+  };
+
+  StructSchema schema;
+  kj::Array<kj::Array<Step>> paths;
+
+  static Step makeStep(StructSchema::Field field);
+  static _::StructReader walk(_::StructReader reader, const Step& step);
+  static DynamicValue::Reader read(_::StructReader reader, const Step& step);
+};
+
+// -------------------------------------------------------------------
+
 class DynamicList::Reader {
 public:
   typedef DynamicList Reads;
@@ -408,6 +465,7 @@ private:
   friend struct _::PointerHelpers;
   friend struct DynamicStruct;
   friend class DynamicList::Builder;
+  friend class DynamicAccessPlan;
   template <typename T, ::capnp::Kind k>
   friend struct ::capnp::ToDynamic_;
   friend class Orphanage;
@@ -514,6 +572,7 @@ private:
   friend struct DynamicStruct;
   friend struct DynamicList;
   friend struct DynamicValue;
+  friend class DynamicAccessPlan;
   friend class Orphan<DynamicCapability>;
   friend class Orphan<DynamicValue>;
   friend class Orphan<AnyPointer>;
@@ -21,6 +21,7 @@
 
 #include <capnp/test-import.capnp.h>
 #include <capnp/test-import2.capnp.h>
+#include <capnp/test-lite.capnp.h>
 #include "message.h"
 #include <kj/debug.h>
 #include <kj/compat/gtest.h>
@@ -1689,6 +1690,71 @@ TEST(Encoding, GlobalConstants) {
   }
 }
 
+TEST(Encoding, LiteFile) {
+  // test-lite.capnp is annotated with $Cxx.lite, so its generated code has no reflection tables
+  // even in a full build. Defaults and constants still work, since they keep the encoded schema.
+  using capnproto_test::capnp::test_lite::TestLiteStruct;
+  using capnproto_test::capnp::test_lite::TestLiteEnum;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestLiteStruct>();
+
+  EXPECT_EQ(123, root.getInt32Field());
+  EXPECT_EQ("foo", root.getTextField());
+  EXPECT_EQ(TestLiteEnum::BAR, root.getEnumField());
+  checkList(root.getInt32List(), {1, 2, 3});
+  EXPECT_EQ(321u, root.getStructField().getValue());
+  EXPECT_EQ(7u, root.getGroup().getValue());
+  EXPECT_TRUE(root.isUnset());
+
+  root.setInt32Field(456);
+  root.setEnumField(TestLiteEnum::FOO);
+  root.initStructField().setValue(654);
+  root.setSet("bar");
+
+  auto reader = root.asReader();
+  EXPECT_EQ(456, reader.getInt32Field());
+  EXPECT_EQ(TestLiteEnum::FOO, reader.getEnumField());
+  EXPECT_EQ(654u, reader.getStructField().getValue());
+  ASSERT_TRUE(reader.isSet());
+  EXPECT_EQ("bar", reader.getSet());
+
+  EXPECT_EQ(456u, capnproto_test::capnp::test_lite::LITE_CONSTANT->getValue());
+  EXPECT_EQ("bar", capnproto_test::capnp::test_lite::LITE_TEXT_CONSTANT.get());
+}
+
+TEST(Encoding, LiteFileGenericsAndInterfaces) {
+  // In lite mode, generic types still work, while interfaces are reduced to their method
+  // parameter and result structs, and capability fields to has*().
+  using capnproto_test::capnp::test_lite::TestLiteStruct;
+  using capnproto_test::capnp::test_lite::TestLiteGeneric;
+  using capnproto_test::capnp::test_lite::TestLiteUsesGeneric;
+  using capnproto_test::capnp::test_lite::TestLiteInterface;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestLiteUsesGeneric>();
+  root.initGeneric().initValue().setValue(123);
+  root.initInner().setValue("foo");
+  root.getAny().setAs<Text>("bar");
+
+  auto reader = root.asReader();
+  EXPECT_EQ(123u, reader.getGeneric().getValue().getValue());
+  EXPECT_FALSE(reader.getGeneric().hasCap());
+  EXPECT_EQ("foo", reader.getInner().getValue());
+  EXPECT_FALSE(reader.hasCap());
+  EXPECT_EQ("bar", reader.getAny().getAs<Text>());
+
+  MallocMessageBuilder builder2;
+  auto results = builder2.initRoot<TestLiteInterface<Text>::GenericResults<TestLiteStruct>>();
+  results.initValue().setInt32Field(456);
+  EXPECT_EQ(456, results.asReader().getValue().getInt32Field());
+
+  MallocMessageBuilder builder3;
+  auto passResults = builder3.initRoot<TestLiteGeneric<Text>>();
+  passResults.setValue("baz");
+  EXPECT_EQ("baz", passResults.asReader().getValue());
+}
+
 TEST(Encoding, Embeds) {
   {
     kj::ArrayInputStream input(test::EMBEDDED_DATA);
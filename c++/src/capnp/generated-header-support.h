@@ -335,12 +335,7 @@ inline constexpr uint sizeInWords() {
 #define CAPNP_AUTO_IF_MSVC(...) __VA_ARGS__
 #endif
 
-#if CAPNP_LITE
-
-#define CAPNP_DECLARE_SCHEMA(id) \
-    extern ::capnp::word const* const bp_##id
-
-#define CAPNP_DECLARE_ENUM(type, id) \
+#define CAPNP_DECLARE_LITE_ENUM(type, id) \
     inline ::kj::String KJ_STRINGIFY(type##_##id value) { \
       return ::kj::str(static_cast<uint16_t>(value)); \
     } \
@@ -349,15 +344,25 @@ inline constexpr uint sizeInWords() {
       static constexpr uint64_t typeId = 0x##id; \
       static inline ::capnp::word const* encodedSchema() { return bp_##id; } \
     }
+// Used directly for enums in files annotated with $Cxx.lite, which have no schema to refer to even
+// in full mode.
 
 #if _MSC_VER
 // TODO(msvc): MSVC dosen't expect constexprs to have definitions.
-#define CAPNP_DEFINE_ENUM(type, id)
+#define CAPNP_DEFINE_LITE_ENUM(type, id)
 #else
-#define CAPNP_DEFINE_ENUM(type, id) \
+#define CAPNP_DEFINE_LITE_ENUM(type, id) \
     constexpr uint64_t EnumInfo<type>::typeId
 #endif
 
+#if CAPNP_LITE
+
+#define CAPNP_DECLARE_SCHEMA(id) \
+    extern ::capnp::word const* const bp_##id
+
+#define CAPNP_DECLARE_ENUM(type, id) CAPNP_DECLARE_LITE_ENUM(type, id)
+#define CAPNP_DEFINE_ENUM(type, id) CAPNP_DEFINE_LITE_ENUM(type, id)
+
 #define CAPNP_DECLARE_STRUCT_HEADER(id, dataWordSize_, pointerCount_) \
       struct IsStruct; \
       static constexpr uint64_t typeId = 0x##id; \
@@ -409,6 +409,22 @@ TEST(WireFormat, NanPatching) {
   EXPECT_EQ(0x7ff8000000000000ull, mask(unmask<double>(0x7ff8000000000000ull, 0), 0));
 }
 
+TEST(WireFormat, DefaultMasksAreConstexpr) {
+  // The integer versions can be evaluated at compile time.
+  static_assert(mask<uint32_t>(123u, 123u) == 0u, "default should encode as zero");
+  static_assert(unmask<uint32_t>(0u, 123u) == 123u, "zero should decode as default");
+  static_assert(unmask<int64_t>(mask<int64_t>(-5ll, 42ll), 42ll) == -5ll, "round trip");
+  static_assert(unmask<bool>(false, true) == true, "bool default");
+  static_assert(unmask<uint16_t>(mask<uint16_t>(7u, 0u), 0u) == 7u, "zero mask is identity");
+
+  word segment[2];
+  memset(segment, 0, sizeof(segment));
+  auto data = reinterpret_cast<WireValue<uint32_t>*>(segment);
+  data[1].set(mask<uint32_t>(456u, 123u));
+  EXPECT_EQ(123u, unmask<uint32_t>(data[0].get(), 123u));
+  EXPECT_EQ(456u, unmask<uint32_t>(data[1].get(), 123u));
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -248,13 +248,18 @@ template <typename T> struct Mask_<T, Kind::OTHER> {
 template <typename T>
 using Mask = typename Mask_<T>::Type;
 
+// Data fields are stored XORed with their default value, so that a freshly-allocated (zeroed)
+// struct already holds all of its defaults.  The integer, enum and bool versions of mask() and
+// unmask() are constexpr, so they can be used in constant expressions; floating-point values are
+// bit-cast and so are not.
+
 template <typename T>
-KJ_ALWAYS_INLINE(Mask<T> mask(T value, Mask<T> mask));
+KJ_ALWAYS_INLINE(constexpr Mask<T> mask(T value, Mask<T> mask));
 template <typename T>
-KJ_ALWAYS_INLINE(T unmask(Mask<T> value, Mask<T> mask));
+KJ_ALWAYS_INLINE(constexpr T unmask(Mask<T> value, Mask<T> mask));
 
 template <typename T>
-inline Mask<T> mask(T value, Mask<T> mask) {
+inline constexpr Mask<T> mask(T value, Mask<T> mask) {
   return static_cast<Mask<T> >(value) ^ mask;
 }
 
@@ -287,7 +292,7 @@ inline uint64_t mask<double>(double value, uint64_t mask) {
 }
 
 template <typename T>
-inline T unmask(Mask<T> value, Mask<T> mask) {
+inline constexpr T unmask(Mask<T> value, Mask<T> mask) {
   return static_cast<T>(value ^ mask);
 }
 
@@ -0,0 +1,195 @@
+// Copyright (c) 2013-2014 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "message-profile.h"
+#include "serialize.h"
+#include <kj/debug.h>
+#include <kj/test.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+const MessageProfile::Path& findPath(const MessageProfile& profile, kj::StringPtr path) {
+  for (auto& p: profile.paths) {
+    if (p.path == path) return p;
+  }
+  KJ_FAIL_ASSERT("path not in profile", path);
+}
+
+bool hasPath(const MessageProfile& profile, kj::StringPtr path) {
+  for (auto& p: profile.paths) {
+    if (p.path == path) return true;
+  }
+  return false;
+}
+
+KJ_TEST("profile attributes space to field paths") {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.setTextField("foo");
+  root.initStructList(3)[1].setTextField("bar");
+  root.setUInt16List({1, 2, 3});
+
+  auto structProto = Schema::from<TestAllTypes>().getProto().getStruct();
+  uint64_t rootWords = structProto.getDataWordCount() + structProto.getPointerCount();
+
+  SegmentArrayMessageReader reader(builder.getSegmentsForOutput());
+  auto profile = profileMessage(reader, Schema::from<TestAllTypes>());
+
+  KJ_EXPECT(profile.messageCount == 1);
+  KJ_EXPECT(profile.segmentCount == 1);
+  KJ_EXPECT(profile.orphanedWords == 0);
+  KJ_EXPECT(profile.reachableWords == profile.totalWords);
+  KJ_EXPECT(profile.farPointerCount == 0);
+  KJ_EXPECT(profile.segmentCrossingCount == 0);
+
+  auto& rootPath = findPath(profile, "<root>");
+  KJ_EXPECT(rootPath.objectCount == 1);
+  KJ_EXPECT(rootPath.ownWords == rootWords);
+  KJ_EXPECT(rootPath.totalWords == profile.totalWords - 1);  // everything but the root pointer
+  KJ_EXPECT(profile.paths[0].path == "<root>");
+
+  auto& text = findPath(profile, "textField");
+  KJ_EXPECT(text.objectCount == 1);
+  KJ_EXPECT(text.ownWords == 1);
+  KJ_EXPECT(text.paddingBytes == 4);  // "foo" plus NUL in an 8-byte word
+
+  auto& list = findPath(profile, "structList");
+  KJ_EXPECT(list.objectCount == 1);
+  KJ_EXPECT(list.ownWords == 1 + 3 * rootWords);
+  KJ_EXPECT(list.totalWords == 1 + 3 * rootWords + 1);
+
+  auto& elements = findPath(profile, "structList[]");
+  KJ_EXPECT(elements.objectCount == 3);
+  KJ_EXPECT(elements.ownWords == 3 * rootWords);
+
+  auto& nested = findPath(profile, "structList[].textField");
+  KJ_EXPECT(nested.objectCount == 1);
+  KJ_EXPECT(nested.ownWords == 1);
+
+  auto& shorts = findPath(profile, "uInt16List");
+  KJ_EXPECT(shorts.ownWords == 1);
+  KJ_EXPECT(shorts.paddingBytes == 2);
+
+  KJ_EXPECT(!hasPath(profile, "dataField"));
+}
+
+KJ_TEST("profile counts orphaned space") {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.setTextField("some text that is longer than a word");
+  root.disownTextField();
+
+  SegmentArrayMessageReader reader(builder.getSegmentsForOutput());
+  auto profile = profileMessage(reader, Schema::from<TestAllTypes>());
+
+  KJ_EXPECT(profile.orphanedWords == 5);
+  KJ_EXPECT(profile.reachableWords + profile.orphanedWords == profile.totalWords);
+  KJ_EXPECT(!hasPath(profile, "textField"));
+}
+
+KJ_TEST("profile counts far pointers") {
+  MallocMessageBuilder builder(1, AllocationStrategy::FIXED_SIZE);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  SegmentArrayMessageReader reader(builder.getSegmentsForOutput());
+  auto profile = profileMessage(reader, Schema::from<TestAllTypes>());
+
+  KJ_EXPECT(profile.segmentCount > 1);
+  KJ_EXPECT(profile.firstSegmentWords == 1);
+  KJ_EXPECT(profile.farPointerCount + profile.doubleFarPointerCount > 0);
+  KJ_EXPECT(profile.segmentCrossingCount > 0);
+  KJ_EXPECT(profile.landingPadWords ==
+            profile.farPointerCount + 2 * profile.doubleFarPointerCount);
+  KJ_EXPECT(profile.orphanedWords == 0);
+
+  // Same content as a single segment, minus the landing pads.
+  MallocMessageBuilder flatBuilder;
+  initTestMessage(flatBuilder.initRoot<TestAllTypes>());
+  SegmentArrayMessageReader flatReader(flatBuilder.getSegmentsForOutput());
+  auto flatProfile = profileMessage(flatReader, Schema::from<TestAllTypes>());
+  KJ_EXPECT(flatProfile.farPointerCount == 0);
+  KJ_EXPECT(profile.reachableWords == flatProfile.reachableWords + profile.landingPadWords);
+  KJ_EXPECT(findPath(profile, "structList[]").ownWords ==
+            findPath(flatProfile, "structList[]").ownWords);
+}
+
+KJ_TEST("profile accumulates over messages") {
+  MessageProfiler profiler;
+  for (uint i = 0; i < 3; i++) {
+    MallocMessageBuilder builder;
+    builder.initRoot<TestAllTypes>().setTextField("foo");
+    SegmentArrayMessageReader reader(builder.getSegmentsForOutput());
+    profiler.add(reader, Schema::from<TestAllTypes>());
+  }
+
+  auto profile = profiler.getProfile();
+  KJ_EXPECT(profile.messageCount == 3);
+  KJ_EXPECT(findPath(profile, "textField").objectCount == 3);
+  KJ_EXPECT(kj::str(profile).startsWith("messages: 3;"));
+}
+
+KJ_TEST("profile counts empty segments") {
+  AlignedData<1> words = {{0, 0, 0, 0, 0, 0, 0, 0}};
+
+  {
+    // A message whose only segment is empty has a null root.
+    kj::ArrayPtr<const word> segments[1] = {kj::arrayPtr(words.words, 0)};
+    SegmentArrayMessageReader reader(kj::arrayPtr(segments, 1));
+    auto profile = profileMessage(reader, Schema::from<TestAllTypes>());
+    KJ_EXPECT(profile.segmentCount == 1);
+    KJ_EXPECT(profile.totalWords == 0);
+    KJ_EXPECT(profile.reachableWords == 0);
+    KJ_EXPECT(kj::str(profile).startsWith("messages: 1; segments: 1 "));
+  }
+
+  {
+    // Empty segments ahead of a non-empty one don't end the message.
+    kj::ArrayPtr<const word> segments[3] = {
+      kj::arrayPtr(words.words, 1), kj::arrayPtr(words.words, 0), kj::arrayPtr(words.words, 1)
+    };
+    SegmentArrayMessageReader reader(kj::arrayPtr(segments, 3));
+    auto profile = profileMessage(reader, Schema::from<TestAllTypes>());
+    KJ_EXPECT(profile.segmentCount == 3);
+    KJ_EXPECT(profile.totalWords == 2);
+    KJ_EXPECT(profile.reachableWords == 1);
+    KJ_EXPECT(profile.orphanedWords == 1);
+  }
+}
+
+KJ_TEST("profile rejects out-of-bounds pointers") {
+  AlignedData<2> segment = {{
+    // Struct pointer to 16 data words, but the segment only has one word after it.
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  }};
+  kj::ArrayPtr<const word> segments[1] = {kj::arrayPtr(segment.words, 2)};
+  SegmentArrayMessageReader reader(kj::arrayPtr(segments, 1));
+
+  KJ_EXPECT_THROW_MESSAGE("out-of-bounds",
+      profileMessage(reader, Schema::from<TestAllTypes>()));
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,664 @@
+// Copyright (c) 2013-2014 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "message-profile.h"
+#include "endian.h"
+#include <kj/debug.h>
+#include <kj/vector.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+
+namespace capnp {
+
+namespace {
+
+static constexpr size_t NO_PATH = kj::maxValue;
+// Passed as the path of objects that are already accounted for by an enclosing AnyPointer.
+
+struct StructLayout {
+  // What the schema knows about a struct's data section.
+
+  uint dataWordCount;
+
+  kj::Array<uint64_t> unusedBitsBefore;
+  // unusedBitsBefore[i] is the number of bits in the first `i` data words which no field (or
+  // union discriminant) of the schema occupies.
+};
+
+uint dataFieldBits(schema::Type::Which type) {
+  switch (type) {
+    case schema::Type::VOID: return 0;
+    case schema::Type::BOOL: return 1;
+    case schema::Type::INT8: return 8;
+    case schema::Type::INT16: return 16;
+    case schema::Type::INT32: return 32;
+    case schema::Type::INT64: return 64;
+    case schema::Type::UINT8: return 8;
+    case schema::Type::UINT16: return 16;
+    case schema::Type::UINT32: return 32;
+    case schema::Type::UINT64: return 64;
+    case schema::Type::FLOAT32: return 32;
+    case schema::Type::FLOAT64: return 64;
+    case schema::Type::ENUM: return 16;
+    default: return 0;
+  }
+}
+
+bool isPointerType(schema::Type::Which type) {
+  switch (type) {
+    case schema::Type::TEXT:
+    case schema::Type::DATA:
+    case schema::Type::LIST:
+    case schema::Type::STRUCT:
+    case schema::Type::INTERFACE:
+    case schema::Type::ANY_POINTER:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void markUsedBits(StructSchema schema, kj::ArrayPtr<bool> used) {
+  auto structProto = schema.getProto().getStruct();
+  if (structProto.getDiscriminantCount() > 0) {
+    uint offset = structProto.getDiscriminantOffset() * 16;
+    for (uint i = offset; i < offset + 16 && i < used.size(); i++) used[i] = true;
+  }
+
+  for (auto field: schema.getFields()) {
+    auto proto = field.getProto();
+    switch (proto.which()) {
+      case schema::Field::SLOT: {
+        uint bits = dataFieldBits(proto.getSlot().getType().which());
+        uint64_t offset = uint64_t(proto.getSlot().getOffset()) * bits;
+        for (uint64_t i = offset; i < offset + bits && i < used.size(); i++) used[i] = true;
+        break;
+      }
+      case schema::Field::GROUP:
+        markUsedBits(field.getType().asStruct(), used);
+        break;
+    }
+  }
+}
+
+StructLayout makeLayout(StructSchema schema) {
+  uint dataWordCount = schema.getProto().getStruct().getDataWordCount();
+  auto used = kj::heapArray<bool>(dataWordCount * 64);
+  for (auto& bit: used) bit = false;
+  markUsedBits(schema, used);
+
+  auto unusedBitsBefore = kj::heapArray<uint64_t>(dataWordCount + 1);
+  unusedBitsBefore[0] = 0;
+  for (uint i = 0; i < dataWordCount; i++) {
+    uint64_t unused = 0;
+    for (uint j = 0; j < 64; j++) {
+      if (!used[i * 64 + j]) ++unused;
+    }
+    unusedBitsBefore[i + 1] = unusedBitsBefore[i] + unused;
+  }
+
+  return { dataWordCount, kj::mv(unusedBitsBefore) };
+}
+
+}  // namespace
+
+struct MessageProfiler::Impl {
+  struct Node {
+    size_t parent;
+    kj::String name;
+    MessageProfile::Path stats;
+  };
+
+  kj::Vector<Node> nodes;
+  // Node 0 is the root.
+
+  std::map<std::pair<size_t, kj::StringPtr>, size_t> children;
+  // Maps (parent, name) to a node. The names point into `nodes`.
+
+  std::map<uint64_t, StructLayout> layouts;
+  // Keyed by struct type ID.
+
+  MessageProfile totals;
+  // Everything but `paths`.
+
+  Impl() {
+    nodes.add(Node { NO_PATH, kj::heapString("<root>"), {} });
+    nodes.back().stats.path = kj::heapString("<root>");
+  }
+
+  size_t child(size_t parent, kj::StringPtr name) {
+    if (parent == NO_PATH) return NO_PATH;
+
+    auto iter = children.find(std::make_pair(parent, name));
+    if (iter != children.end()) return iter->second;
+
+    kj::String path;
+    if (parent == 0) {
+      path = kj::heapString(name);
+    } else if (name == "[]") {
+      path = kj::str(nodes[parent].stats.path, name);
+    } else {
+      path = kj::str(nodes[parent].stats.path, '.', name);
+    }
+
+    size_t index = nodes.size();
+    nodes.add(Node { parent, kj::heapString(name), {} });
+    nodes.back().stats.path = kj::mv(path);
+    auto key = std::make_pair(parent, kj::StringPtr(nodes.back().name));
+    children.insert(std::make_pair(key, index));
+    return index;
+  }
+
+  const StructLayout& getLayout(StructSchema schema) {
+    uint64_t id = schema.getProto().getId();
+    auto iter = layouts.find(id);
+    if (iter == layouts.end()) {
+      iter = layouts.insert(std::make_pair(id, makeLayout(schema))).first;
+    }
+    return iter->second;
+  }
+
+  void addPadding(size_t node, uint64_t bytes) {
+    totals.paddingBytes += bytes;
+    if (node != NO_PATH) nodes[node].stats.paddingBytes += bytes;
+  }
+};
+
+class MessageProfiler::Walker {
+  // Walks one message, adding what it finds to a MessageProfiler::Impl.
+
+public:
+  Walker(MessageProfiler::Impl& profiler, MessageReader& message)
+      : profiler(profiler), nestingLimit(message.getOptions().nestingLimit) {
+    for (uint i = 0;; i++) {
+      auto segment = message.getSegment(i);
+      // A zero-length segment is still a segment; only a null pointer means there are no more.
+      // (`segment == nullptr` would be true for both.)
+      if (segment.begin() == nullptr) break;
+      auto reached = kj::heapArray<bool>(segment.size());
+      for (auto& word: reached) word = false;
+      segments.add(Segment { segment, kj::mv(reached) });
+    }
+  }
+
+  void walk(StructSchema rootType) {
+    auto& totals = profiler.totals;
+    ++totals.messageCount;
+    totals.segmentCount += segments.size();
+
+    uint64_t totalWords = 0;
+    for (auto& segment: segments) {
+      totalWords += segment.words.size();
+    }
+    totals.totalWords += totalWords;
+
+    uint64_t reachableWords = 0;
+    if (segments.size() > 0) {
+      totals.firstSegmentWords += segments[0].words.size();
+    }
+    if (segments.size() > 0 && segments[0].words.size() > 0) {
+      // An empty first segment has no root pointer, which readers treat as a null root.
+      reachableWords = mark(0, segments[0].words.begin(), 1) +
+          visitPointer(0, segments[0].words.begin(), Type(rootType), 0, 0);
+    }
+
+    totals.reachableWords += reachableWords;
+    totals.orphanedWords += totalWords - reachableWords;
+  }
+
+private:
+  struct Segment {
+    kj::ArrayPtr<const word> words;
+    kj::Array<bool> reached;
+  };
+
+  enum PointerKind {
+    STRUCT = 0,
+    LIST = 1,
+    FAR = 2,
+    OTHER = 3
+  };
+
+  enum ElementSize {
+    VOID = 0,
+    BIT = 1,
+    BYTE = 2,
+    TWO_BYTES = 3,
+    FOUR_BYTES = 4,
+    EIGHT_BYTES = 5,
+    POINTER = 6,
+    INLINE_COMPOSITE = 7
+  };
+
+  MessageProfiler::Impl& profiler;
+  int nestingLimit;
+  kj::Vector<Segment> segments;
+
+  static uint32_t lowerHalf(const word* ptr) {
+    return reinterpret_cast<const _::WireValue<uint32_t>*>(ptr)[0].get();
+  }
+  static uint32_t upperHalf(const word* ptr) {
+    return reinterpret_cast<const _::WireValue<uint32_t>*>(ptr)[1].get();
+  }
+  static int32_t offsetOf(uint32_t lower) {
+    return int32_t(lower) >> 2;
+  }
+
+  Segment& getSegment(uint32_t id) {
+    KJ_REQUIRE(id < segments.size(), "Message contains far pointer to unknown segment.");
+    return segments[id];
+  }
+
+  void checkBounds(const Segment& segment, const word* start, uint64_t size) {
+    KJ_REQUIRE(start >= segment.words.begin() && start <= segment.words.end() &&
+               size <= uint64_t(segment.words.end() - start),
+               "Message contains out-of-bounds pointer.");
+  }
+
+  uint64_t mark(uint32_t segmentId, const word* start, uint64_t size) {
+    // Marks the words as reached, returning how many weren't already.
+
+    auto& segment = segments[segmentId];
+    bool* reached = segment.reached.begin() + (start - segment.words.begin());
+    uint64_t result = 0;
+    for (uint64_t i = 0; i < size; i++) {
+      if (!reached[i]) {
+        reached[i] = true;
+        ++result;
+      }
+    }
+    return result;
+  }
+
+  bool alreadyReached(uint32_t segmentId, const word* start) {
+    auto& segment = segments[segmentId];
+    return segment.reached[start - segment.words.begin()];
+  }
+
+  void count(size_t node, uint64_t objects, uint64_t ownWords, uint64_t totalWords) {
+    if (node == NO_PATH) return;
+    auto& stats = profiler.nodes[node].stats;
+    stats.objectCount += objects;
+    stats.ownWords += ownWords;
+    stats.totalWords += totalWords;
+  }
+
+  uint64_t visitPointer(uint32_t segmentId, const word* ptr, kj::Maybe<Type> type,
+                        size_t node, int depth) {
+    // Follows the pointer at `ptr`, which has type `type` (null if unknown), attributing what it
+    // finds to `node`. Returns the number of words newly reached, not counting the pointer itself.
+
+    uint32_t lower = lowerHalf(ptr);
+    uint32_t upper = upperHalf(ptr);
+    if (lower == 0 && upper == 0) return 0;
+
+    KJ_REQUIRE(depth < nestingLimit, "Message is too deeply-nested or contains cycles.");
+
+    uint64_t reached = 0;
+
+    // `tag` is the pointer describing the object, and `target` is where the object starts.
+    const word* tag = ptr;
+    const word* target;
+    uint32_t targetSegmentId = segmentId;
+
+    if ((lower & 3) == FAR) {
+      bool isDouble = (lower & 4) != 0;
+      uint32_t padSegmentId = upper;
+      auto& padSegment = getSegment(padSegmentId);
+      const word* pad = padSegment.words.begin() + (lower >> 3);
+      uint padWords = isDouble ? 2 : 1;
+      checkBounds(padSegment, pad, padWords);
+
+      reached += mark(padSegmentId, pad, padWords);
+      profiler.totals.landingPadWords += padWords;
+
+      if (isDouble) {
+        ++profiler.totals.doubleFarPointerCount;
+        uint32_t padLower = lowerHalf(pad);
+        KJ_REQUIRE((padLower & 7) == FAR,
+                   "Second word of inter-segment pointer's landing pad is not a far pointer.");
+        targetSegmentId = upperHalf(pad);
+        target = getSegment(targetSegmentId).words.begin() + (padLower >> 3);
+        tag = pad + 1;
+      } else {
+        ++profiler.totals.farPointerCount;
+        KJ_REQUIRE((lowerHalf(pad) & 3) != FAR,
+                   "Far pointer's landing pad is another far pointer.");
+        targetSegmentId = padSegmentId;
+        tag = pad;
+        target = pad + 1 + offsetOf(lowerHalf(pad));
+      }
+
+      if (targetSegmentId != segmentId) {
+        ++profiler.totals.segmentCrossingCount;
+      }
+    } else {
+      target = ptr + 1 + offsetOf(lower);
+    }
+
+    lower = lowerHalf(tag);
+    upper = upperHalf(tag);
+    auto& targetSegment = getSegment(targetSegmentId);
+
+    switch (lower & 3) {
+      case STRUCT: {
+        uint dataWords = upper & 0xffff;
+        uint pointerCount = upper >> 16;
+        uint64_t size = dataWords + pointerCount;
+        checkBounds(targetSegment, target, size);
+
+        if (size > 0 && alreadyReached(targetSegmentId, target)) {
+          ++profiler.totals.sharedObjectCount;
+          return reached;
+        }
+        uint64_t ownWords = mark(targetSegmentId, target, size);
+        uint64_t childWords = 0;
+
+        kj::Maybe<StructSchema> schema;
+        KJ_IF_MAYBE(t, type) {
+          if (t->isStruct()) schema = t->asStruct();
+        }
+
+        KJ_IF_MAYBE(s, schema) {
+          childWords = visitStruct(targetSegmentId, target, dataWords, pointerCount, *s,
+                                   node, depth);
+        } else {
+          // Nothing below here has a path of its own.
+          ownWords += visitAnonymousStruct(targetSegmentId, target, dataWords, pointerCount,
+                                           depth);
+        }
+        reached += ownWords + childWords;
+        count(node, 1, ownWords, reached);
+        return reached;
+      }
+
+      case LIST: {
+        uint elementSize = upper & 7;
+        uint32_t elementCount = upper >> 3;
+
+        kj::Maybe<Type> elementType;
+        KJ_IF_MAYBE(t, type) {
+          if (t->isList()) {
+            elementType = t->asList().getElementType();
+          } else if (t->isText() || t->isData()) {
+            elementType = Type(schema::Type::UINT8);
+          }
+        }
+        uint64_t size;
+        uint64_t ownWords;
+        uint64_t childWords = 0;
+        bool childrenHavePaths = elementType != nullptr;
+
+        if (elementSize == INLINE_COMPOSITE) {
+          size = uint64_t(elementCount) + 1;
+          checkBounds(targetSegment, target, size);
+          if (alreadyReached(targetSegmentId, target)) {
+            ++profiler.totals.sharedObjectCount;
+            return reached;
+          }
+          ownWords = mark(targetSegmentId, target, size);
+
+          uint32_t tagLower = lowerHalf(target);
+          uint32_t tagUpper = upperHalf(target);
+          KJ_REQUIRE((tagLower & 3) == STRUCT,
+                     "INLINE_COMPOSITE lists of non-STRUCT type are not supported.");
+          int32_t structCount = offsetOf(tagLower);
+          uint dataWords = tagUpper & 0xffff;
+          uint pointerCount = tagUpper >> 16;
+          uint64_t stride = dataWords + pointerCount;
+          KJ_REQUIRE(structCount >= 0 && uint64_t(structCount) * stride <= elementCount,
+                     "INLINE_COMPOSITE list's elements overrun its word count.");
+
+          kj::Maybe<StructSchema> elementSchema;
+          KJ_IF_MAYBE(t, elementType) {
+            if (t->isStruct()) elementSchema = t->asStruct();
+          }
+          childrenHavePaths = elementSchema != nullptr;
+          size_t elementNode = childrenHavePaths ? profiler.child(node, "[]") : NO_PATH;
+
+          const word* element = target + 1;
+          for (int32_t i = 0; i < structCount; i++, element += stride) {
+            KJ_IF_MAYBE(s, elementSchema) {
+              childWords += visitStruct(targetSegmentId, element, dataWords, pointerCount, *s,
+                                        elementNode, depth);
+            } else {
+              childWords += visitAnonymousStruct(targetSegmentId, element, dataWords,
+                                                 pointerCount, depth);
+            }
+          }
+
+          if (childrenHavePaths) {
+            count(elementNode, structCount, uint64_t(structCount) * stride,
+                  uint64_t(structCount) * stride + childWords);
+          }
+        } else if (elementSize == POINTER) {
+          size = elementCount;
+          checkBounds(targetSegment, target, size);
+          if (size > 0 && alreadyReached(targetSegmentId, target)) {
+            ++profiler.totals.sharedObjectCount;
+            return reached;
+          }
+          ownWords = mark(targetSegmentId, target, size);
+
+          size_t elementNode = childrenHavePaths ? profiler.child(node, "[]") : NO_PATH;
+          for (uint32_t i = 0; i < elementCount; i++) {
+            childWords += visitPointer(targetSegmentId, target + i, elementType, elementNode,
+                                       depth + 1);
+          }
+        } else {
+          static const uint BITS_PER_ELEMENT[] = { 0, 1, 8, 16, 32, 64 };
+          uint64_t bits = uint64_t(elementCount) * BITS_PER_ELEMENT[elementSize];
+          size = (bits + 63) / 64;
+          checkBounds(targetSegment, target, size);
+          if (size > 0 && alreadyReached(targetSegmentId, target)) {
+            ++profiler.totals.sharedObjectCount;
+            return reached;
+          }
+          ownWords = mark(targetSegmentId, target, size);
+          profiler.addPadding(node, (size * 64 - bits) / 8);
+          childrenHavePaths = true;
+        }
+
+        if (!childrenHavePaths) {
+          // Nothing below here has a path of its own.
+          ownWords += childWords;
+          childWords = 0;
+        }
+        reached += ownWords + childWords;
+        count(node, 1, ownWords, reached);
+        return reached;
+      }
+
+      case OTHER:
+        KJ_REQUIRE(lower == OTHER, "Unknown pointer type.");
+        ++profiler.totals.capabilityCount;
+        count(node, 1, 0, reached);
+        return reached;
+
+      default:
+        KJ_FAIL_REQUIRE("Far pointer's landing pad is another far pointer.");
+    }
+  }
+
+  uint64_t visitStruct(uint32_t segmentId, const word* start, uint dataWords, uint pointerCount,
+                       StructSchema schema, size_t node, int depth) {
+    // Visits the pointers of a struct whose sections have already been counted, returning the
+    // number of words newly reached through them.
+
+    auto& layout = profiler.getLayout(schema);
+    uint64_t unusedBits = layout.unusedBitsBefore[kj::min(dataWords, layout.dataWordCount)];
+    profiler.addPadding(node, unusedBits / 8);
+
+    kj::ArrayPtr<const byte> data(reinterpret_cast<const byte*>(start), dataWords * sizeof(word));
+    const word* pointers = start + dataWords;
+
+    uint64_t reached = visitFields(segmentId, data, pointers, pointerCount, schema, node, depth);
+
+    uint schemaPointerCount = schema.getProto().getStruct().getPointerCount();
+    for (uint i = schemaPointerCount; i < pointerCount; i++) {
+      reached += visitPointer(segmentId, pointers + i, nullptr,
+                              profiler.child(node, kj::str("<ptr", i, ">")), depth + 1);
+    }
+    return reached;
+  }
+
+  uint64_t visitFields(uint32_t segmentId, kj::ArrayPtr<const byte> data, const word* pointers,
+                       uint pointerCount, StructSchema schema, size_t node, int depth) {
+    uint64_t reached = 0;
+
+    for (auto field: schema.getFields()) {
+      auto proto = field.getProto();
+
+      if (proto.getDiscriminantValue() != schema::Field::NO_DISCRIMINANT) {
+        uint offset = schema.getProto().getStruct().getDiscriminantOffset() * 2;
+        uint16_t discriminant = offset + 2 <= data.size() ?
+            reinterpret_cast<const _::WireValue<uint16_t>*>(data.begin() + offset)->get() : 0;
+        if (discriminant != proto.getDiscriminantValue()) continue;
+      }
+
+      switch (proto.which()) {
+        case schema::Field::SLOT: {
+          auto type = field.getType();
+          uint index = proto.getSlot().getOffset();
+          if (isPointerType(type.which()) && index < pointerCount) {
+            reached += visitPointer(segmentId, pointers + index, type,
+                                    profiler.child(node, proto.getName()), depth + 1);
+          }
+          break;
+        }
+        case schema::Field::GROUP:
+          reached += visitFields(segmentId, data, pointers, pointerCount,
+                                 field.getType().asStruct(),
+                                 profiler.child(node, proto.getName()), depth);
+          break;
+      }
+    }
+
+    return reached;
+  }
+
+  uint64_t visitAnonymousStruct(uint32_t segmentId, const word* start, uint dataWords,
+                                uint pointerCount, int depth) {
+    uint64_t reached = 0;
+    for (uint i = 0; i < pointerCount; i++) {
+      reached += visitPointer(segmentId, start + dataWords + i, nullptr, NO_PATH, depth + 1);
+    }
+    return reached;
+  }
+};
+
+MessageProfiler::MessageProfiler(): impl(kj::heap<Impl>()) {}
+MessageProfiler::~MessageProfiler() noexcept(false) {}
+
+void MessageProfiler::add(MessageReader& message, StructSchema rootType) {
+  Walker(*impl, message).walk(rootType);
+}
+
+MessageProfile MessageProfiler::getProfile() const {
+  auto& totals = impl->totals;
+
+  MessageProfile result;
+  result.messageCount = totals.messageCount;
+  result.segmentCount = totals.segmentCount;
+  result.firstSegmentWords = totals.firstSegmentWords;
+  result.totalWords = totals.totalWords;
+  result.reachableWords = totals.reachableWords;
+  result.orphanedWords = totals.orphanedWords;
+  result.paddingBytes = totals.paddingBytes;
+  result.farPointerCount = totals.farPointerCount;
+  result.doubleFarPointerCount = totals.doubleFarPointerCount;
+  result.landingPadWords = totals.landingPadWords;
+  result.segmentCrossingCount = totals.segmentCrossingCount;
+  result.capabilityCount = totals.capabilityCount;
+  result.sharedObjectCount = totals.sharedObjectCount;
+
+  kj::Vector<MessageProfile::Path> paths;
+  for (auto& node: impl->nodes) {
+    // Group nodes never see any objects of their own.
+    if (node.stats.objectCount == 0) continue;
+
+    MessageProfile::Path path;
+    path.path = kj::heapString(node.stats.path);
+    path.objectCount = node.stats.objectCount;
+    path.ownWords = node.stats.ownWords;
+    path.totalWords = node.stats.totalWords;
+    path.paddingBytes = node.stats.paddingBytes;
+    paths.add(kj::mv(path));
+  }
+  std::stable_sort(paths.begin(), paths.end(),
+      [](const MessageProfile::Path& a, const MessageProfile::Path& b) {
+    return a.totalWords > b.totalWords;
+  });
+  result.paths = paths.releaseAsArray();
+
+  return result;
+}
+
+MessageProfile profileMessage(MessageReader& message, StructSchema rootType) {
+  MessageProfiler profiler;
+  profiler.add(message, rootType);
+  return profiler.getProfile();
+}
+
+namespace {
+
+kj::String padLeft(kj::StringPtr text, size_t width) {
+  return kj::str(kj::repeat(' ', width - kj::min(width, text.size())), text);
+}
+
+kj::String percentOf(uint64_t part, uint64_t whole) {
+  uint64_t tenths = whole == 0 ? 0 : (part * 1000 + whole / 2) / whole;
+  return kj::str(tenths / 10, '.', tenths % 10, '%');
+}
+
+}  // namespace
+
+kj::String KJ_STRINGIFY(const MessageProfile& profile) {
+  kj::Vector<kj::String> lines;
+
+  lines.add(kj::str("messages: ", profile.messageCount,
+                    "; segments: ", profile.segmentCount,
+                    " (first segments total ", profile.firstSegmentWords, " words)"));
+  lines.add(kj::str("words: ", profile.totalWords, " total, ",
+                    profile.reachableWords, " reachable, ",
+                    profile.orphanedWords, " orphaned (",
+                    percentOf(profile.orphanedWords, profile.totalWords), ")"));
+  lines.add(kj::str("padding: ", profile.paddingBytes, " bytes (",
+                    percentOf(profile.paddingBytes, profile.totalWords * sizeof(word)), ")"));
+  lines.add(kj::str("far pointers: ", profile.farPointerCount, " single, ",
+                    profile.doubleFarPointerCount, " double, ",
+                    profile.landingPadWords, " landing pad words; ",
+                    profile.segmentCrossingCount, " segment crossings"));
+  lines.add(kj::str("capabilities: ", profile.capabilityCount,
+                    "; shared objects: ", profile.sharedObjectCount));
+  lines.add(kj::str(padLeft("total words", 12), padLeft("own words", 12), padLeft("objects", 12),
+                    padLeft("padding", 12), "  path"));
+  for (auto& path: profile.paths) {
+    lines.add(kj::str(padLeft(kj::str(path.totalWords), 12), padLeft(kj::str(path.ownWords), 12),
+                      padLeft(kj::str(path.objectCount), 12),
+                      padLeft(kj::str(path.paddingBytes), 12), "  ", path.path));
+  }
+
+  return kj::strArray(lines, "\n");
+}
+
+}  // namespace capnp
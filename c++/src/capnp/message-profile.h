@@ -0,0 +1,125 @@
+// Copyright (c) 2013-2014 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#if defined(__GNUC__) && !defined(CAPNP_HEADER_WARNINGS)
+#pragma GCC system_header
+#endif
+
+#include "message.h"
+#include "schema.h"
+
+namespace capnp {
+
+struct MessageProfile {
+  // Breakdown of where the space in one or more messages goes. Unlike `MessageReader::totalSize()`,
+  // this walks the raw encoding with the help of the schema, so it can attribute space to field
+  // paths and see far pointers, padding, and space that isn't reachable from the root at all.
+  //
+  // Sizes are in words (8 bytes) unless the name says otherwise.
+
+  struct Path {
+    kj::String path;
+    // Field path relative to the root, like "foo.bar[].baz", where "[]" means all elements of a
+    // list and "<ptrN>" means pointer slot N of a struct newer than the schema. The root itself
+    // is "<root>".
+
+    uint64_t objectCount = 0;
+    // Number of non-null pointers found at this path. For "[]" paths, number of struct elements.
+
+    uint64_t ownWords = 0;
+    // Space taken by the objects themselves: struct data and pointer sections, list contents, and
+    // list tags. For AnyPointer fields, whose contents have no schema, this is everything
+    // reachable from the pointer.
+
+    uint64_t totalWords = 0;
+    // `ownWords` plus everything reachable from the objects, including far pointer landing pads.
+
+    uint64_t paddingBytes = 0;
+    // Bytes within `ownWords` that hold nothing: data section bits not used by any field in the
+    // schema, and the unused tail of lists of sub-word elements.
+  };
+
+  uint64_t messageCount = 0;
+  uint64_t segmentCount = 0;
+
+  uint64_t firstSegmentWords = 0;
+  // Size of each message's first segment, summed.
+
+  uint64_t totalWords = 0;
+  // Size of all segments.
+
+  uint64_t reachableWords = 0;
+  // Words reachable from the root, counting the root pointer and far pointer landing pads.
+
+  uint64_t orphanedWords = 0;
+  // `totalWords - reachableWords`: space left behind by orphaned, disowned or re-initialized
+  // objects.
+
+  uint64_t paddingBytes = 0;
+  // Sum of `Path::paddingBytes` over all paths.
+
+  uint64_t farPointerCount = 0;
+  uint64_t doubleFarPointerCount = 0;
+  uint64_t landingPadWords = 0;
+
+  uint64_t segmentCrossingCount = 0;
+  // Number of pointers whose target is in a different segment than the pointer itself.
+
+  uint64_t capabilityCount = 0;
+
+  uint64_t sharedObjectCount = 0;
+  // Pointers to objects which were already reached through another pointer. These are legal, but
+  // MessageBuilder never produces them. They are counted but not followed again.
+
+  kj::Array<Path> paths;
+  // Sorted by `totalWords`, largest first.
+};
+
+class MessageProfiler {
+  // Accumulates a MessageProfile over any number of messages.
+
+public:
+  MessageProfiler();
+  ~MessageProfiler() noexcept(false);
+  KJ_DISALLOW_COPY(MessageProfiler);
+
+  void add(MessageReader& message, StructSchema rootType);
+  // Walk `message`, whose root has type `rootType`, and add it to the profile. Throws if the
+  // message is malformed, or nested deeper than its ReaderOptions allow. Its traversal limit is
+  // not consulted, since each word is visited at most once anyway.
+
+  MessageProfile getProfile() const;
+
+private:
+  struct Impl;
+  class Walker;
+  kj::Own<Impl> impl;
+};
+
+MessageProfile profileMessage(MessageReader& message, StructSchema rootType);
+// Profile a single message.
+
+kj::String KJ_STRINGIFY(const MessageProfile& profile);
+// Human-readable report, with one line per path.
+
+}  // namespace capnp
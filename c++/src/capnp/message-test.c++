@@ -168,6 +168,150 @@ TEST(Message, ReadWriteDataStruct) {
   checkTestMessageAllZero(defaultValue<TestAllTypes>());
 }
 
+size_t totalWords(MessageBuilder& builder) {
+  size_t result = 0;
+  for (auto segment: builder.getSegmentsForOutput()) {
+    result += segment.size();
+  }
+  return result;
+}
+
+TEST(Message, Compact) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+  size_t expectedWords = root.totalSize().wordCount + 1;
+
+  // Overwrite some fields, leaving garbage behind.
+  for (uint i = 0; i < 10; i++) {
+    root.setTextField(kj::str("some text which takes up a few words ", i));
+    root.initStructList(3);
+    root.disownDataField();
+  }
+  initTestMessage(root);
+  size_t wordsBefore = totalWords(builder);
+  EXPECT_GT(wordsBefore, expectedWords);
+
+  auto firstSegment = builder.getSegmentsForOutput()[0].begin();
+  EXPECT_EQ((wordsBefore - expectedWords) * sizeof(word), builder.compact());
+
+  EXPECT_EQ(1u, builder.getSegmentsForOutput().size());
+  EXPECT_EQ(expectedWords, totalWords(builder));
+  EXPECT_EQ(firstSegment, builder.getSegmentsForOutput()[0].begin());
+  checkTestMessage(builder.getRoot<TestAllTypes>());
+
+  // Nothing left to reclaim.
+  EXPECT_EQ(0u, builder.compact());
+  checkTestMessage(builder.getRoot<TestAllTypes>());
+
+  // The message can still be modified afterwards.
+  builder.getRoot<TestAllTypes>().setTextField("foo");
+  EXPECT_EQ("foo", builder.getRoot<TestAllTypes>().getTextField());
+}
+
+TEST(Message, CompactMultiSegment) {
+  MallocMessageBuilder builder(0, AllocationStrategy::FIXED_SIZE);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  EXPECT_GT(builder.getSegmentsForOutput().size(), 1u);
+
+  EXPECT_GT(builder.compact(), 0u);
+
+  // The first segment was too small to reuse, so we got a new one big enough for everything.
+  EXPECT_EQ(1u, builder.getSegmentsForOutput().size());
+  checkTestMessage(builder.getRoot<TestAllTypes>());
+}
+
+TEST(Message, CompactWithFirstSegment) {
+  word scratch[16];
+  memset(scratch, 0, sizeof(scratch));
+
+  {
+    MallocMessageBuilder builder(kj::arrayPtr(scratch, 16));
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    builder.compact();
+    checkTestMessage(builder.getRoot<TestAllTypes>());
+    EXPECT_EQ(1u, builder.getSegmentsForOutput().size());
+    EXPECT_NE(scratch, builder.getSegmentsForOutput()[0].begin());
+
+    // The scratch space, which was too small, was handed back zeroed.
+    for (auto& w: scratch) {
+      EXPECT_EQ(0u, *reinterpret_cast<uint64_t*>(&w));
+    }
+  }
+
+  {
+    MallocMessageBuilder builder(kj::arrayPtr(scratch, 16));
+    auto root = builder.getRoot<AnyPointer>();
+    root.setAs<Text>("some text which takes up a few words");
+    root.setAs<Text>("foo");
+    EXPECT_EQ(5 * sizeof(word), builder.compact());
+    EXPECT_EQ(scratch, builder.getSegmentsForOutput()[0].begin());
+    EXPECT_EQ("foo", builder.getRoot<AnyPointer>().getAs<Text>());
+  }
+
+  // The destructor zeroed the scratch space again.
+  for (auto& w: scratch) {
+    EXPECT_EQ(0u, *reinterpret_cast<uint64_t*>(&w));
+  }
+}
+
+TEST(Message, SizeHint) {
+  MessageSizeHint hint(0, 16);
+  EXPECT_EQ(16u, hint.getFirstSegmentWords());
+
+  size_t words;
+  {
+    MallocMessageBuilder builder(hint);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    EXPECT_GT(builder.getSegmentsForOutput().size(), 1u);
+    words = totalWords(builder);
+  }
+
+  // The hint grew to fit the message, so the next one is built in a single segment.
+  EXPECT_GE(hint.getFirstSegmentWords(), words);
+  {
+    MallocMessageBuilder builder(hint);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    EXPECT_EQ(1u, builder.getSegmentsForOutput().size());
+  }
+
+  auto stats = hint.getStats();
+  EXPECT_EQ(2u, stats.messageCount);
+  EXPECT_EQ(1u, stats.multiSegmentMessageCount);
+  EXPECT_GT(stats.extraSegmentCount, 0u);
+  EXPECT_EQ(words, stats.maxWords);
+
+  // Small messages make it shrink back, slowly.
+  uint before = hint.getFirstSegmentWords();
+  for (uint i = 0; i < 10; i++) {
+    MallocMessageBuilder builder(hint);
+    builder.initRoot<TestAllTypes>();
+  }
+  EXPECT_LT(hint.getFirstSegmentWords(), before);
+  EXPECT_GE(hint.getFirstSegmentWords(), before / 2);
+  EXPECT_EQ(1u, hint.getStats().multiSegmentMessageCount);
+}
+
+TEST(Message, SizeHintForType) {
+  auto& hint = messageSizeHint<TestAllTypes>();
+  EXPECT_EQ(&hint, &messageSizeHint<TestAllTypes>());
+
+  {
+    MallocMessageBuilder builder(hint);
+    builder.initRoot<TestAllTypes>().setTextField("foo");
+  }
+
+  bool found = false;
+  for (auto& stats: MessageSizeHint::getAllStats()) {
+    if (stats.typeId == typeId<TestAllTypes>()) {
+      EXPECT_FALSE(found);
+      found = true;
+      EXPECT_GE(stats.messageCount, 1u);
+    }
+  }
+  EXPECT_TRUE(found);
+}
+
 // TODO(test):  More tests.
 
 }  // namespace
@@ -22,6 +22,7 @@
 #define CAPNP_PRIVATE
 #include "message.h"
 #include <kj/debug.h>
+#include <kj/vector.h>
 #include "arena.h"
 #include "orphan.h"
 #include <stdlib.h>
@@ -116,6 +117,13 @@ MessageBuilder::~MessageBuilder() noexcept(false) {
   }
 }
 
+void MessageBuilder::resetArena() {
+  if (allocatedArena) {
+    kj::dtor(*arena());
+    allocatedArena = false;
+  }
+}
+
 MessageBuilder::MessageBuilder(kj::ArrayPtr<SegmentInit> segments)
     : allocatedArena(false) {
   kj::ctor(*arena(), this, segments);
@@ -199,6 +207,81 @@ kj::ArrayPtr<const word> SegmentArrayMessageReader::getSegment(uint id) {
 
 // -------------------------------------------------------------------
 
+namespace {
+
+kj::MutexGuarded<kj::Vector<MessageSizeHint*>>& sizeHintRegistry() {
+  static kj::MutexGuarded<kj::Vector<MessageSizeHint*>> registry;
+  return registry;
+}
+
+}  // namespace
+
+MessageSizeHint::MessageSizeHint(uint64_t typeId, uint initialWords): typeId(typeId) {
+  KJ_REQUIRE(bounded(initialWords) * WORDS <= MAX_SEGMENT_WORDS,
+      "MessageSizeHint initial size is above maximum segment size.");
+  state.getWithoutLock().firstSegmentWords = initialWords;
+  sizeHintRegistry().lockExclusive()->add(this);
+}
+
+MessageSizeHint::~MessageSizeHint() noexcept(false) {
+  auto registry = sizeHintRegistry().lockExclusive();
+  for (auto& hint: *registry) {
+    if (hint == this) {
+      hint = registry->back();
+      registry->removeLast();
+      break;
+    }
+  }
+}
+
+uint MessageSizeHint::getFirstSegmentWords() const {
+  return state.lockShared()->firstSegmentWords;
+}
+
+void MessageSizeHint::record(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  uint64_t words = 0;
+  for (auto segment: segments) {
+    words += segment.size();
+  }
+  if (words == 0) return;
+
+  // Leave a quarter again as headroom, so that a message slightly bigger than the biggest seen so
+  // far still fits.
+  uint64_t target = kj::min(words + words / 4, uint64_t(unbound(MAX_SEGMENT_WORDS / WORDS)));
+
+  auto lock = state.lockExclusive();
+  ++lock->messageCount;
+  lock->totalWords += words;
+  lock->maxWords = kj::max(lock->maxWords, words);
+  if (segments.size() > 1) {
+    ++lock->multiSegmentMessageCount;
+    lock->extraSegmentCount += segments.size() - 1;
+  }
+
+  if (words > lock->firstSegmentWords) {
+    // Didn't fit. Grow right away.
+    lock->firstSegmentWords = target;
+  } else if (target < lock->firstSegmentWords) {
+    // Shrink slowly, so that the suggestion settles near the biggest recent messages.
+    lock->firstSegmentWords -= (lock->firstSegmentWords - target) / 64;
+  }
+}
+
+MessageSizeHint::Stats MessageSizeHint::getStats() const {
+  auto lock = state.lockShared();
+  return {
+    typeId, lock->firstSegmentWords, lock->messageCount, lock->totalWords, lock->maxWords,
+    lock->multiSegmentMessageCount, lock->extraSegmentCount
+  };
+}
+
+kj::Array<MessageSizeHint::Stats> MessageSizeHint::getAllStats() {
+  auto registry = sizeHintRegistry().lockShared();
+  return KJ_MAP(hint, *registry) { return hint->getStats(); };
+}
+
+// -------------------------------------------------------------------
+
 struct MallocMessageBuilder::MoreSegments {
   std::vector<void*> segments;
 };
@@ -206,12 +289,14 @@ struct MallocMessageBuilder::MoreSegments {
 MallocMessageBuilder::MallocMessageBuilder(
     uint firstSegmentWords, AllocationStrategy allocationStrategy)
     : nextSize(firstSegmentWords), allocationStrategy(allocationStrategy),
-      ownFirstSegment(true), returnedFirstSegment(false), firstSegment(nullptr) {}
+      ownFirstSegment(true), returnedFirstSegment(false), firstSegment(nullptr),
+      firstSegmentSize(0) {}
 
 MallocMessageBuilder::MallocMessageBuilder(
     kj::ArrayPtr<word> firstSegment, AllocationStrategy allocationStrategy)
     : nextSize(firstSegment.size()), allocationStrategy(allocationStrategy),
-      ownFirstSegment(false), returnedFirstSegment(false), firstSegment(firstSegment.begin()) {
+      ownFirstSegment(false), returnedFirstSegment(false), firstSegment(firstSegment.begin()),
+      firstSegmentSize(firstSegment.size()) {
   KJ_REQUIRE(firstSegment.size() > 0, "First segment size must be non-zero.");
 
   // Checking just the first word should catch most cases of failing to zero the segment.
@@ -219,24 +304,33 @@ MallocMessageBuilder::MallocMessageBuilder(
           "First segment must be zeroed.");
 }
 
+MallocMessageBuilder::MallocMessageBuilder(
+    MessageSizeHint& sizeHint, AllocationStrategy allocationStrategy)
+    : MallocMessageBuilder(sizeHint.getFirstSegmentWords(), allocationStrategy) {
+  this->sizeHint = sizeHint;
+}
+
 MallocMessageBuilder::~MallocMessageBuilder() noexcept(false) {
-  if (returnedFirstSegment) {
-    if (ownFirstSegment) {
-      free(firstSegment);
-    } else {
-      // Must zero first segment.
-      kj::ArrayPtr<const kj::ArrayPtr<const word>> segments = getSegmentsForOutput();
-      if (segments.size() > 0) {
-        KJ_ASSERT(segments[0].begin() == firstSegment,
-            "First segment in getSegmentsForOutput() is not the first segment allocated?");
-        memset(firstSegment, 0, segments[0].size() * sizeof(word));
-      }
+  KJ_IF_MAYBE(h, sizeHint) {
+    h->record(getSegmentsForOutput());
+  }
+
+  if (ownFirstSegment) {
+    // Note that compact() may leave us holding a first segment we haven't returned yet.
+    free(firstSegment);
+  } else if (returnedFirstSegment) {
+    // Must zero first segment.
+    kj::ArrayPtr<const kj::ArrayPtr<const word>> segments = getSegmentsForOutput();
+    if (segments.size() > 0) {
+      KJ_ASSERT(segments[0].begin() == firstSegment,
+          "First segment in getSegmentsForOutput() is not the first segment allocated?");
+      memset(firstSegment, 0, segments[0].size() * sizeof(word));
     }
+  }
 
-    KJ_IF_MAYBE(s, moreSegments) {
-      for (void* ptr: s->get()->segments) {
-        free(ptr);
-      }
+  KJ_IF_MAYBE(s, moreSegments) {
+    for (void* ptr: s->get()->segments) {
+      free(ptr);
     }
   }
 }
@@ -247,15 +341,17 @@ kj::ArrayPtr<word> MallocMessageBuilder::allocateSegment(uint minimumSize) {
   KJ_ASSERT(bounded(nextSize) * WORDS <= MAX_SEGMENT_WORDS,
       "MallocMessageBuilder nextSize out of bounds.");
 
-  if (!returnedFirstSegment && !ownFirstSegment) {
-    kj::ArrayPtr<word> result = kj::arrayPtr(reinterpret_cast<word*>(firstSegment), nextSize);
+  if (!returnedFirstSegment && firstSegment != nullptr) {
+    // Either the caller provided the first segment, or compact() kept the one we had.
+    kj::ArrayPtr<word> result =
+        kj::arrayPtr(reinterpret_cast<word*>(firstSegment), firstSegmentSize);
     if (result.size() >= minimumSize) {
       returnedFirstSegment = true;
       return result;
     }
-    // If the provided first segment wasn't big enough, we discard it and proceed to allocate
-    // our own.  This never happens in practice since minimumSize is always 1 for the first
-    // segment.
+    // If the first segment wasn't big enough, we discard it and proceed to allocate our own.
+    // This never happens in practice since minimumSize is always 1 for the first segment.
+    if (ownFirstSegment) free(firstSegment);
     ownFirstSegment = true;
   }
 
@@ -268,6 +364,7 @@ kj::ArrayPtr<word> MallocMessageBuilder::allocateSegment(uint minimumSize) {
 
   if (!returnedFirstSegment) {
     firstSegment = result;
+    firstSegmentSize = size;
     returnedFirstSegment = true;
 
     // After the first segment, we want nextSize to equal the total size allocated so far.
@@ -293,6 +390,63 @@ kj::ArrayPtr<word> MallocMessageBuilder::allocateSegment(uint minimumSize) {
   return kj::arrayPtr(reinterpret_cast<word*>(result), size);
 }
 
+size_t MallocMessageBuilder::compact() {
+  auto oldSegments = getSegmentsForOutput();
+  if (oldSegments.size() == 0) return 0;
+
+  uint64_t oldWords = 0;
+  for (auto segment: oldSegments) {
+    oldWords += segment.size();
+  }
+  size_t firstSegmentUsed = oldSegments[0].size();
+
+  // Copy the content out to a single segment of exactly the right size.
+  auto root = getRoot<AnyPointer>();
+  uint64_t neededWords = kj::min(root.targetSize().wordCount + 1,
+                                 uint64_t(unbound(MAX_SEGMENT_WORDS / WORDS)));
+  MallocMessageBuilder copy(neededWords, AllocationStrategy::FIXED_SIZE);
+  copy.getRoot<AnyPointer>().set(root.asReader());
+
+  // Throw away the old content, keeping only the first segment, and only if the result fits.
+  resetArena();
+
+  KJ_IF_MAYBE(s, moreSegments) {
+    for (void* ptr: s->get()->segments) {
+      free(ptr);
+    }
+    s->get()->segments.clear();
+  }
+
+  if (returnedFirstSegment) {
+    if (!ownFirstSegment) {
+      // The caller expects to get their space back zeroed.
+      memset(firstSegment, 0, firstSegmentUsed * sizeof(word));
+      if (firstSegmentSize < neededWords) {
+        firstSegment = nullptr;
+        ownFirstSegment = true;
+      }
+    } else if (firstSegmentSize < neededWords) {
+      free(firstSegment);
+      firstSegment = nullptr;
+    } else {
+      memset(firstSegment, 0, firstSegmentUsed * sizeof(word));
+    }
+    returnedFirstSegment = false;
+  }
+  if (firstSegment == nullptr) {
+    nextSize = kj::max(nextSize, uint(neededWords));
+  }
+
+  // And copy it back in.
+  getRoot<AnyPointer>().set(copy.getRoot<AnyPointer>().asReader());
+
+  uint64_t newWords = 0;
+  for (auto segment: getSegmentsForOutput()) {
+    newWords += segment.size();
+  }
+  return oldWords > newWords ? (oldWords - newWords) * sizeof(word) : 0;
+}
+
 // -------------------------------------------------------------------
 
 FlatMessageBuilder::FlatMessageBuilder(kj::ArrayPtr<word> array): array(array), allocated(false) {}
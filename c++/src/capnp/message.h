@@ -226,6 +226,13 @@ public:
   bool isCanonical();
   // Check whether the message builder is in canonical form
 
+protected:
+  void resetArena();
+  // Destroys the arena and everything in it, so that the message is empty again and the next
+  // access allocates segments anew. For subclasses which are about to reuse or free the space
+  // they've handed out; all Builders, Readers and Orphans pointing into the message become
+  // invalid.
+
 private:
   void* arenaSpace[22];
   // Space in which we can construct a BuilderArena.  We don't use BuilderArena directly here
@@ -345,6 +352,79 @@ enum class AllocationStrategy: uint8_t {
 constexpr uint SUGGESTED_FIRST_SEGMENT_WORDS = 1024;
 constexpr AllocationStrategy SUGGESTED_ALLOCATION_STRATEGY = AllocationStrategy::GROW_HEURISTICALLY;
 
+class MessageSizeHint {
+  // Learns how big a certain kind of message (typically, messages with a given root type) tends
+  // to be, so that a MallocMessageBuilder constructed with the hint can allocate a first segment
+  // big enough for the whole message. A message that doesn't fit in its first segment spills into
+  // more segments, which means far pointers, which make every later read slower.
+  //
+  // Every MallocMessageBuilder constructed with the hint reports the size of its message back to
+  // it when destroyed. The suggested size grows right away to fit (with some headroom) any message
+  // that didn't fit, and shrinks slowly back down while messages are consistently smaller, so that
+  // one outlier doesn't waste memory forever.
+  //
+  // Hints are thread-safe, so a single hint can be shared by all threads building the same kind of
+  // message. Usually you want `messageSizeHint<MyType>()`, below.
+
+public:
+  explicit MessageSizeHint(uint64_t typeId = 0,
+                           uint initialWords = SUGGESTED_FIRST_SEGMENT_WORDS);
+  // `typeId` only serves to identify the hint in getAllStats().
+
+  ~MessageSizeHint() noexcept(false);
+  KJ_DISALLOW_COPY(MessageSizeHint);
+
+  uint getFirstSegmentWords() const;
+  // How big the first segment of the next message should be.
+
+  void record(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments);
+  // Learn from a finished message, given its `getSegmentsForOutput()`. MallocMessageBuilder does
+  // this itself; call it for messages built some other way.
+
+  struct Stats {
+    uint64_t typeId;
+    uint firstSegmentWords;
+    // Current suggestion.
+
+    uint64_t messageCount;
+    uint64_t totalWords;
+    uint64_t maxWords;
+
+    uint64_t multiSegmentMessageCount;
+    // Messages which didn't fit in their first segment. Each contains at least one far pointer,
+    // while single-segment messages contain none, so in steady state this should stop growing.
+
+    uint64_t extraSegmentCount;
+    // Segments beyond the first, over all messages.
+  };
+
+  Stats getStats() const;
+
+  static kj::Array<Stats> getAllStats();
+  // Stats of all hints which currently exist, in order of creation. Useful for exporting to
+  // monitoring.
+
+private:
+  struct State {
+    uint firstSegmentWords;
+    uint64_t messageCount = 0;
+    uint64_t totalWords = 0;
+    uint64_t maxWords = 0;
+    uint64_t multiSegmentMessageCount = 0;
+    uint64_t extraSegmentCount = 0;
+  };
+
+  uint64_t typeId;
+  kj::MutexGuarded<State> state;
+};
+
+template <typename RootType>
+MessageSizeHint& messageSizeHint();
+// Get the process-wide hint for messages with the given (struct) root type. Use it like:
+//
+//     MallocMessageBuilder message(messageSizeHint<MyStruct>());
+//     message.initRoot<MyStruct>() ...
+
 class MallocMessageBuilder: public MessageBuilder {
   // A simple MessageBuilder that uses malloc() (actually, calloc()) to allocate segments.  This
   // implementation should be reasonable for any case that doesn't require writing the message to
@@ -374,11 +454,29 @@ public:
   // firstSegment MUST be zero-initialized.  MallocMessageBuilder's destructor will write new zeros
   // over any space that was used so that it can be reused.
 
+  explicit MallocMessageBuilder(MessageSizeHint& sizeHint,
+      AllocationStrategy allocationStrategy = SUGGESTED_ALLOCATION_STRATEGY);
+  // Uses the hint's suggestion for the first segment size, and tells the hint how big the message
+  // turned out to be when destroyed. The hint must outlive the builder.
+
   KJ_DISALLOW_COPY(MallocMessageBuilder);
   virtual ~MallocMessageBuilder() noexcept(false);
 
   virtual kj::ArrayPtr<word> allocateSegment(uint minimumSize) override;
 
+  size_t compact();
+  // Re-lays the message content into a single contiguous segment (if it fits in one), dropping
+  // the space left behind by overwritten fields, disowned orphans and far pointer landing pads.
+  // Returns the number of bytes by which the output of `getSegmentsForOutput()` shrank.
+  //
+  // The content is copied out to a temporary message and back. The first segment is reused if
+  // it's big enough for the result, and all other segments are freed, so a long-lived builder
+  // which is modified in place can call this periodically to keep its memory use bounded.
+  // Capabilities are preserved.
+  //
+  // All Builders, Readers and Orphans pointing into the message are invalidated; call getRoot()
+  // again afterwards.
+
 private:
   uint nextSize;
   AllocationStrategy allocationStrategy;
@@ -387,6 +485,9 @@ private:
   bool returnedFirstSegment;
 
   void* firstSegment;
+  uint firstSegmentSize;
+
+  kj::Maybe<MessageSizeHint&> sizeHint;
 
   struct MoreSegments;
   kj::Maybe<kj::Own<MoreSegments>> moreSegments;
@@ -492,6 +593,12 @@ typename kj::ArrayPtr<const word> writeDataStruct(BuilderType builder) {
                       reinterpret_cast<word*>(bytes.end()));
 }
 
+template <typename RootType>
+MessageSizeHint& messageSizeHint() {
+  static MessageSizeHint hint(RootType::_capnpPrivate::typeId);
+  return hint;
+}
+
 template <typename Type>
 static typename Type::Reader defaultValue() {
   return typename Type::Reader(_::StructReader());
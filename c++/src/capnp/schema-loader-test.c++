@@ -25,6 +25,7 @@
 #include <kj/compat/gtest.h>
 #include "test-util.h"
 #include <kj/debug.h>
+#include <kj/thread.h>
 
 namespace capnp {
 namespace _ {  // private
@@ -389,6 +390,63 @@ TEST(SchemaLoader, Generics) {
   }
 }
 
+TEST(SchemaLoader, ManySchemas) {
+  SchemaLoader loader;
+
+  kj::Vector<Schema> loaded;
+  for (uint i = 0; i < 500; i++) {
+    MallocMessageBuilder builder;
+    auto node = builder.initRoot<schema::Node>();
+    node.setId(0x8000000000000000ull | (uint64_t(i) << 17));
+    node.setDisplayName(kj::str("Struct", i));
+    node.initStruct();
+    loaded.add(loader.load(node));
+  }
+
+  for (uint i = 0; i < 500; i++) {
+    EXPECT_TRUE(loader.get(0x8000000000000000ull | (uint64_t(i) << 17)) == loaded[i]);
+  }
+  EXPECT_TRUE(loader.tryGet(0x8000000000000000ull | 1) == nullptr);
+}
+
+TEST(SchemaLoader, ConcurrentLookups) {
+  SchemaLoader loader;
+
+  loader.load(Schema::from<TestAllTypes>().getProto());
+  loader.load(Schema::from<test::TestAnyPointer>().getProto());
+  loader.load(Schema::from<test::TestGenerics<>::Inner>().getProto());
+  loader.load(Schema::from<test::TestGenerics<>::Inner2<>>().getProto());
+  loader.load(Schema::from<test::TestGenerics<>::Interface<>>().getProto());
+  loader.load(Schema::from<test::TestGenerics<>::Interface<>::CallResults>().getProto());
+  loader.load(Schema::from<test::TestGenerics<>>().getProto());
+  Schema scope = loader.load(Schema::from<test::TestUseGenerics>().getProto());
+
+  auto type = scope.asStruct().getFieldByName("basic").getProto().getSlot().getType().getStruct();
+  uint64_t genericId = typeId<test::TestGenerics<>>();
+
+  // Lookups from many threads at once must agree, both the first time (which takes the lock)
+  // and afterwards (which doesn't).
+  kj::Vector<kj::Own<kj::Thread>> threads;
+  auto results = kj::heapArray<Schema>(8 * 1000);
+  for (uint t = 0; t < 8; t++) {
+    threads.add(kj::heap<kj::Thread>([&,t]() {
+      for (uint i = 0; i < 1000; i++) {
+        results[t * 1000 + i] = loader.get(genericId, type.getBrand(), scope);
+        KJ_ASSERT(loader.get(typeId<TestAllTypes>()).getProto().getId() == typeId<TestAllTypes>());
+      }
+    }));
+  }
+  threads.releaseAsArray();
+
+  Schema expected = loader.get(genericId, type.getBrand(), scope);
+  EXPECT_TRUE(expected == scope.asStruct().getFieldByName("basic").getType().asStruct());
+  EXPECT_TRUE(expected != loader.get(genericId));
+  EXPECT_TRUE(loader.getUnbound(genericId) == loader.getUnbound(genericId));
+  for (auto& result: results) {
+    EXPECT_TRUE(result == expected);
+  }
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -26,6 +26,7 @@
 #include <map>
 #include "message.h"
 #include "arena.h"
+#include "any.h"
 #include <kj/debug.h>
 #include <kj/exception.h>
 #include <kj/arena.h>
@@ -77,6 +78,148 @@ struct SchemaBindingsPairHash {
   }
 };
 
+template <typename T>
+inline T* loadAcquire(T* const& ptr) {
+#if __GNUC__
+  return __atomic_load_n(&ptr, __ATOMIC_ACQUIRE);
+#elif _MSC_VER
+  T* result = *static_cast<T* const volatile*>(&ptr);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return result;
+#else
+#error "Platform not supported"
+#endif
+}
+
+template <typename T>
+inline void storeRelease(T*& ptr, T* value) {
+#if __GNUC__
+  __atomic_store_n(&ptr, value, __ATOMIC_RELEASE);
+#elif _MSC_VER
+  std::atomic_thread_fence(std::memory_order_release);
+  *static_cast<T* volatile*>(&ptr) = value;
+#else
+#error "Platform not supported"
+#endif
+}
+
+template <typename T>
+class PublishedIndex {
+  // A hash table from 64-bit keys to pointers which can be searched without taking any lock and
+  // without writing to shared memory, so that lookups from many threads don't contend. Writes
+  // must be serialized by the caller; SchemaLoader only writes while holding its mutex.
+  //
+  // Entries are never removed, though an entry's value may be replaced. When the table gets half
+  // full, it is copied into one twice the size, which is then published in its place. A reader
+  // may still be searching an old table, so old tables are kept until the index is destroyed.
+  // Since each table is half the size of the next, that at most doubles the memory used.
+
+public:
+  PublishedIndex() { current = newTable(6); }
+
+  T* find(uint64_t key) const {
+    // Returns null if not found.
+
+    const Table* table = loadAcquire(current);
+    for (size_t i = table->start(key);; i = (i + 1) & table->mask) {
+      const Slot& slot = table->slots[i];
+      T* value = loadAcquire(slot.value);
+      if (value == nullptr) return nullptr;
+      if (slot.key == key) return value;
+    }
+  }
+
+  void set(uint64_t key, T* value) {
+    KJ_IREQUIRE(value != nullptr);
+
+    for (size_t i = current->start(key);; i = (i + 1) & current->mask) {
+      Slot& slot = current->slots[i];
+      if (slot.value == nullptr) {
+        if ((count + 1) * 2 > current->slots.size()) {
+          grow();
+          return set(key, value);
+        }
+        // Write the key before publishing the value, since readers look at the value first.
+        slot.key = key;
+        storeRelease(slot.value, value);
+        ++count;
+        return;
+      } else if (slot.key == key) {
+        storeRelease(slot.value, value);
+        return;
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    uint64_t key;
+    T* value;
+  };
+
+  struct Table {
+    uint shift;
+    size_t mask;
+    kj::Array<Slot> slots;
+
+    inline size_t start(uint64_t key) const {
+      // Keys may be pointers, so mix the bits (Fibonacci hashing).
+      return (key * 0x9e3779b97f4a7c15ull) >> shift;
+    }
+  };
+
+  Table* current;
+  size_t count = 0;
+  kj::Vector<kj::Own<Table>> tables;
+  // All tables ever published, including `current`.
+
+  Table* newTable(uint bits) {
+    auto table = kj::heap<Table>();
+    table->shift = 64 - bits;
+    table->mask = (size_t(1) << bits) - 1;
+    table->slots = kj::heapArray<Slot>(size_t(1) << bits);
+    memset(table->slots.begin(), 0, table->slots.asBytes().size());
+    Table* result = table;
+    tables.add(kj::mv(table));
+    return result;
+  }
+
+  void grow() {
+    Table* table = newTable(64 - current->shift + 1);
+    for (auto& slot: current->slots) {
+      if (slot.value != nullptr) {
+        size_t i = table->start(slot.key);
+        while (table->slots[i].value != nullptr) i = (i + 1) & table->mask;
+        table->slots[i] = slot;
+      }
+    }
+    storeRelease(current, table);
+  }
+};
+
+struct BrandCacheEntry {
+  // A branded schema previously built by SchemaLoader::tryGet(), indexed so that later lookups of
+  // the same brand don't need the lock.
+
+  const _::RawSchema* schema;
+  const _::RawBrandedSchema* scope;
+  schema::Brand::Reader brand;
+  // Copy of the brand in the loader's arena.
+
+  const _::RawBrandedSchema* result;
+  const BrandCacheEntry* next;
+  // Another entry with the same hash.
+};
+
+uint64_t brandCacheKey(const _::RawSchema* schema, schema::Brand::Reader brand,
+                       const _::RawBrandedSchema* scope) {
+  uint64_t hash = 31 * reinterpret_cast<uintptr_t>(schema) + reinterpret_cast<uintptr_t>(scope);
+  for (auto brandScope: brand.getScopes()) {
+    hash = (hash * 0x100000001b3ull) ^ brandScope.getScopeId();
+  }
+  return hash;
+}
+
 }  // namespace
 
 bool hasDiscriminantValue(const schema::Field::Reader& reader) {
@@ -138,6 +281,23 @@ public:
 
   const _::RawBrandedSchema* getUnbound(const _::RawSchema* schema);
 
+  // The following may be called without holding the lock. They only find things which are
+  // already loaded, returning null otherwise; the caller should then fall back to the locked
+  // methods above.
+
+  _::RawSchema* tryGetPublished(uint64_t typeId) const {
+    return publishedSchemas.find(typeId);
+  }
+
+  const _::RawBrandedSchema* tryGetPublishedBrand(
+      const _::RawSchema* schema, schema::Brand::Reader brand,
+      const _::RawBrandedSchema* scope) const;
+  void publishBrand(const _::RawSchema* schema, schema::Brand::Reader brand,
+                    const _::RawBrandedSchema* scope, const _::RawBrandedSchema* result);
+  // Records the result of makeBranded(schema, brand, scope->scopes) for tryGetPublishedBrand().
+
+  const _::RawBrandedSchema* tryGetPublishedUnbound(const _::RawSchema* schema) const;
+
   kj::Array<Schema> getAllLoaded() const;
 
   void requireStructSize(uint64_t id, uint dataWordCount, uint pointerCount);
@@ -158,6 +318,11 @@ private:
   std::unordered_map<SchemaBindingsPair, _::RawBrandedSchema*, SchemaBindingsPairHash> brands;
   std::unordered_map<const _::RawSchema*, _::RawBrandedSchema*> unboundBrands;
 
+  PublishedIndex<_::RawSchema> publishedSchemas;
+  PublishedIndex<const BrandCacheEntry> publishedBrands;
+  PublishedIndex<const _::RawBrandedSchema> publishedUnboundBrands;
+  // Lock-free indexes over the above. A schema is only published once it is fully constructed.
+
   struct RequiredSize {
     uint16_t dataWordCount;
     uint16_t pointerCount;
@@ -1325,6 +1490,7 @@ _::RawSchema* SchemaLoader::Impl::load(const schema::Node::Reader& reader, bool
 #endif
   }
 
+  publishedSchemas.set(slot->id, slot);
   return slot;
 }
 
@@ -1425,6 +1591,7 @@ _::RawSchema* SchemaLoader::Impl::loadNative(const _::RawSchema* nativeSchema) {
 #endif
   }
 
+  publishedSchemas.set(result->id, result);
   return result;
 }
 
@@ -1825,11 +1992,57 @@ const _::RawBrandedSchema* SchemaLoader::Impl::getUnbound(const _::RawSchema* sc
     auto deps = makeBrandedDependencies(schema, nullptr);
     slot->dependencies = deps.begin();
     slot->dependencyCount = deps.size();
+    publishedUnboundBrands.set(reinterpret_cast<uintptr_t>(schema), slot);
   }
 
   return slot;
 }
 
+const _::RawBrandedSchema* SchemaLoader::Impl::tryGetPublishedBrand(
+    const _::RawSchema* schema, schema::Brand::Reader brand,
+    const _::RawBrandedSchema* scope) const {
+  const BrandCacheEntry* entry = publishedBrands.find(brandCacheKey(schema, brand, scope));
+  for (; entry != nullptr; entry = entry->next) {
+    if (entry->schema == schema && entry->scope == scope &&
+        AnyStruct::Reader(entry->brand) == AnyStruct::Reader(brand)) {
+      return entry->result;
+    }
+  }
+  return nullptr;
+}
+
+void SchemaLoader::Impl::publishBrand(
+    const _::RawSchema* schema, schema::Brand::Reader brand,
+    const _::RawBrandedSchema* scope, const _::RawBrandedSchema* result) {
+  if (tryGetPublishedBrand(schema, brand, scope) != nullptr) {
+    // Another thread got here first.
+    return;
+  }
+
+  uint64_t key = brandCacheKey(schema, brand, scope);
+
+  size_t size = brand.totalSize().wordCount + 1;
+  kj::ArrayPtr<word> copy = arena.allocateArray<word>(size);
+  memset(copy.begin(), 0, size * sizeof(word));
+  copyToUnchecked(brand, copy);
+
+  auto& entry = arena.allocate<BrandCacheEntry>();
+  entry.schema = schema;
+  entry.scope = scope;
+  entry.brand = readMessageUnchecked<schema::Brand>(copy.begin());
+  entry.result = result;
+  entry.next = publishedBrands.find(key);
+  publishedBrands.set(key, &entry);
+}
+
+const _::RawBrandedSchema* SchemaLoader::Impl::tryGetPublishedUnbound(
+    const _::RawSchema* schema) const {
+  if (!readMessageUnchecked<schema::Node>(schema->encodedNode).getIsGeneric()) {
+    return &schema->defaultBrand;
+  }
+  return publishedUnboundBrands.find(reinterpret_cast<uintptr_t>(schema));
+}
+
 kj::Array<Schema> SchemaLoader::Impl::getAllLoaded() const {
   size_t count = 0;
   for (auto& schema: schemas) {
@@ -1999,6 +2212,21 @@ Schema SchemaLoader::get(uint64_t id, schema::Brand::Reader brand, Schema scope)
 
 kj::Maybe<Schema> SchemaLoader::tryGet(
     uint64_t id, schema::Brand::Reader brand, Schema scope) const {
+  // Fast path: anything looked up before can be found without locking. `impl` itself is never
+  // replaced, so it's safe to dereference without the lock.
+  const Impl& unlocked = *impl.getWithoutLock();
+  _::RawSchema* published = unlocked.tryGetPublished(id);
+  if (published != nullptr && loadAcquire(published->lazyInitializer) == nullptr) {
+    if (brand.getScopes().size() == 0) {
+      return Schema(&published->defaultBrand);
+    }
+    auto brandedSchema = unlocked.tryGetPublishedBrand(published, brand, scope.raw);
+    if (brandedSchema != nullptr) {
+      brandedSchema->ensureInitialized();
+      return Schema(brandedSchema);
+    }
+  }
+
   auto getResult = impl.lockShared()->get()->tryGet(id);
   if (getResult.schema == nullptr || getResult.schema->lazyInitializer != nullptr) {
     // This schema couldn't be found or has yet to be lazily loaded. If we have a lazy loader
@@ -2010,8 +2238,13 @@ kj::Maybe<Schema> SchemaLoader::tryGet(
   }
   if (getResult.schema != nullptr && getResult.schema->lazyInitializer == nullptr) {
     if (brand.getScopes().size() > 0) {
-      auto brandedSchema = impl.lockExclusive()->get()->makeBranded(
-          getResult.schema, brand, kj::arrayPtr(scope.raw->scopes, scope.raw->scopeCount));
+      const _::RawBrandedSchema* brandedSchema;
+      {
+        auto lock = impl.lockExclusive();
+        brandedSchema = lock->get()->makeBranded(
+            getResult.schema, brand, kj::arrayPtr(scope.raw->scopes, scope.raw->scopeCount));
+        lock->get()->publishBrand(getResult.schema, brand, scope.raw, brandedSchema);
+      }
       brandedSchema->ensureInitialized();
       return Schema(brandedSchema);
     } else {
@@ -2024,6 +2257,10 @@ kj::Maybe<Schema> SchemaLoader::tryGet(
 
 Schema SchemaLoader::getUnbound(uint64_t id) const {
   auto schema = get(id);
+  auto unbound = impl.getWithoutLock()->tryGetPublishedUnbound(schema.raw->generic);
+  if (unbound != nullptr) {
+    return Schema(unbound);
+  }
   return Schema(impl.lockExclusive()->get()->getUnbound(schema.raw->generic));
 }
 
@@ -264,5 +264,63 @@ TEST(SchemaParser, SourceInfo) {
   expectSourceInfo(thud.getSourceInfo(), 0xcca9972702b730b4, "post-comment\n", {});
 }
 
+TEST(SchemaParser, CacheDirectory) {
+  auto cacheDir = kj::newInMemoryDirectory(kj::nullClock());
+
+  FakeFileReader reader;
+  reader.add("foo.capnp",
+      "@0x84a2c6051e1061ed;\n"
+      "struct Foo { bar @0 :UInt32; }\n");
+  reader.add("baz.capnp",
+      "@0x8000000000000002;\n"
+      "struct Baz { qux @0 :Text; }\n");
+
+  kj::Path fooPath = nullptr;
+  {
+    SchemaParser parser;
+    parser.setDiskFilesystem(reader);
+    parser.setCacheDirectory(*cacheDir);
+    auto foo = parser.parseDiskFile("foo.capnp", "foo.capnp", nullptr).getNested("Foo");
+    EXPECT_EQ("bar", foo.asStruct().getFields()[0].getProto().getName());
+
+    auto names = cacheDir->listNames();
+    ASSERT_EQ(1u, names.size());
+    fooPath = kj::Path(kj::mv(names[0]));
+
+    // Parse baz.capnp too, and then put its entry under foo.capnp's name.
+    parser.parseDiskFile("baz.capnp", "baz.capnp", nullptr);
+    ASSERT_EQ(2u, cacheDir->listNames().size());
+    for (auto& name: cacheDir->listNames()) {
+      if (name != fooPath[0]) {
+        auto bazEntry = cacheDir->openFile(kj::Path(kj::mv(name)))->readAllBytes();
+        auto replacer = cacheDir->replaceFile(fooPath, kj::WriteMode::MODIFY);
+        replacer->get().writeAll(bazEntry);
+        replacer->commit();
+      }
+    }
+  }
+
+  {
+    // A new parser believes the cache, so it finds Baz in foo.capnp.
+    SchemaParser parser;
+    parser.setDiskFilesystem(reader);
+    parser.setCacheDirectory(*cacheDir);
+    auto file = parser.parseDiskFile("foo.capnp", "foo.capnp", nullptr);
+    EXPECT_TRUE(file.findNested("Foo") == nullptr);
+    EXPECT_TRUE(file.findNested("Baz") != nullptr);
+  }
+
+  {
+    // A corrupt entry is ignored.
+    cacheDir->openFile(fooPath, kj::WriteMode::MODIFY)->truncate(20);
+    SchemaParser parser;
+    parser.setDiskFilesystem(reader);
+    parser.setCacheDirectory(*cacheDir);
+    KJ_EXPECT_LOG(WARNING, "ignoring bad entry in parsed file cache");
+    auto foo = parser.parseDiskFile("foo.capnp", "foo.capnp", nullptr).getNested("Foo");
+    EXPECT_EQ("bar", foo.asStruct().getFields()[0].getProto().getName());
+  }
+}
+
 }  // namespace
 }  // namespace capnp
@@ -69,28 +69,7 @@ public:
     return file->getDisplayName();
   }
 
-  Orphan<compiler::ParsedFile> loadContent(Orphanage orphanage) override {
-    kj::Array<const char> content = file->readContent();
-
-    lineBreaks.get([&](kj::SpaceFor<kj::Vector<uint>>& space) {
-      auto vec = space.construct(content.size() / 40);
-      vec->add(0);
-      for (const char* pos = content.begin(); pos < content.end(); ++pos) {
-        if (*pos == '\n') {
-          vec->add(pos + 1 - content.begin());
-        }
-      }
-      return vec;
-    });
-
-    MallocMessageBuilder lexedBuilder;
-    auto statements = lexedBuilder.initRoot<compiler::LexedStatements>();
-    compiler::lex(content, statements, *this);
-
-    auto parsed = orphanage.newOrphan<compiler::ParsedFile>();
-    compiler::parseFile(statements.getStatements(), parsed.get(), *this);
-    return parsed;
-  }
+  Orphan<compiler::ParsedFile> loadContent(Orphanage orphanage) override;
 
   kj::Maybe<Module&> importRelative(kj::StringPtr importPath) override {
     KJ_IF_MAYBE(importedFile, file->import(importPath)) {
@@ -189,8 +168,37 @@ struct SchemaParser::Impl {
   compiler::Compiler compiler;
 
   kj::MutexGuarded<kj::Maybe<DiskFileCompat>> compat;
+
+  kj::Maybe<compiler::ParsedFileCache> parsedFileCache;
 };
 
+Orphan<compiler::ParsedFile> SchemaParser::ModuleImpl::loadContent(Orphanage orphanage) {
+  kj::Array<const char> content = file->readContent();
+
+  lineBreaks.get([&](kj::SpaceFor<kj::Vector<uint>>& space) {
+    auto vec = space.construct(content.size() / 40);
+    vec->add(0);
+    for (const char* pos = content.begin(); pos < content.end(); ++pos) {
+      if (*pos == '\n') {
+        vec->add(pos + 1 - content.begin());
+      }
+    }
+    return vec;
+  });
+
+  KJ_IF_MAYBE(cache, parser.impl->parsedFileCache) {
+    return cache->parse(content, orphanage, *this);
+  }
+
+  MallocMessageBuilder lexedBuilder;
+  auto statements = lexedBuilder.initRoot<compiler::LexedStatements>();
+  compiler::lex(content, statements, *this);
+
+  auto parsed = orphanage.newOrphan<compiler::ParsedFile>();
+  compiler::parseFile(statements.getStatements(), parsed.get(), *this);
+  return parsed;
+}
+
 SchemaParser::SchemaParser(): impl(kj::heap<Impl>()) {}
 SchemaParser::~SchemaParser() noexcept(false) {}
 
@@ -285,6 +293,12 @@ void SchemaParser::setDiskFilesystem(kj::Filesystem& fs) {
   lock->emplace(fs);
 }
 
+void SchemaParser::setCacheDirectory(const kj::Directory& dir) {
+  KJ_REQUIRE(impl->fileMap.getWithoutLock().empty(),
+             "setCacheDirectory() must be called before parsing anything");
+  impl->parsedFileCache = compiler::ParsedFileCache(dir);
+}
+
 ParsedSchema SchemaParser::parseFile(kj::Own<SchemaFile>&& file) const {
   KJ_DEFER(impl->compiler.clearWorkspace());
   uint64_t id = impl->compiler.add(getModuleImpl(kj::mv(file)));
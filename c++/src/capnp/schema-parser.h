@@ -120,6 +120,15 @@ public:
   // If parseDiskFile() is called without having called setDiskFilesystem(), then
   // kj::newDiskFilesystem() will be used instead.
 
+  void setCacheDirectory(const kj::Directory& dir);
+  // Keep the result of lexing and parsing each file in `dir`, keyed by a hash of the file's
+  // content, and reuse it whenever a file with the same content is parsed again -- including by
+  // other SchemaParsers and other processes sharing the directory. This speeds up programs that
+  // parse the same schemas every time they start. Entries are written atomically and corrupt
+  // entries are ignored. Nothing is ever removed from the directory.
+  //
+  // Call before parsing anything. `dir` must remain valid until the `SchemaParser` is destroyed.
+
   ParsedSchema parseFile(kj::Own<SchemaFile>&& file) const;
   // Advanced interface for parsing a file that may or may not be located in any global namespace.
   // Most users will prefer `parseFromDirectory()`.
@@ -25,6 +25,8 @@
 
 #include "serialize-async.h"
 #include "serialize.h"
+#include "serialize-packed.h"
+#include "serialize-compressed.h"
 #include <kj/debug.h>
 #include <kj/thread.h>
 #include <stdlib.h>
@@ -343,6 +345,177 @@ TEST(SerializeAsyncTest, WriteAsyncEvenSegmentCount) {
   writeMessage(*output, message).wait(ioContext.waitScope);
 }
 
+TEST(SerializeAsyncTest, ParsePackedAsync) {
+  PipeWithSmallBuffer fds;
+  auto ioContext = kj::setupAsyncIo();
+  auto input = ioContext.lowLevelProvider->wrapInputFd(fds[0]);
+  SocketOutputStream rawOutput(fds[1]);
+  FragmentingOutputStream output(rawOutput);
+
+  TestMessageBuilder message(7);
+  initTestMessage(message.getRoot<TestAllTypes>());
+
+  kj::Thread thread([&]() {
+    writePackedMessage(output, message);
+    rawOutput.write("x", 1);
+  });
+
+  auto received = readPackedMessage(*input).wait(ioContext.waitScope);
+  checkTestMessage(received->getRoot<TestAllTypes>());
+
+  // readPackedMessage() must not have consumed anything past the end of the message.
+  char c;
+  EXPECT_EQ(1u, input->tryRead(&c, 1, 1).wait(ioContext.waitScope));
+  EXPECT_EQ('x', c);
+}
+
+TEST(SerializeAsyncTest, ParsePackedAsyncMultiple) {
+  PipeWithSmallBuffer fds;
+  auto ioContext = kj::setupAsyncIo();
+  auto input = ioContext.lowLevelProvider->wrapInputFd(fds[0]);
+  SocketOutputStream rawOutput(fds[1]);
+  FragmentingOutputStream output(rawOutput);
+
+  TestMessageBuilder message(10);
+  initTestMessage(message.getRoot<TestAllTypes>());
+
+  kj::Thread thread([&]() {
+    for (uint i = 0; i < 3; i++) {
+      writePackedMessage(output, message);
+    }
+    KJ_SOCKCALL(shutdown(fds[1], SHUT_WR));
+  });
+
+  AsyncPackedInputStream packedInput(*input, 64);
+  for (uint i = 0; i < 3; i++) {
+    auto received = readMessage(packedInput).wait(ioContext.waitScope);
+    checkTestMessage(received->getRoot<TestAllTypes>());
+  }
+  EXPECT_TRUE(tryReadMessage(packedInput).wait(ioContext.waitScope) == nullptr);
+}
+
+TEST(SerializeAsyncTest, WritePackedAsync) {
+  PipeWithSmallBuffer fds;
+  auto ioContext = kj::setupAsyncIo();
+  auto output = ioContext.lowLevelProvider->wrapOutputFd(fds[1]);
+
+  MallocMessageBuilder message;
+  auto root = message.getRoot<TestAllTypes>();
+  auto list = root.initStructList(16);
+  for (auto element: list) {
+    initTestMessage(element);
+  }
+
+  // Big enough to be packed in several chunks, and incompressible so that it becomes long
+  // uncompressed runs.
+  auto data = root.initDataField(200000);
+  for (uint i = 0; i < data.size(); i++) {
+    data[i] = i * 7 % 251 + 1;
+  }
+
+  kj::Thread thread([&]() {
+    SocketInputStream rawInput(fds[0]);
+    kj::BufferedInputStreamWrapper input(rawInput);
+    PackedMessageReader reader(input);
+    auto rootReader = reader.getRoot<TestAllTypes>();
+    auto listReader = rootReader.getStructList();
+    EXPECT_EQ(list.size(), listReader.size());
+    for (auto element: listReader) {
+      checkTestMessage(element);
+    }
+    EXPECT_TRUE(rootReader.getDataField() == data);
+  });
+
+  writePackedMessage(*output, message).wait(ioContext.waitScope);
+}
+
+TEST(SerializeAsyncTest, PackedAsyncRoundTrip) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = ioContext.provider->newTwoWayPipe();
+
+  MallocMessageBuilder message;
+  auto root = message.getRoot<TestAllTypes>();
+  initTestMessage(root.initStructList(1)[0]);
+  auto data = root.initDataField(100000);
+  for (uint i = 0; i < data.size(); i++) {
+    data[i] = i % 3 == 0 ? 0 : i;
+  }
+
+  auto writePromise = writePackedMessage(*pipe.ends[0], message)
+      .then([&]() { pipe.ends[0]->shutdownWrite(); });
+
+  auto received = readPackedMessage(*pipe.ends[1]).wait(ioContext.waitScope);
+  writePromise.wait(ioContext.waitScope);
+
+  auto rootReader = received->getRoot<TestAllTypes>();
+  checkTestMessage(rootReader.getStructList()[0]);
+  EXPECT_TRUE(rootReader.getDataField() == data);
+  EXPECT_TRUE(tryReadPackedMessage(*pipe.ends[1]).wait(ioContext.waitScope) == nullptr);
+}
+
+TEST(SerializeAsyncTest, ParseCompressedAsync) {
+  PipeWithSmallBuffer fds;
+  auto ioContext = kj::setupAsyncIo();
+  auto input = ioContext.lowLevelProvider->wrapInputFd(fds[0]);
+  SocketOutputStream rawOutput(fds[1]);
+  FragmentingOutputStream output(rawOutput);
+
+  TestMessageBuilder message(7);
+  initTestMessage(message.getRoot<TestAllTypes>());
+
+  kj::Thread thread([&]() {
+    writeCompressedPackedMessage(output, message);
+    writeCompressedPackedMessage(output, message);
+    KJ_SOCKCALL(shutdown(fds[1], SHUT_WR));
+  });
+
+  for (uint i = 0; i < 2; i++) {
+    auto received = readCompressedPackedMessage(*input).wait(ioContext.waitScope);
+    checkTestMessage(received->getRoot<TestAllTypes>());
+  }
+  EXPECT_TRUE(tryReadCompressedPackedMessage(*input).wait(ioContext.waitScope) == nullptr);
+}
+
+TEST(SerializeAsyncTest, CompressedAsyncRoundTrip) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = ioContext.provider->newTwoWayPipe();
+
+  MallocMessageBuilder message;
+  auto root = message.getRoot<TestAllTypes>();
+  auto list = root.initStructList(100);
+  for (auto element: list) {
+    initTestMessage(element);
+  }
+
+  auto writePromise = writeCompressedPackedMessage(*pipe.ends[0], message)
+      .then([&]() { pipe.ends[0]->shutdownWrite(); });
+
+  auto received = readCompressedPackedMessage(*pipe.ends[1]).wait(ioContext.waitScope);
+  writePromise.wait(ioContext.waitScope);
+
+  auto listReader = received->getRoot<TestAllTypes>().getStructList();
+  EXPECT_EQ(list.size(), listReader.size());
+  for (auto element: listReader) {
+    checkTestMessage(element);
+  }
+}
+
+TEST(SerializeAsyncTest, ReadMessageFromFile) {
+  auto ioContext = kj::setupAsyncIo();
+  auto fileProvider = kj::newAsyncFileProvider(*ioContext.provider, 2);
+
+  TestMessageBuilder message(7);
+  initTestMessage(message.getRoot<TestAllTypes>());
+
+  auto file = kj::newInMemoryFile(kj::nullClock());
+  file->writeAll(messageToFlatArray(message).asBytes());
+
+  auto asyncFile = fileProvider->wrapReadableFile(kj::mv(file));
+  auto received = readMessage(*asyncFile).wait(ioContext.waitScope);
+
+  checkTestMessage(received->getRoot<TestAllTypes>());
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -20,6 +20,8 @@
 // THE SOFTWARE.
 
 #include "serialize-async.h"
+#include "serialize-packed.h"
+#include "serialize-compressed.h"
 #include <kj/debug.h>
 
 namespace capnp {
@@ -172,6 +174,28 @@ kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadMessage(
   }));
 }
 
+kj::Promise<kj::Own<MessageReader>> readMessage(
+    const kj::AsyncReadableFile& file, ReaderOptions options) {
+  return file.readAllBytes().then([options](kj::Array<byte>&& bytes) -> kj::Own<MessageReader> {
+    KJ_REQUIRE(bytes.size() % sizeof(word) == 0,
+               "Message file size is not a multiple of the word size.") { break; }
+
+    kj::ArrayPtr<const word> words;
+    kj::Array<word> copy;
+    if (reinterpret_cast<uintptr_t>(bytes.begin()) % alignof(word) == 0) {
+      words = kj::arrayPtr(reinterpret_cast<const word*>(bytes.begin()),
+                           bytes.size() / sizeof(word));
+    } else {
+      // The allocator didn't align the buffer for us.
+      copy = kj::heapArray<word>(bytes.size() / sizeof(word));
+      memcpy(copy.begin(), bytes.begin(), copy.asBytes().size());
+      words = copy;
+    }
+
+    return kj::heap<FlatArrayMessageReader>(words, options).attach(kj::mv(bytes), kj::mv(copy));
+  });
+}
+
 // =======================================================================================
 
 namespace {
@@ -217,4 +241,410 @@ kj::Promise<void> writeMessage(kj::AsyncOutputStream& output,
   return promise.then(kj::mvCapture(arrays, [](WriteArrays&&) {}));
 }
 
+// =======================================================================================
+
+AsyncPackedInputStream::AsyncPackedInputStream(kj::AsyncInputStream& inner, size_t readAheadBytes)
+    : inner(inner),
+      // Even in exact mode we need room for a whole tag group (tag, 8 bytes, run count), and we
+      // might as well allow a few of them at a time.
+      buffer(kj::heapArray<byte>(kj::max(readAheadBytes, size_t(256)))),
+      exact(readAheadBytes == 0),
+      pos(buffer.begin()), end(buffer.begin()) {}
+
+AsyncPackedInputStream::~AsyncPackedInputStream() noexcept(false) {}
+
+size_t AsyncPackedInputStream::unpackBuffered(byte*& outRef, byte* outEnd) {
+  // Unpack as much as possible from `buffer` into [outRef, outEnd), advancing `outRef`.  Returns
+  // zero if the output was filled, otherwise the number of additional input bytes needed before
+  // any further progress can be made.
+
+  uint8_t* __restrict__ out = reinterpret_cast<uint8_t*>(outRef);
+  KJ_DEFER(outRef = reinterpret_cast<byte*>(out));
+
+  for (;;) {
+    if (zeroRunBytes > 0) {
+      size_t n = kj::min(zeroRunBytes, size_t(outEnd - out));
+      memset(out, 0, n);
+      out += n;
+      zeroRunBytes -= n;
+    }
+
+    if (rawRunBytes > 0) {
+      size_t n = kj::min(rawRunBytes, size_t(kj::min(outEnd - out, end - pos)));
+      memcpy(out, pos, n);
+      out += n;
+      pos += n;
+      rawRunBytes -= n;
+      if (rawRunBytes > 0 && out < outEnd) {
+        return rawRunBytes;
+      }
+    }
+
+    if (out == outEnd) {
+      return 0;
+    }
+
+    KJ_DASSERT((out - reinterpret_cast<uint8_t*>(outRef)) % sizeof(word) == 0,
+               "Output pointer should always be aligned here.");
+
+    const uint8_t* __restrict__ in = reinterpret_cast<const uint8_t*>(pos);
+    size_t available = end - pos;
+    uint8_t tag;
+
+    if (available >= 10) {
+      // Fast path: a whole tag group is certainly available, so no bounds checks are needed.
+      tag = *in++;
+
+#define HANDLE_BYTE(n) \
+      { \
+         bool isNonzero = (tag & (1u << n)) != 0; \
+         *out++ = *in & (-(int8_t)isNonzero); \
+         in += isNonzero; \
+      }
+
+      HANDLE_BYTE(0);
+      HANDLE_BYTE(1);
+      HANDLE_BYTE(2);
+      HANDLE_BYTE(3);
+      HANDLE_BYTE(4);
+      HANDLE_BYTE(5);
+      HANDLE_BYTE(6);
+      HANDLE_BYTE(7);
+#undef HANDLE_BYTE
+    } else {
+      if (available == 0) {
+        return 1;
+      }
+
+      tag = *in;
+      size_t groupSize = 1 + kj::popCount(tag) + (tag == 0 || tag == 0xffu);
+      if (available < groupSize) {
+        return groupSize - available;
+      }
+
+      ++in;
+      for (uint i = 0; i < 8; i++) {
+        if (tag & (1u << i)) {
+          *out++ = *in++;
+        } else {
+          *out++ = 0;
+        }
+      }
+    }
+
+    if (tag == 0) {
+      zeroRunBytes = *in++ * sizeof(word);
+    } else if (tag == 0xffu) {
+      rawRunBytes = *in++ * sizeof(word);
+    }
+
+    pos = reinterpret_cast<byte*>(const_cast<uint8_t*>(in));
+  }
+}
+
+kj::Promise<size_t> AsyncPackedInputStream::tryRead(void* dst, size_t minBytes, size_t maxBytes) {
+  if (maxBytes == 0) {
+    return size_t(0);
+  }
+
+  KJ_REQUIRE(minBytes % sizeof(word) == 0, "AsyncPackedInputStream reads must be word-aligned.");
+  KJ_REQUIRE(maxBytes % sizeof(word) == 0, "AsyncPackedInputStream reads must be word-aligned.");
+
+  byte* out = reinterpret_cast<byte*>(dst);
+  return tryReadInternal(out, out, out + minBytes, out + maxBytes);
+}
+
+kj::Promise<size_t> AsyncPackedInputStream::tryReadInternal(
+    byte* dst, byte* out, byte* outMin, byte* outEnd) {
+  size_t needed = unpackBuffered(out, outEnd);
+  if (needed == 0 || out >= outMin) {
+    return size_t(out - dst);
+  }
+
+  if (rawRunBytes > 0) {
+    // We're in the middle of an uncompressed run and the buffer is drained.  The rest of the run
+    // can be read directly into the output.
+    KJ_DASSERT(pos == end);
+    size_t n = kj::min(rawRunBytes, size_t(outEnd - out));
+    return inner.tryRead(out, n, n)
+        .then([this,dst,out,outMin,outEnd](size_t actual) -> kj::Promise<size_t> {
+      rawRunBytes -= actual;
+      KJ_REQUIRE(rawRunBytes == 0 || out + actual == outEnd, "Premature end of packed input.") {
+        return size_t(out + actual - dst);
+      }
+      return tryReadInternal(dst, out + actual, outMin, outEnd);
+    });
+  }
+
+  // Shift the unconsumed partial tag group (if any) to the front of the buffer and fill the rest.
+  size_t remaining = end - pos;
+  memmove(buffer.begin(), pos, remaining);
+  pos = buffer.begin();
+  end = pos + remaining;
+
+  size_t maxRead = buffer.size() - remaining;
+  if (exact) {
+    // Don't read beyond the bytes we know to be part of this read.  Every tag group covers at most
+    // 256 words and takes at least two bytes, which gives a lower bound on what's left.
+    size_t wordsLeft = (outEnd - out) / sizeof(word);
+    size_t lowerBound = (wordsLeft + 255) / 256 * 2;
+    maxRead = kj::min(maxRead,
+        kj::max(needed, lowerBound > remaining ? lowerBound - remaining : 0));
+  }
+
+  return inner.tryRead(end, needed, maxRead)
+      .then([this,dst,out,outMin,outEnd,needed](size_t n) -> kj::Promise<size_t> {
+    end += n;
+    if (n < needed) {
+      // EOF.  That's only OK on a word boundary, in which case the caller sees a short read.
+      KJ_REQUIRE(pos == end, "Premature end of packed input.") {
+        return size_t(out - dst);
+      }
+      return size_t(out - dst);
+    }
+    return tryReadInternal(dst, out, outMin, outEnd);
+  });
+}
+
+kj::Promise<kj::Own<MessageReader>> readPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  auto packed = kj::heap<AsyncPackedInputStream>(input, 0);
+  auto promise = readMessage(*packed, options, scratchSpace);
+  return promise.attach(kj::mv(packed));
+}
+
+kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  auto packed = kj::heap<AsyncPackedInputStream>(input, 0);
+  auto promise = tryReadMessage(*packed, options, scratchSpace);
+  return promise.attach(kj::mv(packed));
+}
+
+// -------------------------------------------------------------------
+
+namespace {
+
+class AsyncPackedMessageWriter {
+  // Packs a message a chunk at a time, writing each chunk before packing the next.  If
+  // `compress` is true, each packed chunk is written as one compressed frame.
+
+public:
+  AsyncPackedMessageWriter(kj::AsyncOutputStream& output,
+                           kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                           bool compress)
+      : output(output), segments(segments),
+        table(kj::heapArray<_::WireValue<uint32_t>>((segments.size() + 2) & ~size_t(1))),
+        // Packing never expands a word to more than 10 bytes (tag, 8 bytes, run count).
+        buffer(kj::heapArray<byte>(CHUNK_WORDS * 10)),
+        frame(compress ? kj::heapArray<byte>(FRAME_HEADER_SIZE + buffer.size()) : nullptr) {
+    // Same segment table as writeMessage().
+    table[0].set(segments.size() - 1);
+    for (uint i = 0; i < segments.size(); i++) {
+      table[i + 1].set(segments[i].size());
+    }
+    if (segments.size() % 2 == 0) {
+      // Set padding byte.
+      table[segments.size() + 1].set(0);
+    }
+  }
+
+  kj::Promise<void> writeNext() {
+    kj::ArrayOutputStream arrayOutput(buffer);
+    {
+      _::PackedOutputStream packedOutput(arrayOutput);
+      size_t budget = CHUNK_WORDS;
+      while (budget > 0 && pieceIndex <= segments.size()) {
+        kj::ArrayPtr<const word> piece = pieceIndex == 0
+            ? kj::arrayPtr(reinterpret_cast<const word*>(table.begin()),
+                           table.size() * sizeof(table[0]) / sizeof(word))
+            : segments[pieceIndex - 1];
+        size_t n = kj::min(budget, piece.size() - pieceOffset);
+        packedOutput.write(piece.begin() + pieceOffset, n * sizeof(word));
+        budget -= n;
+        pieceOffset += n;
+        if (pieceOffset == piece.size()) {
+          ++pieceIndex;
+          pieceOffset = 0;
+        }
+      }
+    }
+
+    auto bytes = arrayOutput.getArray();
+    if (bytes.size() == 0) {
+      return kj::READY_NOW;
+    }
+
+    if (frame != nullptr) {
+      // Same frame layout as _::CompressedOutputStream.
+      auto header = reinterpret_cast<_::WireValue<uint32_t>*>(frame.begin());
+      size_t compressedSize = _::compressBlock(
+          bytes, frame.slice(FRAME_HEADER_SIZE, frame.size()));
+      header[0].set(bytes.size());
+      if (compressedSize == 0) {
+        // Didn't compress; store it raw.
+        header[1].set(bytes.size());
+        pieces[0] = frame.slice(0, FRAME_HEADER_SIZE);
+        pieces[1] = bytes;
+        return output.write(kj::arrayPtr(pieces, 2)).then([this]() { return writeNext(); });
+      } else {
+        header[1].set(compressedSize);
+        return output.write(frame.begin(), FRAME_HEADER_SIZE + compressedSize)
+            .then([this]() { return writeNext(); });
+      }
+    }
+
+    return output.write(bytes.begin(), bytes.size()).then([this]() { return writeNext(); });
+  }
+
+private:
+  static constexpr size_t CHUNK_WORDS = 8192;
+  static constexpr size_t FRAME_HEADER_SIZE = sizeof(_::WireValue<uint32_t>) * 2;
+  static_assert(CHUNK_WORDS * 10 <= _::MAX_COMPRESSED_BLOCK_SIZE,
+                "Packed chunk may not fit in a compressed frame.");
+
+  kj::AsyncOutputStream& output;
+  kj::ArrayPtr<const kj::ArrayPtr<const word>> segments;
+  kj::Array<_::WireValue<uint32_t>> table;
+  kj::Array<byte> buffer;
+  kj::Array<byte> frame;
+  kj::ArrayPtr<const byte> pieces[2];
+
+  size_t pieceIndex = 0;
+  size_t pieceOffset = 0;
+  // Position of the next word to pack.  Piece 0 is the segment table; piece i is segment i - 1.
+};
+
+constexpr size_t AsyncPackedMessageWriter::CHUNK_WORDS;
+constexpr size_t AsyncPackedMessageWriter::FRAME_HEADER_SIZE;
+
+}  // namespace
+
+kj::Promise<void> writePackedMessage(kj::AsyncOutputStream& output,
+                                     kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  KJ_REQUIRE(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  auto writer = kj::heap<AsyncPackedMessageWriter>(output, segments, false);
+  auto promise = writer->writeNext();
+  return promise.attach(kj::mv(writer));
+}
+
+// =======================================================================================
+
+namespace {
+
+class AsyncCompressedInputStream final: public kj::AsyncInputStream {
+  // Asynchronous equivalent of _::CompressedInputStream.  Only reads another frame from `inner`
+  // when the current one can't satisfy `minBytes`, so an AsyncPackedInputStream layered on top
+  // never reads beyond the end of a message, however much it tries to read ahead.
+
+public:
+  explicit AsyncCompressedInputStream(kj::AsyncInputStream& inner): inner(inner) {}
+
+  kj::Promise<size_t> tryRead(void* dst, size_t minBytes, size_t maxBytes) override {
+    return tryReadInternal(reinterpret_cast<byte*>(dst), minBytes, maxBytes, 0);
+  }
+
+private:
+  kj::AsyncInputStream& inner;
+  _::WireValue<uint32_t> header[2];
+  kj::Array<byte> compressed;
+  kj::Array<byte> decompressed;
+  kj::ArrayPtr<const byte> available;
+
+  kj::Promise<size_t> tryReadInternal(byte* dst, size_t minBytes, size_t maxBytes,
+                                      size_t alreadyRead) {
+    size_t n = kj::min(available.size(), maxBytes);
+    memcpy(dst, available.begin(), n);
+    available = available.slice(n, available.size());
+
+    if (n >= minBytes) {
+      return alreadyRead + n;
+    }
+
+    return nextFrame().then([this,dst,minBytes,maxBytes,alreadyRead,n](bool gotFrame)
+        -> kj::Promise<size_t> {
+      if (gotFrame) {
+        return tryReadInternal(dst + n, minBytes - n, maxBytes - n, alreadyRead + n);
+      } else {
+        return alreadyRead + n;
+      }
+    });
+  }
+
+  kj::Promise<bool> nextFrame() {
+    return inner.tryRead(header, sizeof(header), sizeof(header))
+        .then([this](size_t n) -> kj::Promise<bool> {
+      if (n == 0) {
+        return false;
+      }
+      KJ_REQUIRE(n == sizeof(header), "Premature EOF in compressed frame header.") {
+        return false;
+      }
+
+      size_t uncompressedSize = header[0].get();
+      size_t payloadSize = header[1].get();
+      KJ_REQUIRE(uncompressedSize > 0 && uncompressedSize <= _::MAX_COMPRESSED_BLOCK_SIZE,
+                 "Compressed frame has invalid size.") {
+        return false;
+      }
+      KJ_REQUIRE(payloadSize <= uncompressedSize, "Compressed frame has invalid size.") {
+        return false;
+      }
+
+      if (decompressed.size() < uncompressedSize) {
+        decompressed = kj::heapArray<byte>(uncompressedSize);
+      }
+
+      if (payloadSize == uncompressedSize) {
+        // Stored uncompressed.
+        return inner.read(decompressed.begin(), payloadSize).then([this,uncompressedSize]() {
+          available = decompressed.slice(0, uncompressedSize);
+          return true;
+        });
+      }
+
+      if (compressed.size() < payloadSize) {
+        compressed = kj::heapArray<byte>(payloadSize);
+      }
+      return inner.read(compressed.begin(), payloadSize)
+          .then([this,uncompressedSize,payloadSize]() {
+        size_t size = _::decompressBlock(compressed.slice(0, payloadSize),
+                                         decompressed.slice(0, uncompressedSize));
+        KJ_REQUIRE(size == uncompressedSize, "Compressed frame is corrupt.") {
+          return false;
+        }
+        available = decompressed.slice(0, uncompressedSize);
+        return true;
+      });
+    });
+  }
+};
+
+}  // namespace
+
+kj::Promise<kj::Own<MessageReader>> readCompressedPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  auto compressed = kj::heap<AsyncCompressedInputStream>(input);
+  auto packed = kj::heap<AsyncPackedInputStream>(*compressed);
+  auto promise = readMessage(*packed, options, scratchSpace);
+  return promise.attach(kj::mv(packed), kj::mv(compressed));
+}
+
+kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadCompressedPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  auto compressed = kj::heap<AsyncCompressedInputStream>(input);
+  auto packed = kj::heap<AsyncPackedInputStream>(*compressed);
+  auto promise = tryReadMessage(*packed, options, scratchSpace);
+  return promise.attach(kj::mv(packed), kj::mv(compressed));
+}
+
+kj::Promise<void> writeCompressedPackedMessage(
+    kj::AsyncOutputStream& output, kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  KJ_REQUIRE(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  auto writer = kj::heap<AsyncPackedMessageWriter>(output, segments, true);
+  auto promise = writer->writeNext();
+  return promise.attach(kj::mv(writer));
+}
+
 }  // namespace capnp
@@ -26,6 +26,7 @@
 #endif
 
 #include <kj/async-io.h>
+#include <kj/async-file.h>
 #include "message.h"
 
 namespace capnp {
@@ -44,6 +45,13 @@ kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadMessage(
     kj::ArrayPtr<word> scratchSpace = nullptr);
 // Like `readMessage` but returns null on EOF.
 
+kj::Promise<kj::Own<MessageReader>> readMessage(
+    const kj::AsyncReadableFile& file, ReaderOptions options = ReaderOptions());
+// Read a message stored in a file (as written by e.g. writeMessageToFd()), without blocking the
+// event loop while waiting for the disk. See kj/async-file.h for how to obtain an
+// AsyncReadableFile. The whole file is read into memory, which the returned reader owns. Anything
+// after the first message in the file is ignored.
+
 kj::Promise<void> writeMessage(kj::AsyncOutputStream& output,
                                kj::ArrayPtr<const kj::ArrayPtr<const word>> segments)
     KJ_WARN_UNUSED_RESULT;
@@ -51,6 +59,89 @@ kj::Promise<void> writeMessage(kj::AsyncOutputStream& output, MessageBuilder& bu
     KJ_WARN_UNUSED_RESULT;
 // Write asynchronously.  The parameters must remain valid until the returned promise resolves.
 
+// =======================================================================================
+// Packed encoding
+
+class AsyncPackedInputStream final: public kj::AsyncInputStream {
+  // Asynchronous equivalent of the input side of PackedMessageReader: unpacks data read from
+  // `inner` as it arrives, without buffering the whole packed message.  Like the synchronous
+  // version, reads must be word-aligned, so typically the only thing you do with this stream is
+  // pass it to `readMessage()` / `tryReadMessage()` above, as many times as there are messages.
+
+public:
+  explicit AsyncPackedInputStream(kj::AsyncInputStream& inner, size_t readAheadBytes = 8192);
+  // `readAheadBytes` is the size of the internal buffer of packed bytes.  Bytes may be read from
+  // `inner` beyond the end of the current message and kept for the next read, so once you start
+  // reading through an AsyncPackedInputStream you must continue doing so.
+  //
+  // If `readAheadBytes` is zero, no byte is ever read from `inner` unless it is known to be part of
+  // the data requested, so that `inner` can be used directly again afterwards.  Since the packed
+  // format does not reveal the length of a word until its tag byte has been seen, this mode makes
+  // many more (small) reads from `inner`.
+
+  KJ_DISALLOW_COPY(AsyncPackedInputStream);
+  ~AsyncPackedInputStream() noexcept(false);
+
+  // implements AsyncInputStream -------------------------------------
+  kj::Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+private:
+  kj::AsyncInputStream& inner;
+  kj::Array<byte> buffer;
+  bool exact;
+
+  byte* pos;
+  byte* end;
+  // Packed bytes in `buffer` that have been read from `inner` but not yet unpacked.
+
+  size_t zeroRunBytes = 0;
+  size_t rawRunBytes = 0;
+  // Remainder of a run started by a 0x00 or 0xff tag which didn't fit in the last read.
+
+  size_t unpackBuffered(byte*& out, byte* outEnd);
+  kj::Promise<size_t> tryReadInternal(byte* dst, byte* out, byte* outMin, byte* outEnd);
+};
+
+kj::Promise<kj::Own<MessageReader>> readPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options = ReaderOptions(),
+    kj::ArrayPtr<word> scratchSpace = nullptr);
+kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options = ReaderOptions(),
+    kj::ArrayPtr<word> scratchSpace = nullptr);
+// Read a single packed message asynchronously, unpacking it directly into the message's segment
+// space as bytes arrive.  These never read past the end of the message (they use an
+// AsyncPackedInputStream with `readAheadBytes` = 0).  If you are going to read a sequence of
+// packed messages from the same stream, it is considerably more efficient to construct one
+// AsyncPackedInputStream and pass it to `readMessage()` repeatedly.
+
+kj::Promise<void> writePackedMessage(kj::AsyncOutputStream& output,
+                                     kj::ArrayPtr<const kj::ArrayPtr<const word>> segments)
+    KJ_WARN_UNUSED_RESULT;
+kj::Promise<void> writePackedMessage(kj::AsyncOutputStream& output, MessageBuilder& builder)
+    KJ_WARN_UNUSED_RESULT;
+// Write a packed message asynchronously.  The message is packed in chunks as the output accepts
+// them, so the whole packed form is never held in memory at once.  The parameters must remain
+// valid until the returned promise resolves.
+
+kj::Promise<kj::Own<MessageReader>> readCompressedPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options = ReaderOptions(),
+    kj::ArrayPtr<word> scratchSpace = nullptr);
+kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadCompressedPackedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options = ReaderOptions(),
+    kj::ArrayPtr<word> scratchSpace = nullptr);
+// Read a message written in the compressed framing (see serialize-compressed.h).  Frames are
+// decompressed one at a time and unpacked as they arrive.  Never reads past the end of the
+// message.
+
+kj::Promise<void> writeCompressedPackedMessage(
+    kj::AsyncOutputStream& output, kj::ArrayPtr<const kj::ArrayPtr<const word>> segments)
+    KJ_WARN_UNUSED_RESULT;
+kj::Promise<void> writeCompressedPackedMessage(
+    kj::AsyncOutputStream& output, MessageBuilder& builder)
+    KJ_WARN_UNUSED_RESULT;
+// Write a message in the compressed framing.  Like writePackedMessage(), the message is processed
+// a chunk at a time, with each chunk becoming one frame.
+
 // =======================================================================================
 // inline implementation details
 
@@ -58,4 +149,14 @@ inline kj::Promise<void> writeMessage(kj::AsyncOutputStream& output, MessageBuil
   return writeMessage(output, builder.getSegmentsForOutput());
 }
 
+inline kj::Promise<void> writePackedMessage(
+    kj::AsyncOutputStream& output, MessageBuilder& builder) {
+  return writePackedMessage(output, builder.getSegmentsForOutput());
+}
+
+inline kj::Promise<void> writeCompressedPackedMessage(
+    kj::AsyncOutputStream& output, MessageBuilder& builder) {
+  return writeCompressedPackedMessage(output, builder.getSegmentsForOutput());
+}
+
 }  // namespace capnp
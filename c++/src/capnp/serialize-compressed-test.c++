@@ -0,0 +1,195 @@
+// Copyright (c) 2018 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "serialize-compressed.h"
+#include <kj/debug.h>
+#include <kj/test.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+kj::Array<byte> roundTripBlock(kj::ArrayPtr<const byte> input, size_t* compressedSize) {
+  auto compressed = kj::heapArray<byte>(input.size() + 64);
+  *compressedSize = compressBlock(input, compressed);
+  if (*compressedSize == 0) {
+    return nullptr;
+  }
+
+  auto result = kj::heapArray<byte>(input.size());
+  KJ_EXPECT(decompressBlock(compressed.slice(0, *compressedSize), result) == input.size());
+  return result;
+}
+
+KJ_TEST("compressed block round trip") {
+  {
+    // Repetitive text compresses well.
+    auto text = kj::str("The quick brown fox jumps over the lazy dog. ", 1234, ' ',
+                        "The quick brown fox jumps over the lazy dog. ",
+                        "The quick brown fox jumps over the lazy cat. ");
+    size_t compressedSize;
+    auto result = roundTripBlock(text.asBytes(), &compressedSize);
+    KJ_ASSERT(result != nullptr);
+    KJ_EXPECT(compressedSize < text.size());
+    KJ_EXPECT(result.asPtr() == text.asBytes());
+  }
+
+  {
+    // Long runs, including overlapping matches and lengths needing extra length bytes.
+    auto input = kj::heapArray<byte>(100000);
+    for (uint i = 0; i < input.size(); i++) {
+      input[i] = (i / 1000) % 3 == 0 ? 'a' : i % 7;
+    }
+    size_t compressedSize;
+    auto result = roundTripBlock(input, &compressedSize);
+    KJ_ASSERT(result != nullptr);
+    KJ_EXPECT(compressedSize < input.size() / 10);
+    KJ_EXPECT(result == input);
+  }
+
+  {
+    // Incompressible input is rejected so that it can be stored raw.
+    auto input = kj::heapArray<byte>(4096);
+    uint32_t state = 12345;
+    for (auto& b: input) {
+      state = state * 1103515245 + 12345;
+      b = state >> 24;
+    }
+    size_t compressedSize;
+    KJ_EXPECT(roundTripBlock(input, &compressedSize) == nullptr);
+    KJ_EXPECT(compressedSize == 0);
+  }
+
+  {
+    // Too short to contain any match.
+    auto input = kj::heapArray<byte>(10);
+    memset(input.begin(), 0, input.size());
+    size_t compressedSize;
+    KJ_EXPECT(roundTripBlock(input, &compressedSize) == nullptr);
+  }
+}
+
+KJ_TEST("compressed block rejects bad input") {
+  byte output[64];
+
+  {
+    // Match offset points before the start of the output.
+    byte input[] = { 0x10, 'a', 0x05, 0x00, 0x10, 'b' };
+    KJ_EXPECT_THROW_MESSAGE("invalid match offset", decompressBlock(input, output));
+  }
+
+  {
+    // Match overruns the output.
+    byte input[] = { 0x1f, 'a', 0x01, 0x00, 0xff, 0x00, 0x10, 'b' };
+    KJ_EXPECT_THROW_MESSAGE("overruns", decompressBlock(input, output));
+  }
+
+  {
+    // Literal length runs past the end of input.
+    byte input[] = { 0x50, 'a', 'b' };
+    KJ_EXPECT_THROW_MESSAGE("truncated", decompressBlock(input, output));
+  }
+}
+
+KJ_TEST("compressed message round trip") {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  kj::VectorOutputStream output;
+  writeCompressedPackedMessage(output, builder);
+  writeCompressedPackedMessage(output, builder);
+
+  auto bytes = output.getArray();
+  kj::ArrayInputStream input(bytes);
+
+  {
+    CompressedPackedMessageReader reader(input);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+  {
+    CompressedPackedMessageReader reader(input);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+  KJ_EXPECT(input.tryGetReadBuffer().size() == 0);
+}
+
+KJ_TEST("compressed message spanning many frames") {
+  MallocMessageBuilder builder(1);
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  // A repetitive string much larger than a frame.
+  kj::Vector<char> chars;
+  for (uint i = 0; i < 20000; i++) {
+    for (char c: kj::str("row ", i % 100, ";")) {
+      chars.add(c);
+    }
+  }
+  auto text = kj::heapString(chars.begin(), chars.size());
+  root.setTextField(text);
+
+  size_t packedSize;
+  {
+    kj::VectorOutputStream packedOutput;
+    writePackedMessage(packedOutput, builder);
+    packedSize = packedOutput.getArray().size();
+  }
+
+  kj::VectorOutputStream output;
+  writeCompressedPackedMessage(output, builder);
+  KJ_EXPECT(output.getArray().size() < packedSize / 4, output.getArray().size(), packedSize);
+
+  kj::ArrayInputStream input(output.getArray());
+  CompressedPackedMessageReader reader(input);
+  auto rootReader = reader.getRoot<TestAllTypes>();
+  KJ_EXPECT(rootReader.getTextField() == text);
+  KJ_EXPECT(rootReader.getInt32Field() == -12345678);
+}
+
+KJ_TEST("compressed message all zero") {
+  MallocMessageBuilder builder;
+  builder.initRoot<TestAllTypes>();
+
+  kj::VectorOutputStream output;
+  writeCompressedPackedMessage(output, builder);
+
+  kj::ArrayInputStream input(output.getArray());
+  CompressedPackedMessageReader reader(input);
+  checkTestMessageAllZero(reader.getRoot<TestAllTypes>());
+}
+
+KJ_TEST("compressed message premature EOF") {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  kj::VectorOutputStream output;
+  writeCompressedPackedMessage(output, builder);
+
+  auto bytes = output.getArray();
+  kj::ArrayInputStream input(bytes.slice(0, bytes.size() - 1));
+  KJ_EXPECT_THROW_MESSAGE("EOF", CompressedPackedMessageReader reader(input));
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,413 @@
+// Copyright (c) 2018 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "serialize-compressed.h"
+#include <kj/debug.h>
+
+namespace capnp {
+
+namespace _ {  // private
+
+namespace {
+
+// Parameters of the LZ4 block format.
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t LAST_LITERALS = 5;   // The last five bytes are always literals.
+static constexpr size_t MF_LIMIT = 12;       // The last match must start 12 bytes before the end.
+static constexpr size_t MAX_OFFSET = 65535;
+
+static constexpr uint HASH_BITS = 12;
+
+inline uint32_t read32(const byte* ptr) {
+  uint32_t result;
+  memcpy(&result, ptr, sizeof(result));
+  return result;
+}
+
+inline uint hashSequence(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+inline byte* writeExtraLength(byte* out, size_t length) {
+  while (length >= 255) {
+    *out++ = 255;
+    length -= 255;
+  }
+  *out++ = length;
+  return out;
+}
+
+inline size_t worstCaseSequenceSize(size_t literalLength, size_t matchLength) {
+  // Token, literal length bytes, literals, offset, match length bytes.
+  return 1 + (literalLength / 255 + 1) + literalLength + 2 + (matchLength / 255 + 1);
+}
+
+}  // namespace
+
+size_t compressBlock(kj::ArrayPtr<const byte> input, kj::ArrayPtr<byte> output) {
+  // A greedy single-pass matcher in the style of LZ4's "fast" mode: hash each 4-byte sequence,
+  // look up the last position with the same hash, and emit a match if the bytes really are
+  // equal.  When matches aren't being found, the step size grows so that incompressible input is
+  // skipped quickly.
+
+  const byte* const base = input.begin();
+  const byte* const inEnd = input.end();
+  const byte* in = base;
+  const byte* anchor = base;  // Start of literals not yet emitted.
+
+  byte* out = output.begin();
+  byte* const outEnd = output.end();
+
+  if (input.size() > MF_LIMIT) {
+    const byte* const matchStartLimit = inEnd - MF_LIMIT;
+    const byte* const matchEndLimit = inEnd - LAST_LITERALS;
+
+    uint32_t table[1u << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    ++in;
+    while (in < matchStartLimit) {
+      uint32_t sequence = read32(in);
+      uint h = hashSequence(sequence);
+      const byte* match = base + table[h];
+      table[h] = in - base;
+
+      if (in - match > MAX_OFFSET || read32(match) != sequence) {
+        in += 1 + ((in - anchor) >> 6);
+        continue;
+      }
+
+      // Extend the match backwards into the pending literals, then forwards.
+      while (in > anchor && match > base && in[-1] == match[-1]) {
+        --in;
+        --match;
+      }
+      const byte* matchEnd = in + MIN_MATCH;
+      const byte* matchSource = match + MIN_MATCH;
+      while (matchEnd < matchEndLimit && *matchEnd == *matchSource) {
+        ++matchEnd;
+        ++matchSource;
+      }
+
+      size_t literalLength = in - anchor;
+      size_t matchLength = matchEnd - in - MIN_MATCH;
+      if (size_t(outEnd - out) < worstCaseSequenceSize(literalLength, matchLength)) {
+        return 0;
+      }
+
+      byte* token = out++;
+      if (literalLength >= 15) {
+        *token = 15 << 4;
+        out = writeExtraLength(out, literalLength - 15);
+      } else {
+        *token = literalLength << 4;
+      }
+      memcpy(out, anchor, literalLength);
+      out += literalLength;
+
+      size_t offset = in - match;
+      *out++ = offset;
+      *out++ = offset >> 8;
+
+      if (matchLength >= 15) {
+        *token |= 15;
+        out = writeExtraLength(out, matchLength - 15);
+      } else {
+        *token |= matchLength;
+      }
+
+      // Give the next search a candidate from inside this match.
+      table[hashSequence(read32(matchEnd - 2))] = matchEnd - 2 - base;
+
+      in = anchor = matchEnd;
+    }
+  }
+
+  // The block always ends with a literal-only sequence.
+  size_t literalLength = inEnd - anchor;
+  if (size_t(outEnd - out) < 1 + (literalLength / 255 + 1) + literalLength) {
+    return 0;
+  }
+  if (literalLength >= 15) {
+    *out++ = 15 << 4;
+    out = writeExtraLength(out, literalLength - 15);
+  } else {
+    *out++ = literalLength << 4;
+  }
+  memcpy(out, anchor, literalLength);
+  out += literalLength;
+
+  size_t result = out - output.begin();
+  return result < input.size() ? result : 0;
+}
+
+size_t decompressBlock(kj::ArrayPtr<const byte> input, kj::ArrayPtr<byte> output) {
+  const byte* in = input.begin();
+  const byte* const inEnd = input.end();
+  byte* out = output.begin();
+  byte* const outEnd = output.end();
+
+#define READ_EXTRA_LENGTH(length) \
+  for (;;) { \
+    KJ_REQUIRE(in < inEnd, "Compressed block is truncated.") { \
+      return out - output.begin(); \
+    } \
+    byte b = *in++; \
+    length += b; \
+    if (b != 255) break; \
+  }
+
+  for (;;) {
+    KJ_REQUIRE(in < inEnd, "Compressed block is truncated.") {
+      break;
+    }
+
+    uint token = *in++;
+
+    size_t literalLength = token >> 4;
+    if (literalLength == 15) {
+      READ_EXTRA_LENGTH(literalLength);
+    }
+    KJ_REQUIRE(literalLength <= size_t(inEnd - in), "Compressed block is truncated.") {
+      break;
+    }
+    KJ_REQUIRE(literalLength <= size_t(outEnd - out), "Compressed block overruns its frame.") {
+      break;
+    }
+    memcpy(out, in, literalLength);
+    in += literalLength;
+    out += literalLength;
+
+    if (in == inEnd) {
+      // Last sequence has no match.
+      break;
+    }
+
+    KJ_REQUIRE(inEnd - in >= 2, "Compressed block is truncated.") {
+      break;
+    }
+    size_t offset = in[0] | (size_t(in[1]) << 8);
+    in += 2;
+    KJ_REQUIRE(offset > 0 && offset <= size_t(out - output.begin()),
+               "Compressed block contains invalid match offset.") {
+      break;
+    }
+
+    size_t matchLength = token & 15;
+    if (matchLength == 15) {
+      READ_EXTRA_LENGTH(matchLength);
+    }
+    matchLength += MIN_MATCH;
+    KJ_REQUIRE(matchLength <= size_t(outEnd - out), "Compressed block overruns its frame.") {
+      break;
+    }
+
+    const byte* match = out - offset;
+    if (offset >= matchLength) {
+      memcpy(out, match, matchLength);
+      out += matchLength;
+    } else {
+      // Overlapping copy, i.e. a repeating pattern.  Must go byte-by-byte.
+      for (size_t i = 0; i < matchLength; i++) {
+        *out++ = *match++;
+      }
+    }
+  }
+
+#undef READ_EXTRA_LENGTH
+
+  return out - output.begin();
+}
+
+// -------------------------------------------------------------------
+
+CompressedInputStream::CompressedInputStream(kj::InputStream& inner): inner(inner) {}
+CompressedInputStream::~CompressedInputStream() noexcept(false) {}
+
+bool CompressedInputStream::nextFrame() {
+  WireValue<uint32_t> header[2];
+  size_t n = inner.tryRead(header, sizeof(header), sizeof(header));
+  if (n == 0) {
+    return false;
+  }
+  KJ_REQUIRE(n == sizeof(header), "Premature EOF in compressed frame header.") {
+    return false;
+  }
+
+  size_t uncompressedSize = header[0].get();
+  size_t payloadSize = header[1].get();
+  KJ_REQUIRE(uncompressedSize > 0 && uncompressedSize <= MAX_COMPRESSED_BLOCK_SIZE,
+             "Compressed frame has invalid size.") {
+    return false;
+  }
+  KJ_REQUIRE(payloadSize <= uncompressedSize, "Compressed frame has invalid size.") {
+    return false;
+  }
+
+  if (decompressed.size() < uncompressedSize) {
+    decompressed = kj::heapArray<byte>(uncompressedSize);
+  }
+
+  if (payloadSize == uncompressedSize) {
+    // Stored uncompressed.
+    inner.read(decompressed.begin(), payloadSize);
+  } else {
+    if (compressed.size() < payloadSize) {
+      compressed = kj::heapArray<byte>(payloadSize);
+    }
+    inner.read(compressed.begin(), payloadSize);
+    size_t size = decompressBlock(compressed.slice(0, payloadSize),
+                                  decompressed.slice(0, uncompressedSize));
+    KJ_REQUIRE(size == uncompressedSize, "Compressed frame is corrupt.") {
+      return false;
+    }
+  }
+
+  available = decompressed.slice(0, uncompressedSize);
+  return true;
+}
+
+kj::ArrayPtr<const byte> CompressedInputStream::tryGetReadBuffer() {
+  if (available.size() == 0) {
+    nextFrame();
+  }
+  return available;
+}
+
+size_t CompressedInputStream::tryRead(void* dst, size_t minBytes, size_t maxBytes) {
+  byte* out = reinterpret_cast<byte*>(dst);
+  size_t total = 0;
+
+  for (;;) {
+    size_t n = kj::min(available.size(), maxBytes - total);
+    memcpy(out + total, available.begin(), n);
+    available = available.slice(n, available.size());
+    total += n;
+
+    if (total >= minBytes || !nextFrame()) {
+      return total;
+    }
+  }
+}
+
+void CompressedInputStream::skip(size_t bytes) {
+  while (bytes > 0) {
+    if (available.size() == 0) {
+      KJ_REQUIRE(nextFrame(), "Premature EOF.") {
+        return;
+      }
+    }
+
+    size_t n = kj::min(available.size(), bytes);
+    available = available.slice(n, available.size());
+    bytes -= n;
+  }
+}
+
+// -------------------------------------------------------------------
+
+CompressedOutputStream::CompressedOutputStream(kj::OutputStream& inner)
+    : inner(inner),
+      buffer(kj::heapArray<byte>(COMPRESSED_BLOCK_SIZE)),
+      frame(kj::heapArray<byte>(sizeof(WireValue<uint32_t>) * 2 + COMPRESSED_BLOCK_SIZE)),
+      bufferPos(buffer.begin()) {}
+
+CompressedOutputStream::~CompressedOutputStream() noexcept(false) {
+  unwindDetector.catchExceptionsIfUnwinding([&]() {
+    flush();
+  });
+}
+
+void CompressedOutputStream::flush() {
+  if (bufferPos == buffer.begin()) {
+    return;
+  }
+
+  auto input = kj::arrayPtr(buffer.begin(), bufferPos);
+  auto header = reinterpret_cast<WireValue<uint32_t>*>(frame.begin());
+  auto payload = frame.slice(sizeof(WireValue<uint32_t>) * 2, frame.size());
+
+  size_t compressedSize = compressBlock(input, payload);
+  header[0].set(input.size());
+
+  if (compressedSize == 0) {
+    // Didn't compress; store it raw.
+    header[1].set(input.size());
+    kj::ArrayPtr<const byte> pieces[2] = {
+      frame.slice(0, sizeof(WireValue<uint32_t>) * 2), input
+    };
+    inner.write(kj::arrayPtr(pieces, 2));
+  } else {
+    header[1].set(compressedSize);
+    inner.write(frame.begin(), sizeof(WireValue<uint32_t>) * 2 + compressedSize);
+  }
+
+  bufferPos = buffer.begin();
+}
+
+kj::ArrayPtr<byte> CompressedOutputStream::getWriteBuffer() {
+  return kj::arrayPtr(bufferPos, buffer.end());
+}
+
+void CompressedOutputStream::write(const void* src, size_t size) {
+  if (src == bufferPos) {
+    // The caller wrote directly into our buffer.
+    bufferPos += size;
+  } else {
+    const byte* in = reinterpret_cast<const byte*>(src);
+    while (size > 0) {
+      size_t n = kj::min(size, size_t(buffer.end() - bufferPos));
+      memcpy(bufferPos, in, n);
+      bufferPos += n;
+      in += n;
+      size -= n;
+
+      if (bufferPos == buffer.end()) {
+        flush();
+      }
+    }
+  }
+
+  if (bufferPos == buffer.end()) {
+    flush();
+  }
+}
+
+}  // namespace _ (private)
+
+// =======================================================================================
+
+CompressedPackedMessageReader::CompressedPackedMessageReader(
+    kj::InputStream& inputStream, ReaderOptions options, kj::ArrayPtr<word> scratchSpace)
+    : CompressedInputStream(inputStream),
+      PackedMessageReader(static_cast<CompressedInputStream&>(*this), options, scratchSpace) {}
+
+CompressedPackedMessageReader::~CompressedPackedMessageReader() noexcept(false) {}
+
+void writeCompressedPackedMessage(kj::OutputStream& output,
+                                  kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  _::CompressedOutputStream compressedOutput(output);
+  writePackedMessage(compressedOutput, segments);
+  compressedOutput.flush();
+}
+
+}  // namespace capnp
@@ -0,0 +1,135 @@
+// Copyright (c) 2018 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+
+#if defined(__GNUC__) && !defined(CAPNP_HEADER_WARNINGS)
+#pragma GCC system_header
+#endif
+
+#include "serialize-packed.h"
+
+namespace capnp {
+
+// Compressed framing:  The packed encoding (see serialize-packed.h) removes zeros, but doesn't
+// find repeated byte sequences, such as repeated strings or similar list elements.  The compressed
+// framing runs the packed bytes through a fast block compressor (using the LZ4 block format) and
+// writes them as a sequence of frames.  Each frame is:
+//
+// - A 32-bit little-endian byte count of the frame's uncompressed content.
+// - A 32-bit little-endian byte count of the frame's payload.  If this is equal to the
+//   uncompressed size, the payload is stored as-is (because it didn't compress).
+// - The payload.
+//
+// Every message ends at a frame boundary, so a reader never needs to read past the end of the
+// message it's parsing.
+
+namespace _ {  // private
+
+static constexpr size_t COMPRESSED_BLOCK_SIZE = 65536;
+// Amount of packed data which writers put into each frame.
+
+static constexpr size_t MAX_COMPRESSED_BLOCK_SIZE = 1u << 17;
+// Largest uncompressed frame that readers will accept.
+
+size_t compressBlock(kj::ArrayPtr<const byte> input, kj::ArrayPtr<byte> output);
+// Compress `input` into `output` in LZ4 block format.  Returns the compressed size, or zero if
+// the result would not be smaller than the input (in which case it should be stored raw).
+
+size_t decompressBlock(kj::ArrayPtr<const byte> input, kj::ArrayPtr<byte> output);
+// Decompress an LZ4 block into `output`, returning the decompressed size.  Throws if the input is
+// malformed or would overrun `output`.
+
+class CompressedInputStream: public kj::BufferedInputStream {
+  // Reads compressed frames from `inner`, exposing the decompressed bytes.  Never reads past the
+  // end of a frame.
+
+public:
+  explicit CompressedInputStream(kj::InputStream& inner);
+  KJ_DISALLOW_COPY(CompressedInputStream);
+  ~CompressedInputStream() noexcept(false);
+
+  // implements BufferedInputStream ----------------------------------
+  kj::ArrayPtr<const byte> tryGetReadBuffer() override;
+  size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+  void skip(size_t bytes) override;
+
+private:
+  kj::InputStream& inner;
+  kj::Array<byte> compressed;
+  kj::Array<byte> decompressed;
+  kj::ArrayPtr<const byte> available;
+
+  bool nextFrame();
+};
+
+class CompressedOutputStream: public kj::BufferedOutputStream {
+  // Buffers data written to it, compressing and writing a frame to `inner` each time the buffer
+  // fills or flush() is called.
+
+public:
+  explicit CompressedOutputStream(kj::OutputStream& inner);
+  KJ_DISALLOW_COPY(CompressedOutputStream);
+  ~CompressedOutputStream() noexcept(false);
+
+  void flush();
+  // Write out a frame for all data written so far.
+
+  // implements BufferedOutputStream ---------------------------------
+  kj::ArrayPtr<byte> getWriteBuffer() override;
+  void write(const void* buffer, size_t size) override;
+
+private:
+  kj::OutputStream& inner;
+  kj::Array<byte> buffer;
+  kj::Array<byte> frame;
+  byte* bufferPos;
+  kj::UnwindDetector unwindDetector;
+};
+
+}  // namespace _ (private)
+
+class CompressedPackedMessageReader: private _::CompressedInputStream,
+                                     public PackedMessageReader {
+public:
+  CompressedPackedMessageReader(kj::InputStream& inputStream,
+                                ReaderOptions options = ReaderOptions(),
+                                kj::ArrayPtr<word> scratchSpace = nullptr);
+  // Each frame is read from `inputStream` with two reads (header, then payload), so if it is a
+  // file descriptor or socket, consider wrapping it in a kj::BufferedInputStreamWrapper.
+  KJ_DISALLOW_COPY(CompressedPackedMessageReader);
+  ~CompressedPackedMessageReader() noexcept(false);
+};
+
+void writeCompressedPackedMessage(kj::OutputStream& output, MessageBuilder& builder);
+void writeCompressedPackedMessage(kj::OutputStream& output,
+                                  kj::ArrayPtr<const kj::ArrayPtr<const word>> segments);
+// Write a packed and compressed message.  Each frame is passed to `output` in a single write().
+
+// =======================================================================================
+// inline stuff
+
+inline void writeCompressedPackedMessage(kj::OutputStream& output, MessageBuilder& builder) {
+  writeCompressedPackedMessage(output, builder.getSegmentsForOutput());
+}
+
+}  // namespace capnp
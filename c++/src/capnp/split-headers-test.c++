@@ -0,0 +1,87 @@
+// Copyright (c) 2013-2014 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+// Include the per-type headers directly, ahead of anything else, to check that they are
+// self-contained.
+#include <capnp/test-split.capnp-TestSplitA.h>
+#include <capnp/test-split.capnp-TestSplitDerived.h>
+#include <capnp/message.h>
+#include <kj/test.h>
+
+namespace capnproto_test {
+namespace capnp {
+namespace test_split {
+namespace {
+
+KJ_TEST("split headers: structs referring to each other") {
+  ::capnp::MallocMessageBuilder message;
+  auto a = message.initRoot<TestSplitA>();
+  a.setText("outer");
+  auto b = a.initB();
+  b.setValue(123);
+  b.initA().setText("inner");
+
+  auto reader = message.getRoot<TestSplitA>().asReader();
+  KJ_EXPECT(reader.getText() == "outer");
+  KJ_EXPECT(reader.getB().getValue() == 123);
+  KJ_EXPECT(reader.getB().getA().getText() == "inner");
+  KJ_EXPECT(!reader.getB().getA().hasB());
+}
+
+class DerivedImpl final: public TestSplitDerived::Server {
+public:
+  uint32_t value = 0;
+
+protected:
+  kj::Promise<void> get(GetContext context) override {
+    auto a = context.getResults().initA();
+    a.setText("got");
+    a.initB().setValue(value);
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> put(PutContext context) override {
+    value = context.getParams().getB().getValue();
+    return kj::READY_NOW;
+  }
+};
+
+KJ_TEST("split headers: interface extending one from another header") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  TestSplitDerived::Client derived = kj::heap<DerivedImpl>();
+
+  auto put = derived.putRequest();
+  put.initB().setValue(456);
+  put.send().wait(waitScope);
+
+  TestSplitBase::Client base = derived;
+  auto response = base.getRequest().send().wait(waitScope);
+  KJ_EXPECT(response.getA().getText() == "got");
+  KJ_EXPECT(response.getA().getB().getValue() == 456);
+}
+
+}  // namespace
+}  // namespace test_split
+}  // namespace capnp
+}  // namespace capnproto_test
@@ -0,0 +1,123 @@
+// Copyright (c) 2017 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "async-file.h"
+#include "vector.h"
+#include <kj/test.h>
+
+namespace kj {
+namespace {
+
+KJ_TEST("AsyncFile read and write") {
+  auto io = setupAsyncIo();
+  auto provider = newAsyncFileProvider(*io.provider, 2);
+
+  auto file = newInMemoryFile(nullClock());
+  file->writeAll("foobar");
+  auto asyncFile = provider->wrapFile(file->clone());
+
+  byte buffer[16];
+  KJ_EXPECT(asyncFile->read(3, buffer).wait(io.waitScope) == 3);
+  KJ_EXPECT(kj::str(arrayPtr(buffer, 3).asChars()) == "bar");
+
+  {
+    auto data = kj::str("bazqux");
+    auto promise = asyncFile->write(3, data.asBytes());
+    data = nullptr;  // write() must have copied the data
+    promise.wait(io.waitScope);
+  }
+  asyncFile->datasync().wait(io.waitScope);
+
+  KJ_EXPECT(file->readAllText() == "foobazqux");
+  KJ_EXPECT(asyncFile->stat().wait(io.waitScope).size == 9);
+  KJ_EXPECT(kj::str(asyncFile->readAllBytes().wait(io.waitScope).asChars()) == "foobazqux");
+
+  auto readable = provider->wrapReadableFile(file->clone());
+  KJ_EXPECT(readable->read(6, buffer).wait(io.waitScope) == 3);
+  KJ_EXPECT(kj::str(arrayPtr(buffer, 3).asChars()) == "qux");
+}
+
+KJ_TEST("AsyncFile many concurrent reads") {
+  auto io = setupAsyncIo();
+  auto provider = newAsyncFileProvider(*io.provider, 4);
+
+  auto file = newInMemoryFile(nullClock());
+  for (uint i = 0; i < 256; i++) {
+    byte b = i;
+    file->write(i, arrayPtr(&b, 1));
+  }
+  auto asyncFile = provider->wrapReadableFile(file->clone());
+
+  auto buffers = heapArray<byte>(256 * 4);
+  kj::Vector<Promise<size_t>> promises;
+  for (uint i = 0; i < 256; i++) {
+    promises.add(asyncFile->read(i, buffers.slice(i * 4, i * 4 + 4)));
+  }
+  auto sizes = joinPromises(promises.releaseAsArray()).wait(io.waitScope);
+
+  for (uint i = 0; i < 256; i++) {
+    KJ_EXPECT(sizes[i] == kj::min(4u, 256 - i));
+    KJ_EXPECT(buffers[i * 4] == i);
+  }
+}
+
+KJ_TEST("AsyncFile cancellation") {
+  auto io = setupAsyncIo();
+  auto provider = newAsyncFileProvider(*io.provider, 1);
+
+  auto file = newInMemoryFile(nullClock());
+  file->writeAll("foobar");
+  auto asyncFile = provider->wrapFile(file->clone());
+
+  {
+    auto buffer = heapArray<byte>(6);
+    auto promise = asyncFile->read(0, buffer);
+    // Destroying the promise, and then the buffer, must be safe even if the read is in progress.
+  }
+
+  // The file wrapper can also go away while operations are still queued.
+  asyncFile->write(0, kj::StringPtr("baz").asBytes()).wait(io.waitScope);
+  auto promise = asyncFile->readAllBytes();
+  asyncFile = nullptr;
+  KJ_EXPECT(kj::str(promise.wait(io.waitScope).asChars()) == "bazbar");
+}
+
+KJ_TEST("AsyncFile provider destroyed with jobs pending") {
+  auto io = setupAsyncIo();
+  auto provider = newAsyncFileProvider(*io.provider, 2);
+
+  auto file = newInMemoryFile(nullClock());
+  auto asyncFile = provider->wrapFile(file->clone());
+
+  kj::Vector<Promise<void>> promises;
+  for (uint i = 0; i < 100; i++) {
+    promises.add(asyncFile->write(i, kj::StringPtr("x").asBytes()));
+  }
+
+  // Must not hang or crash.
+  promises.releaseAsArray();
+  asyncFile = nullptr;
+  provider = nullptr;
+}
+
+}  // namespace
+}  // namespace kj
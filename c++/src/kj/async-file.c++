@@ -0,0 +1,304 @@
+// Copyright (c) 2017 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "async-file.h"
+#include "debug.h"
+#include "mutex.h"
+#include <deque>
+#include <string.h>
+
+namespace kj {
+
+namespace {
+
+class AsyncFileImpl;
+
+class FileJob: public Refcounted {
+  // One blocking operation, performed on a helper thread.
+  //
+  // Only the event loop thread touches the refcount. The helper thread receives a raw pointer,
+  // which remains valid because the job stays in its worker's queue until the helper thread has
+  // replied.
+
+public:
+  explicit FileJob(Own<const AsyncFileImpl> file): file(kj::mv(file)) {}
+
+  virtual void run() = 0;
+  // Called on the helper thread.
+
+  Own<const AsyncFileImpl> file;
+  Maybe<Exception> exception;
+  Own<PromiseFulfiller<void>> fulfiller;
+};
+
+class AsyncFileProviderImpl final: public AsyncFileProvider {
+public:
+  AsyncFileProviderImpl(AsyncIoProvider& ioProvider, uint threadCount);
+  ~AsyncFileProviderImpl() noexcept(false);
+  KJ_DISALLOW_COPY(AsyncFileProviderImpl);
+
+  Own<AsyncReadableFile> wrapReadableFile(Own<const ReadableFile> file) override;
+  Own<AsyncFile> wrapFile(Own<const File> file) override;
+
+  Promise<void> submit(Own<FileJob> job);
+  // Queues `job` on the least-busy helper thread. The returned promise resolves (or rejects with
+  // the job's exception) once the job has run.
+
+private:
+  struct Worker {
+    std::deque<Own<FileJob>> queue;
+    // Jobs sent to the helper thread and not yet replied to, in order. Declared first so that it
+    // is destroyed last, after the thread has been joined.
+
+    AsyncIoProvider::PipeThread pipeThread;
+    Promise<void> sendQueue = READY_NOW;
+    Promise<void> replyLoop = nullptr;
+    byte reply;
+  };
+
+  MutexGuarded<bool> shuttingDown;
+  // Set when the provider is being destroyed, telling helper threads to skip jobs they have not
+  // started yet.
+
+  Array<Worker> workers;
+
+  Promise<void> receiveReplies(Worker& worker);
+};
+
+class AsyncFileImpl final: public AsyncFile, public AtomicRefcounted {
+public:
+  AsyncFileImpl(AsyncFileProviderImpl& provider, Own<const ReadableFile> file,
+                const File* writable)
+      : provider(provider), file(kj::mv(file)), writable(writable) {}
+
+  const ReadableFile& getFile() const { return *file; }
+  const File& getWritable() const { return KJ_ASSERT_NONNULL(writable); }
+
+  Promise<FsNode::Metadata> stat() const override;
+  Promise<size_t> read(uint64_t offset, ArrayPtr<byte> buffer) const override;
+  Promise<Array<byte>> readAllBytes() const override;
+  Promise<void> write(uint64_t offset, ArrayPtr<const byte> data) const override;
+  Promise<void> datasync() const override;
+
+private:
+  AsyncFileProviderImpl& provider;
+  Own<const ReadableFile> file;
+  Maybe<const File&> writable;
+  // Points into `file` when this object was created by wrapFile().
+};
+
+// -------------------------------------------------------------------
+
+class StatJob final: public FileJob {
+public:
+  using FileJob::FileJob;
+  void run() override { result = file->getFile().stat(); }
+  FsNode::Metadata result;
+};
+
+class ReadJob final: public FileJob {
+public:
+  ReadJob(Own<const AsyncFileImpl> file, uint64_t offset, size_t size)
+      : FileJob(kj::mv(file)), offset(offset), buffer(heapArray<byte>(size)) {}
+  void run() override { result = file->getFile().read(offset, buffer); }
+
+  uint64_t offset;
+  Array<byte> buffer;
+  size_t result = 0;
+};
+
+class ReadAllJob final: public FileJob {
+public:
+  using FileJob::FileJob;
+  void run() override { result = file->getFile().readAllBytes(); }
+  Array<byte> result;
+};
+
+class WriteJob final: public FileJob {
+public:
+  WriteJob(Own<const AsyncFileImpl> file, uint64_t offset, ArrayPtr<const byte> data)
+      : FileJob(kj::mv(file)), offset(offset), data(heapArray(data)) {}
+  void run() override { file->getWritable().write(offset, data); }
+
+  uint64_t offset;
+  Array<byte> data;
+};
+
+class DatasyncJob final: public FileJob {
+public:
+  using FileJob::FileJob;
+  void run() override { file->getWritable().datasync(); }
+};
+
+Promise<FsNode::Metadata> AsyncFileImpl::stat() const {
+  auto job = refcounted<StatJob>(atomicAddRef(*this));
+  auto promise = provider.submit(addRef(*job));
+  return promise.then(kj::mvCapture(job, [](Own<StatJob>&& job) {
+    return job->result;
+  }));
+}
+
+Promise<size_t> AsyncFileImpl::read(uint64_t offset, ArrayPtr<byte> buffer) const {
+  auto job = refcounted<ReadJob>(atomicAddRef(*this), offset, buffer.size());
+  auto promise = provider.submit(addRef(*job));
+  byte* dst = buffer.begin();
+  return promise.then(kj::mvCapture(job, [dst](Own<ReadJob>&& job) {
+    memcpy(dst, job->buffer.begin(), job->result);
+    return job->result;
+  }));
+}
+
+Promise<Array<byte>> AsyncFileImpl::readAllBytes() const {
+  auto job = refcounted<ReadAllJob>(atomicAddRef(*this));
+  auto promise = provider.submit(addRef(*job));
+  return promise.then(kj::mvCapture(job, [](Own<ReadAllJob>&& job) {
+    return kj::mv(job->result);
+  }));
+}
+
+Promise<void> AsyncFileImpl::write(uint64_t offset, ArrayPtr<const byte> data) const {
+  return provider.submit(refcounted<WriteJob>(atomicAddRef(*this), offset, data));
+}
+
+Promise<void> AsyncFileImpl::datasync() const {
+  return provider.submit(refcounted<DatasyncJob>(atomicAddRef(*this)));
+}
+
+// -------------------------------------------------------------------
+
+AsyncFileProviderImpl::AsyncFileProviderImpl(AsyncIoProvider& ioProvider, uint threadCount)
+    : shuttingDown(false) {
+  KJ_REQUIRE(threadCount > 0, "need at least one helper thread");
+
+  const MutexGuarded<bool>& shuttingDown = this->shuttingDown;
+  auto builder = heapArrayBuilder<Worker>(threadCount);
+  for (uint i = 0; i < threadCount; i++) {
+    builder.add();
+    auto& worker = builder.back();
+    worker.pipeThread = ioProvider.newPipeThread(
+        [&shuttingDown](AsyncIoProvider&, AsyncIoStream& pipe, WaitScope& waitScope) {
+      for (;;) {
+        FileJob* job;
+        if (pipe.tryRead(&job, sizeof(job), sizeof(job)).wait(waitScope) < sizeof(job)) {
+          // The provider has been destroyed.
+          return;
+        }
+
+        if (*shuttingDown.lockShared()) continue;
+
+        job->exception = kj::runCatchingExceptions([&]() { job->run(); });
+
+        byte reply = 0;
+        auto writeError = kj::runCatchingExceptions([&]() {
+          pipe.write(&reply, 1).wait(waitScope);
+        });
+        if (writeError != nullptr) {
+          // The provider is gone; nobody is listening.
+          return;
+        }
+      }
+    });
+  }
+  workers = builder.finish();
+
+  for (auto& worker: workers) {
+    worker.replyLoop = receiveReplies(worker)
+        .eagerlyEvaluate([&worker](Exception&& e) {
+      // The helper thread died. Fail everything it was working on.
+      while (!worker.queue.empty()) {
+        worker.queue.front()->fulfiller->reject(kj::cp(e));
+        worker.queue.pop_front();
+      }
+    });
+  }
+}
+
+AsyncFileProviderImpl::~AsyncFileProviderImpl() noexcept(false) {
+  *shuttingDown.lockExclusive() = true;
+
+  // Now destroying `workers` disconnects each pipe and then joins each thread. A thread may be in
+  // the middle of a job, but won't start another one.
+}
+
+Promise<void> AsyncFileProviderImpl::receiveReplies(Worker& worker) {
+  return worker.pipeThread.pipe->tryRead(&worker.reply, 1, 1)
+      .then([this,&worker](size_t n) -> Promise<void> {
+    KJ_ASSERT(n == 1, "file I/O helper thread exited unexpectedly");
+    KJ_ASSERT(!worker.queue.empty(), "file I/O helper thread replied to nonexistent job");
+
+    auto job = kj::mv(worker.queue.front());
+    worker.queue.pop_front();
+
+    KJ_IF_MAYBE(e, job->exception) {
+      job->fulfiller->reject(kj::mv(*e));
+    } else {
+      job->fulfiller->fulfill();
+    }
+
+    return receiveReplies(worker);
+  });
+}
+
+Promise<void> AsyncFileProviderImpl::submit(Own<FileJob> job) {
+  Worker* target = &workers[0];
+  for (auto& worker: workers) {
+    if (worker.queue.size() < target->queue.size()) {
+      target = &worker;
+    }
+  }
+
+  auto paf = newPromiseAndFulfiller<void>();
+  job->fulfiller = kj::mv(paf.fulfiller);
+
+  // The pointer has to stay put until the write completes, so give it a home on the heap.
+  auto message = heap<FileJob*>(job.get());
+  target->queue.push_back(kj::mv(job));
+
+  target->sendQueue = target->sendQueue.then(kj::mvCapture(message,
+      [target](Own<FileJob*>&& message) {
+    auto promise = target->pipeThread.pipe->write(message.get(), sizeof(FileJob*));
+    return promise.attach(kj::mv(message));
+  })).eagerlyEvaluate([](Exception&& e) {
+    // Writing to the pipe only fails if the helper thread has died, in which case the reply loop
+    // fails the queued jobs.
+    KJ_LOG(ERROR, "couldn't send job to file I/O helper thread", e);
+  });
+
+  return kj::mv(paf.promise);
+}
+
+Own<AsyncReadableFile> AsyncFileProviderImpl::wrapReadableFile(Own<const ReadableFile> file) {
+  return atomicRefcounted<AsyncFileImpl>(*this, kj::mv(file), nullptr);
+}
+
+Own<AsyncFile> AsyncFileProviderImpl::wrapFile(Own<const File> file) {
+  const File* writable = file.get();
+  return atomicRefcounted<AsyncFileImpl>(*this, kj::mv(file), writable);
+}
+
+}  // namespace
+
+Own<AsyncFileProvider> newAsyncFileProvider(AsyncIoProvider& ioProvider, uint threadCount) {
+  return heap<AsyncFileProviderImpl>(ioProvider, threadCount);
+}
+
+}  // namespace kj
@@ -0,0 +1,98 @@
+// Copyright (c) 2017 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+
+#if defined(__GNUC__) && !KJ_HEADER_WARNINGS
+#pragma GCC system_header
+#endif
+
+#include "async-io.h"
+#include "filesystem.h"
+
+namespace kj {
+
+// =======================================================================================
+// Asynchronous file I/O
+//
+// The interfaces in filesystem.h are blocking. Calling them from an event loop thread stalls every
+// other event on that thread until the disk responds, which for a cold cache or a network
+// filesystem can take a long time. The classes here wrap a `File` or `ReadableFile` so that its
+// reads and writes complete asynchronously instead.
+
+class AsyncReadableFile {
+  // Asynchronous counterpart of `ReadableFile`.
+
+public:
+  virtual Promise<FsNode::Metadata> stat() const = 0;
+  // Asynchronous `FsNode::stat()`.
+
+  virtual Promise<size_t> read(uint64_t offset, ArrayPtr<byte> buffer) const = 0;
+  // Reads up to `buffer.size()` bytes starting at `offset`. Resolves to the number of bytes read,
+  // which is less than `buffer.size()` only if end-of-file was reached.
+  //
+  // `buffer` must remain valid until the returned promise resolves or is canceled. Canceling takes
+  // effect immediately: the buffer will not be written after the promise is destroyed, even if the
+  // underlying I/O is still in progress.
+
+  virtual Promise<Array<byte>> readAllBytes() const = 0;
+  // Reads the entire file.
+};
+
+class AsyncFile: public AsyncReadableFile {
+  // Asynchronous counterpart of `File`.
+
+public:
+  virtual Promise<void> write(uint64_t offset, ArrayPtr<const byte> data) const = 0;
+  // Writes `data` at `offset`, extending the file if necessary. `data` need not remain valid after
+  // write() returns.
+  //
+  // If the returned promise is canceled, the write may or may not still take place.
+
+  virtual Promise<void> datasync() const = 0;
+  // Asynchronous `FsNode::datasync()`.
+};
+
+class AsyncFileProvider {
+  // Turns blocking files into asynchronous ones, scheduling their I/O so that it doesn't block the
+  // calling thread's event loop.
+  //
+  // All methods must be called from the thread that created the provider, and the provider must
+  // outlive all files it has wrapped.
+
+public:
+  virtual Own<AsyncReadableFile> wrapReadableFile(Own<const ReadableFile> file) = 0;
+  virtual Own<AsyncFile> wrapFile(Own<const File> file) = 0;
+};
+
+Own<AsyncFileProvider> newAsyncFileProvider(AsyncIoProvider& ioProvider, uint threadCount = 4);
+// Creates an AsyncFileProvider which performs I/O on a fixed pool of `threadCount` helper threads
+// (created with `ioProvider.newPipeThread()`). Each operation is assigned to the thread with the
+// fewest operations outstanding, so at most `threadCount` operations are in progress at once.
+//
+// Data passes through a buffer owned by the operation, so that cancellation is always safe. This
+// costs one extra copy per read or write, which is normally small next to the cost of the I/O.
+//
+// Destroying the provider abandons any operations that have not started yet and waits for those
+// already in progress to finish.
+
+}  // namespace kj
@@ -38,6 +38,19 @@ namespace _ {  // private
 kj::ArrayPtr<const char> safeUnixPath(const struct sockaddr_un* addr, uint addrlen);
 // sockaddr_un::sun_path is not required to have a NUL terminator! Thus to be safe unix address
 // paths MUST be read using this function.
+
+class AsyncFdStream: public AsyncCapabilityStream {
+  // The stream that the Unix LowLevelAsyncIoProvider wraps file descriptors in. This isn't part
+  // of the public API: kj/compat/tls.c++ finds it with dynamicDowncastIfAvailable() so that
+  // OpenSSL can do I/O on the descriptor itself rather than going through an intermediate buffer.
+  // Since only one UnixEventPort::FdObserver may exist per descriptor, such a layer must dup()
+  // the descriptor to observe it, and it must not have any read() or write() outstanding on the
+  // stream meanwhile.
+
+public:
+  virtual UnixEventPort& getEventPort() const = 0;
+  // The port on which the stream waits for its descriptor, AsyncIoStream::getFd().
+};
 #endif
 
 class CidrRange {
@@ -194,6 +194,27 @@ TEST(AsyncIo, TwoWayPipe) {
   EXPECT_EQ("bar", result2);
 }
 
+#if !_WIN32
+TEST(AsyncIo, GetFd) {
+  auto ioContext = setupAsyncIo();
+
+  auto pipe = ioContext.provider->newTwoWayPipe();
+  int fd = KJ_ASSERT_NONNULL(pipe.ends[0]->getFd());
+  auto& fdStream = KJ_ASSERT_NONNULL(dynamicDowncastIfAvailable<_::AsyncFdStream>(*pipe.ends[0]));
+  EXPECT_TRUE(&fdStream.getEventPort() == &ioContext.unixEventPort);
+
+  // Writing to the raw descriptor is visible to the other end of the stream.
+  KJ_SYSCALL(write(fd, "foo", 3));
+  char buffer[4];
+  EXPECT_EQ(3u, pipe.ends[1]->tryRead(buffer, 3, 4).wait(ioContext.waitScope));
+  EXPECT_EQ("foo", heapString(buffer, 3));
+
+  auto memoryPipe = newTwoWayPipe();
+  EXPECT_TRUE(memoryPipe.ends[0]->getFd() == nullptr);
+  EXPECT_TRUE(dynamicDowncastIfAvailable<_::AsyncFdStream>(*memoryPipe.ends[0]) == nullptr);
+}
+#endif
+
 #if !_WIN32
 TEST(AsyncIo, CapabilityPipe) {
   auto ioContext = setupAsyncIo();
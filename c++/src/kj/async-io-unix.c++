@@ -126,7 +126,7 @@ private:
 
 // =======================================================================================
 
-class AsyncStreamFd: public OwnedFileDescriptor, public AsyncCapabilityStream {
+class AsyncStreamFd: public OwnedFileDescriptor, public _::AsyncFdStream {
 public:
   AsyncStreamFd(UnixEventPort& eventPort, int fd, uint flags)
       : OwnedFileDescriptor(fd, flags),
@@ -213,6 +213,14 @@ public:
     *length = socklen;
   }
 
+  Maybe<int> getFd() const override {
+    return fd;
+  }
+
+  UnixEventPort& getEventPort() const override {
+    return eventPort;
+  }
+
   kj::Promise<Maybe<Own<AsyncCapabilityStream>>> tryReceiveStream() override {
     return tryReceiveFdImpl<Own<AsyncCapabilityStream>>();
   }
@@ -1165,6 +1165,11 @@ void AsyncIoStream::getsockname(struct sockaddr* addr, uint* length) {
 void AsyncIoStream::getpeername(struct sockaddr* addr, uint* length) {
   KJ_UNIMPLEMENTED("Not a socket.");
 }
+#if !_WIN32
+Maybe<int> AsyncIoStream::getFd() const {
+  return nullptr;
+}
+#endif
 void ConnectionReceiver::getsockopt(int level, int option, void* value, uint* length) {
   KJ_UNIMPLEMENTED("Not a socket.");
 }
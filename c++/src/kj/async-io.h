@@ -134,6 +134,12 @@ public:
   // Note that we don't provide methods that return NetworkAddress because it usually wouldn't
   // be useful. You can't connect() to or listen() on these addresses, obviously, because they are
   // ephemeral addresses for a single connection.
+
+#if !_WIN32
+  virtual Maybe<int> getFd() const;
+  // If this stream directly wraps a non-blocking file descriptor, return it. The default
+  // implementation returns null.
+#endif
 };
 
 class AsyncCapabilityStream: public AsyncIoStream {
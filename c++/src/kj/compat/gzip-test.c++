@@ -291,6 +291,78 @@ KJ_TEST("gzip huge round trip") {
   KJ_ASSERT(memcmp(bytes.begin(), decompressed.begin(), bytes.size()) == 0);
 }
 
+KJ_TEST("parallel gzip compression") {
+  // Small writes, spread over several flushes and batches.
+  {
+    MockOutputStream rawOutput;
+    {
+      ParallelGzipOutputStream gzip(rawOutput, Z_DEFAULT_COMPRESSION, 3, 4);
+      gzip.write("foo", 3);
+      gzip.flush();
+      gzip.write("barbazquxcorge", 14);
+    }
+
+    KJ_EXPECT(rawOutput.decompress() == "foobarbazquxcorge");
+  }
+
+  // Empty input still produces a valid stream.
+  {
+    MockOutputStream rawOutput;
+    { ParallelGzipOutputStream gzip(rawOutput); }
+    KJ_EXPECT(rawOutput.decompress() == "");
+  }
+
+  // Incompressible input, with many more blocks than threads so that write() has to wait.
+  {
+    auto bytes = heapArray<byte>(100000);
+    for (auto& b: bytes) b = rand();
+
+    MockOutputStream rawOutput;
+    {
+      ParallelGzipOutputStream gzip(rawOutput, 9, 1, 1000);
+      gzip.write(bytes.begin(), bytes.size());
+    }
+
+    MockInputStream rawInput(rawOutput.bytes, kj::maxValue);
+    GzipInputStream gzipIn(rawInput);
+    auto decompressed = gzipIn.readAllBytes();
+    KJ_ASSERT(decompressed.size() == bytes.size());
+    KJ_ASSERT(memcmp(bytes.begin(), decompressed.begin(), bytes.size()) == 0);
+  }
+}
+
+KJ_TEST("parallel gzip huge round trip") {
+  // Mostly-compressible data so that dictionary priming across blocks actually matters, plus
+  // enough of it to span several batches of several blocks.
+  auto bytes = heapArray<byte>(1 << 20);
+  for (auto i: kj::indices(bytes)) {
+    bytes[i] = (i % 1000 < 100) ? rand() : 'a' + (i / 7) % 26;
+  }
+
+  MockOutputStream parallelOutput;
+  {
+    ParallelGzipOutputStream gzipOut(parallelOutput, Z_DEFAULT_COMPRESSION, 4, 65536);
+    gzipOut.write(bytes.slice(0, 12345).begin(), 12345);
+    gzipOut.write(bytes.slice(12345, bytes.size()).begin(), bytes.size() - 12345);
+  }
+
+  MockInputStream rawInput(parallelOutput.bytes, kj::maxValue);
+  GzipInputStream gzipIn(rawInput);
+  auto decompressed = gzipIn.readAllBytes();
+
+  KJ_ASSERT(decompressed.size() == bytes.size());
+  KJ_ASSERT(memcmp(bytes.begin(), decompressed.begin(), bytes.size()) == 0);
+
+  // Priming each block with its predecessor's tail should keep us close to single-threaded output.
+  MockOutputStream serialOutput;
+  {
+    GzipOutputStream gzipOut(serialOutput);
+    gzipOut.write(bytes.begin(), bytes.size());
+  }
+  KJ_EXPECT(parallelOutput.bytes.size() < serialOutput.bytes.size() * 11 / 10,
+            parallelOutput.bytes.size(), serialOutput.bytes.size());
+}
+
 KJ_TEST("async gzip compression") {
   auto io = setupAsyncIo();
 
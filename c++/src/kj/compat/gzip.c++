@@ -23,6 +23,9 @@
 
 #include "gzip.h"
 #include <kj/debug.h>
+#include <kj/thread.h>
+#include <kj/vector.h>
+#include <deque>
 
 namespace kj {
 
@@ -169,6 +172,187 @@ void GzipOutputStream::pump(int flush) {
 
 // =======================================================================================
 
+namespace {
+
+static constexpr size_t WINDOW_SIZE = 32768;
+// deflate's maximum back-reference distance, and so the most dictionary that's useful.
+
+}  // namespace
+
+struct ParallelGzipOutputStream::Block final: public WorkerPool::Job {
+  int level;
+
+  kj::Array<byte> data;
+  // The tail of the preceding input, used as the dictionary, followed by this block's input.
+
+  size_t dictionarySize = 0;
+  size_t inputSize = 0;
+  bool last = false;
+
+  // Filled in by run(), on a worker thread.
+  kj::Array<byte> output;
+  size_t outputSize = 0;
+  uLong crc = 0;
+
+  Block(int level, size_t blockSize)
+      : level(level), data(heapArray<byte>(WINDOW_SIZE + blockSize)) {}
+
+  ArrayPtr<const byte> input() const {
+    return data.slice(dictionarySize, dictionarySize + inputSize);
+  }
+
+  void run() override {
+    z_stream ctx = {};
+
+    // windowBits = -15 requests raw deflate: the gzip header and trailer are written separately,
+    // once for the whole stream.
+    int result = deflateInit2(&ctx, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    if (result != Z_OK) fail(ctx, result);
+    KJ_DEFER(deflateEnd(&ctx));
+
+    if (dictionarySize > 0) {
+      result = deflateSetDictionary(&ctx, data.begin(), dictionarySize);
+      if (result != Z_OK) fail(ctx, result);
+    }
+
+    auto in = input();
+    ctx.next_in = const_cast<byte*>(in.begin());
+    ctx.avail_in = in.size();
+
+    // A sync flush ends on a byte boundary without marking the final block, so the next block's
+    // output can simply be appended. It adds a few bytes beyond deflateBound(), so leave room for
+    // them, but keep going with a bigger buffer if deflate() still runs out.
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    output = heapArray<byte>(deflateBound(&ctx, in.size()) + 16);
+    for (;;) {
+      ctx.next_out = output.begin() + outputSize;
+      ctx.avail_out = output.size() - outputSize;
+
+      result = deflate(&ctx, flush);
+      if (result != Z_OK && result != Z_STREAM_END) fail(ctx, result);
+      outputSize = output.size() - ctx.avail_out;
+
+      // Z_FINISH is done when it says so; a sync flush is done once it leaves output space unused.
+      if (last ? result == Z_STREAM_END : ctx.avail_out > 0) break;
+
+      auto bigger = heapArray<byte>(output.size() * 2);
+      memcpy(bigger.begin(), output.begin(), outputSize);
+      output = kj::mv(bigger);
+    }
+    KJ_ASSERT(ctx.avail_in == 0);
+
+    crc = crc32(0, in.begin(), in.size());
+  }
+
+  static void fail(z_stream& ctx, int result) {
+    if (ctx.msg == nullptr) {
+      KJ_FAIL_REQUIRE("gzip compression failed", result);
+    } else {
+      KJ_FAIL_REQUIRE("gzip compression failed", ctx.msg);
+    }
+  }
+};
+
+struct ParallelGzipOutputStream::InFlight {
+  std::deque<Own<Block>> blocks;
+  // Submitted blocks not yet written out, in stream order.
+
+  WorkerPool pool;
+  // Declared last so that the workers are stopped before the blocks they work on are freed.
+
+  explicit InFlight(uint threadCount): pool(threadCount) {}
+};
+
+ParallelGzipOutputStream::ParallelGzipOutputStream(
+    OutputStream& inner, int compressionLevel, uint threadCount, size_t blockSize)
+    : inner(inner), compressionLevel(compressionLevel), blockSize(blockSize),
+      maxInFlight(threadCount * 2), crc(crc32(0, nullptr, 0)) {
+  KJ_REQUIRE(threadCount > 0, "need at least one thread");
+  KJ_REQUIRE(blockSize > 0, "block size must be non-zero");
+  current = heap<Block>(compressionLevel, blockSize);
+  inFlight = heap<InFlight>(threadCount);
+}
+
+ParallelGzipOutputStream::~ParallelGzipOutputStream() noexcept(false) {
+  submit(true);
+  writeFinished(true);
+
+  byte trailer[8];
+  for (uint i = 0; i < 4; i++) {
+    trailer[i] = (crc >> (i * 8)) & 0xff;
+    trailer[i + 4] = (totalSize >> (i * 8)) & 0xff;
+  }
+  inner.write(trailer, sizeof(trailer));
+}
+
+void ParallelGzipOutputStream::write(const void* in, size_t size) {
+  auto bytes = arrayPtr(reinterpret_cast<const byte*>(in), size);
+  while (bytes.size() > 0) {
+    size_t n = kj::min(bytes.size(), blockSize - current->inputSize);
+    memcpy(current->data.begin() + current->dictionarySize + current->inputSize,
+           bytes.begin(), n);
+    current->inputSize += n;
+    bytes = bytes.slice(n, bytes.size());
+
+    if (current->inputSize == blockSize) {
+      submit(false);
+      writeFinished(false);
+    }
+  }
+}
+
+void ParallelGzipOutputStream::flush() {
+  if (current->inputSize > 0) {
+    submit(false);
+  }
+  writeFinished(true);
+}
+
+void ParallelGzipOutputStream::submit(bool last) {
+  // Prime the next block with the tail of this one's dictionary and input. The workers only read
+  // `data`, so copying from it after handing the block over is fine.
+  auto next = heap<Block>(compressionLevel, blockSize);
+  size_t used = current->dictionarySize + current->inputSize;
+  next->dictionarySize = kj::min(WINDOW_SIZE, used);
+  memcpy(next->data.begin(), current->data.begin() + used - next->dictionarySize,
+         next->dictionarySize);
+
+  current->last = last;
+  inFlight->pool.submit(*current);
+  inFlight->blocks.push_back(kj::mv(current));
+  current = kj::mv(next);
+}
+
+void ParallelGzipOutputStream::writeFinished(bool all) {
+  // Writes out finished blocks from the front of the queue. If `all` is true, or too many blocks
+  // are in flight, waits for the workers rather than stopping at the first unfinished block.
+
+  auto& blocks = inFlight->blocks;
+  auto& pool = inFlight->pool;
+  while (!blocks.empty()) {
+    if (!all && blocks.size() <= maxInFlight && !pool.isDone(*blocks.front())) return;
+
+    // Take the block off the queue first, so that a compression error is only thrown once.
+    auto ownBlock = kj::mv(blocks.front());
+    blocks.pop_front();
+    auto& block = *ownBlock;
+    pool.wait(block);
+
+    if (!headerWritten) {
+      // Minimal gzip header: magic, CM = deflate, no flags, no mtime, no extra flags, OS unknown.
+      static const byte HEADER[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+      inner.write(HEADER, sizeof(HEADER));
+      headerWritten = true;
+    }
+
+    inner.write(block.output.begin(), block.outputSize);
+    crc = crc32_combine(crc, block.crc, block.inputSize);
+    totalSize += block.inputSize;
+  }
+}
+
+// =======================================================================================
+
 GzipAsyncInputStream::GzipAsyncInputStream(AsyncInputStream& inner)
     : inner(inner) {
   // windowBits = 15 (maximum) + magic value 16 to ask for gzip.
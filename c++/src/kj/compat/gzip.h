@@ -89,6 +89,57 @@ private:
   void pump(int flush);
 };
 
+class ParallelGzipOutputStream final: public OutputStream {
+  // Like GzipOutputStream (in compression mode), but splits the input into fixed-size blocks and
+  // deflates several blocks at once on separate threads, in the manner of pigz. Each block is
+  // primed with the last 32KiB of input preceding it, so the compression ratio is close to that
+  // of a single-threaded stream. The blocks are concatenated into one ordinary gzip member (with
+  // a combined CRC), which any gzip decoder -- including GzipInputStream -- can read.
+  //
+  // The `threadCount` compression threads are started by the constructor and live as long as the
+  // stream. Each full block is handed to them as soon as it has been written, and finished blocks
+  // are written to `inner` in order as they complete, so compression overlaps with both the
+  // caller's writes and the output. `write()` only waits once about two blocks per thread are in
+  // flight.
+
+public:
+  ParallelGzipOutputStream(OutputStream& inner, int compressionLevel = Z_DEFAULT_COMPRESSION,
+                           uint threadCount = 4, size_t blockSize = 128 * 1024);
+  ~ParallelGzipOutputStream() noexcept(false);
+  KJ_DISALLOW_COPY(ParallelGzipOutputStream);
+
+  void write(const void* buffer, size_t size) override;
+  using OutputStream::write;
+
+  void flush();
+  // Compresses and writes out all buffered input, ending on a byte boundary (like Z_SYNC_FLUSH).
+  // Flushing often produces small blocks and so defeats the parallelism.
+
+private:
+  struct Block;
+  struct InFlight;
+
+  OutputStream& inner;
+  int compressionLevel;
+  size_t blockSize;
+  uint maxInFlight;
+
+  kj::Own<Block> current;
+  // The block being filled by write().
+
+  bool headerWritten = false;
+  uLong crc;
+  uint32_t totalSize = 0;
+  // gzip's ISIZE field is the input size modulo 2^32.
+
+  kj::Own<InFlight> inFlight;
+  // Blocks handed to the compression threads. Declared last so that the threads are stopped
+  // before anything they might touch goes away.
+
+  void submit(bool last);
+  void writeFinished(bool all);
+};
+
 class GzipAsyncInputStream final: public AsyncInputStream {
 public:
   GzipAsyncInputStream(AsyncInputStream& inner);
@@ -0,0 +1,218 @@
+// Copyright (c) 2017 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#if KJ_HAS_ZLIB
+
+#include "http-gzip.h"
+#include <kj/debug.h>
+#include <kj/test.h>
+
+namespace kj {
+namespace {
+
+class ContentService final: public HttpService {
+  // Responds to "/<content-type>/<size>" with `size` bytes of text, declaring the given type
+  // (with '/' replaced by '_' in the URL). "/reset" gets a text/plain 205 Reset Content, which
+  // has no body, and doesn't say so.
+
+public:
+  ContentService(HttpHeaderTable& table): table(table) {}
+
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    if (url == "/reset") {
+      HttpHeaders responseHeaders(table);
+      responseHeaders.set(HttpHeaderId::CONTENT_TYPE, "text/plain");
+      auto stream = response.send(205, "Reset Content", responseHeaders);
+      return kj::READY_NOW;
+    }
+
+    auto parts = url.slice(1);
+    auto slash = KJ_ASSERT_NONNULL(parts.findFirst('/'));
+    auto type = kj::heapString(parts.slice(0, slash));
+    for (auto& c: type) if (c == '_') c = '/';
+    size_t size = parts.slice(slash + 1).parseAs<size_t>();
+
+    auto body = kj::heapString(size);
+    for (auto i: kj::indices(body)) body[i] = 'a' + (i / 3) % 26;
+
+    HttpHeaders responseHeaders(table);
+    responseHeaders.set(HttpHeaderId::CONTENT_TYPE, type);
+    auto stream = response.send(200, "OK", responseHeaders, body.size());
+    auto promise = stream->write(body.begin(), body.size());
+    return promise.attach(kj::mv(stream), kj::mv(body), kj::mv(type));
+  }
+
+private:
+  HttpHeaderTable& table;
+};
+
+struct GzipTestSetup {
+  kj::EventLoop eventLoop;
+  kj::WaitScope waitScope;
+  kj::TimerImpl timer;
+  kj::TwoWayPipe pipe;
+  HttpHeaderTable table;
+  ContentService service;
+  kj::Own<HttpService> gzipService;
+  HttpServer server;
+  kj::Promise<void> listenTask;
+  kj::Own<HttpClient> client;
+
+  GzipTestSetup()
+      : waitScope(eventLoop),
+        timer(kj::origin<kj::TimePoint>()),
+        pipe(kj::newTwoWayPipe()),
+        service(table),
+        gzipService(newGzipHttpService(service)),
+        server(timer, table, *gzipService),
+        listenTask(server.listenHttp(kj::mv(pipe.ends[1]))),
+        client(newHttpClient(table, *pipe.ends[0])) {}
+
+  struct Result {
+    kj::Maybe<kj::String> contentEncoding;
+    kj::Maybe<kj::String> vary;
+    kj::Array<byte> body;
+  };
+
+  Result get(HttpClient& via, kj::StringPtr url, kj::Maybe<kj::StringPtr> acceptEncoding) {
+    HttpHeaders headers(table);
+    KJ_IF_MAYBE(ae, acceptEncoding) {
+      headers.set(HttpHeaderId::ACCEPT_ENCODING, *ae);
+    }
+    auto response = via.request(HttpMethod::GET, url, headers).response.wait(waitScope);
+    KJ_EXPECT(response.statusCode == 200);
+
+    Result result;
+    KJ_IF_MAYBE(ce, response.headers->get(HttpHeaderId::CONTENT_ENCODING)) {
+      result.contentEncoding = kj::str(*ce);
+    }
+    KJ_IF_MAYBE(v, response.headers->get(HttpHeaderId::VARY)) {
+      result.vary = kj::str(*v);
+    }
+    result.body = response.body->readAllBytes().wait(waitScope);
+    return result;
+  }
+};
+
+KJ_TEST("gzip HttpService compresses when accepted") {
+  GzipTestSetup setup;
+
+  auto result = setup.get(*setup.client, "/text_plain/10000", kj::StringPtr("deflate, gzip"));
+  KJ_EXPECT(KJ_ASSERT_NONNULL(result.contentEncoding) == "gzip");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(result.vary) == "Accept-Encoding");
+  KJ_EXPECT(result.body.size() < 10000);
+
+  {
+    kj::ArrayInputStream input(result.body);
+    GzipInputStream gzip(input);
+    auto text = gzip.readAllText();
+    KJ_EXPECT(text.size() == 10000);
+    KJ_EXPECT(text.startsWith("aaabbbccc"));
+  }
+}
+
+KJ_TEST("gzip HttpService respects Accept-Encoding, size and content type") {
+  GzipTestSetup setup;
+
+  {
+    // Not accepted at all: eligible, so still varies.
+    auto result = setup.get(*setup.client, "/text_plain/10000", nullptr);
+    KJ_EXPECT(result.contentEncoding == nullptr);
+    KJ_EXPECT(KJ_ASSERT_NONNULL(result.vary) == "Accept-Encoding");
+    KJ_EXPECT(result.body.size() == 10000);
+  }
+
+  {
+    // Explicitly refused, wildcard notwithstanding.
+    auto result = setup.get(*setup.client, "/text_plain/10000", kj::StringPtr("gzip;q=0, *"));
+    KJ_EXPECT(result.contentEncoding == nullptr);
+    KJ_EXPECT(result.body.size() == 10000);
+  }
+
+  {
+    // Accepted via wildcard, with a parameterized content type.
+    auto result = setup.get(*setup.client, "/application_json;charset=utf-8/10000",
+                            kj::StringPtr("*;q=0.5"));
+    KJ_EXPECT(KJ_ASSERT_NONNULL(result.contentEncoding) == "gzip");
+  }
+
+  {
+    // Too small.
+    auto result = setup.get(*setup.client, "/text_plain/100", kj::StringPtr("gzip"));
+    KJ_EXPECT(result.contentEncoding == nullptr);
+    KJ_EXPECT(result.vary == nullptr);
+    KJ_EXPECT(result.body.size() == 100);
+  }
+
+  {
+    // Not a compressible type.
+    auto result = setup.get(*setup.client, "/image_png/10000", kj::StringPtr("gzip"));
+    KJ_EXPECT(result.contentEncoding == nullptr);
+    KJ_EXPECT(result.vary == nullptr);
+    KJ_EXPECT(result.body.size() == 10000);
+  }
+}
+
+KJ_TEST("gzip HttpService leaves responses without a body alone") {
+  GzipTestSetup setup;
+
+  HttpHeaders headers(setup.table);
+  headers.set(HttpHeaderId::ACCEPT_ENCODING, "gzip");
+  auto response = setup.client->request(HttpMethod::GET, "/reset", headers)
+      .response.wait(setup.waitScope);
+  KJ_EXPECT(response.statusCode == 205);
+  KJ_EXPECT(response.headers->get(HttpHeaderId::CONTENT_ENCODING) == nullptr);
+  KJ_EXPECT(response.body->readAllBytes().wait(setup.waitScope).size() == 0);
+
+  // The connection is still good.
+  auto result = setup.get(*setup.client, "/text_plain/10000", kj::StringPtr("gzip"));
+  KJ_EXPECT(KJ_ASSERT_NONNULL(result.contentEncoding) == "gzip");
+}
+
+KJ_TEST("gzip HttpClient decompresses transparently") {
+  GzipTestSetup setup;
+  auto gzipClient = newGzipHttpClient(*setup.client);
+
+  // Several requests on the same connection, to check that each compressed response is
+  // terminated properly.
+  for (uint i = 0; i < 3; i++) {
+    auto result = setup.get(*gzipClient, "/text_html/50000", nullptr);
+    KJ_EXPECT(result.contentEncoding == nullptr);
+    KJ_EXPECT(KJ_ASSERT_NONNULL(result.vary) == "Accept-Encoding");
+    KJ_EXPECT(result.body.size() == 50000);
+    KJ_EXPECT(result.body.slice(0, 9) == kj::StringPtr("aaabbbccc").asBytes());
+  }
+
+  {
+    // An explicit Accept-Encoding means the caller wants the raw encoded body.
+    auto result = setup.get(*gzipClient, "/text_html/50000", kj::StringPtr("gzip"));
+    KJ_EXPECT(KJ_ASSERT_NONNULL(result.contentEncoding) == "gzip");
+    KJ_EXPECT(result.body.size() < 50000);
+  }
+}
+
+}  // namespace
+}  // namespace kj
+
+#endif  // KJ_HAS_ZLIB
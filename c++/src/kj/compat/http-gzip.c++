@@ -0,0 +1,404 @@
+// Copyright (c) 2017 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#if KJ_HAS_ZLIB
+
+#include "http-gzip.h"
+#include <kj/debug.h>
+#include <kj/vector.h>
+#include <stdlib.h>
+
+namespace kj {
+
+namespace {
+
+static const kj::StringPtr DEFAULT_CONTENT_TYPES[] = {
+  "text/",
+  "application/json",
+  "application/javascript",
+  "application/xml",
+  "image/svg+xml",
+};
+
+static kj::ArrayPtr<const char> trim(kj::ArrayPtr<const char> text) {
+  while (text.size() > 0 && (text.front() == ' ' || text.front() == '\t')) {
+    text = text.slice(1, text.size());
+  }
+  while (text.size() > 0 && (text.back() == ' ' || text.back() == '\t')) {
+    text = text.slice(0, text.size() - 1);
+  }
+  return text;
+}
+
+static kj::ArrayPtr<const char> splitAt(kj::ArrayPtr<const char>& text, char delim) {
+  // Returns the text before the first `delim` and advances `text` past it. If there is no
+  // `delim`, returns all of `text` and leaves it empty.
+
+  for (auto i: kj::indices(text)) {
+    if (text[i] == delim) {
+      auto result = text.slice(0, i);
+      text = text.slice(i + 1, text.size());
+      return result;
+    }
+  }
+
+  auto result = text;
+  text = nullptr;
+  return result;
+}
+
+static bool equalsIgnoreCase(kj::ArrayPtr<const char> a, kj::StringPtr b) {
+  if (a.size() != b.size()) return false;
+  for (auto i: kj::indices(a)) {
+    char ca = a[i], cb = b[i];
+    if ('A' <= ca && ca <= 'Z') ca += 'a' - 'A';
+    if ('A' <= cb && cb <= 'Z') cb += 'a' - 'A';
+    if (ca != cb) return false;
+  }
+  return true;
+}
+
+static bool acceptsGzip(kj::StringPtr acceptEncoding) {
+  // Parses an Accept-Encoding header (RFC 7231 section 5.3.4). An explicit "gzip" (or the legacy
+  // "x-gzip") entry decides the matter; otherwise "*" does.
+
+  kj::Maybe<bool> gzip;
+  kj::Maybe<bool> wildcard;
+
+  kj::ArrayPtr<const char> rest = acceptEncoding;
+  while (rest.size() > 0) {
+    auto params = splitAt(rest, ',');
+    auto coding = trim(splitAt(params, ';'));
+
+    bool acceptable = true;
+    while (params.size() > 0) {
+      auto param = trim(splitAt(params, ';'));
+      auto name = trim(splitAt(param, '='));
+      if (equalsIgnoreCase(name, "q")) {
+        // Parse into a NUL-terminated copy; `param` points into the middle of the header.
+        acceptable = strtod(kj::heapString(trim(param)).cStr(), nullptr) > 0;
+      }
+    }
+
+    if (equalsIgnoreCase(coding, "gzip") || equalsIgnoreCase(coding, "x-gzip")) {
+      gzip = acceptable;
+    } else if (equalsIgnoreCase(coding, "*")) {
+      wildcard = acceptable;
+    }
+  }
+
+  KJ_IF_MAYBE(g, gzip) return *g;
+  return wildcard.orDefault(false);
+}
+
+static bool isCompressibleType(kj::StringPtr contentType,
+                               kj::ArrayPtr<const kj::StringPtr> types) {
+  kj::ArrayPtr<const char> rest = contentType;
+  auto mediaType = trim(splitAt(rest, ';'));
+
+  for (auto& type: types) {
+    if (type.endsWith("/")) {
+      if (mediaType.size() > type.size() &&
+          equalsIgnoreCase(mediaType.slice(0, type.size()), type)) {
+        return true;
+      }
+    } else if (equalsIgnoreCase(mediaType, type)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool statusHasBody(uint statusCode) {
+  return statusCode >= 200 && statusCode != 204 && statusCode != 205 && statusCode != 304;
+}
+
+// =======================================================================================
+// Server side
+
+class GzipResponseBody final: public kj::AsyncOutputStream, public kj::Refcounted {
+  // Compresses into the real response body. The application holds one reference (through
+  // GzipResponseBodyRef) and the service wrapper the other, because the gzip trailer can only be
+  // written asynchronously after the application has dropped its end.
+
+public:
+  GzipResponseBody(kj::Own<kj::AsyncOutputStream> inner, int compressionLevel)
+      : inner(kj::mv(inner)), ctx(compressionLevel) {}
+
+  Promise<void> write(const void* buffer, size_t size) override {
+    ctx.setInput(buffer, size);
+    return writeCompressed(Z_NO_FLUSH);
+  }
+
+  Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    for (auto& piece: pieces) {
+      ctx.setInput(piece.begin(), piece.size());
+      pump(Z_NO_FLUSH);
+    }
+    return writeCompressed(Z_NO_FLUSH);
+  }
+
+  void finish() {
+    // Called when the application drops the body. Runs the compressor to completion; the output
+    // is written by end().
+
+    if (inner.get() != nullptr) {
+      pump(Z_FINISH);
+      finished = true;
+    }
+  }
+
+  kj::Promise<void> end() {
+    // Called once the inner service's request() has completed.
+
+    if (!finished) {
+      // The application never dropped the body, or is still holding it. Either way the response
+      // is incomplete; dropping `inner` aborts it as it would without us.
+      inner = nullptr;
+      return kj::READY_NOW;
+    }
+
+    auto data = pending.releaseAsArray();
+    auto promise = inner->write(data.begin(), data.size());
+    return promise.attach(kj::mv(data), kj::mv(inner));
+  }
+
+private:
+  kj::Own<kj::AsyncOutputStream> inner;
+  _::GzipOutputContext ctx;
+  kj::Vector<byte> pending;
+  bool finished = false;
+
+  void pump(int flush) {
+    bool ok;
+    do {
+      auto result = ctx.pumpOnce(flush);
+      ok = get<0>(result);
+      pending.addAll(get<1>(result));
+    } while (ok);
+  }
+
+  Promise<void> writeCompressed(int flush) {
+    pump(flush);
+    if (pending.size() == 0) return kj::READY_NOW;
+
+    auto data = pending.releaseAsArray();
+    auto promise = inner->write(data.begin(), data.size());
+    return promise.attach(kj::mv(data));
+  }
+};
+
+class GzipResponseBodyRef final: public kj::AsyncOutputStream {
+public:
+  GzipResponseBodyRef(kj::Own<GzipResponseBody> body): body(kj::mv(body)) {}
+  ~GzipResponseBodyRef() noexcept(false) {
+    body->finish();
+  }
+
+  Promise<void> write(const void* buffer, size_t size) override {
+    return body->write(buffer, size);
+  }
+  Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    return body->write(pieces);
+  }
+
+private:
+  kj::Own<GzipResponseBody> body;
+};
+
+class GzipServiceResponse final: public HttpService::Response {
+public:
+  GzipServiceResponse(HttpService::Response& inner, bool acceptsGzip,
+                      const HttpCompressionSettings& settings)
+      : inner(inner), acceptsGzip(acceptsGzip), settings(settings) {}
+
+  kj::Own<kj::AsyncOutputStream> send(
+      uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
+      kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
+    if (!isEligible(statusCode, headers, expectedBodySize)) {
+      return inner.send(statusCode, statusText, headers, expectedBodySize);
+    }
+
+    auto newHeaders = headers.cloneShallow();
+    KJ_IF_MAYBE(vary, headers.get(HttpHeaderId::VARY)) {
+      newHeaders.set(HttpHeaderId::VARY, kj::str(*vary, ", Accept-Encoding"));
+    } else {
+      newHeaders.set(HttpHeaderId::VARY, "Accept-Encoding");
+    }
+
+    if (!acceptsGzip) {
+      return inner.send(statusCode, statusText, newHeaders, expectedBodySize);
+    }
+
+    newHeaders.set(HttpHeaderId::CONTENT_ENCODING, "gzip");
+    auto body = kj::refcounted<GzipResponseBody>(
+        inner.send(statusCode, statusText, newHeaders), settings.compressionLevel);
+    auto result = kj::heap<GzipResponseBodyRef>(kj::addRef(*body));
+    compressedBody = kj::mv(body);
+    return kj::mv(result);
+  }
+
+  kj::Own<WebSocket> acceptWebSocket(const HttpHeaders& headers) override {
+    return inner.acceptWebSocket(headers);
+  }
+
+  kj::Promise<void> end() {
+    KJ_IF_MAYBE(body, compressedBody) {
+      return (*body)->end();
+    } else {
+      return kj::READY_NOW;
+    }
+  }
+
+private:
+  HttpService::Response& inner;
+  bool acceptsGzip;
+  const HttpCompressionSettings& settings;
+  kj::Maybe<kj::Own<GzipResponseBody>> compressedBody;
+
+  bool isEligible(uint statusCode, const HttpHeaders& headers,
+                  kj::Maybe<uint64_t> expectedBodySize) {
+    if (!statusHasBody(statusCode) || statusCode == 206) return false;
+    if (headers.get(HttpHeaderId::CONTENT_ENCODING) != nullptr) return false;
+
+    KJ_IF_MAYBE(size, expectedBodySize) {
+      if (*size < settings.minimumSize) return false;
+    }
+
+    KJ_IF_MAYBE(type, headers.get(HttpHeaderId::CONTENT_TYPE)) {
+      auto types = settings.contentTypes.size() > 0 ? settings.contentTypes
+          : kj::ArrayPtr<const kj::StringPtr>(DEFAULT_CONTENT_TYPES);
+      return isCompressibleType(*type, types);
+    } else {
+      return false;
+    }
+  }
+};
+
+class GzipHttpService final: public HttpService {
+public:
+  GzipHttpService(HttpService& inner, HttpCompressionSettings settings)
+      : inner(inner), settings(kj::mv(settings)) {}
+
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    bool accepts = false;
+    KJ_IF_MAYBE(acceptEncoding, headers.get(HttpHeaderId::ACCEPT_ENCODING)) {
+      accepts = acceptsGzip(*acceptEncoding);
+    }
+
+    auto wrapped = kj::heap<GzipServiceResponse>(response, accepts, settings);
+    auto& wrappedRef = *wrapped;
+    return inner.request(method, url, headers, requestBody, wrappedRef)
+        .then([&wrappedRef]() { return wrappedRef.end(); })
+        .attach(kj::mv(wrapped));
+  }
+
+  kj::Promise<kj::Own<kj::AsyncIoStream>> connect(kj::StringPtr host) override {
+    return inner.connect(host);
+  }
+
+private:
+  HttpService& inner;
+  HttpCompressionSettings settings;
+};
+
+// =======================================================================================
+// Client side
+
+class GzipHttpClient final: public HttpClient {
+public:
+  explicit GzipHttpClient(HttpClient& inner): inner(inner) {}
+
+  Request request(HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+                  kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
+    if (headers.get(HttpHeaderId::ACCEPT_ENCODING) != nullptr) {
+      return inner.request(method, url, headers, expectedBodySize);
+    }
+
+    auto newHeaders = headers.cloneShallow();
+    newHeaders.set(HttpHeaderId::ACCEPT_ENCODING, "gzip");
+    auto result = inner.request(method, url, newHeaders, expectedBodySize);
+    result.response = result.response.then([method](Response&& response) {
+      return decode(method, kj::mv(response));
+    });
+    return result;
+  }
+
+  kj::Promise<WebSocketResponse> openWebSocket(
+      kj::StringPtr url, const HttpHeaders& headers) override {
+    return inner.openWebSocket(url, headers);
+  }
+
+  kj::Promise<kj::Own<kj::AsyncIoStream>> connect(kj::StringPtr host) override {
+    return inner.connect(host);
+  }
+
+private:
+  HttpClient& inner;
+
+  static Response decode(HttpMethod method, Response&& response) {
+    if (method == HttpMethod::HEAD || !statusHasBody(response.statusCode)) {
+      return kj::mv(response);
+    }
+
+    KJ_IF_MAYBE(encoding, response.headers->get(HttpHeaderId::CONTENT_ENCODING)) {
+      auto coding = trim(*encoding);
+      if (!equalsIgnoreCase(coding, "gzip") && !equalsIgnoreCase(coding, "x-gzip")) {
+        return kj::mv(response);
+      }
+    } else {
+      return kj::mv(response);
+    }
+
+    // The original status text and headers are invalidated once we read from the body, so the
+    // decoded response needs its own copies.
+    auto statusText = kj::str(response.statusText);
+    auto headers = kj::heap(response.headers->clone());
+    headers->unset(HttpHeaderId::CONTENT_ENCODING);
+    headers->unset(HttpHeaderId::CONTENT_LENGTH);
+
+    Response result;
+    result.statusCode = response.statusCode;
+    result.statusText = statusText;
+    result.headers = headers.get();
+    result.body = kj::heap<GzipAsyncInputStream>(*response.body)
+        .attach(kj::mv(response.body), kj::mv(headers), kj::mv(statusText));
+    return result;
+  }
+};
+
+}  // namespace
+
+kj::Own<HttpService> newGzipHttpService(HttpService& inner, HttpCompressionSettings settings) {
+  return kj::heap<GzipHttpService>(inner, kj::mv(settings));
+}
+
+kj::Own<HttpClient> newGzipHttpClient(HttpClient& inner) {
+  return kj::heap<GzipHttpClient>(inner);
+}
+
+}  // namespace kj
+
+#endif  // KJ_HAS_ZLIB
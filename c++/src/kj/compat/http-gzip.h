@@ -0,0 +1,73 @@
+// Copyright (c) 2017 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+// gzip Content-Encoding for kj::HttpService and kj::HttpClient.
+//
+// These are adapters rather than options to HttpServer / newHttpClient() so that kj-http itself
+// does not depend on zlib: wrap the service you hand to HttpServer, or the client you make
+// requests through.
+
+#include "http.h"
+#include "gzip.h"
+
+namespace kj {
+
+struct HttpCompressionSettings {
+  int compressionLevel = Z_DEFAULT_COMPRESSION;
+
+  uint64_t minimumSize = 1024;
+  // Responses whose `expectedBodySize` is known and smaller than this are sent uncompressed, since
+  // the gzip framing and chunked encoding overhead would eat most of the savings. Responses of
+  // unknown size are always eligible.
+
+  kj::ArrayPtr<const kj::StringPtr> contentTypes = nullptr;
+  // Media types eligible for compression, matched case-insensitively against the response's
+  // Content-Type with parameters removed. An entry ending in '/' matches a whole top-level type,
+  // e.g. "text/". If empty, a default list of textual types (text/, JSON, JavaScript, XML, SVG) is
+  // used. Responses without a Content-Type are never compressed.
+};
+
+kj::Own<HttpService> newGzipHttpService(
+    HttpService& inner, HttpCompressionSettings settings = HttpCompressionSettings());
+// Wraps `inner` so that eligible responses are gzipped when the request's Accept-Encoding allows
+// it. A response is eligible if its status may carry a body (not 1xx, 204, 206 or 304), it does
+// not already have a Content-Encoding, and its size and Content-Type pass the checks described
+// in HttpCompressionSettings. Eligible responses also get `Vary: Accept-Encoding`, whether or not
+// they end up compressed.
+//
+// A compressed response is sent with chunked encoding, because its length isn't known up front.
+// Body writes are buffered by the compressor, so a slowly-trickling (streaming) response won't
+// reach the client promptly -- keep such content types out of `contentTypes`.
+//
+// As with any HttpService, the response body stream must be dropped before the promise returned
+// by request() resolves. The wrapper relies on this to write the gzip trailer.
+
+kj::Own<HttpClient> newGzipHttpClient(HttpClient& inner);
+// Wraps `inner` so that requests advertise `Accept-Encoding: gzip` and responses carrying
+// `Content-Encoding: gzip` are decompressed transparently. The response headers seen by the
+// caller have Content-Encoding and Content-Length removed, since they describe the encoded body.
+//
+// Requests whose headers already set Accept-Encoding are passed through untouched, responses
+// included: the caller has asked to negotiate encodings itself.
+
+}  // namespace kj
@@ -1278,6 +1278,44 @@ KJ_TEST("HttpClient parallel pipeline") {
   writeResponsesPromise.wait(waitScope);
 }
 
+KJ_TEST("HttpClient pipeline depth") {
+  kj::EventLoop eventLoop;
+  kj::WaitScope waitScope(eventLoop);
+  auto pipe = kj::newTwoWayPipe();
+
+  HttpHeaderTable table;
+  HttpClientSettings settings;
+  settings.maxPipelineDepth = 2;
+  auto client = newHttpClient(table, *pipe.ends[0], settings);
+
+  auto requests = KJ_MAP(i, kj::range(0, 3)) {
+    return client->request(HttpMethod::GET, kj::str("/", i), HttpHeaders(table));
+  };
+
+  // Only the first two requests go out.
+  expectRead(*pipe.ends[1], "GET /0 HTTP/1.1\r\n\r\nGET /1 HTTP/1.1\r\n\r\n").wait(waitScope);
+  char c;
+  auto extraRead = pipe.ends[1]->tryRead(&c, 1, 1);
+  KJ_EXPECT(!extraRead.poll(waitScope));
+
+  // Answering the first request isn't enough: its body must be read.
+  kj::StringPtr response = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nfoo";
+  pipe.ends[1]->write(response.begin(), response.size()).wait(waitScope);
+  auto response0 = requests[0].response.wait(waitScope);
+  KJ_EXPECT(!extraRead.poll(waitScope));
+
+  KJ_EXPECT(response0.body->readAllText().wait(waitScope) == "foo");
+  KJ_EXPECT(extraRead.wait(waitScope) == 1);
+  KJ_EXPECT(c == 'G');
+  expectRead(*pipe.ends[1], "ET /2 HTTP/1.1\r\n\r\n").wait(waitScope);
+
+  for (auto i: kj::range(1, 3)) {
+    pipe.ends[1]->write(response.begin(), response.size()).wait(waitScope);
+    auto r = requests[i].response.wait(waitScope);
+    KJ_EXPECT(r.body->readAllText().wait(waitScope) == "foo");
+  }
+}
+
 KJ_TEST("HttpServer pipeline") {
   auto PIPELINE_TESTS = pipelineTestCases();
 
@@ -2819,6 +2857,126 @@ KJ_TEST("HttpClient connection management") {
   KJ_EXPECT(count == 1);
 }
 
+KJ_TEST("HttpClient pipelines onto busy connections") {
+  auto io = kj::setupAsyncIo();
+
+  kj::TimerImpl serverTimer(kj::origin<kj::TimePoint>());
+  kj::TimerImpl clientTimer(kj::origin<kj::TimePoint>());
+  HttpHeaderTable headerTable;
+
+  auto listener = io.provider->getNetwork().parseAddress("localhost", 0)
+      .wait(io.waitScope)->listen();
+  DummyService service(headerTable);
+  HttpServer server(serverTimer, headerTable, service);
+  auto listenTask = server.listenHttp(*listener);
+
+  auto addr = io.provider->getNetwork().parseAddress("localhost", listener->getPort())
+      .wait(io.waitScope);
+  uint count = 0;
+  CountingNetworkAddress countingAddr(*addr, count);
+
+  HttpClientSettings clientSettings;
+  clientSettings.maxPipelineDepth = 4;
+  auto client = newHttpClient(clientTimer, headerTable, countingAddr, clientSettings);
+
+  auto get = [&](kj::StringPtr url) {
+    return client->request(HttpMethod::GET, url, HttpHeaders(headerTable)).response;
+  };
+  auto readBody = [&](HttpClient::Response&& response) {
+    // Reads and drops the body, releasing the connection.
+    auto body = kj::mv(response.body);
+    return body->readAllText().wait(io.waitScope);
+  };
+
+  // A fresh connection isn't pipelined onto until it has completed an exchange.
+  {
+    auto first = get("/0");
+    auto second = get("/1");
+    KJ_EXPECT(readBody(first.wait(io.waitScope)) == "null:/0");
+    KJ_EXPECT(readBody(second.wait(io.waitScope)) == "null:/1");
+    KJ_EXPECT(count == 2);
+  }
+
+  // Now both connections are proven and idle. Keep both busy, and further requests are pipelined
+  // behind them rather than opening more connections.
+  {
+    auto busy1 = get("/2");
+    auto busy2 = get("/3");
+    auto queued = KJ_MAP(i, kj::range(4, 8)) { return get(kj::str("/", i)); };
+    KJ_EXPECT(count == 2);
+
+    KJ_EXPECT(readBody(busy1.wait(io.waitScope)) == "null:/2");
+    KJ_EXPECT(readBody(busy2.wait(io.waitScope)) == "null:/3");
+    for (auto i: kj::indices(queued)) {
+      KJ_EXPECT(readBody(queued[i].wait(io.waitScope)) == kj::str("null:/", i + 4));
+    }
+    KJ_EXPECT(count == 2);
+  }
+
+  // A POST is never pipelined.
+  {
+    auto busy1 = get("/8");
+    auto busy2 = get("/9");
+    auto post = client->request(HttpMethod::POST, "/post", HttpHeaders(headerTable), uint64_t(0));
+    KJ_EXPECT(count == 3);
+    KJ_EXPECT(readBody(post.response.wait(io.waitScope)) == "null:/post");
+    KJ_EXPECT(readBody(busy1.wait(io.waitScope)) == "null:/8");
+    KJ_EXPECT(readBody(busy2.wait(io.waitScope)) == "null:/9");
+  }
+}
+
+KJ_TEST("HttpClient stops pipelining when the server closes the connection") {
+  auto io = kj::setupAsyncIo();
+
+  kj::TimerImpl clientTimer(kj::origin<kj::TimePoint>());
+  HttpHeaderTable headerTable;
+
+  auto listener = io.provider->getNetwork().parseAddress("localhost", 0)
+      .wait(io.waitScope)->listen();
+  auto addr = io.provider->getNetwork().parseAddress("localhost", listener->getPort())
+      .wait(io.waitScope);
+
+  HttpClientSettings clientSettings;
+  clientSettings.maxPipelineDepth = 4;
+  auto client = newHttpClient(clientTimer, headerTable, *addr, clientSettings);
+
+  kj::StringPtr okResponse = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+  kj::StringPtr closeResponse =
+      "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok";
+
+  // The server answers one request, then a second request but closes the connection afterwards
+  // even though a third was pipelined behind it.
+  auto serverTask = listener->accept().then([&](kj::Own<kj::AsyncIoStream> conn) {
+    auto& c = *conn;
+    return expectRead(c, "GET /0 HTTP/1.1\r\n\r\n").then([&]() {
+      return c.write(okResponse.begin(), okResponse.size());
+    }).then([&]() {
+      return expectRead(c, "GET /1 HTTP/1.1\r\n\r\nGET /2 HTTP/1.1\r\n\r\n");
+    }).then([&]() {
+      return c.write(closeResponse.begin(), closeResponse.size());
+    }).attach(kj::mv(conn));
+  }).then([&]() {
+    // The unanswered request is retried on a new connection.
+    return listener->accept();
+  }).then([&](kj::Own<kj::AsyncIoStream> conn) {
+    auto& c = *conn;
+    return expectRead(c, "GET /2 HTTP/1.1\r\n\r\n").then([&]() {
+      return c.write(okResponse.begin(), okResponse.size());
+    }).attach(kj::mv(conn));
+  }).eagerlyEvaluate([](kj::Exception&& e) { KJ_LOG(ERROR, e); });
+
+  auto get = [&](kj::StringPtr url) {
+    return client->request(HttpMethod::GET, url, HttpHeaders(headerTable)).response;
+  };
+
+  KJ_EXPECT(get("/0").wait(io.waitScope).body->readAllText().wait(io.waitScope) == "ok");
+  auto response1 = get("/1");
+  auto response2 = get("/2");
+  KJ_EXPECT(response1.wait(io.waitScope).body->readAllText().wait(io.waitScope) == "ok");
+  KJ_EXPECT(response2.wait(io.waitScope).body->readAllText().wait(io.waitScope) == "ok");
+  serverTask.wait(io.waitScope);
+}
+
 KJ_TEST("HttpClient multi host") {
   auto io = kj::setupAsyncIo();
 
@@ -1010,6 +1010,30 @@ public:
     return !broken && pendingMessageCount == 0;
   }
 
+  bool isBroken() {
+    return broken;
+  }
+
+  uint getPendingMessageCount() {
+    return pendingMessageCount;
+  }
+
+  uint64_t getFinishedMessageCount() {
+    return finishedMessageCount;
+  }
+
+  kj::Promise<void> awaitFinishedMessages(uint64_t count) {
+    // Resolves once at least `count` messages have been completely read. The client uses this to
+    // bound its pipelining depth.
+
+    if (finishedMessageCount >= count) return kj::READY_NOW;
+    if (broken) return KJ_EXCEPTION(DISCONNECTED, "HTTP stream is broken");
+
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    finishedMessageWaiters.push_back({ count, kj::mv(paf.fulfiller) });
+    return kj::mv(paf.promise);
+  }
+
   // ---------------------------------------------------------------------------
   // Stream locking: While an entity-body is being read, the body stream "locks" the underlying
   // HTTP stream. Once the entity-body is complete, we can read the next pipelined message.
@@ -1020,6 +1044,15 @@ public:
     KJ_REQUIRE_NONNULL(onMessageDone)->fulfill();
     onMessageDone = nullptr;
     --pendingMessageCount;
+    ++finishedMessageCount;
+
+    // Waiters are queued in increasing order of count, since each pipelined request waits on the
+    // response before it.
+    while (!finishedMessageWaiters.empty() &&
+           finishedMessageWaiters.front().count <= finishedMessageCount) {
+      finishedMessageWaiters.front().fulfiller->fulfill();
+      finishedMessageWaiters.pop_front();
+    }
   }
 
   void abortRead() {
@@ -1030,6 +1063,13 @@ public:
         "can't read next pipelined request/response"));
     onMessageDone = nullptr;
     broken = true;
+
+    for (auto& waiter: finishedMessageWaiters) {
+      waiter.fulfiller->reject(KJ_EXCEPTION(DISCONNECTED,
+          "application did not finish reading previous HTTP response body",
+          "can't send next pipelined request"));
+    }
+    finishedMessageWaiters.clear();
   }
 
   // ---------------------------------------------------------------------------
@@ -1208,6 +1248,15 @@ private:
   uint pendingMessageCount = 0;
   // Number of reads we have queued up.
 
+  uint64_t finishedMessageCount = 0;
+  // Number of messages completely read so far.
+
+  struct FinishedMessageWaiter {
+    uint64_t count;
+    kj::Own<kj::PromiseFulfiller<void>> fulfiller;
+  };
+  std::deque<FinishedMessageWaiter> finishedMessageWaiters;
+
   kj::Promise<void> messageReadQueue = kj::READY_NOW;
 
   kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> onMessageDone;
@@ -1717,6 +1766,15 @@ public:
     return fork.addBranch();
   }
 
+  void delayWrites(kj::Promise<void> promise) {
+    // Holds back all subsequently-queued writes until `promise` resolves. If it rejects, so do
+    // they.
+
+    writeQueue = writeQueue.then(kj::mvCapture(promise, [](kj::Promise<void>&& promise) {
+      return kj::mv(promise);
+    }));
+  }
+
 private:
   AsyncOutputStream& inner;
   kj::Promise<void> writeQueue = kj::READY_NOW;
@@ -2999,7 +3057,11 @@ public:
       : httpInput(*rawStream, responseHeaderTable),
         httpOutput(*rawStream),
         ownStream(kj::mv(rawStream)),
-        settings(kj::mv(settings)) {}
+        settings(kj::mv(settings)) {
+    KJ_IF_MAYBE(depth, this->settings.maxPipelineDepth) {
+      KJ_REQUIRE(*depth > 0, "maxPipelineDepth must be at least 1");
+    }
+  }
 
   bool canReuse() {
     // Returns true if we can immediately reuse this HttpClient for another message (so all
@@ -3008,6 +3070,15 @@ public:
     return !upgraded && !closed && httpInput.canReuse() && httpOutput.canReuse();
   }
 
+  bool canPipeline(uint depth) {
+    // Returns true if another request could be sent right away without waiting for outstanding
+    // responses, and with fewer than `depth` of them. We only pipeline once the server has shown
+    // that it keeps connections open.
+
+    return keepAliveConfirmed && !upgraded && !closed && !httpInput.isBroken() &&
+        httpOutput.canReuse() && httpInput.getPendingMessageCount() < depth;
+  }
+
   Request request(HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
                   kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
     KJ_REQUIRE(!upgraded,
@@ -3019,6 +3090,17 @@ public:
         "can't start new request until previous request body has been fully written");
     closeWatcherTask = nullptr;
 
+    KJ_IF_MAYBE(depth, settings.maxPipelineDepth) {
+      // This will be request number `counter + 1`, so it may go out once the responses to all but
+      // the last `depth - 1` requests before it have been read.
+      if (counter + 1 > *depth) {
+        uint64_t needed = counter + 1 - *depth;
+        if (httpInput.getFinishedMessageCount() < needed) {
+          httpOutput.delayWrites(httpInput.awaitFinishedMessages(needed));
+        }
+      }
+    }
+
     kj::StringPtr connectionHeaders[CONNECTION_HEADERS_COUNT];
     kj::String lengthStr;
 
@@ -3078,11 +3160,14 @@ public:
         if (fastCaseCmp<'c', 'l', 'o', 's', 'e'>(
             headers.get(HttpHeaderId::CONNECTION).orDefault(nullptr).cStr())) {
           closed = true;
-        } else if (counter == id) {
-          watchForClose();
         } else {
-          // Anothe request was already queued after this one, so we don't want to watch for
-          // stream closure because we're fully expecting another response.
+          keepAliveConfirmed = true;
+          if (counter == id) {
+            watchForClose();
+          } else {
+            // Anothe request was already queued after this one, so we don't want to watch for
+            // stream closure because we're fully expecting another response.
+          }
         }
         return result;
       } else {
@@ -3194,6 +3279,9 @@ private:
   bool upgraded = false;
   bool closed = false;
 
+  bool keepAliveConfirmed = false;
+  // Set once a response arrives without `Connection: close`.
+
   uint counter = 0;
   // Counts requests for the sole purpose of detecting if more requests have been made after some
   // point in history.
@@ -3435,6 +3523,10 @@ public:
 
   Request request(HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
                   kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
+    KJ_IF_MAYBE(refcounted, findPipelineTarget(method, headers, expectedBodySize)) {
+      return pipelinedRequest(kj::mv(*refcounted), method, url, headers);
+    }
+
     auto refcounted = getClient();
     auto result = refcounted->client->request(method, url, headers, expectedBodySize);
     result.body = result.body.attach(kj::addRef(*refcounted));
@@ -3478,6 +3570,9 @@ private:
   kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> drainedFulfiller;
   uint activeConnectionCount = 0;
 
+  bool pipeliningDisabled = false;
+  // Set if the server closed a connection with pipelined requests still unanswered.
+
   bool timeoutsScheduled = false;
   kj::Promise<void> timeoutTask = nullptr;
 
@@ -3492,9 +3587,17 @@ private:
     RefcountedClient(NetworkAddressHttpClient& parent, kj::Own<HttpClientImpl> client)
         : parent(parent), client(kj::mv(client)) {
       ++parent.activeConnectionCount;
+      parent.activeClients.add(this);
     }
     ~RefcountedClient() noexcept(false) {
       --parent.activeConnectionCount;
+      for (auto& c: parent.activeClients) {
+        if (c == this) {
+          c = parent.activeClients.back();
+          parent.activeClients.removeLast();
+          break;
+        }
+      }
       KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
         parent.returnClientToAvailable(kj::mv(client));
       })) {
@@ -3506,6 +3609,61 @@ private:
     kj::Own<HttpClientImpl> client;
   };
 
+  kj::Vector<RefcountedClient*> activeClients;
+  // Connections currently in use, which are candidates for pipelining.
+
+  kj::Maybe<kj::Own<RefcountedClient>> findPipelineTarget(
+      HttpMethod method, const HttpHeaders& headers, kj::Maybe<uint64_t> expectedBodySize) {
+    // If this request should be pipelined onto a busy connection, returns that connection.
+
+    uint depth = settings.maxPipelineDepth.orDefault(1);
+    if (depth <= 1 || pipeliningDisabled) return nullptr;
+
+    // Only pipeline requests which are safe to retry and have no body that could hold up the
+    // connection.
+    if (method != HttpMethod::GET && method != HttpMethod::HEAD) return nullptr;
+    if (expectedBodySize.orDefault(0) != 0 ||
+        headers.get(HttpHeaderId::TRANSFER_ENCODING) != nullptr) {
+      return nullptr;
+    }
+
+    // An idle connection is better than queuing behind someone else's response.
+    for (auto& available: availableClients) {
+      if (available.client->canReuse()) return nullptr;
+    }
+
+    for (auto client: activeClients) {
+      if (client->client->canPipeline(depth)) {
+        return kj::addRef(*client);
+      }
+    }
+    return nullptr;
+  }
+
+  Request pipelinedRequest(kj::Own<RefcountedClient> refcounted,
+                           HttpMethod method, kj::StringPtr url, const HttpHeaders& headers) {
+    auto result = refcounted->client->request(method, url, headers);
+    result.response = result.response.then(kj::mvCapture(refcounted,
+        [](kj::Own<RefcountedClient>&& refcounted, Response&& response) {
+      response.body = response.body.attach(kj::mv(refcounted));
+      return kj::mv(response);
+    })).catch_(kj::mvCapture(kj::str(url), kj::mvCapture(headers.clone(),
+        [this,method](HttpHeaders&& headers, kj::String&& url, kj::Exception&& exception)
+        -> kj::Promise<Response> {
+      if (exception.getType() != kj::Exception::Type::DISCONNECTED) {
+        return kj::mv(exception);
+      }
+
+      // The server hung up before answering. Most likely it closed the connection after an
+      // earlier response, meaning it never saw this request. Retry on a connection of our own,
+      // and don't pipeline again.
+      pipeliningDisabled = true;
+      auto retry = request(method, url, headers);
+      return retry.response.attach(kj::mv(retry.body), kj::mv(headers), kj::mv(url));
+    })));
+    return result;
+  }
+
   kj::Own<RefcountedClient> getClient() {
     for (;;) {
       if (availableClients.empty()) {
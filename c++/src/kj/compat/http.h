@@ -147,7 +147,10 @@ public:
   MACRO(HOST, "Host") \
   MACRO(DATE, "Date") \
   MACRO(LOCATION, "Location") \
-  MACRO(CONTENT_TYPE, "Content-Type")
+  MACRO(CONTENT_TYPE, "Content-Type") \
+  MACRO(CONTENT_ENCODING, "Content-Encoding") \
+  MACRO(ACCEPT_ENCODING, "Accept-Encoding") \
+  MACRO(VARY, "Vary")
   // For convenience, these headers are valid for all HttpHeaderTables. You can refer to them like:
   //
   //     HttpHeaderId::HOST
@@ -572,6 +575,23 @@ struct HttpClientSettings {
   // or vulnerable proxies between you and the server, you can provide a dummy entropy source that
   // doesn't generate real entropy (e.g. returning the same value every time). Otherwise, you must
   // provide a cryptographically-random entropy source.
+
+  kj::Maybe<uint> maxPipelineDepth = nullptr;
+  // Limits how many requests may be outstanding (sent, but response not yet fully read) on one
+  // connection at a time.
+  //
+  // For a client created on a single stream, null means no limit: every request is written as
+  // soon as the previous request's body is complete. With a limit, a request beyond it is still
+  // returned immediately, but its headers and body are not written until an earlier response has
+  // been consumed.
+  //
+  // For clients which create their own connections, null (or 1) means no pipelining: a connection
+  // carries one request at a time and more connections are opened as needed. A larger value lets
+  // a GET or HEAD request without a body be pipelined onto a busy connection instead, provided the
+  // connection has already completed one persistent (non-`Connection: close`) exchange. If the
+  // server closes such a connection before answering a pipelined request, the request is retried
+  // on a fresh connection and the client stops pipelining altogether, since the server evidently
+  // doesn't cooperate. Only enable this for upstreams you trust to implement pipelining properly.
 };
 
 kj::Own<HttpClient> newHttpClient(kj::Timer& timer, HttpHeaderTable& responseHeaderTable,
@@ -610,10 +630,11 @@ kj::Own<HttpClient> newHttpClient(HttpHeaderTable& responseHeaderTable, kj::Asyn
 // be used as a proxy client or a host client depending on whether the peer is operating as
 // a proxy.
 //
-// Note that since this client has only one stream to work with, it will try to pipeline all
-// requests on this stream. If one request or response has an I/O failure, all subsequent requests
-// fail as well. If the destination server chooses to close the connection after a response,
-// subsequent requests will fail. If a response takes a long time, it blocks subsequent responses.
+// Note that since this client has only one stream to work with, it pipelines all requests on this
+// stream, up to `settings.maxPipelineDepth` at a time. If one request or response has an I/O
+// failure, all subsequent requests fail as well. If the destination server chooses to close the
+// connection after a response, subsequent requests will fail. If a response takes a long time, it
+// blocks subsequent responses.
 // If a WebSocket is opened successfully, all subsequent requests fail.
 
 kj::Own<HttpClient> newHttpClient(
@@ -24,6 +24,7 @@
 #include "tls.h"
 #include <kj/test.h>
 #include <kj/async-io.h>
+#include <kj/vector.h>
 #include <stdlib.h>
 #include <openssl/opensslv.h>
 
@@ -431,6 +432,282 @@ KJ_TEST("TLS full duplex") {
   writeDown.wait(test.io.waitScope);
 }
 
+KJ_TEST("TLS gathered writes") {
+  // A mix of pieces smaller and larger than a record, with a small record size so that pieces
+  // get split across records.
+  auto clientOptions = TlsTest::defaultClient();
+  clientOptions.maxRecordSize = 1024;
+  TlsTest test(kj::mv(clientOptions));
+  ErrorNexus e;
+
+  auto pipe = test.io.provider->newTwoWayPipe();
+
+  auto clientPromise = e.wrap(test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "example.com"));
+  auto serverPromise = e.wrap(test.tlsServer.wrapServer(kj::mv(pipe.ends[1])));
+
+  auto client = clientPromise.wait(test.io.waitScope);
+  auto server = serverPromise.wait(test.io.waitScope);
+
+  size_t sizes[] = { 8, 3, 700, 1, 0, 2000, 5, 40000, 17, 1024, 9 };
+  kj::Vector<kj::Array<byte>> buffers;
+  kj::Vector<kj::ArrayPtr<const byte>> pieces;
+  size_t total = 0;
+  for (size_t size: sizes) {
+    auto buffer = kj::heapArray<byte>(size);
+    for (auto i: kj::indices(buffer)) {
+      buffer[i] = (total + i) * 7;
+    }
+    total += size;
+    pieces.add(buffer);
+    buffers.add(kj::mv(buffer));
+  }
+
+  auto writePromise = client->write(pieces);
+
+  auto received = kj::heapArray<byte>(total);
+  server->read(received.begin(), total).wait(test.io.waitScope);
+  writePromise.wait(test.io.waitScope);
+
+  for (auto i: kj::indices(received)) {
+    KJ_ASSERT(received[i] == byte(i * 7), i);
+  }
+}
+
+KJ_TEST("TLS over a stream that isn't a file descriptor") {
+  // The streams in the other tests wrap sockets, so TlsConnection does I/O on them directly. An
+  // in-memory pipe has to go through the buffered readiness wrappers instead.
+  TlsTest test;
+  ErrorNexus e;
+
+  auto pipe = kj::newTwoWayPipe();
+  KJ_EXPECT(pipe.ends[0]->getFd() == nullptr);
+
+  auto clientPromise = e.wrap(test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "example.com"));
+  auto serverPromise = e.wrap(test.tlsServer.wrapServer(kj::mv(pipe.ends[1])));
+
+  auto client = clientPromise.wait(test.io.waitScope);
+  auto server = serverPromise.wait(test.io.waitScope);
+
+  auto writeUp = writeN(*client, "foo", 10000);
+  auto readDown = readN(*client, "bar", 10000);
+  auto writeDown = writeN(*server, "bar", 10000);
+  auto readUp = readN(*server, "foo", 10000);
+
+  readUp.wait(test.io.waitScope);
+  readDown.wait(test.io.waitScope);
+  writeUp.wait(test.io.waitScope);
+  writeDown.wait(test.io.waitScope);
+}
+
+void connectAndExchange(TlsTest& test, TlsContext& clientContext, TlsContext& serverContext) {
+  // Make a connection and pass a byte in each direction, so that the client gets a chance to
+  // receive session tickets (which in TLS 1.3 are sent after the handshake).
+
+  auto pipe = test.io.provider->newTwoWayPipe();
+
+  auto clientPromise = clientContext.wrapClient(kj::mv(pipe.ends[0]), "example.com");
+  auto serverPromise = serverContext.wrapServer(kj::mv(pipe.ends[1]));
+
+  auto client = clientPromise.wait(test.io.waitScope);
+  auto server = serverPromise.wait(test.io.waitScope);
+
+  auto writeUp = client->write("a", 1);
+  readN(*server, "a", 1).wait(test.io.waitScope);
+  writeUp.wait(test.io.waitScope);
+
+  auto writeDown = server->write("b", 1);
+  readN(*client, "b", 1).wait(test.io.waitScope);
+  writeDown.wait(test.io.waitScope);
+}
+
+void connectAndExchange(TlsTest& test) {
+  connectAndExchange(test, test.tlsClient, test.tlsServer);
+}
+
+KJ_TEST("TLS session resumption") {
+  TlsTest test;
+
+  connectAndExchange(test);
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().full == 1);
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().resumed == 0);
+
+  connectAndExchange(test);
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().full == 1);
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().resumed == 1);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().full == 1);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().resumed == 1);
+
+  // Tickets issued under the previous key are still accepted after one rotation...
+  test.tlsServer.rotateSessionTicketKey();
+  connectAndExchange(test);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().resumed == 2);
+
+  // ...but not after two.
+  test.tlsServer.rotateSessionTicketKey();
+  test.tlsServer.rotateSessionTicketKey();
+  connectAndExchange(test);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().full == 2);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().resumed == 2);
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().full == 2);
+}
+
+KJ_TEST("TLS connection outlives its context") {
+  // In TLS 1.3 the server's session ticket arrives after the handshake, so the client's session
+  // cache is updated by whichever read sees it -- here, after the client's TlsContext is gone.
+  TlsTest test;
+  auto clientContext = kj::heap<TlsContext>(TlsTest::defaultClient());
+
+  auto pipe = test.io.provider->newTwoWayPipe();
+  auto clientPromise = clientContext->wrapClient(kj::mv(pipe.ends[0]), "example.com");
+  auto serverPromise = test.tlsServer.wrapServer(kj::mv(pipe.ends[1]));
+  auto client = clientPromise.wait(test.io.waitScope);
+  auto server = serverPromise.wait(test.io.waitScope);
+
+  clientContext = nullptr;
+
+  auto writeDown = server->write("b", 1);
+  readN(*client, "b", 1).wait(test.io.waitScope);
+  writeDown.wait(test.io.waitScope);
+
+  auto writeUp = client->write("a", 1);
+  readN(*server, "a", 1).wait(test.io.waitScope);
+  writeUp.wait(test.io.waitScope);
+}
+
+KJ_TEST("TLS session resumption with a context that is both client and server") {
+  // Sessions created on the server side of a connection must not land in the client's cache under
+  // the hostname the peer asked for, replacing the session `both` got as a client of that host.
+  auto options = TlsTest::defaultServer();
+  options.useSystemTrustStore = false;
+  options.trustedCertificates = TlsTest::defaultClient().trustedCertificates;
+  options.sessionTickets = false;  // so that server-side sessions go through the session cache
+  TlsTest test;
+  TlsContext both(kj::mv(options));
+
+  connectAndExchange(test, both, test.tlsServer);
+  connectAndExchange(test, test.tlsClient, both);
+  connectAndExchange(test, both, test.tlsServer);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().full == 1);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().resumed == 1);
+}
+
+KJ_TEST("TLS session resumption disabled") {
+  auto clientOptions = TlsTest::defaultClient();
+  clientOptions.clientSessionCacheSize = 0;
+  TlsTest test(kj::mv(clientOptions));
+
+  connectAndExchange(test);
+  connectAndExchange(test);
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().full == 2);
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().resumed == 0);
+}
+
+void exchangeBulkData(kj::AsyncIoStream& a, kj::AsyncIoStream& b, kj::WaitScope& waitScope) {
+  // Send a gathered write of assorted sizes, several records' worth in all, from `a` to `b` and
+  // check that every byte arrives intact.
+
+  size_t sizes[] = { 3, 40000, 1, 16384, 700, 100000, 9 };
+  kj::Vector<kj::Array<byte>> buffers;
+  kj::Vector<kj::ArrayPtr<const byte>> pieces;
+  size_t total = 0;
+  for (size_t size: sizes) {
+    auto buffer = kj::heapArray<byte>(size);
+    for (auto i: kj::indices(buffer)) {
+      buffer[i] = (total + i) * 13;
+    }
+    total += size;
+    pieces.add(buffer);
+    buffers.add(kj::mv(buffer));
+  }
+
+  auto writePromise = a.write(pieces);
+
+  auto received = kj::heapArray<byte>(total);
+  b.read(received.begin(), total).wait(waitScope);
+  writePromise.wait(waitScope);
+
+  for (auto i: kj::indices(received)) {
+    KJ_ASSERT(received[i] == byte(i * 13), i);
+  }
+}
+
+TlsContext::Options withKernelTls(TlsContext::Options options) {
+  options.kernelTls = true;
+  return options;
+}
+
+KJ_TEST("TLS kernel offload over loopback") {
+  // Whether or not the kernel can actually take over (it needs the "tls" module, and OpenSSL must
+  // have been built with kTLS support), the connection must work.
+  TlsTest test(withKernelTls(TlsTest::defaultClient()),
+               withKernelTls(TlsTest::defaultServer()));
+  ErrorNexus e;
+
+  auto& network = test.io.provider->getNetwork();
+  auto listener = network.parseAddress("127.0.0.1", 0).wait(test.io.waitScope)->listen();
+  auto address = network.parseAddress("127.0.0.1", listener->getPort()).wait(test.io.waitScope);
+
+  auto serverPromise = e.wrap(listener->accept().then([&](kj::Own<kj::AsyncIoStream> stream) {
+    return test.tlsServer.wrapServer(kj::mv(stream));
+  }));
+  auto clientPromise = e.wrap(address->connect().then([&](kj::Own<kj::AsyncIoStream> stream) {
+    return test.tlsClient.wrapClient(kj::mv(stream), "example.com");
+  }));
+
+  auto client = clientPromise.wait(test.io.waitScope);
+  auto server = serverPromise.wait(test.io.waitScope);
+
+  auto writeUp = writeN(*client, "foo", 10000);
+  auto readDown = readN(*client, "bar", 10000);
+  auto writeDown = writeN(*server, "bar", 10000);
+  auto readUp = readN(*server, "foo", 10000);
+
+  readUp.wait(test.io.waitScope);
+  readDown.wait(test.io.waitScope);
+  writeUp.wait(test.io.waitScope);
+  writeDown.wait(test.io.waitScope);
+
+  // Bulk data, which goes straight to the socket as plaintext if the kernel took over.
+  exchangeBulkData(*client, *server, test.io.waitScope);
+  exchangeBulkData(*server, *client, test.io.waitScope);
+
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().kernelTls <= 1);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().kernelTls <= 1);
+  KJ_LOG(INFO, "kernel TLS", test.tlsClient.getHandshakeStats().kernelTls,
+                             test.tlsServer.getHandshakeStats().kernelTls);
+
+  client->shutdownWrite();
+  char c;
+  KJ_EXPECT(server->tryRead(&c, 1, 1).wait(test.io.waitScope) == 0);
+}
+
+KJ_TEST("TLS kernel offload falls back to userspace") {
+  // kTLS only works on TCP sockets, so over a Unix socket pair OpenSSL keeps doing the crypto
+  // itself -- but still through its own socket BIO rather than ours.
+  TlsTest test(withKernelTls(TlsTest::defaultClient()),
+               withKernelTls(TlsTest::defaultServer()));
+  ErrorNexus e;
+
+  auto pipe = test.io.provider->newTwoWayPipe();
+  KJ_EXPECT(pipe.ends[0]->getFd() != nullptr);
+
+  auto clientPromise = e.wrap(test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "example.com"));
+  auto serverPromise = e.wrap(test.tlsServer.wrapServer(kj::mv(pipe.ends[1])));
+
+  auto client = clientPromise.wait(test.io.waitScope);
+  auto server = serverPromise.wait(test.io.waitScope);
+
+  exchangeBulkData(*client, *server, test.io.waitScope);
+  exchangeBulkData(*server, *client, test.io.waitScope);
+
+  KJ_EXPECT(test.tlsClient.getHandshakeStats().kernelTls == 0);
+  KJ_EXPECT(test.tlsServer.getHandshakeStats().kernelTls == 0);
+
+  client->shutdownWrite();
+  char c;
+  KJ_EXPECT(server->tryRead(&c, 1, 1).wait(test.io.waitScope) == 0);
+}
+
 class TestSniCallback: public TlsSniCallback {
 public:
   kj::Maybe<TlsKeypair> getKey(kj::StringPtr hostname) override {
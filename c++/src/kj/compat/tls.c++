@@ -32,8 +32,33 @@
 #include <openssl/conf.h>
 #include <openssl/ssl.h>
 #include <openssl/tls1.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 #include <kj/debug.h>
 #include <kj/vector.h>
+#include <kj/refcount.h>
+#include <map>
+
+#if !_WIN32
+#include <kj/async-unix.h>
+#include <kj/async-io-internal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#if __linux__ && OPENSSL_VERSION_NUMBER >= 0x30000000L && \
+    !defined(OPENSSL_NO_KTLS) && !defined(OPENSSL_IS_BORINGSSL)
+#define KJ_TLS_KERNEL_OFFLOAD 1
+// OpenSSL can hand record encryption to the kernel (Linux "kTLS"), but only when it's doing the
+// socket I/O itself.
+#else
+#define KJ_TLS_KERNEL_OFFLOAD 0
+#endif
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #define BIO_set_init(x,v)          (x->init=v)
@@ -93,26 +118,76 @@ void ensureOpenSslInitialized() {
 // =======================================================================================
 // Implementation of kj::AsyncIoStream that applies TLS on top of some other AsyncIoStream.
 //
-// TODO(perf): OpenSSL's I/O abstraction layer, "BIO", is readiness-based, but AsyncIoStream is
-//   completion-based. This forces us to use an intermediate buffer which wastes memory and incurs
-//   redundant copies. We could improve the situation by creating a way to detect if the underlying
-//   AsyncIoStream is simply wrapping a file descriptor (or other readiness-based stream?) and use
-//   that directly if so.
+// OpenSSL's I/O abstraction layer, "BIO", is readiness-based, but AsyncIoStream is
+// completion-based. In general this forces us to use an intermediate buffer which wastes memory
+// and incurs redundant copies. However, when the underlying AsyncIoStream simply wraps a file
+// descriptor (it is a kj::_::AsyncFdStream, as created by the Unix LowLevelAsyncIoProvider), the
+// BIO reads and writes the descriptor directly instead, waiting for readiness using a
+// UnixEventPort::FdObserver.
+//
+// If kernel TLS was requested, we go one step further and give OpenSSL the descriptor via one of
+// its own socket BIOs, so that it can install the session keys into the kernel after the
+// handshake. From then on, writes bypass OpenSSL entirely and go to the inner stream as plaintext.
+//
+// TODO(perf): Other readiness-based streams could be handled directly too.
 
 class TlsConnection final: public kj::AsyncIoStream {
 public:
-  TlsConnection(kj::Own<kj::AsyncIoStream> stream, SSL_CTX* ctx)
-      : TlsConnection(*stream, ctx) {
+  TlsConnection(kj::Own<kj::AsyncIoStream> stream, SSL_CTX* ctx, size_t maxRecordSize,
+                bool kernelTls, kj::Own<kj::Refcounted> contextState,
+                TlsContext::HandshakeStats& stats)
+      : TlsConnection(*stream, ctx, maxRecordSize, kernelTls, kj::mv(contextState), stats) {
     ownInner = kj::mv(stream);
   }
 
-  TlsConnection(kj::AsyncIoStream& stream, SSL_CTX* ctx)
-      : inner(stream), readBuffer(stream), writeBuffer(stream) {
+  TlsConnection(kj::AsyncIoStream& stream, SSL_CTX* ctx, size_t maxRecordSize,
+                bool kernelTls, kj::Own<kj::Refcounted> contextState,
+                TlsContext::HandshakeStats& stats)
+      : inner(stream), maxRecordSize(maxRecordSize), contextState(kj::mv(contextState)),
+        stats(stats) {
+#if !_WIN32
+    KJ_IF_MAYBE(fdStream, kj::dynamicDowncastIfAvailable<kj::_::AsyncFdStream>(stream)) {
+      KJ_IF_MAYBE(fd, fdStream->getFd()) {
+        direct = kj::heap<DirectFd>(fdStream->getEventPort(), *fd);
+      }
+    }
+    if (direct == nullptr)
+#endif
+    {
+      readBuffer = kj::heap<ReadyInputStreamWrapper>(stream);
+      writeBuffer = kj::heap<ReadyOutputStreamWrapper>(stream);
+    }
+
     ssl = SSL_new(ctx);
     if (ssl == nullptr) {
       throwOpensslError();
     }
 
+    // Make OpenSSL split large writes at the same boundary we use when coalescing small ones.
+    if (!SSL_set_max_send_fragment(ssl, maxRecordSize)) {
+      SSL_free(ssl);
+      throwOpensslError();
+    }
+
+#if KJ_TLS_KERNEL_OFFLOAD
+    KJ_IF_MAYBE(d, direct) {
+      if (kernelTls) {
+        BIO* bio = BIO_new_socket((*d)->fd, BIO_NOCLOSE);
+        if (bio == nullptr) {
+          SSL_free(ssl);
+          throwOpensslError();
+        }
+        SSL_set_bio(ssl, bio, bio);
+
+        // OpenSSL quietly continues in userspace if the kernel can't take the negotiated cipher,
+        // or lacks the "tls" module altogether.
+        SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+        socketBio = true;
+        return;
+      }
+    }
+#endif
+
     BIO* bio = BIO_new(const_cast<BIO_METHOD*>(getBioVtable()));
     if (bio == nullptr) {
       SSL_free(ssl);
@@ -124,6 +199,24 @@ public:
     SSL_set_bio(ssl, bio, bio);
   }
 
+  void resume(SSL_SESSION* session) {
+    // Offer to resume `session` in connect().
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(OPENSSL_IS_BORINGSSL)
+    // Hand OpenSSL a copy, so that the cached session isn't marked non-resumable if this
+    // connection isn't shut down cleanly. (See TlsContext::ClientSessionCache::onNewSession().)
+    session = SSL_SESSION_dup(session);
+    if (session == nullptr) {
+      throwOpensslError();
+    }
+    KJ_DEFER(SSL_SESSION_free(session));
+#endif
+
+    if (!SSL_set_session(ssl, session)) {
+      throwOpensslError();
+    }
+  }
+
   kj::Promise<void> connect(kj::StringPtr expectedServerHostname) {
     if (!SSL_set_tlsext_host_name(ssl, expectedServerHostname.cStr())) {
       throwOpensslError();
@@ -149,13 +242,17 @@ public:
         const char* reason = X509_verify_cert_error_string(result);
         KJ_FAIL_REQUIRE("TLS peer's certificate is not trusted", reason);
       }
+
+      countHandshake();
     });
   }
   kj::Promise<void> accept() {
     // We are the server. Set SSL options to prefer server's cipher choice.
     SSL_set_options(ssl, SSL_OP_CIPHER_SERVER_PREFERENCE);
 
-    return sslCall([this]() { return SSL_accept(ssl); }).ignoreResult();
+    return sslCall([this]() { return SSL_accept(ssl); }).then([this](size_t) {
+      countHandshake();
+    });
   }
 
   ~TlsConnection() noexcept(false) {
@@ -167,10 +264,18 @@ public:
   }
 
   Promise<void> write(const void* buffer, size_t size) override {
+    if (kernelSend) {
+      KJ_REQUIRE(shutdownTask == nullptr, "already called shutdownWrite()");
+      return inner.write(buffer, size);
+    }
     return writeInternal(kj::arrayPtr(reinterpret_cast<const byte*>(buffer), size), nullptr);
   }
 
   Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    if (kernelSend) {
+      KJ_REQUIRE(shutdownTask == nullptr, "already called shutdownWrite()");
+      return inner.write(pieces);
+    }
     return writeInternal(pieces[0], pieces.slice(1, pieces.size()));
   }
 
@@ -216,8 +321,152 @@ private:
   bool disconnected = false;
   kj::Maybe<kj::Promise<void>> shutdownTask;
 
-  ReadyInputStreamWrapper readBuffer;
-  ReadyOutputStreamWrapper writeBuffer;
+  kj::Own<ReadyInputStreamWrapper> readBuffer;
+  kj::Own<ReadyOutputStreamWrapper> writeBuffer;
+  // Used when the inner stream isn't a file descriptor (i.e. `direct` is null).
+
+#if !_WIN32
+  struct DirectFd {
+    // Our own handle on the inner stream's file descriptor, when it has one.
+
+    kj::AutoCloseFd fd;
+    UnixEventPort::FdObserver observer;
+
+    kj::Maybe<kj::ForkedPromise<void>> readable;
+    kj::Maybe<kj::ForkedPromise<void>> writable;
+    bool readableFired = false;
+    bool writableFired = false;
+    // Created when OpenSSL reports that a read or write would block, and shared by everything
+    // that then needs to wait (e.g. a read and a write can both be waiting for the peer's
+    // handshake messages). Once one has fired, the next wait creates a new one. Since the
+    // observer is edge-triggered, these must only be created right after EAGAIN.
+
+    kj::Maybe<kj::Exception> error;
+    // An I/O error can't be thrown through OpenSSL, so it is stashed here by the BIO and rethrown
+    // by sslCall().
+
+    DirectFd(UnixEventPort& eventPort, int innerFd)
+        : fd(dupFd(innerFd)),
+          observer(eventPort, fd, UnixEventPort::FdObserver::OBSERVE_READ_WRITE) {}
+
+    static kj::AutoCloseFd dupFd(int fd) {
+      // The descriptor must be dup()ed because the inner stream already has an FdObserver on it.
+      // The copy shares the original's non-blocking flag.
+      int result;
+      KJ_SYSCALL(result = fcntl(fd, F_DUPFD_CLOEXEC, 0));
+      return kj::AutoCloseFd(result);
+    }
+
+    int read(BIO* b, char* out, int outl) {
+      ssize_t n;
+      KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+        KJ_NONBLOCKING_SYSCALL(n = ::read(fd, out, outl));
+      })) {
+        error = kj::mv(*exception);
+        return -1;
+      }
+
+      if (n < 0) {
+        // EAGAIN
+        BIO_set_retry_read(b);
+        return -1;
+      }
+
+      return n;
+    }
+
+    int write(BIO* b, const char* in, int inl) {
+      ssize_t n;
+      KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+        KJ_NONBLOCKING_SYSCALL(n = ::write(fd, in, inl));
+      })) {
+        error = kj::mv(*exception);
+        return -1;
+      }
+
+      if (n < 0) {
+        // EAGAIN
+        BIO_set_retry_write(b);
+        return -1;
+      }
+
+      return n;
+    }
+
+    kj::Promise<void> whenReadable() {
+      if (readable == nullptr || readableFired) {
+        readableFired = false;
+        readable = observer.whenBecomesReadable().then([this]() {
+          readableFired = true;
+        }).fork();
+      }
+      return KJ_ASSERT_NONNULL(readable).addBranch();
+    }
+
+    kj::Promise<void> whenWritable() {
+      if (writable == nullptr || writableFired) {
+        writableFired = false;
+        writable = observer.whenBecomesWritable().then([this]() {
+          writableFired = true;
+        }).fork();
+      }
+      return KJ_ASSERT_NONNULL(writable).addBranch();
+    }
+  };
+
+  kj::Maybe<kj::Own<DirectFd>> direct;
+#endif
+
+  bool socketBio = false;
+  // OpenSSL is doing I/O on `direct->fd` itself, with a socket BIO, rather than through our BIO.
+
+  bool kernelSend = false;
+  // The kernel has taken over encrypting outgoing records, so write() goes straight to `inner`.
+
+  kj::Promise<void> whenReadable() {
+#if !_WIN32
+    KJ_IF_MAYBE(d, direct) {
+      return (*d)->whenReadable();
+    }
+#endif
+    return readBuffer->whenReady();
+  }
+
+  kj::Promise<void> whenWritable() {
+#if !_WIN32
+    KJ_IF_MAYBE(d, direct) {
+      return (*d)->whenWritable();
+    }
+#endif
+    return writeBuffer->whenReady();
+  }
+
+  size_t maxRecordSize;
+
+  kj::Own<kj::Refcounted> contextState;
+  // Keeps the TlsContext's shared state -- including `stats`, and whatever OpenSSL's callbacks
+  // reach through the SSL_CTX -- alive for as long as this connection, even if the TlsContext
+  // itself is destroyed first.
+
+  TlsContext::HandshakeStats& stats;
+  kj::Array<byte> stagingBuffer;
+  // Gathered writes are copied here so that several small pieces go out as one TLS record,
+  // rather than each paying for its own record header and MAC. Allocated on first use.
+
+  void countHandshake() {
+    if (SSL_session_reused(ssl)) {
+      ++stats.resumed;
+    } else {
+      ++stats.full;
+    }
+
+#if KJ_TLS_KERNEL_OFFLOAD
+    if (socketBio && BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+      kernelSend = true;
+      ++stats.kernelTls;
+    }
+#endif
+  }
 
   kj::Promise<size_t> tryReadInternal(
       void* buffer, size_t minBytes, size_t maxBytes, size_t alreadyDone) {
@@ -238,6 +487,10 @@ private:
                               kj::ArrayPtr<const kj::ArrayPtr<const byte>> rest) {
     KJ_REQUIRE(shutdownTask == nullptr, "already called shutdownWrite()");
 
+    if (rest.size() > 0 && first.size() < maxRecordSize) {
+      return writeCoalesced(first, rest);
+    }
+
     return sslCall([this,first]() { return SSL_write(ssl, first.begin(), first.size()); })
         .then([this,first,rest](size_t n) -> kj::Promise<void> {
       if (n == 0) {
@@ -252,11 +505,65 @@ private:
     });
   }
 
+  Promise<void> writeCoalesced(kj::ArrayPtr<const byte> first,
+                               kj::ArrayPtr<const kj::ArrayPtr<const byte>> rest) {
+    // Fill the staging buffer with as many pieces as fit, write it as one record, then continue
+    // with whatever is left. A piece that doesn't fit entirely is split; once the remainder is at
+    // least a full record in size, writeInternal() passes it to SSL_write() directly.
+
+    if (stagingBuffer == nullptr) {
+      stagingBuffer = kj::heapArray<byte>(maxRecordSize);
+    }
+
+    size_t filled = 0;
+    for (;;) {
+      size_t n = kj::min(first.size(), stagingBuffer.size() - filled);
+      memcpy(stagingBuffer.begin() + filled, first.begin(), n);
+      filled += n;
+      first = first.slice(n, first.size());
+      if (first.size() > 0 || rest.size() == 0) break;
+      first = rest[0];
+      rest = rest.slice(1, rest.size());
+    }
+
+    return writeStaged(0, filled).then([this,first,rest]() -> kj::Promise<void> {
+      if (first.size() > 0) {
+        return writeInternal(first, rest);
+      } else {
+        return kj::READY_NOW;
+      }
+    });
+  }
+
+  Promise<void> writeStaged(size_t start, size_t end) {
+    // Note that if SSL_write() wants to be retried, it must be retried with the same buffer, so
+    // the staging buffer must not be touched until this completes. Since only one write may be
+    // in progress at a time, that's guaranteed.
+
+    auto piece = stagingBuffer.slice(start, end);
+    return sslCall([this,piece]() { return SSL_write(ssl, piece.begin(), piece.size()); })
+        .then([this,start,end](size_t n) -> kj::Promise<void> {
+      if (n == 0) {
+        return KJ_EXCEPTION(DISCONNECTED, "ssl connection ended during write");
+      } else if (start + n < end) {
+        return writeStaged(start + n, end);
+      } else {
+        return kj::READY_NOW;
+      }
+    });
+  }
+
   template <typename Func>
-  kj::Promise<size_t> sslCall(Func&& func) {
+  kj::Promise<size_t> sslCall(Func&& func, bool retriedPending = false) {
     if (disconnected) return size_t(0);
 
+    // SSL_get_error() consults the thread's OpenSSL error queue, and a socket BIO reports
+    // failures through errno, so start with both clear and save errno before anything else (even
+    // SSL_get_error()) can overwrite it.
+    ERR_clear_error();
+    errno = 0;
     ssize_t result = func();
+    int savedErrno = errno;
 
     if (result > 0) {
       return result;
@@ -267,23 +574,44 @@ private:
           disconnected = true;
           return size_t(0);
         case SSL_ERROR_WANT_READ:
-          return readBuffer.whenReady().then(kj::mvCapture(func,
+          if (SSL_pending(ssl) > 0 && !retriedPending) {
+            // OpenSSL already holds decrypted data, which the descriptor becoming readable won't
+            // announce. Retry once without waiting.
+            return kj::evalLater(kj::mvCapture(func, [this](Func&& func) mutable {
+              return sslCall(kj::fwd<Func>(func), true);
+            }));
+          }
+          return whenReadable().then(kj::mvCapture(func,
               [this](Func&& func) mutable { return sslCall(kj::fwd<Func>(func)); }));
         case SSL_ERROR_WANT_WRITE:
-          return writeBuffer.whenReady().then(kj::mvCapture(func,
+          return whenWritable().then(kj::mvCapture(func,
               [this](Func&& func) mutable { return sslCall(kj::fwd<Func>(func)); }));
         case SSL_ERROR_SSL:
           throwOpensslError();
         case SSL_ERROR_SYSCALL:
-          if (result == 0) {
+#if !_WIN32
+          KJ_IF_MAYBE(d, direct) {
+            KJ_IF_MAYBE(exception, (*d)->error) {
+              kj::throwFatalException(kj::mv(*exception));
+            }
+          }
+#endif
+          if (result == 0 && ERR_peek_error() == 0) {
+            // The peer closed the connection without a TLS close_notify.
             disconnected = true;
             return size_t(0);
-          } else {
-            // According to documentation we shouldn't get here, because our BIO never returns an
-            // "error". But in practice we do get here sometimes when the peer disconnects
-            // prematurely.
-            KJ_FAIL_ASSERT("TLS protocol error");
           }
+          if (socketBio && savedErrno != 0) {
+            // OpenSSL's socket BIO leaves the error in errno.
+            KJ_FAIL_SYSCALL("TLS socket I/O", savedErrno);
+          }
+          if (ERR_peek_error() != 0) {
+            throwOpensslError();
+          }
+          // According to documentation we shouldn't get here, because our BIO never returns an
+          // "error". But in practice we do get here sometimes when the peer disconnects
+          // prematurely.
+          KJ_FAIL_ASSERT("TLS protocol error");
         default:
           KJ_FAIL_ASSERT("unexpected SSL error code", error);
       }
@@ -292,8 +620,13 @@ private:
 
   static int bioRead(BIO* b, char* out, int outl) {
     BIO_clear_retry_flags(b);
-    KJ_IF_MAYBE(n, reinterpret_cast<TlsConnection*>(BIO_get_data(b))->readBuffer
-        .read(kj::arrayPtr(out, outl).asBytes())) {
+    auto& self = *reinterpret_cast<TlsConnection*>(BIO_get_data(b));
+#if !_WIN32
+    KJ_IF_MAYBE(d, self.direct) {
+      return (*d)->read(b, out, outl);
+    }
+#endif
+    KJ_IF_MAYBE(n, self.readBuffer->read(kj::arrayPtr(out, outl).asBytes())) {
       return *n;
     } else {
       BIO_set_retry_read(b);
@@ -303,8 +636,13 @@ private:
 
   static int bioWrite(BIO* b, const char* in, int inl) {
     BIO_clear_retry_flags(b);
-    KJ_IF_MAYBE(n, reinterpret_cast<TlsConnection*>(BIO_get_data(b))->writeBuffer
-        .write(kj::arrayPtr(in, inl).asBytes())) {
+    auto& self = *reinterpret_cast<TlsConnection*>(BIO_get_data(b));
+#if !_WIN32
+    KJ_IF_MAYBE(d, self.direct) {
+      return (*d)->write(b, in, inl);
+    }
+#endif
+    KJ_IF_MAYBE(n, self.writeBuffer->write(kj::arrayPtr(in, inl).asBytes())) {
       return *n;
     } else {
       BIO_set_retry_write(b);
@@ -484,7 +822,13 @@ TlsContext::Options::Options()
     : useSystemTrustStore(true),
       verifyClients(false),
       minVersion(TlsVersion::TLS_1_0),
-      cipherList("ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-AES128-SHA256:ECDHE-RSA-AES128-SHA256:ECDHE-ECDSA-AES128-SHA:ECDHE-RSA-AES256-SHA384:ECDHE-RSA-AES128-SHA:ECDHE-ECDSA-AES256-SHA384:ECDHE-ECDSA-AES256-SHA:ECDHE-RSA-AES256-SHA:ECDHE-ECDSA-DES-CBC3-SHA:ECDHE-RSA-DES-CBC3-SHA:AES128-GCM-SHA256:AES256-GCM-SHA384:AES128-SHA256:AES256-SHA256:AES128-SHA:AES256-SHA:DES-CBC3-SHA:!DSS") {}
+      maxRecordSize(16384),
+      cipherList("ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-AES128-SHA256:ECDHE-RSA-AES128-SHA256:ECDHE-ECDSA-AES128-SHA:ECDHE-RSA-AES256-SHA384:ECDHE-RSA-AES128-SHA:ECDHE-ECDSA-AES256-SHA384:ECDHE-ECDSA-AES256-SHA:ECDHE-RSA-AES256-SHA:ECDHE-ECDSA-DES-CBC3-SHA:ECDHE-RSA-DES-CBC3-SHA:AES128-GCM-SHA256:AES256-GCM-SHA384:AES128-SHA256:AES256-SHA256:AES128-SHA:AES256-SHA:DES-CBC3-SHA:!DSS"),
+      clientSessionCacheSize(256),
+      serverSessionCacheSize(20480),
+      sessionTimeout(5 * kj::MINUTES),
+      sessionTickets(true),
+      kernelTls(false) {}
 // Cipher list is Mozilla's "intermediate" list, except with classic DH removed since we don't
 // currently support setting dhparams. See:
 //     https://mozilla.github.io/server-side-tls/ssl-config-generator/
@@ -499,7 +843,207 @@ struct TlsContext::SniCallback {
   static int callback(SSL* ssl, int* ad, void* arg);
 };
 
-TlsContext::TlsContext(Options options) {
+struct TlsContext::SharedState: public kj::Refcounted {
+  // Reached from OpenSSL's callbacks through the SSL_CTX's app data. See TlsContext::shared.
+
+  HandshakeStats stats;
+
+  kj::Own<ClientSessionCache> clientSessions;
+  // Null if `clientSessionCacheSize` is zero.
+
+  kj::Own<TicketKeys> ticketKeys;
+  // Null if `sessionTickets` is false.
+
+  static SharedState* from(SSL* ssl) {
+    // Null if the SSL_CTX has none, which shouldn't happen, but the callbacks check anyway rather
+    // than crash inside OpenSSL.
+    return reinterpret_cast<SharedState*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+  }
+};
+
+struct TlsContext::ClientSessionCache {
+  // The most recent resumable session for each server hostname, least-recently-used first out.
+
+  explicit ClientSessionCache(size_t capacity): capacity(capacity) {}
+  KJ_DISALLOW_COPY(ClientSessionCache);
+
+  ~ClientSessionCache() noexcept(false) {
+    for (auto& entry: byHostname) {
+      SSL_SESSION_free(entry.second.session);
+    }
+  }
+
+  SSL_SESSION* find(kj::StringPtr hostname) {
+    // Returns null if there's no session for this host. Otherwise, the cache retains ownership.
+
+    auto iter = byHostname.find(hostname);
+    if (iter == byHostname.end()) return nullptr;
+    touch(iter->second);
+    return iter->second.session;
+  }
+
+  void put(kj::StringPtr hostname, SSL_SESSION* session) {
+    // Takes ownership of `session`, replacing any previous session for the host.
+
+    auto iter = byHostname.find(hostname);
+    if (iter != byHostname.end()) {
+      SSL_SESSION_free(iter->second.session);
+      iter->second.session = session;
+      touch(iter->second);
+      return;
+    }
+
+    if (byHostname.size() >= capacity) {
+      auto oldest = byAge.begin();
+      auto victim = byHostname.find(oldest->second);
+      SSL_SESSION_free(victim->second.session);
+      byHostname.erase(victim);
+      byAge.erase(oldest);
+    }
+
+    Entry entry { kj::heapString(hostname), session, ++clock };
+    kj::StringPtr key = entry.hostname;
+    byAge.insert(std::make_pair(entry.lastUsed, key));
+    byHostname.insert(std::make_pair(key, kj::mv(entry)));
+  }
+
+  static int onNewSession(SSL* ssl, SSL_SESSION* session) {
+    // Called by OpenSSL when a client connection receives a session it could later resume. For
+    // TLS 1.3 this happens after the handshake, when the server's ticket arrives.
+    //
+    // When the context also has a server-side cache, OpenSSL calls this for sessions on server
+    // connections too. Those are none of our business.
+    if (SSL_is_server(ssl)) return 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(OPENSSL_IS_BORINGSSL)
+    if (!SSL_SESSION_is_resumable(session)) return 0;
+#endif
+
+    const char* hostname = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (hostname == nullptr) return 0;
+
+    auto state = SharedState::from(ssl);
+    if (state == nullptr || state->clientSessions.get() == nullptr) return 0;
+    auto& cache = *state->clientSessions;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(OPENSSL_IS_BORINGSSL)
+    // Keep a copy. OpenSSL marks a connection's session non-resumable if the connection is freed
+    // without a TLS shutdown, which is how most of our connections end.
+    SSL_SESSION* copy = SSL_SESSION_dup(session);
+    if (copy == nullptr) return 0;
+    cache.put(hostname, copy);
+    return 0;  // We didn't take ownership of the original.
+#else
+    cache.put(hostname, session);
+    return 1;  // We took ownership.
+#endif
+  }
+
+private:
+  struct Entry {
+    kj::String hostname;
+    SSL_SESSION* session;
+    uint64_t lastUsed;
+  };
+
+  size_t capacity;
+  uint64_t clock = 0;
+  std::map<kj::StringPtr, Entry> byHostname;
+  std::map<uint64_t, kj::StringPtr> byAge;
+
+  void touch(Entry& entry) {
+    byAge.erase(entry.lastUsed);
+    entry.lastUsed = ++clock;
+    byAge.insert(std::make_pair(entry.lastUsed, kj::StringPtr(entry.hostname)));
+  }
+};
+
+struct TlsContext::TicketKeys {
+  // Keys used to encrypt and authenticate session tickets. We manage these ourselves, rather than
+  // letting OpenSSL generate one per SSL_CTX, so that they can be rotated.
+
+  struct Key {
+    byte name[16];
+    byte hmacKey[32];
+    byte aesKey[32];
+  };
+
+  Key current;
+  kj::Maybe<Key> previous;
+
+  TicketKeys(): current(generate()) {}
+
+  void rotate() {
+    previous = current;
+    current = generate();
+  }
+
+  static Key generate() {
+    Key key;
+    if (RAND_bytes(reinterpret_cast<unsigned char*>(&key), sizeof(key)) <= 0) {
+      throwOpensslError();
+    }
+    return key;
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  typedef EVP_MAC_CTX MacContext;
+
+  static bool initMac(EVP_MAC_CTX* mac, Key& key) {
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmacKey, sizeof(key.hmacKey)),
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+      OSSL_PARAM_construct_end()
+    };
+    return EVP_MAC_CTX_set_params(mac, params);
+  }
+#else
+  typedef HMAC_CTX MacContext;
+
+  static bool initMac(HMAC_CTX* mac, Key& key) {
+    return HMAC_Init_ex(mac, key.hmacKey, sizeof(key.hmacKey), EVP_sha256(), nullptr);
+  }
+#endif
+
+  static int callback(SSL* ssl, unsigned char* name, unsigned char* iv,
+                      EVP_CIPHER_CTX* cipher, MacContext* mac, int encrypt) {
+    // Return values: -1 for error, 0 if no ticket should be issued / the ticket is unknown, 1 if
+    // the ticket is good, 2 if the ticket is good but should be replaced.
+
+    auto state = SharedState::from(ssl);
+    if (state == nullptr || state->ticketKeys.get() == nullptr) return 0;
+    auto& keys = *state->ticketKeys;
+
+    if (encrypt) {
+      Key& key = keys.current;
+      if (RAND_bytes(iv, 16) <= 0) return -1;
+      memcpy(name, key.name, sizeof(key.name));
+      if (!EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aesKey, iv)) return -1;
+      if (!initMac(mac, key)) return -1;
+      return 1;
+    } else {
+      Key* key;
+      int result;
+      if (memcmp(name, keys.current.name, sizeof(keys.current.name)) == 0) {
+        key = &keys.current;
+        result = 1;
+      } else KJ_IF_MAYBE(previous, keys.previous) {
+        if (memcmp(name, previous->name, sizeof(previous->name)) != 0) return 0;
+        key = previous;
+        result = 2;
+      } else {
+        return 0;
+      }
+
+      if (!initMac(mac, *key)) return -1;
+      if (!EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key->aesKey, iv)) return -1;
+      return result;
+    }
+  }
+};
+
+TlsContext::TlsContext(Options options)
+    : shared(kj::refcounted<SharedState>()) {
   ensureOpenSslInitialized();
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L || defined(OPENSSL_IS_BORINGSSL)
@@ -587,6 +1131,51 @@ TlsContext::TlsContext(Options options) {
     SSL_CTX_set_tlsext_servername_arg(ctx, sni);
   }
 
+  // Session callbacks find their way back to the shared state this way.
+  SSL_CTX_set_app_data(ctx, shared.get());
+
+  // honor options.clientSessionCacheSize and options.serverSessionCacheSize
+  long cacheMode = SSL_SESS_CACHE_OFF;
+  if (options.clientSessionCacheSize > 0) {
+    shared->clientSessions = kj::heap<ClientSessionCache>(options.clientSessionCacheSize);
+    SSL_CTX_sess_set_new_cb(ctx, &ClientSessionCache::onNewSession);
+    cacheMode |= SSL_SESS_CACHE_CLIENT;
+  }
+  if (options.serverSessionCacheSize > 0) {
+    SSL_CTX_sess_set_cache_size(ctx, options.serverSessionCacheSize);
+    cacheMode |= SSL_SESS_CACHE_SERVER;
+  }
+  SSL_CTX_set_session_cache_mode(ctx, cacheMode);
+
+  // Servers refuse to resume sessions unless a session ID context is set, when verifying clients.
+  static const unsigned char SESSION_ID_CONTEXT[] = "kj-tls";
+  if (!SSL_CTX_set_session_id_context(ctx, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1)) {
+    throwOpensslError();
+  }
+
+  // honor options.sessionTimeout
+  SSL_CTX_set_timeout(ctx, options.sessionTimeout / kj::SECONDS);
+
+  // honor options.sessionTickets
+  if (options.sessionTickets) {
+    shared->ticketKeys = kj::heap<TicketKeys>();
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &TicketKeys::callback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, &TicketKeys::callback);
+#endif
+  } else {
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+  }
+
+  // honor options.maxRecordSize
+  KJ_REQUIRE(options.maxRecordSize >= 512 && options.maxRecordSize <= 16384,
+             "maxRecordSize must be between 512 and 16384", options.maxRecordSize);
+  maxRecordSize = options.maxRecordSize;
+
+  // honor options.kernelTls
+  kernelTls = options.kernelTls;
+
   this->ctx = ctx;
 }
 
@@ -634,12 +1223,26 @@ int TlsContext::SniCallback::callback(SSL* ssl, int* ad, void* arg) {
 }
 
 TlsContext::~TlsContext() noexcept(false) {
+  // Connections still open hold their own references to both the SSL_CTX and `shared`, so the
+  // app data remains valid for as long as anything can call back through it.
   SSL_CTX_free(reinterpret_cast<SSL_CTX*>(ctx));
 }
 
+TlsContext::HandshakeStats TlsContext::getHandshakeStats() const {
+  return shared->stats;
+}
+
 kj::Promise<kj::Own<kj::AsyncIoStream>> TlsContext::wrapClient(
     kj::Own<kj::AsyncIoStream> stream, kj::StringPtr expectedServerHostname) {
-  auto conn = kj::heap<TlsConnection>(kj::mv(stream), reinterpret_cast<SSL_CTX*>(ctx));
+  auto conn = kj::heap<TlsConnection>(
+      kj::mv(stream), reinterpret_cast<SSL_CTX*>(ctx), maxRecordSize, kernelTls,
+      kj::addRef(*shared), shared->stats);
+  if (shared->clientSessions.get() != nullptr) {
+    SSL_SESSION* session = shared->clientSessions->find(expectedServerHostname);
+    if (session != nullptr) {
+      conn->resume(session);
+    }
+  }
   auto promise = conn->connect(expectedServerHostname);
   return promise.then(kj::mvCapture(conn, [](kj::Own<TlsConnection> conn)
       -> kj::Own<kj::AsyncIoStream> {
@@ -648,7 +1251,9 @@ kj::Promise<kj::Own<kj::AsyncIoStream>> TlsContext::wrapClient(
 }
 
 kj::Promise<kj::Own<kj::AsyncIoStream>> TlsContext::wrapServer(kj::Own<kj::AsyncIoStream> stream) {
-  auto conn = kj::heap<TlsConnection>(kj::mv(stream), reinterpret_cast<SSL_CTX*>(ctx));
+  auto conn = kj::heap<TlsConnection>(
+      kj::mv(stream), reinterpret_cast<SSL_CTX*>(ctx), maxRecordSize, kernelTls,
+      kj::addRef(*shared), shared->stats);
   auto promise = conn->accept();
   return promise.then(kj::mvCapture(conn, [](kj::Own<TlsConnection> conn)
       -> kj::Own<kj::AsyncIoStream> {
@@ -664,6 +1269,11 @@ kj::Own<kj::Network> TlsContext::wrapNetwork(kj::Network& network) {
   return kj::heap<TlsNetwork>(*this, network);
 }
 
+void TlsContext::rotateSessionTicketKey() {
+  KJ_REQUIRE(shared->ticketKeys.get() != nullptr, "session tickets are disabled");
+  shared->ticketKeys->rotate();
+}
+
 // =======================================================================================
 // class TlsPrivateKey
 
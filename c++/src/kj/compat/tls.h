@@ -73,6 +73,14 @@ public:
     //
     //     options.minVersion = kj::max(myVersion, options.minVersion);
 
+    size_t maxRecordSize;
+    // Maximum number of plaintext bytes to put in one TLS record, between 512 and 16384 (the
+    // protocol maximum, and the default). When a gathered write is made up of many small pieces
+    // -- e.g. a Cap'n Proto message's segment table followed by its segments -- the pieces are
+    // packed together into records of up to this size rather than each being sent as a record of
+    // its own. Smaller values let the peer start decrypting sooner at the cost of more per-record
+    // overhead.
+
     kj::StringPtr cipherList;
     // OpenSSL cipher list string. The default is a curated list designed to be compatible with
     // almost all software in curent use (specifically, based on Mozilla's "intermediate"
@@ -90,6 +98,33 @@ public:
     kj::Maybe<TlsSniCallback&> sniCallback;
     // Callback that can be used to choose a different key/certificate based on the specific
     // hostname requested by the client.
+
+    size_t clientSessionCacheSize;
+    // When acting as a client, the number of servers (by hostname, as passed to wrapClient()) for
+    // which to remember the most recent session, so that reconnecting can resume it with an
+    // abbreviated handshake. Zero disables client-side resumption. Default: 256.
+
+    size_t serverSessionCacheSize;
+    // When acting as a server, the number of sessions to remember so that clients may resume
+    // them by session ID. Zero disables the server-side cache (clients can still resume using
+    // session tickets, if enabled). Default: 20480.
+
+    kj::Duration sessionTimeout;
+    // How long a session, cached or ticketed, remains resumable. Default: 5 minutes.
+
+    bool sessionTickets;
+    // When acting as a server, whether to issue session tickets, which allow clients to resume
+    // without the server keeping any per-session state. Tickets are encrypted with a key
+    // generated by the TlsContext; see rotateSessionTicketKey(). Default: true.
+
+    bool kernelTls;
+    // On Linux, try to have the kernel encrypt and decrypt records once the handshake completes
+    // ("kTLS"). Outgoing data is then written to the socket as plaintext, with no copy through
+    // OpenSSL, which also makes zero-copy paths like sendfile() usable. This only applies to
+    // connections wrapping a socket file descriptor, and requires OpenSSL 3 built with kTLS
+    // support, the kernel's "tls" module, and a cipher the kernel implements (AES-GCM, and on
+    // newer kernels ChaCha20-Poly1305). When any of those is missing, the connection silently
+    // continues to do its crypto in userspace. See HandshakeStats::kernelTls. Default: false.
   };
 
   TlsContext(Options options = Options());
@@ -121,10 +156,39 @@ public:
   // only accept addresses of the form "hostname" and "hostname:port" (it does not accept raw IP
   // addresses). It will automatically use SNI and verify certificates based on these hostnames.
 
+  void rotateSessionTicketKey();
+  // Start encrypting new session tickets with a freshly-generated key. Tickets encrypted with the
+  // previous key are still accepted (and replaced with new ones when used) until the next
+  // rotation, so calling this once per `sessionTimeout` or so limits how long any one key
+  // protects session secrets without forcing clients into full handshakes.
+
+  struct HandshakeStats {
+    uint64_t full = 0;
+    // Handshakes that negotiated a new session.
+
+    uint64_t resumed = 0;
+    // Handshakes that resumed a previous session.
+
+    uint64_t kernelTls = 0;
+    // Handshakes after which the kernel took over encrypting outgoing records.
+  };
+
+  HandshakeStats getHandshakeStats() const;
+  // Counts of completed handshakes on connections wrapped by this context, in either role.
+
 private:
   void* ctx;  // actually type SSL_CTX, but we don't want to #include the OpenSSL headers here
+  size_t maxRecordSize;
+  bool kernelTls;
 
   struct SniCallback;
+  struct ClientSessionCache;
+  struct TicketKeys;
+
+  struct SharedState;
+  kj::Own<SharedState> shared;
+  // State that OpenSSL's callbacks and our connections need. Connections (and so the SSL_CTX)
+  // may outlive the TlsContext, so this is refcounted and each connection holds a reference.
 };
 
 class TlsPrivateKey {
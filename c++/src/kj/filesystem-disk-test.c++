@@ -723,6 +723,65 @@ KJ_TEST("DiskDirectory createTemporary") {
   KJ_EXPECT(dir->listNames() == nullptr);
 }
 
+KJ_TEST("DiskDirectory listEntriesWithMetadata()") {
+  TempDir tempDir;
+  auto dir = tempDir.get();
+
+  dir->openFile(Path("foo"), WriteMode::CREATE)->writeAll("foobar");
+  dir->openFile(Path("bar"), WriteMode::CREATE)->writeAll("bazquxcorge");
+  dir->openSubdir(Path({"baz", "qux"}), WriteMode::CREATE | WriteMode::CREATE_PARENT);
+
+  // Hidden temporary files must not show up.
+  auto replacer = dir->replaceFile(Path("pending"), WriteMode::CREATE);
+
+  auto entries = dir->listEntriesWithMetadata();
+  KJ_ASSERT(entries.size() == 3);
+
+  KJ_EXPECT(entries[0].name == "bar");
+  KJ_EXPECT(entries[0].metadata.type == FsNode::Type::FILE);
+  KJ_EXPECT(entries[0].metadata.size == 11);
+  KJ_EXPECT(entries[0].metadata.hashCode == dir->lstat(Path("bar")).hashCode);
+
+  KJ_EXPECT(entries[1].name == "baz");
+  KJ_EXPECT(entries[1].metadata.type == FsNode::Type::DIRECTORY);
+
+  KJ_EXPECT(entries[2].name == "foo");
+  KJ_EXPECT(entries[2].metadata.type == FsNode::Type::FILE);
+  KJ_EXPECT(entries[2].metadata.size == 6);
+  KJ_EXPECT(entries[2].metadata.lastModified == dir->lstat(Path("foo")).lastModified);
+}
+
+KJ_TEST("DiskDirectory listTreeWithMetadata()") {
+  TempDir tempDir;
+  auto dir = tempDir.get();
+
+  for (auto i: kj::zeroTo(4)) {
+    for (auto j: kj::zeroTo(3)) {
+      dir->openFile(Path({kj::str("d", i), kj::str("e", j), "file"}),
+                    WriteMode::CREATE | WriteMode::CREATE_PARENT)->writeAll(kj::str(i, j));
+    }
+  }
+  dir->openFile(Path("top"), WriteMode::CREATE)->writeAll("top");
+
+  auto serial = listTreeWithMetadata(*dir);
+  KJ_ASSERT(serial.size() == 1 + 4 + 4 * 3 + 4 * 3);
+  KJ_EXPECT(serial[0].path.toString() == "d0");
+  KJ_EXPECT(serial[0].metadata.type == FsNode::Type::DIRECTORY);
+  KJ_EXPECT(serial[1].path.toString() == "d0/e0");
+  KJ_EXPECT(serial[2].path.toString() == "d0/e0/file");
+  KJ_EXPECT(serial[2].metadata.size == 2);
+  KJ_EXPECT(serial[serial.size() - 1].path.toString() == "top");
+
+  auto parallel = listTreeWithMetadata(*dir, 4);
+  KJ_ASSERT(parallel.size() == serial.size());
+  for (auto i: kj::indices(serial)) {
+    KJ_EXPECT(parallel[i].path == serial[i].path);
+    KJ_EXPECT(parallel[i].metadata.type == serial[i].metadata.type);
+    KJ_EXPECT(parallel[i].metadata.size == serial[i].metadata.size);
+    KJ_EXPECT(parallel[i].metadata.hashCode == serial[i].metadata.hashCode);
+  }
+}
+
 KJ_TEST("DiskDirectory replaceSubdir()") {
   TempDir tempDir;
   auto dir = tempDir.get();
@@ -45,6 +45,13 @@
 #include <syscall.h>
 #include <linux/fs.h>
 #include <sys/sendfile.h>
+#include <sys/sysmacros.h>
+#endif
+
+#if __linux__ && defined(STATX_TYPE) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 28)
+#define KJ_USE_STATX 1
+#endif
 #endif
 
 namespace kj {
@@ -123,11 +130,14 @@ static FsNode::Type modeToType(mode_t mode) {
   }
 }
 
-static FsNode::Metadata statToMetadata(struct stat& stats) {
+static uint64_t nodeHash(uint64_t dev, uint64_t ino) {
   // Probably st_ino and st_dev are usually under 32 bits, so mix by rotating st_dev left 32 bits
   // and XOR.
-  uint64_t d = stats.st_dev;
-  uint64_t hash = ((d << 32) | (d >> 32)) ^ stats.st_ino;
+  return ((dev << 32) | (dev >> 32)) ^ ino;
+}
+
+static FsNode::Metadata statToMetadata(struct stat& stats) {
+  uint64_t hash = nodeHash(stats.st_dev, stats.st_ino);
 
   return FsNode::Metadata {
     modeToType(stats.st_mode),
@@ -143,6 +153,54 @@ static FsNode::Metadata statToMetadata(struct stat& stats) {
   };
 }
 
+#if KJ_USE_STATX
+static constexpr unsigned int STATX_METADATA_MASK =
+    STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_MTIME | STATX_NLINK | STATX_INO;
+// Just the fields that FsNode::Metadata needs. Leaving out permissions, ownership and the other
+// timestamps lets some filesystems (especially network ones) answer more cheaply.
+
+static FsNode::Metadata statxToMetadata(struct statx& stats) {
+  return FsNode::Metadata {
+    modeToType(stats.stx_mode),
+    stats.stx_size,
+    stats.stx_blocks * 512u,
+    toKjDate({ static_cast<time_t>(stats.stx_mtime.tv_sec),
+               static_cast<long>(stats.stx_mtime.tv_nsec) }),
+    stats.stx_nlink,
+    nodeHash(makedev(stats.stx_dev_major, stats.stx_dev_minor), stats.stx_ino)
+  };
+}
+#endif
+
+static Maybe<FsNode::Metadata> lstatAt(int dirFd, const char* name) {
+  // Like fstatat(dirFd, name, AT_SYMLINK_NOFOLLOW), but returns null if the entry doesn't exist.
+
+#if KJ_USE_STATX
+  struct statx xstats;
+  KJ_SYSCALL_HANDLE_ERRORS(statx(dirFd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                                 STATX_METADATA_MASK, &xstats)) {
+    case ENOENT:
+      return nullptr;
+    case ENOSYS:
+      // Kernel predates statx() (Linux 4.11). Fall back to fstatat().
+      break;
+    default:
+      KJ_FAIL_SYSCALL("statx(dirFd, name)", error, name) { return nullptr; }
+  } else {
+    return statxToMetadata(xstats);
+  }
+#endif
+
+  struct stat stats;
+  KJ_SYSCALL_HANDLE_ERRORS(fstatat(dirFd, name, &stats, AT_SYMLINK_NOFOLLOW)) {
+    case ENOENT:
+      return nullptr;
+    default:
+      KJ_FAIL_SYSCALL("fstatat(dirFd, name)", error, name) { return nullptr; }
+  }
+  return statToMetadata(stats);
+}
+
 static bool rmrf(int fd, StringPtr path);
 
 static void rmrfChildrenAndClose(int fd) {
@@ -703,6 +761,48 @@ public:
     });
   }
 
+  Array<ReadableDirectory::EntryWithMetadata> listEntriesWithMetadata() const {
+    kj::Vector<ReadableDirectory::EntryWithMetadata> entries;
+
+#if __linux__
+    // Open a separate description of the directory, so that we have our own read offset (unlike
+    // list(), this is then safe to call from several threads at once), and read it with
+    // getdents64() in much bigger batches than readdir() would use.
+    int dirFd;
+    KJ_SYSCALL(dirFd = openat(fd, ".", O_RDONLY | MAYBE_O_CLOEXEC | MAYBE_O_DIRECTORY));
+    AutoCloseFd ownDirFd(dirFd);
+
+    auto buffer = heapArray<byte>(128 * 1024);
+    for (;;) {
+      ssize_t n;
+      KJ_SYSCALL(n = syscall(SYS_getdents64, dirFd, buffer.begin(), buffer.size()));
+      if (n == 0) break;
+
+      for (ssize_t pos = 0; pos < n;) {
+        auto entry = reinterpret_cast<const struct dirent64*>(buffer.begin() + pos);
+        pos += entry->d_reclen;
+
+        kj::StringPtr name = entry->d_name;
+        if (name != "." && name != ".." && !name.startsWith(HIDDEN_PREFIX)) {
+          KJ_IF_MAYBE(meta, lstatAt(dirFd, name.cStr())) {
+            entries.add(ReadableDirectory::EntryWithMetadata { heapString(name), *meta });
+          }
+        }
+      }
+    }
+#else
+    for (auto& name: listNames()) {
+      KJ_IF_MAYBE(meta, lstatAt(fd, name.cStr())) {
+        entries.add(ReadableDirectory::EntryWithMetadata { kj::mv(name), *meta });
+      }
+    }
+#endif
+
+    auto result = entries.releaseAsArray();
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
   bool exists(PathPtr path) const {
     KJ_SYSCALL_HANDLE_ERRORS(faccessat(fd, path.toString().cStr(), F_OK, 0)) {
       case ENOENT:
@@ -1549,6 +1649,9 @@ public:
 
   Array<String> listNames() const override { return DiskHandle::listNames(); }
   Array<Entry> listEntries() const override { return DiskHandle::listEntries(); }
+  Array<EntryWithMetadata> listEntriesWithMetadata() const override {
+    return DiskHandle::listEntriesWithMetadata();
+  }
   bool exists(PathPtr path) const override { return DiskHandle::exists(path); }
   Maybe<FsNode::Metadata> tryLstat(PathPtr path) const override {
     return DiskHandle::tryLstat(path);
@@ -1570,6 +1673,9 @@ public:
 
   Array<String> listNames() const override { return DiskHandle::listNames(); }
   Array<Entry> listEntries() const override { return DiskHandle::listEntries(); }
+  Array<EntryWithMetadata> listEntriesWithMetadata() const override {
+    return DiskHandle::listEntriesWithMetadata();
+  }
   bool exists(PathPtr path) const override { return DiskHandle::exists(path); }
   Maybe<FsNode::Metadata> tryLstat(PathPtr path) const override {
     return DiskHandle::tryLstat(path);
@@ -26,7 +26,9 @@
 #include "encoding.h"
 #include "refcount.h"
 #include "mutex.h"
+#include "thread.h"
 #include <map>
+#include <algorithm>
 
 namespace kj {
 
@@ -542,6 +544,114 @@ FsNode::Metadata ReadableDirectory::lstat(PathPtr path) const {
   }
 }
 
+Array<ReadableDirectory::EntryWithMetadata> ReadableDirectory::listEntriesWithMetadata() const {
+  auto names = listNames();
+  kj::Vector<EntryWithMetadata> result(names.size());
+  for (auto& name: names) {
+    KJ_IF_MAYBE(meta, tryLstat(Path(kj::str(name)))) {
+      result.add(EntryWithMetadata { kj::mv(name), *meta });
+    }
+  }
+  return result.releaseAsArray();
+}
+
+namespace {
+
+class TreeWalk {
+  // Implements listTreeWithMetadata(). Each directory is a separate job, identified by its path
+  // relative to `root` and opened only while it is being listed, so a wide tree doesn't hold a
+  // file descriptor open for every pending directory. Directory sizes vary wildly, so the jobs
+  // share one pool rather than splitting the tree up front.
+
+public:
+  TreeWalk(const ReadableDirectory& root, uint threadCount): root(root), pool(threadCount) {}
+
+  Array<TreeEntry> run() {
+    add(Path(nullptr));
+    pool.waitIdle();
+
+    auto lock = state.lockExclusive();
+    size_t total = 0;
+    for (auto& job: lock->jobs) {
+      // Rethrows the job's failure, if any.
+      pool.wait(*job);
+      total += job->entries.size();
+    }
+
+    kj::Vector<TreeEntry> result(total);
+    for (auto& job: lock->jobs) {
+      for (auto& entry: job->entries) result.add(kj::mv(entry));
+    }
+
+    auto array = result.releaseAsArray();
+    std::sort(array.begin(), array.end(), [](const TreeEntry& a, const TreeEntry& b) {
+      return a.path < b.path;
+    });
+    return array;
+  }
+
+private:
+  struct DirJob final: public WorkerPool::Job {
+    TreeWalk& walk;
+    Path path;
+    kj::Vector<TreeEntry> entries;
+
+    DirJob(TreeWalk& walk, Path path): walk(walk), path(kj::mv(path)) {}
+    void run() override { walk.list(*this); }
+  };
+
+  struct State {
+    kj::Vector<Own<DirJob>> jobs;
+    bool failed = false;
+    // Set by the first job to throw. Jobs that start after that skip their directory.
+  };
+
+  const ReadableDirectory& root;
+  MutexGuarded<State> state;
+
+  WorkerPool pool;
+  // Declared last so that the workers are stopped before the jobs are freed.
+
+  void add(Path path) {
+    auto job = heap<DirJob>(*this, kj::mv(path));
+    auto& ref = *job;
+    state.lockExclusive()->jobs.add(kj::mv(job));
+    pool.submit(ref);
+  }
+
+  void list(DirJob& job) {
+    if (state.lockShared()->failed) return;
+    KJ_ON_SCOPE_FAILURE(state.lockExclusive()->failed = true);
+
+    const ReadableDirectory* dir = &root;
+    Own<const ReadableDirectory> ownDir;
+    if (job.path.size() > 0) {
+      KJ_IF_MAYBE(subdir, root.tryOpenSubdir(job.path)) {
+        ownDir = kj::mv(*subdir);
+        dir = ownDir;
+      } else {
+        // Removed since its parent was listed.
+        return;
+      }
+    }
+
+    for (auto& entry: dir->listEntriesWithMetadata()) {
+      auto entryPath = job.path.append(entry.name);
+      if (entry.metadata.type == FsNode::Type::DIRECTORY) {
+        add(entryPath.clone());
+      }
+      job.entries.add(TreeEntry { kj::mv(entryPath), entry.metadata });
+    }
+  }
+};
+
+}  // namespace
+
+Array<TreeEntry> listTreeWithMetadata(const ReadableDirectory& root, uint threadCount) {
+  KJ_REQUIRE(threadCount > 0, "need at least one thread");
+  return TreeWalk(root, threadCount).run();
+}
+
 Own<const ReadableFile> ReadableDirectory::openFile(PathPtr path) const {
   KJ_IF_MAYBE(file, tryOpenFile(path)) {
     return kj::mv(*file);
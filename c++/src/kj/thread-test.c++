@@ -21,6 +21,7 @@
 
 #include "thread.h"
 #include "test.h"
+#include "vector.h"
 #include <atomic>
 
 #if _WIN32
@@ -120,5 +121,85 @@ KJ_TEST("threads pick up exception callback initializer") {
   KJ_EXPECT(context.captured == "foobar", context.captured);
 }
 
+KJ_TEST("WorkerPool runs jobs and reports their exceptions") {
+  struct CountJob final: public WorkerPool::Job {
+    std::atomic<uint>* count;
+    bool fail = false;
+    void run() override {
+      ++*count;
+      if (fail) KJ_FAIL_ASSERT("job failed");
+    }
+  };
+
+  std::atomic<uint> count(0);
+  CountJob jobs[20];
+  {
+    WorkerPool pool(3);
+    for (auto& job: jobs) {
+      job.count = &count;
+      pool.submit(job);
+    }
+    for (auto& job: jobs) {
+      pool.wait(job);
+      KJ_EXPECT(pool.isDone(job));
+    }
+    KJ_EXPECT(count == 20);
+
+    // A job can be submitted again once it has finished.
+    jobs[0].fail = true;
+    pool.submit(jobs[0]);
+    KJ_EXPECT_THROW_MESSAGE("job failed", pool.wait(jobs[0]));
+    KJ_EXPECT(count == 21);
+  }
+}
+
+KJ_TEST("WorkerPool jobs can submit more jobs") {
+  // Each job splits its range in two until it is a single number, like a walk of a binary tree.
+  struct RangeJob final: public WorkerPool::Job {
+    WorkerPool* pool;
+    std::atomic<uint>* sum;
+    kj::Vector<kj::Own<RangeJob>>* children;
+    std::atomic<uint>* childCount;
+    uint begin, end;
+
+    void run() override {
+      if (end - begin == 1) {
+        *sum += begin;
+      } else {
+        uint mid = (begin + end) / 2;
+        split(begin, mid);
+        split(mid, end);
+      }
+    }
+
+    void split(uint childBegin, uint childEnd) {
+      auto& child = (*children)[(*childCount)++];
+      child = kj::heap<RangeJob>(*this);
+      child->begin = childBegin;
+      child->end = childEnd;
+      pool->submit(*child);
+    }
+  };
+
+  std::atomic<uint> sum(0);
+  std::atomic<uint> childCount(0);
+  kj::Vector<kj::Own<RangeJob>> children;
+  children.resize(256);  // Enough for the whole tree, so that it is never resized concurrently.
+
+  WorkerPool pool(4);
+  RangeJob root;
+  root.pool = &pool;
+  root.sum = &sum;
+  root.children = &children;
+  root.childCount = &childCount;
+  root.begin = 0;
+  root.end = 100;
+  pool.submit(root);
+  pool.waitIdle();
+
+  KJ_EXPECT(sum == 4950);
+  KJ_EXPECT(childCount == 198);
+}
+
 }  // namespace
 }  // namespace kj
@@ -21,6 +21,10 @@
 
 #include "thread.h"
 #include "debug.h"
+#include "vector.h"
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #if _WIN32
 #include <windows.h>
@@ -147,4 +151,100 @@ void* Thread::runThread(void* ptr) {
   return 0;
 }
 
+// =======================================================================================
+
+struct WorkerPool::Impl {
+  // kj::MutexGuarded::when() isn't implemented on every platform, and the workers need to sleep
+  // until there's a job, so this uses the standard library's mutex and condition variables.
+
+  std::mutex mutex;
+  std::condition_variable jobAdded;
+  std::condition_variable jobDone;
+  // jobDone is also signaled when `running` drops to zero.
+
+  std::deque<Job*> queue;
+  uint running = 0;
+  bool shuttingDown = false;
+
+  Vector<Own<Thread>> threads;
+  // Declared last so that the threads are joined before anything else here is destroyed.
+
+  ~Impl() noexcept(false) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      shuttingDown = true;
+    }
+    jobAdded.notify_all();
+  }
+
+  void work() {
+    for (;;) {
+      Job* job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobAdded.wait(lock, [&]() { return shuttingDown || !queue.empty(); });
+        if (shuttingDown) return;
+        job = queue.front();
+        queue.pop_front();
+        ++running;
+      }
+
+      auto exception = kj::runCatchingExceptions([&]() { job->run(); });
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        job->exception = kj::mv(exception);
+        job->done = true;
+        --running;
+      }
+      jobDone.notify_all();
+    }
+  }
+};
+
+WorkerPool::WorkerPool(uint threadCount): impl(heap<Impl>()) {
+  KJ_REQUIRE(threadCount > 0, "need at least one thread");
+  impl->threads.reserve(threadCount);
+  for (uint i = 0; i < threadCount; i++) {
+    auto& pool = *impl;
+    impl->threads.add(heap<Thread>([&pool]() { pool.work(); }));
+  }
+}
+
+WorkerPool::~WorkerPool() noexcept(false) {}
+
+void WorkerPool::submit(Job& job) {
+  {
+    std::unique_lock<std::mutex> lock(impl->mutex);
+    job.done = false;
+    job.exception = nullptr;
+    impl->queue.push_back(&job);
+  }
+  impl->jobAdded.notify_one();
+}
+
+bool WorkerPool::isDone(Job& job) {
+  std::unique_lock<std::mutex> lock(impl->mutex);
+  return job.done;
+}
+
+void WorkerPool::wait(Job& job) {
+  kj::Maybe<kj::Exception> exception;
+  {
+    std::unique_lock<std::mutex> lock(impl->mutex);
+    impl->jobDone.wait(lock, [&]() { return job.done; });
+    exception = kj::mv(job.exception);
+    job.exception = nullptr;
+  }
+
+  KJ_IF_MAYBE(e, exception) {
+    kj::throwFatalException(kj::mv(*e));
+  }
+}
+
+void WorkerPool::waitIdle() {
+  std::unique_lock<std::mutex> lock(impl->mutex);
+  impl->jobDone.wait(lock, [&]() { return impl->queue.empty() && impl->running == 0; });
+}
+
 }  // namespace kj
@@ -79,4 +79,52 @@ private:
 #endif
 };
 
+class WorkerPool {
+  // A fixed set of threads, all started by the constructor, which run jobs from a shared queue in
+  // the order they were submitted. The thread that owns the pool usually keeps submitting jobs
+  // and collecting their results in order while the workers run.
+
+public:
+  class Job {
+    // Implement run() in a subclass, then pass the object to submit().
+
+  public:
+    virtual void run() = 0;
+    // Called on one of the pool's threads. An exception is caught, and rethrown by wait().
+
+  protected:
+    ~Job() = default;
+
+  private:
+    bool done = false;
+    kj::Maybe<kj::Exception> exception;
+    // Guarded by the pool's lock.
+
+    friend class WorkerPool;
+  };
+
+  explicit WorkerPool(uint threadCount);
+  KJ_DISALLOW_COPY(WorkerPool);
+
+  ~WorkerPool() noexcept(false);
+  // Jobs not yet started are dropped. Waits for jobs in progress and joins the threads.
+
+  void submit(Job& job);
+  // Queue `job` to run. It must remain valid until it has run or the pool has been destroyed.
+  // Safe to call from any thread, including from within a job.
+
+  bool isDone(Job& job);
+  // Whether `job` has finished running. Doesn't block.
+
+  void wait(Job& job);
+  // Block until `job` has finished running, then rethrow its exception, if any.
+
+  void waitIdle();
+  // Block until no job is queued or running. Must not be called from within a job.
+
+private:
+  struct Impl;
+  Own<Impl> impl;
+};
+
 }  // namespace kj